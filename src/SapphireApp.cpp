@@ -17,19 +17,34 @@
 //#include "LuaInterface.h"
 //#include "core/SapphireHash.h"
 #include "grid.fxh"
+#include "CommandLineParser.hpp"
+
+extern "C"
+{
+#include "input_replay.h"
+}
 
 #include <array>
 
 extern "C" void testcimgui();
 
 extern "C" void sapphire_render(IDeviceContext * pContext);
-extern "C" void CreateResources(IRenderDevice * pDevice, ISwapChain * pSwapChain);
-extern "C" void sapphire_init(IRenderDevice * pDevice, ISwapChain * pSwapChain);
+extern "C" void CreateResources(IRenderDevice * pDevice, ISwapChain * pSwapChain, const char* assets_root);
+extern "C" void ReleaseResources();
+extern "C" void render(IDeviceContext * pContext);
+extern "C" void sapphire_init(IRenderDevice * pDevice, ISwapChain * pSwapChain, IDeviceContext** ppDeferredContexts, uint32_t NumDeferredContexts);
 extern "C" void sapphire_destroy();
 extern "C" void sapphire_update(double curr_time, double elapsed_time);
 extern "C" void ss(GraphicsPipelineStateCreateInfo * pso);
 extern "C" void sapphire_window_resize(IRenderDevice * pDevice, ISwapChain * pSwapChain, uint32_t width, uint32_t height);
 extern "C" void testcimgui();
+extern "C" bool sapphire_input_record(const char* file, uint32_t num_keys, double step_dt);
+extern "C" double sapphire_input_replay(const char* file, uint32_t num_keys);
+extern "C" bool sapphire_input_fixed_step(input_snapshot_t* p_snapshot);
+extern "C" const char* sapphire_assets_root();
+extern "C" uint64_t sapphire_select(float x, float y, float width, float height);
+
+static_assert(static_cast<uint32_t>(InputKeys::TotalKeys) <= INPUT_REPLAY_MAX_KEYS, "input snapshots don't hold all keys");
 
 
 
@@ -135,6 +150,7 @@ namespace Sapphire
 
 SapphireApp::~SapphireApp()
 {
+    ReleaseResources();
     sapphire_destroy();
 }
 
@@ -1098,6 +1114,13 @@ void SapphireApp::LoadTextures()
 }
 
 
+void SapphireApp::ModifyEngineInitInfo(const ModifyEngineInitInfoAttribs& Attribs)
+{
+    SampleBase::ModifyEngineInitInfo(Attribs);
+    // one deferred context per shadow cascade (SHADOW_CASCADES_MAX), OpenGL drops them
+    Attribs.EngineCI.NumDeferredContexts = 4;
+}
+
 void SapphireApp::Initialize(const SampleInitInfo& InitInfo)
 {
     LOG_INFO_MESSAGE("HARA");
@@ -1184,8 +1207,29 @@ void SapphireApp::Initialize(const SampleInitInfo& InitInfo)
     //SapphireMeshLoadData meshLoadData;
     //loadModelFromFile("C:/Games/Legend of Grimrock/asset_pack_v2/assets/models/env/dungeon_floor_01.model", &meshLoadData);
 
-    sapphire_init(InitInfo.pDevice, InitInfo.pSwapChain);
-    //CreateResources(InitInfo.pDevice, InitInfo.pSwapChain);
+    // the renderer records the shadow cascades on the deferred contexts
+    std::vector<IDeviceContext*> DeferredContexts;
+    for (auto& pDeferredContext : m_pDeferredContexts)
+        DeferredContexts.push_back(pDeferredContext);
+    sapphire_init(InitInfo.pDevice, InitInfo.pSwapChain, DeferredContexts.data(), static_cast<uint32_t>(DeferredContexts.size()));
+
+    const uint32_t NumKeys = static_cast<uint32_t>(InputKeys::TotalKeys);
+    if (!m_InputReplayFile.empty())
+    {
+        // the fixed steps run at the step length of the recording
+        const double StepTime = sapphire_input_replay(m_InputReplayFile.c_str(), NumKeys);
+        if (StepTime > 0)
+            m_FixedStepTime = StepTime;
+        else
+            LOG_ERROR_MESSAGE("Failed to load input recording ", m_InputReplayFile);
+    }
+    else if (!m_InputRecordFile.empty())
+    {
+        if (!sapphire_input_record(m_InputRecordFile.c_str(), NumKeys, m_FixedStepTime))
+            LOG_ERROR_MESSAGE("Failed to start input recording ", m_InputRecordFile);
+    }
+    // text and the game ui hud, drawn over the frame
+    CreateResources(InitInfo.pDevice, InitInfo.pSwapChain, sapphire_assets_root());
    // m_worldResourceManager.loadMeshResouces(m_pDevice, m_pImmediateContext, "", meshLoadData);
 }
 //
@@ -1349,7 +1393,6 @@ void SapphireApp::Render()
     sapphire_render(m_pImmediateContext);
 #endif
 #define RENDER_PBR_CUBES 0
-#define DO_PICKING 0
 #define CamAttribs_UPDATE 0
 #define lightAttribs_UPDATE 0
 #define RENDER_FULL_SCREEN_RENDER_TARGET 0
@@ -1373,12 +1416,6 @@ void SapphireApp::Render()
     m_pImmediateContext->ClearRenderTarget(m_pColorRTV, &ClearColor.x, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
     m_pImmediateContext->ClearDepthStencil(m_pDepthDSV, CLEAR_DEPTH_FLAG, 1.0f, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
 
-#if DO_PICKING
-    // Reset picking buffer
-    PickingBuffer picking_buffer;
-    std::memset(&picking_buffer, 0, sizeof(picking_buffer));
-    m_pImmediateContext->UpdateBuffer(m_pPickingBuffer, 0, sizeof(picking_buffer), &picking_buffer, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
-#endif
     
     
 #if 0
@@ -1483,9 +1520,6 @@ void SapphireApp::Render()
     
     const auto CameraViewProj = m_ViewMatrix * m_ProjMatrix;
 
-    static bool has_pick_request = false;
-    static bool has_signaled = false;
-    static Uint64 pick_frame = 1;
 
 
     float4x4 CameraWorld = m_ViewMatrix.Inverse();
@@ -1498,18 +1532,6 @@ void SapphireApp::Render()
         CamAttribs->mViewProjT = CameraViewProj.Transpose();
         CamAttribs->mViewProjInvT = CameraViewProj.Inverse().Transpose();
         CamAttribs->f4Position = float4(CameraWorldPos, 1);
-#endif
-        // store mouse position and and picking opacity threshold
-        auto inputController = GetInputController();
-        auto mouse_state = inputController.GetMouseState();
-#if DO_PICKING
-        if (!has_pick_request)
-        {
-            has_pick_request = mouse_state.ButtonFlags & MouseState::BUTTON_FLAG_LEFT;
-            CamAttribs->f4ExtraData[0] = float4(mouse_state.PosX, mouse_state.PosY, 0.5, mouse_state.ButtonFlags & MouseState::BUTTON_FLAG_LEFT);
-            pick_frame = m_FrameId;
-        }
-        
 #endif
         
     }
@@ -1657,52 +1679,6 @@ void SapphireApp::Render()
     }
 #endif
 
-#if DO_PICKING
-    if (has_pick_request)
-    {
-        if (!has_signaled)
-        {
-            m_pImmediateContext->CopyBuffer(m_pPickingBuffer, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION,
-                m_pPickingBufferStaging, 0, sizeof(PickingBuffer),
-                RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
-
-            // We should use synchronizations to safely access the mapped memory.
-            m_pImmediateContext->EnqueueSignal(m_pPickingInfoAvailable, m_FrameId);
-            has_signaled = true;
-        }
-       
-
-        // Read statistics from previous frame.
-        Uint64 AvailableFrameId = m_pPickingInfoAvailable->GetCompletedValue();
-
-        //int historySize = 10;
-
-        //// Synchronize
-        //if (m_FrameId - AvailableFrameId > historySize)
-        //{
-        //    // In theory we should never get here as we wait for more than enough
-        //    // frames.
-        //    AvailableFrameId = m_FrameId - historySize;
-        //    m_pPickingInfoAvailable->Wait(AvailableFrameId);
-        //}
-
-        // Read the staging data
-        if (AvailableFrameId >= pick_frame)
-        {
-            MapHelper<PickingBuffer> StagingData(m_pImmediateContext, m_pPickingBufferStaging, MAP_READ, MAP_FLAG_DO_NOT_WAIT);
-            if (StagingData)
-            {
-                uint64_t hello_from_space = StagingData->identity;
-                printf("%lld\n", hello_from_space);
-            }
-            has_pick_request = false;
-            has_signaled = false;
-        }
-        
-        ++m_FrameId;
-        
-    }
-#endif
 
 #if RENDER_FULL_SCREEN_RENDER_TARGET 
     // render output to render target
@@ -1741,7 +1717,7 @@ void SapphireApp::Render()
     RTDrawAttrs.Flags = DRAW_FLAG_VERIFY_ALL; // Verify the state of vertex and index buffers
     m_pImmediateContext->Draw(RTDrawAttrs);
 #endif
-    //render(m_pImmediateContext.RawPtr());
+    render(m_pImmediateContext);
   
 
     
@@ -1775,10 +1751,63 @@ void SapphireApp::UpdateLuaFrameEnd(double CurrTime, double ElapsedTime)
 
 }
 
+SapphireApp::CommandLineStatus SapphireApp::ProcessCommandLine(int argc, const char* const* argv)
+{
+    CommandLineParser ArgsParser{argc, argv};
+    ArgsParser.Parse("record", m_InputRecordFile);
+    ArgsParser.Parse("replay", m_InputReplayFile);
+    ArgsParser.Parse("fixed_frame_time", m_FixedFrameTime);
+    if (!m_InputRecordFile.empty() && !m_InputReplayFile.empty())
+    {
+        LOG_WARNING_MESSAGE("--record is ignored when replaying input");
+        m_InputRecordFile.clear();
+    }
+    return CommandLineStatus::OK;
+}
+
+static bool IsKeyDown(const input_snapshot_t& Input, InputKeys Key)
+{
+    return (Input.keys[static_cast<size_t>(Key)] & INPUT_KEY_STATE_FLAG_KEY_IS_DOWN) != 0;
+}
+
+static bool IsKeyReleased(const input_snapshot_t& Input, InputKeys Key)
+{
+    return (Input.keys[static_cast<size_t>(Key)] & INPUT_KEY_STATE_FLAG_KEY_WAS_DOWN) != 0;
+}
+
+static bool IsKeyFirstDown(const input_snapshot_t& Input, InputKeys Key)
+{
+    return (Input.keys[static_cast<size_t>(Key)] & INPUT_KEY_STATE_FLAG_KEY_FIRST_DOWN) != 0;
+}
+
 void SapphireApp::UpdateFixed(double sim_time, double sim_dt)
 {
     UpdateLuaFrameStart(sim_time, sim_dt);
 
+    // the fixed step reads its input from a snapshot, so a replay feeds it the recorded input
+    input_snapshot_t Input = {};
+    {
+        const auto& inputController = GetInputController();
+        for (Uint32 i = 0; i < static_cast<Uint32>(InputKeys::TotalKeys); ++i)
+            Input.keys[i] = static_cast<uint8_t>(inputController.GetKeyState(static_cast<InputKeys>(i)));
+        const auto& mouse_state = inputController.GetMouseState();
+        Input.mouse_x       = mouse_state.PosX;
+        Input.mouse_y       = mouse_state.PosY;
+        Input.mouse_wheel   = mouse_state.WheelDelta;
+        Input.mouse_buttons = static_cast<uint8_t>(mouse_state.ButtonFlags);
+    }
+    if (!sapphire_input_fixed_step(&Input))
+        LOG_INFO_MESSAGE("Input replay finished");
+
+    // selection picks on the cpu in the same step, from the snapshot, so replays select the same objects
+    const bool LeftPressed = (Input.mouse_buttons & MouseState::BUTTON_FLAG_LEFT) && !(m_LastMouseButtons & MouseState::BUTTON_FLAG_LEFT);
+    m_LastMouseButtons = Input.mouse_buttons;
+    if (LeftPressed)
+    {
+        const auto& SCDesc = m_pSwapChain->GetDesc();
+        sapphire_select(Input.mouse_x, Input.mouse_y, static_cast<float>(SCDesc.Width), static_cast<float>(SCDesc.Height));
+    }
+
 
     bool isRunning = false;
 
@@ -1790,31 +1819,30 @@ void SapphireApp::UpdateFixed(double sim_time, double sim_dt)
     //    mCurrentGizmoOperation = ImGuizmo::SCALE;
 
 
-    auto inputController = GetInputController();
-    if (inputController.IsKeyFirstDown(InputKeys::MoveLeft))
+    if (IsKeyFirstDown(Input, InputKeys::MoveLeft))
     {
         LOG_INFO_MESSAGE("Key Down First!");
     }
 
-    if (inputController.IsKeyFirstDown(InputKeys::MoveLeft))
+    if (IsKeyFirstDown(Input, InputKeys::MoveLeft))
     {
         LOG_INFO_MESSAGE("Key Down First!");
     }
 
-    if (inputController.IsKeyDown(InputKeys::MoveLeft))
+    if (IsKeyDown(Input, InputKeys::MoveLeft))
     {
         LOG_INFO_MESSAGE("Key Down!");
         isRunning = true;
         playerFacingDirection = -1;
 
     }
-    if (inputController.IsKeyDown(InputKeys::MoveRight))
+    if (IsKeyDown(Input, InputKeys::MoveRight))
     {
         LOG_INFO_MESSAGE("Key Down!");
         isRunning = true;
         playerFacingDirection = 1;
     }
-    if (inputController.IsKeyReleased(InputKeys::MoveLeft))
+    if (IsKeyReleased(Input, InputKeys::MoveLeft))
     {
         LOG_INFO_MESSAGE("Key released!");
     }
@@ -1850,11 +1878,19 @@ void SapphireApp::UpdateFixed(double sim_time, double sim_dt)
 
 void SapphireApp::Update(double CurrTime, double ElapsedTime)
 {
+    // a fixed frame time makes the number of fixed steps per frame independent of how long frames take
+    if (m_FixedFrameTime > 0)
+    {
+        m_FixedClock += m_FixedFrameTime;
+        CurrTime    = m_FixedClock;
+        ElapsedTime = m_FixedFrameTime;
+    }
+
     SampleBase::Update(CurrTime, ElapsedTime);
 
     sapphire_update(CurrTime, ElapsedTime);
 
-    const double sim_dt = 0.01;
+    const double sim_dt = m_FixedStepTime;
     static double accumulator = 0.0;
     static double sim_time = 0.0;
 
@@ -14,6 +14,8 @@ class SapphireApp final : public SampleBase
 public:
     ~SapphireApp();
 
+    virtual void ModifyEngineInitInfo(const ModifyEngineInitInfoAttribs& Attribs) override final;
+    virtual CommandLineStatus ProcessCommandLine(int argc, const char* const* argv) override final;
     virtual void Initialize(const SampleInitInfo& InitInfo) override final;
 
     virtual void Render() override final;
@@ -110,6 +112,16 @@ private:
 
     ///
     double m_timeAccumulator;
+
+    // --record / --replay: input of the fixed steps, --fixed_frame_time: seconds per frame instead of the clock,
+    // for repeatable benchmark runs
+    std::string m_InputRecordFile;
+    std::string m_InputReplayFile;
+    double      m_FixedFrameTime = 0;
+    double      m_FixedClock     = 0;
+    double      m_FixedStepTime  = 0.01;
+    // mouse buttons of the previous fixed step
+    uint8_t     m_LastMouseButtons = 0;
 };
 
 } // namespace Sapphire
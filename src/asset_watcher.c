@@ -0,0 +1,415 @@
+#include "asset_watcher.h"
+
+#include "core/allocator.h"
+#include "core/array.h"
+#include "core/murmurhash64a.h"
+#include "core/sprintf.h"
+#include "core/thread.h"
+
+#include <memory.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// a file is loaded once no event for it arrived for this long, editors write files in several steps
+#define DEBOUNCE_MS 100
+#define EVENT_BUFFER_SIZE 4096
+
+#if !defined(_WIN32)
+// inotify watches a single directory, every folder below the root gets its own watch
+typedef struct watched_dir_t
+{
+    int watch_fd;
+    // relative to the root, empty for the root itself
+    char path[SP_ASSET_PATH_LEN];
+} watched_dir_t;
+#endif
+
+struct sp_asset_watcher_o
+{
+    sp_allocator_i* allocator;
+    char root_path[SP_ASSET_PATH_LEN];
+    sp_asset_load_f load;
+    sp_asset_free_f free_data;
+    void* user_data;
+
+    // changes reported by the os but not loaded yet, only touched by the watcher thread
+    sp_asset_change_t* pending_arr;
+
+    // loaded changes waiting for the main thread, guarded by lock together with quit
+    sp_asset_change_t* loaded_arr;
+    bool quit;
+    sp_mutex_t lock;
+    sp_thread_t thread;
+
+#if defined(_WIN32)
+    HANDLE dir;
+    OVERLAPPED overlapped;
+    DWORD events[EVENT_BUFFER_SIZE / sizeof(DWORD)];
+#else
+    int inotify_fd;
+    // only touched by the watcher thread once it runs
+    watched_dir_t* dirs_arr;
+    char events[EVENT_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+#endif
+};
+
+sp_asset_type_t asset_type_from_path(const char* path)
+{
+    const char* ext = strrchr(path, '.');
+    if (!ext)
+        return SP_ASSET_TYPE_UNKNOWN;
+
+    if (strcmp(ext, ".mat") == 0)
+        return SP_ASSET_TYPE_MATERIALS;
+    if (strcmp(ext, ".scene") == 0)
+        return SP_ASSET_TYPE_SCENE;
+    if (strcmp(ext, ".vsh") == 0 || strcmp(ext, ".psh") == 0 || strcmp(ext, ".fxh") == 0)
+        return SP_ASSET_TYPE_SHADER;
+    if (strcmp(ext, ".png") == 0 || strcmp(ext, ".jpg") == 0 || strcmp(ext, ".jpeg") == 0 || strcmp(ext, ".tga") == 0 || strcmp(ext, ".dds") == 0 || strcmp(ext, ".ktx") == 0)
+        return SP_ASSET_TYPE_TEXTURE;
+    if (strcmp(ext, ".model") == 0)
+        return SP_ASSET_TYPE_MODEL;
+    return SP_ASSET_TYPE_UNKNOWN;
+}
+
+// records a changed file, the same file changing again before it was loaded is only loaded once
+static void add_pending_change(sp_asset_watcher_o* watcher, const char* path)
+{
+    sp_asset_type_t type = asset_type_from_path(path);
+    if (type == SP_ASSET_TYPE_UNKNOWN)
+        return;
+
+    sp_strhash_t path_hash = sp_murmur_hash_string(path);
+    uint32_t num_pending = (uint32_t)sp_array_size(watcher->pending_arr);
+    for (uint32_t i = 0; i < num_pending; ++i)
+    {
+        if (watcher->pending_arr[i].path_hash == path_hash)
+            return;
+    }
+
+    sp_asset_change_t change = { .type = type, .path_hash = path_hash };
+    sp_sprintf_api->print(change.path, sizeof(change.path), "%s", path);
+    sp_array_push(watcher->pending_arr, change, watcher->allocator);
+}
+
+// loads all pending changes and hands them over to the main thread
+static void load_pending_changes(sp_asset_watcher_o* watcher)
+{
+    char full_path[SP_ASSET_PATH_LEN * 2];
+    uint32_t num_pending = (uint32_t)sp_array_size(watcher->pending_arr);
+    for (uint32_t i = 0; i < num_pending; ++i)
+    {
+        sp_asset_change_t* change = &watcher->pending_arr[i];
+        sp_sprintf_api->print(full_path, sizeof(full_path), "%s/%s", watcher->root_path, change->path);
+        watcher->load(change, full_path, watcher->user_data);
+    }
+
+    sp_mutex_lock(&watcher->lock);
+    for (uint32_t i = 0; i < num_pending; ++i)
+    {
+        sp_array_push(watcher->loaded_arr, watcher->pending_arr[i], watcher->allocator);
+    }
+    sp_mutex_unlock(&watcher->lock);
+
+    sp_array_header(watcher->pending_arr)->size = 0;
+}
+
+static bool should_quit(sp_asset_watcher_o* watcher)
+{
+    sp_mutex_lock(&watcher->lock);
+    bool quit = watcher->quit;
+    sp_mutex_unlock(&watcher->lock);
+    return quit;
+}
+
+#if defined(_WIN32)
+
+static bool issue_read(sp_asset_watcher_o* watcher)
+{
+    const DWORD filter = FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME;
+    return ReadDirectoryChangesW(watcher->dir, watcher->events, sizeof(watcher->events), TRUE, filter, NULL, &watcher->overlapped, NULL);
+}
+
+// waits up to timeout_ms for file events, returns true if any arrived
+static bool wait_for_events(sp_asset_watcher_o* watcher, uint32_t timeout_ms)
+{
+    // on a timeout the read is still pending
+    if (WaitForSingleObject(watcher->overlapped.hEvent, timeout_ms) != WAIT_OBJECT_0)
+        return false;
+
+    // the read completed, it has to be issued again whatever it returned or no further change is reported
+    DWORD num_bytes = 0;
+    const bool completed = GetOverlappedResult(watcher->dir, &watcher->overlapped, &num_bytes, FALSE);
+    if (!completed)
+        num_bytes = 0;
+
+    const uint8_t* event_ptr = (const uint8_t*)watcher->events;
+    // 0 bytes means the buffer overflowed, the changes are lost
+    while (num_bytes)
+    {
+        const FILE_NOTIFY_INFORMATION* info = (const FILE_NOTIFY_INFORMATION*)event_ptr;
+        if (info->Action == FILE_ACTION_MODIFIED || info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_RENAMED_NEW_NAME)
+        {
+            char path[SP_ASSET_PATH_LEN];
+            int len = WideCharToMultiByte(CP_UTF8, 0, info->FileName, (int)(info->FileNameLength / sizeof(WCHAR)), path, sizeof(path) - 1, NULL, NULL);
+            path[len] = 0;
+            for (char* c = path; *c; ++c)
+            {
+                if (*c == '\\')
+                    *c = '/';
+            }
+            add_pending_change(watcher, path);
+        }
+        if (!info->NextEntryOffset)
+            break;
+        event_ptr += info->NextEntryOffset;
+    }
+
+    issue_read(watcher);
+    return completed;
+}
+
+static bool platform_start(sp_asset_watcher_o* watcher)
+{
+    watcher->dir = CreateFileA(watcher->root_path, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+    if (watcher->dir == INVALID_HANDLE_VALUE)
+        return false;
+    watcher->overlapped.hEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+    issue_read(watcher);
+    return true;
+}
+
+// called after the watcher thread exited
+static void platform_stop(sp_asset_watcher_o* watcher)
+{
+    CancelIoEx(watcher->dir, &watcher->overlapped);
+    CloseHandle(watcher->overlapped.hEvent);
+    CloseHandle(watcher->dir);
+}
+
+#else
+
+static void join_path(char* dst, uint32_t size, const char* dir, const char* name)
+{
+    if (dir[0])
+        sp_sprintf_api->print(dst, size, "%s/%s", dir, name);
+    else
+        sp_sprintf_api->print(dst, size, "%s", name);
+}
+
+// watches path and the folders below it. A folder that appears while running may already hold files, they are
+// reported as changed when report_files is set
+static void add_watch_recursive(sp_asset_watcher_o* watcher, const char* path, bool report_files)
+{
+    char full_path[SP_ASSET_PATH_LEN * 2];
+    join_path(full_path, sizeof(full_path), watcher->root_path, path);
+
+    // IN_MOVED_TO catches editors that save through a rename, IN_CREATE new folders
+    int watch_fd = inotify_add_watch(watcher->inotify_fd, full_path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+    if (watch_fd < 0)
+        return;
+    // the same folder reached again through a link
+    uint32_t num_dirs = (uint32_t)sp_array_size(watcher->dirs_arr);
+    for (uint32_t i = 0; i < num_dirs; ++i)
+    {
+        if (watcher->dirs_arr[i].watch_fd == watch_fd)
+            return;
+    }
+    watched_dir_t dir = { .watch_fd = watch_fd };
+    sp_sprintf_api->print(dir.path, sizeof(dir.path), "%s", path);
+    sp_array_push(watcher->dirs_arr, dir, watcher->allocator);
+
+    DIR* d = opendir(full_path);
+    if (!d)
+        return;
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        char child_path[SP_ASSET_PATH_LEN];
+        join_path(child_path, sizeof(child_path), path, entry->d_name);
+        char child_full_path[SP_ASSET_PATH_LEN * 2];
+        join_path(child_full_path, sizeof(child_full_path), watcher->root_path, child_path);
+        struct stat st;
+        if (stat(child_full_path, &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            add_watch_recursive(watcher, child_path, report_files);
+        else if (report_files)
+            add_pending_change(watcher, child_path);
+    }
+    closedir(d);
+}
+
+static watched_dir_t* find_watched_dir(sp_asset_watcher_o* watcher, int watch_fd)
+{
+    uint32_t num_dirs = (uint32_t)sp_array_size(watcher->dirs_arr);
+    for (uint32_t i = 0; i < num_dirs; ++i)
+    {
+        if (watcher->dirs_arr[i].watch_fd == watch_fd)
+            return &watcher->dirs_arr[i];
+    }
+    return NULL;
+}
+
+// waits up to timeout_ms for file events, returns true if any arrived
+static bool wait_for_events(sp_asset_watcher_o* watcher, uint32_t timeout_ms)
+{
+    struct pollfd pfd = { .fd = watcher->inotify_fd, .events = POLLIN };
+    if (poll(&pfd, 1, (int)timeout_ms) <= 0)
+        return false;
+
+    ssize_t num_bytes = read(watcher->inotify_fd, watcher->events, sizeof(watcher->events));
+    if (num_bytes <= 0)
+        return false;
+
+    for (const char* event_ptr = watcher->events; event_ptr < watcher->events + num_bytes;)
+    {
+        const struct inotify_event* event = (const struct inotify_event*)event_ptr;
+        event_ptr += sizeof(struct inotify_event) + event->len;
+
+        watched_dir_t* dir = find_watched_dir(watcher, event->wd);
+        if (!dir)
+            continue;
+        // the folder was deleted or moved away, its watch is gone
+        if (event->mask & IN_IGNORED)
+        {
+            *dir = watcher->dirs_arr[sp_array_size(watcher->dirs_arr) - 1];
+            sp_array_header(watcher->dirs_arr)->size--;
+            continue;
+        }
+        if (!event->len)
+            continue;
+
+        char path[SP_ASSET_PATH_LEN];
+        join_path(path, sizeof(path), dir->path, event->name);
+        if (event->mask & IN_ISDIR)
+        {
+            if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                add_watch_recursive(watcher, path, true);
+        }
+        else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+        {
+            add_pending_change(watcher, path);
+        }
+    }
+    return true;
+}
+
+static bool platform_start(sp_asset_watcher_o* watcher)
+{
+    watcher->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher->inotify_fd < 0)
+        return false;
+
+    add_watch_recursive(watcher, "", false);
+    if (!sp_array_size(watcher->dirs_arr))
+    {
+        close(watcher->inotify_fd);
+        return false;
+    }
+
+    return true;
+}
+
+// called after the watcher thread exited
+static void platform_stop(sp_asset_watcher_o* watcher)
+{
+    uint32_t num_dirs = (uint32_t)sp_array_size(watcher->dirs_arr);
+    for (uint32_t i = 0; i < num_dirs; ++i)
+    {
+        inotify_rm_watch(watcher->inotify_fd, watcher->dirs_arr[i].watch_fd);
+    }
+    sp_array_free(watcher->dirs_arr, watcher->allocator);
+    close(watcher->inotify_fd);
+}
+
+#endif
+
+static void watcher_thread(void* user_data)
+{
+    sp_asset_watcher_o* watcher = user_data;
+    while (!should_quit(watcher))
+    {
+        if (!wait_for_events(watcher, DEBOUNCE_MS) && sp_array_size(watcher->pending_arr))
+        {
+            load_pending_changes(watcher);
+        }
+    }
+}
+
+sp_asset_watcher_o* asset_watcher_create(const char* root_path, sp_asset_load_f load, sp_asset_free_f free_data, void* user_data, sp_allocator_i* allocator)
+{
+    sp_asset_watcher_o* watcher = sp_alloc(allocator, sizeof(sp_asset_watcher_o));
+    memset(watcher, 0, sizeof(sp_asset_watcher_o));
+    watcher->allocator = allocator;
+    watcher->load = load;
+    watcher->free_data = free_data;
+    watcher->user_data = user_data;
+    sp_sprintf_api->print(watcher->root_path, sizeof(watcher->root_path), "%s", root_path);
+
+    if (!platform_start(watcher))
+    {
+        sp_free(allocator, watcher, sizeof(sp_asset_watcher_o));
+        return NULL;
+    }
+    sp_mutex_init(&watcher->lock);
+    sp_thread_create(&watcher->thread, watcher_thread, watcher);
+    return watcher;
+}
+
+void asset_watcher_destroy(sp_asset_watcher_o* watcher)
+{
+    if (!watcher)
+        return;
+
+    sp_mutex_lock(&watcher->lock);
+    watcher->quit = true;
+    sp_mutex_unlock(&watcher->lock);
+    sp_thread_join(&watcher->thread);
+    platform_stop(watcher);
+    sp_mutex_destroy(&watcher->lock);
+
+    // changes that were loaded but never polled still own their data
+    uint32_t num_loaded = (uint32_t)sp_array_size(watcher->loaded_arr);
+    for (uint32_t i = 0; i < num_loaded; ++i)
+    {
+        if (watcher->loaded_arr[i].data)
+            watcher->free_data(&watcher->loaded_arr[i], watcher->user_data);
+    }
+
+    sp_allocator_i* allocator = watcher->allocator;
+    sp_array_free(watcher->pending_arr, allocator);
+    sp_array_free(watcher->loaded_arr, allocator);
+    sp_free(allocator, watcher, sizeof(sp_asset_watcher_o));
+}
+
+uint32_t asset_watcher_poll(sp_asset_watcher_o* watcher, sp_asset_change_t* changes, uint32_t max_changes)
+{
+    if (!watcher)
+        return 0;
+
+    sp_mutex_lock(&watcher->lock);
+    uint32_t num_loaded = (uint32_t)sp_array_size(watcher->loaded_arr);
+    uint32_t count = num_loaded < max_changes ? num_loaded : max_changes;
+    if (count)
+    {
+        memcpy(changes, watcher->loaded_arr, count * sizeof(sp_asset_change_t));
+        memmove(watcher->loaded_arr, watcher->loaded_arr + count, (num_loaded - count) * sizeof(sp_asset_change_t));
+        sp_array_header(watcher->loaded_arr)->size = num_loaded - count;
+    }
+    sp_mutex_unlock(&watcher->lock);
+    return count;
+}
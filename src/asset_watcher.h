@@ -0,0 +1,51 @@
+#pragma once
+
+#include "core/sapphire_types.h"
+
+typedef struct sp_allocator_i sp_allocator_i;
+
+// Watches an asset folder and its sub folders on a background thread (ReadDirectoryChangesW on Windows, inotify
+// on Linux).
+//
+// Changed files are debounced - editors usually write a file in several steps - and then handed to the
+// load callback, still on the watcher thread, so parsing and decoding stay off the main thread. The main
+// thread picks up the loaded changes with asset_watcher_poll() and swaps them in between frames.
+
+#define SP_ASSET_PATH_LEN 256
+
+typedef enum sp_asset_type_t
+{
+    SP_ASSET_TYPE_UNKNOWN,
+    SP_ASSET_TYPE_MATERIALS,
+    SP_ASSET_TYPE_SCENE,
+    SP_ASSET_TYPE_SHADER,
+    SP_ASSET_TYPE_TEXTURE,
+    SP_ASSET_TYPE_MODEL,
+} sp_asset_type_t;
+
+typedef struct sp_asset_change_t
+{
+    sp_asset_type_t type;
+    // path relative to the watched folder, with '/' separators
+    char path[SP_ASSET_PATH_LEN];
+    sp_strhash_t path_hash;
+    // result of the load callback, owned by the main thread once polled
+    void* data;
+} sp_asset_change_t;
+
+// called on the watcher thread for every changed file. full_path is the path to open, the callback stores
+// what it loaded in change->data
+typedef void (*sp_asset_load_f)(sp_asset_change_t* change, const char* full_path, void* user_data);
+// frees change->data of changes that were loaded but never polled, called from asset_watcher_destroy
+typedef void (*sp_asset_free_f)(sp_asset_change_t* change, void* user_data);
+
+typedef struct sp_asset_watcher_o sp_asset_watcher_o;
+
+// returns NULL if the folder can't be watched
+sp_asset_watcher_o* asset_watcher_create(const char* root_path, sp_asset_load_f load, sp_asset_free_f free_data, void* user_data, sp_allocator_i* allocator);
+void asset_watcher_destroy(sp_asset_watcher_o* watcher);
+
+// copies up to max_changes loaded changes into changes and removes them from the queue, returns the count
+uint32_t asset_watcher_poll(sp_asset_watcher_o* watcher, sp_asset_change_t* changes, uint32_t max_changes);
+
+sp_asset_type_t asset_type_from_path(const char* path);
@@ -0,0 +1,141 @@
+// Compares sp_json_api and sp_json_simd_api throughput on generated scene files.
+//
+// The scenes use the same dialect as the files in assets/ (unquoted keys, '=', no commas, comments) and
+// are generated in memory so the numbers don't include disk reads.
+
+#include "core/sapphire_types.h"
+#include "core/allocator.h"
+#include "core/array.h"
+#include "core/config.h"
+#include "core/json.h"
+#include "core/json_simd.h"
+#include "core/murmurhash64a.h"
+#include "core/sprintf.h"
+
+#include <math.h>
+#include <memory.h>
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_RUNS 3
+
+typedef bool (*parse_f)(const char* s, sp_config_i* config, uint32_t flags, char* error);
+
+static const uint32_t s_parse_flags = SP_JSON_PARSE_EXT_ALLOW_UNQUOTED_KEYS | SP_JSON_PARSE_EXT_ALLOW_COMMENTS | SP_JSON_PARSE_EXT_IMPLICIT_ROOT_OBJECT | SP_JSON_PARSE_EXT_OPTIONAL_COMMAS | SP_JSON_PARSE_EXT_EQUALS_FOR_COLON;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void append(char** text_arr, const char* s, uint32_t len, sp_allocator_i* allocator)
+{
+    const uint64_t size = sp_array_size(*text_arr);
+    sp_array_ensure(*text_arr, size + len + 1, allocator);
+    memcpy(*text_arr + size, s, len);
+    sp_array_header(*text_arr)->size = size + len;
+    (*text_arr)[size + len] = 0;
+}
+
+// deterministic so runs are comparable
+static float random_float(uint32_t* state, float min, float max)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return min + (max - min) * (float)(*state >> 8) / (float)(1u << 24);
+}
+
+static char* generate_scene(uint64_t target_size, uint32_t* num_instances, sp_allocator_i* allocator)
+{
+    char* text_arr = NULL;
+    char line[512];
+    uint32_t len;
+    uint32_t seed = 12345;
+
+    len = (uint32_t)sp_sprintf_api->print(line, sizeof(line), "// generated benchmark scene\nentities = [\n");
+    append(&text_arr, line, len, allocator);
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        len = (uint32_t)sp_sprintf_api->print(line, sizeof(line), "    { name = \"entity_%u\" model = \"dungeon_wall_%02u.model\" material = \"dungeon_wall\" }\n", i, i % 40);
+        append(&text_arr, line, len, allocator);
+    }
+    len = (uint32_t)sp_sprintf_api->print(line, sizeof(line), "]\n\ninstances = [\n");
+    append(&text_arr, line, len, allocator);
+
+    *num_instances = 0;
+    while (sp_array_size(text_arr) < target_size)
+    {
+        const uint32_t entity = (uint32_t)random_float(&seed, 0.0f, 256.0f);
+        const float x = random_float(&seed, -500.0f, 500.0f);
+        const float y = random_float(&seed, 0.0f, 10.0f);
+        const float z = random_float(&seed, -500.0f, 500.0f);
+        const float angle = random_float(&seed, -3.14f, 3.14f);
+        len = (uint32_t)sp_sprintf_api->print(line, sizeof(line),
+            "    { entity = \"entity_%u\" transform = { position = [%.4f, %.4f, %.4f] rotation = [0, %.6f, 0, %.6f] scale = [1, 1, 1] } }\n",
+            entity, x, y, z, sinf(angle * 0.5f), cosf(angle * 0.5f));
+        append(&text_arr, line, len, allocator);
+        ++*num_instances;
+    }
+    len = (uint32_t)sp_sprintf_api->print(line, sizeof(line), "]\n");
+    append(&text_arr, line, len, allocator);
+    return text_arr;
+}
+
+// best of BENCH_RUNS in MB/s, 0 if the parse failed or lost instances
+static double bench_parser(parse_f parse, const char* text, uint64_t size, uint32_t expected_instances, sp_allocator_i* allocator)
+{
+    const sp_strhash_t instances_hash = sp_murmur_hash_string("instances");
+    double best = 0.0;
+    for (uint32_t run = 0; run < BENCH_RUNS; ++run)
+    {
+        char error[SP_JSON_SIMD_ERROR_LENGTH];
+        sp_config_i* config = sp_config_api->create(allocator);
+
+        const double start = now_seconds();
+        const bool res = parse(text, config, s_parse_flags, error);
+        const double seconds = now_seconds() - start;
+
+        uint32_t num_instances = 0;
+        if (res)
+        {
+            sp_config_item_t* instances = NULL;
+            sp_config_item_t root = config->root(config->inst);
+            num_instances = config->to_array(config->inst, config->object_get(config->inst, root, instances_hash), &instances);
+        }
+        else
+        {
+            printf("    parse failed: %s\n", error);
+        }
+        sp_config_api->destroy(config);
+
+        if (!res || num_instances != expected_instances)
+            return 0.0;
+        const double mb_per_second = (double)size / (1024.0 * 1024.0) / seconds;
+        best = mb_per_second > best ? mb_per_second : best;
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+    sp_allocator_i* allocator = sp_allocator_api->system_allocator;
+    const uint32_t sizes_mb[] = { 10, 25, 50, 100 };
+
+    printf("%10s %12s %14s %14s %8s\n", "size (MB)", "instances", "json (MB/s)", "simd (MB/s)", "speedup");
+    for (uint32_t i = 0; i < SP_ARRAY_COUNT(sizes_mb); ++i)
+    {
+        uint32_t num_instances;
+        char* text_arr = generate_scene((uint64_t)sizes_mb[i] * 1024 * 1024, &num_instances, allocator);
+        const uint64_t size = sp_array_size(text_arr);
+
+        const double json_speed = bench_parser(sp_json_api->parse, text_arr, size, num_instances, allocator);
+        const double simd_speed = bench_parser(sp_json_simd_api->parse, text_arr, size, num_instances, allocator);
+        printf("%10u %12u %14.1f %14.1f %7.2fx\n", sizes_mb[i], num_instances, json_speed, simd_speed, json_speed > 0.0 ? simd_speed / json_speed : 0.0);
+
+        sp_array_free(text_arr, allocator);
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+// Light binning cost of light_clusters_bin() as the light count grows.
+//
+// The lights are torch sized point lights scattered over a dungeon level around the camera, like the lights
+// a Grimrock level would place on its walls. Each light count is binned with 1 and with 4 threads.
+
+#include "core/sapphire_types.h"
+#include "core/allocator.h"
+#include "core/array.h"
+#include "light_clusters.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_FRAMES 100
+#define BENCH_MAX_INDICES (1024 * 1024)
+#define BENCH_NEAR 0.1f
+#define BENCH_FAR 100.0f
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// deterministic so runs are comparable
+static float random_float(uint32_t* state, float min, float max)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return min + (max - min) * (float)(*state >> 8) / (float)(1u << 24);
+}
+
+// row vector perspective looking down +z from the origin, slightly above the floor
+static sp_mat4x4_t view_projection(float aspect)
+{
+    const float f = 1.0f / tanf(0.5f * 3.14159265f / 4.0f);
+    const float eye_height = 1.5f;
+    return (sp_mat4x4_t){
+        .xx = f / aspect,
+        .yy = f,
+        .zz = BENCH_FAR / (BENCH_FAR - BENCH_NEAR), .zw = 1.0f,
+        .wy = -eye_height * f,
+        .wz = -BENCH_NEAR * BENCH_FAR / (BENCH_FAR - BENCH_NEAR),
+    };
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+    sp_allocator_i* allocator = sp_allocator_api->system_allocator;
+    const uint32_t light_counts[] = { 64, 256, 1024, 4096, 16384 };
+    const uint32_t thread_counts[] = { 1, 4 };
+    const sp_mat4x4_t vp = view_projection(16.0f / 9.0f);
+
+    printf("%8s %8s %12s %16s %10s\n", "lights", "threads", "bin (ms)", "lights/cluster", "dropped");
+    for (uint32_t i = 0; i < SP_ARRAY_COUNT(light_counts); ++i)
+    {
+        // a 200 x 200 m level, 3 m high corridors, torches reach 4 - 8 m
+        sp_vec4_t* spheres_arr = NULL;
+        uint32_t seed = 12345;
+        sp_array_ensure(spheres_arr, light_counts[i], allocator);
+        for (uint32_t l = 0; l < light_counts[i]; ++l)
+        {
+            sp_vec4_t sphere = { random_float(&seed, -100.0f, 100.0f), random_float(&seed, 0.5f, 2.5f), random_float(&seed, -100.0f, 100.0f), random_float(&seed, 4.0f, 8.0f) };
+            sp_array_push(spheres_arr, sphere, allocator);
+        }
+
+        for (uint32_t t = 0; t < SP_ARRAY_COUNT(thread_counts); ++t)
+        {
+            light_clusters_t clusters;
+            light_clusters_init(&clusters, BENCH_MAX_INDICES, thread_counts[t], allocator);
+            // warm up, also faults in the index list
+            light_clusters_bin(&clusters, &vp, BENCH_NEAR, BENCH_FAR, spheres_arr, light_counts[i]);
+
+            const double start = now_seconds();
+            for (uint32_t frame = 0; frame < BENCH_FRAMES; ++frame)
+                light_clusters_bin(&clusters, &vp, BENCH_NEAR, BENCH_FAR, spheres_arr, light_counts[i]);
+            const double ms = (now_seconds() - start) * 1000.0 / BENCH_FRAMES;
+
+            printf("%8u %8u %12.3f %16.2f %10u\n", light_counts[i], thread_counts[t], ms, (double)clusters.num_indices / LIGHT_CLUSTERS_COUNT, clusters.num_dropped);
+            light_clusters_destroy(&clusters);
+        }
+        sp_array_free(spheres_arr, allocator);
+    }
+    return 0;
+}
@@ -0,0 +1,43 @@
+// Keys looked up in scene, material and font files. The SP_KEY_<ID> hash constants are generated from this
+// list at build time into config_keys.h, which fails the build if two keys hash to the same value.
+//
+// SP_CONFIG_KEY(ID, "key")
+
+// scene
+SP_CONFIG_KEY(ENTITIES, "entities")
+SP_CONFIG_KEY(INSTANCES, "instances")
+SP_CONFIG_KEY(NAME, "name")
+SP_CONFIG_KEY(MODEL, "model")
+SP_CONFIG_KEY(MATERIAL, "material")
+SP_CONFIG_KEY(FLAGS, "flags")
+SP_CONFIG_KEY(ENTITY, "entity")
+SP_CONFIG_KEY(TRANSFORM, "transform")
+SP_CONFIG_KEY(POSITION, "position")
+SP_CONFIG_KEY(ROTATION, "rotation")
+SP_CONFIG_KEY(SCALE, "scale")
+
+// materials
+SP_CONFIG_KEY(MATERIALS, "materials")
+SP_CONFIG_KEY(ALBEDO_MAP, "albedo_map")
+SP_CONFIG_KEY(ARM_MAP, "arm_map")
+SP_CONFIG_KEY(NORMAL_MAP, "normal_map")
+SP_CONFIG_KEY(DOUBLE_SIDED, "double_sided")
+
+// fonts
+SP_CONFIG_KEY(GLYPHS, "glyphs")
+SP_CONFIG_KEY(SCALE_W, "scale_w")
+SP_CONFIG_KEY(SCALE_H, "scale_h")
+SP_CONFIG_KEY(LINE_HEIGHT, "line_height")
+SP_CONFIG_KEY(TTF, "ttf")
+SP_CONFIG_KEY(ID_CODE, "id_code")
+SP_CONFIG_KEY(X, "x")
+SP_CONFIG_KEY(Y, "y")
+SP_CONFIG_KEY(WIDTH, "width")
+SP_CONFIG_KEY(HEIGHT, "height")
+SP_CONFIG_KEY(XOFFSET, "xoffset")
+SP_CONFIG_KEY(YOFFSET, "yoffset")
+SP_CONFIG_KEY(XADVANCE, "xadvance")
+SP_CONFIG_KEY(KERNINGS, "kernings")
+SP_CONFIG_KEY(FIRST, "first")
+SP_CONFIG_KEY(SECOND, "second")
+SP_CONFIG_KEY(AMOUNT, "amount")
@@ -0,0 +1,115 @@
+#include "core/sapphire_types.h"
+#include "core/allocator.h"
+#include "core/config.h"
+#include "core/murmurhash64a.h"
+
+#include <memory.h>
+#include <string.h>
+
+#include "config_utils.h"
+
+void config_object_index_build(config_object_index_t* index, sp_config_i* config, sp_config_item_t object, sp_allocator_i* allocator)
+{
+    memset(index, 0, sizeof(config_object_index_t));
+    index->config = config;
+    index->object = object;
+    index->allocator = allocator;
+
+    sp_config_item_t* keys = NULL;
+    sp_config_item_t* values = NULL;
+    const uint32_t num_members = config->to_object(config->inst, object, &keys, &values);
+    if (num_members < CONFIG_INDEX_MIN_MEMBERS)
+        return;
+
+    // at most half full
+    uint32_t capacity = 1;
+    while (capacity < num_members * 2)
+    {
+        capacity <<= 1;
+    }
+    index->mask = capacity - 1;
+    index->hashes = sp_alloc(allocator, capacity * sizeof(sp_strhash_t));
+    index->values = sp_alloc(allocator, capacity * sizeof(sp_config_item_t));
+    memset(index->hashes, 0, capacity * sizeof(sp_strhash_t));
+
+    for (uint32_t i = 0; i < num_members; ++i)
+    {
+        const sp_strhash_t hash = sp_murmur_hash_string(config->to_string(config->inst, keys[i]));
+        uint32_t slot = (uint32_t)hash & index->mask;
+        while (index->hashes[slot] && index->hashes[slot] != hash)
+        {
+            slot = (slot + 1) & index->mask;
+        }
+        // the first of duplicated keys wins, like object_get
+        if (!index->hashes[slot])
+        {
+            index->hashes[slot] = hash;
+            index->values[slot] = values[i];
+        }
+    }
+}
+
+void config_object_index_free(config_object_index_t* index)
+{
+    if (index->mask)
+    {
+        const uint32_t capacity = index->mask + 1;
+        sp_free(index->allocator, index->hashes, capacity * sizeof(sp_strhash_t));
+        sp_free(index->allocator, index->values, capacity * sizeof(sp_config_item_t));
+    }
+    memset(index, 0, sizeof(config_object_index_t));
+}
+
+sp_config_item_t config_object_index_get(const config_object_index_t* index, sp_strhash_t hash)
+{
+    if (!index->mask)
+        return index->config->object_get(index->config->inst, index->object, hash);
+
+    uint32_t slot = (uint32_t)hash & index->mask;
+    while (index->hashes[slot])
+    {
+        if (index->hashes[slot] == hash)
+            return index->values[slot];
+        slot = (slot + 1) & index->mask;
+    }
+    return sp_config_api->c_null;
+}
+
+void config_cursor_init(config_cursor_t* cursor, sp_config_i* config)
+{
+    memset(cursor, 0, sizeof(config_cursor_t));
+    cursor->config = config;
+}
+
+void config_cursor_begin(config_cursor_t* cursor, sp_config_item_t object)
+{
+    cursor->keys = NULL;
+    cursor->values = NULL;
+    cursor->num_members = cursor->config->to_object(cursor->config->inst, object, &cursor->keys, &cursor->values);
+    cursor->next = 0;
+}
+
+bool config_cursor_next(config_cursor_t* cursor, sp_strhash_t* key_hash, sp_config_item_t* value)
+{
+    if (cursor->next >= cursor->num_members)
+        return false;
+
+    const uint32_t i = cursor->next++;
+    const char* key = cursor->config->to_string(cursor->config->inst, cursor->keys[i]);
+    *value = cursor->values[i];
+    if (i >= CONFIG_CURSOR_CACHED_KEYS)
+    {
+        *key_hash = sp_murmur_hash_string(key);
+        return true;
+    }
+
+    // interned keys match by pointer, comparing a short key costs less than hashing it
+    const char* cached_key = cursor->cached_keys[i];
+    if (!cached_key || (cached_key != key && strcmp(cached_key, key) != 0))
+    {
+        cursor->cached_keys[i] = key;
+        cursor->cached_hashes[i] = sp_murmur_hash_string(key);
+    }
+    *key_hash = cursor->cached_hashes[i];
+    return true;
+}
@@ -27,4 +27,73 @@ inline double get_attribute_as_number(sp_config_i* config, sp_config_item_t item
     }
     return 0;
 
-}
\ No newline at end of file
+}
+// Lookups by key in large objects. object_get scans the members, objects with at least
+// CONFIG_INDEX_MIN_MEMBERS members get an open addressing table of their key hashes instead, smaller
+// objects keep going through object_get.
+#define CONFIG_INDEX_MIN_MEMBERS 16
+
+typedef struct config_object_index_t
+{
+    sp_config_i* config;
+    sp_config_item_t object;
+    sp_allocator_i* allocator;
+    // capacity - 1, 0 when the object is small and not indexed
+    uint32_t mask;
+    // a 0 hash marks an empty slot
+    sp_strhash_t* hashes;
+    sp_config_item_t* values;
+} config_object_index_t;
+
+void config_object_index_build(config_object_index_t* index, sp_config_i* config, sp_config_item_t object, sp_allocator_i* allocator);
+void config_object_index_free(config_object_index_t* index);
+// c_null if the key is missing
+sp_config_item_t config_object_index_get(const config_object_index_t* index, sp_strhash_t hash);
+
+// the attribute helpers above, looking up through an index
+inline void get_indexed_attribute_as_string(const config_object_index_t* index, sp_strhash_t hash, char* buffer)
+{
+    sp_config_item_t attrib = config_object_index_get(index, hash);
+    if (attrib.type != sp_config_api->c_null.type)
+    {
+        const char* str = index->config->to_string(index->config->inst, attrib);
+        memcpy(buffer, str, strlen(str) + 1);
+    }
+}
+
+inline bool get_indexed_attribute_as_bool(const config_object_index_t* index, sp_strhash_t hash)
+{
+    return config_object_index_get(index, hash).type == SP_CONFIG_TYPE_TRUE;
+}
+
+inline double get_indexed_attribute_as_number(const config_object_index_t* index, sp_strhash_t hash)
+{
+    sp_config_item_t attrib = config_object_index_get(index, hash);
+    if (attrib.type != sp_config_api->c_null.type)
+        return index->config->to_number(index->config->inst, attrib);
+    return 0;
+}
+
+// Walks the members of an object in order, for loaders reading every attribute of many small objects -
+// one pass over the members instead of one object_get per attribute.
+//
+// A cursor is initialized once and begun on every object. Objects read in a loop mostly have the same keys in the
+// same order, so the cursor keeps the key hashes of the previous objects by member position and only hashes a key
+// that differs from the one seen there before.
+#define CONFIG_CURSOR_CACHED_KEYS 16
+
+typedef struct config_cursor_t
+{
+    sp_config_i* config;
+    sp_config_item_t* keys;
+    sp_config_item_t* values;
+    uint32_t num_members;
+    uint32_t next;
+    const char* cached_keys[CONFIG_CURSOR_CACHED_KEYS];
+    sp_strhash_t cached_hashes[CONFIG_CURSOR_CACHED_KEYS];
+} config_cursor_t;
+
+void config_cursor_init(config_cursor_t* cursor, sp_config_i* config);
+void config_cursor_begin(config_cursor_t* cursor, sp_config_item_t object);
+// returns false past the last member
+bool config_cursor_next(config_cursor_t* cursor, sp_strhash_t* key_hash, sp_config_item_t* value);
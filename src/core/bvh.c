@@ -0,0 +1,828 @@
+#include "bvh.h"
+#include "allocator.h"
+#include "array.h"
+#include "frame_allocator.h"
+#include "thread.h"
+
+#include <math.h>
+#include <memory.h>
+#include <assert.h>
+
+// traversal stack entries kept on the stack, deeper trees take theirs from the scratch arena
+#define BVH_STACK_SIZE 256
+#define BVH_SAH_BINS 12
+// deeper than this the build splits ranges in half, which bounds the tree height
+#define BVH_MAX_SAH_DEPTH 64
+// ranges smaller than this are not worth a thread
+#define BVH_PARALLEL_MIN_LEAVES 4096
+
+static sp_aabb_t aabb_union(const sp_aabb_t* a, const sp_aabb_t* b)
+{
+    return (sp_aabb_t){
+        .min = { fminf(a->min.x, b->min.x), fminf(a->min.y, b->min.y), fminf(a->min.z, b->min.z) },
+        .max = { fmaxf(a->max.x, b->max.x), fmaxf(a->max.y, b->max.y), fmaxf(a->max.z, b->max.z) },
+    };
+}
+
+// half the surface area
+static float aabb_area(const sp_aabb_t* a)
+{
+    const float dx = a->max.x - a->min.x;
+    const float dy = a->max.y - a->min.y;
+    const float dz = a->max.z - a->min.z;
+    return dx * dy + dy * dz + dz * dx;
+}
+
+static bool aabb_contains(const sp_aabb_t* outer, const sp_aabb_t* inner)
+{
+    return outer->min.x <= inner->min.x && outer->min.y <= inner->min.y && outer->min.z <= inner->min.z &&
+           outer->max.x >= inner->max.x && outer->max.y >= inner->max.y && outer->max.z >= inner->max.z;
+}
+
+static bool aabb_overlap(const sp_aabb_t* a, const sp_aabb_t* b)
+{
+    return a->min.x <= b->max.x && a->max.x >= b->min.x && a->min.y <= b->max.y && a->max.y >= b->min.y &&
+           a->min.z <= b->max.z && a->max.z >= b->min.z;
+}
+
+static float aabb_axis(const sp_vec3_t* v, uint32_t axis)
+{
+    return axis == 0 ? v->x : (axis == 1 ? v->y : v->z);
+}
+
+static bool is_leaf(const sp_bvh_node_t* node)
+{
+    return node->left == SP_BVH_NULL;
+}
+
+static uint32_t allocate_node(sp_bvh_t* bvh)
+{
+    uint32_t index = bvh->free_list;
+    if (index != SP_BVH_NULL)
+    {
+        bvh->free_list = bvh->nodes_arr[index].parent;
+    }
+    else
+    {
+        sp_bvh_node_t node = {0};
+        index = (uint32_t)sp_array_size(bvh->nodes_arr);
+        sp_array_push(bvh->nodes_arr, node, bvh->allocator);
+    }
+    sp_bvh_node_t* node = &bvh->nodes_arr[index];
+    node->parent = SP_BVH_NULL;
+    node->left = SP_BVH_NULL;
+    node->right = SP_BVH_NULL;
+    node->height = 0;
+    return index;
+}
+
+static void free_node(sp_bvh_t* bvh, uint32_t index)
+{
+    bvh->nodes_arr[index].parent = bvh->free_list;
+    bvh->nodes_arr[index].height = -1;
+    bvh->free_list = index;
+}
+
+static void replace_child(sp_bvh_t* bvh, uint32_t parent, uint32_t old_child, uint32_t new_child)
+{
+    if (parent == SP_BVH_NULL)
+        bvh->root = new_child;
+    else if (bvh->nodes_arr[parent].left == old_child)
+        bvh->nodes_arr[parent].left = new_child;
+    else
+        bvh->nodes_arr[parent].right = new_child;
+}
+
+static int32_t max_height(int32_t a, int32_t b)
+{
+    return a > b ? a : b;
+}
+
+// AVL rotation - if one child of a is more than one level higher than the other, the higher child is
+// rotated up. Returns the root of the rotated subtree
+static uint32_t balance(sp_bvh_t* bvh, uint32_t ia)
+{
+    sp_bvh_node_t* nodes = bvh->nodes_arr;
+    sp_bvh_node_t* a = &nodes[ia];
+    if (is_leaf(a) || a->height < 2)
+        return ia;
+
+    const uint32_t ib = a->left;
+    const uint32_t ic = a->right;
+    sp_bvh_node_t* b = &nodes[ib];
+    sp_bvh_node_t* c = &nodes[ic];
+    const int32_t diff = c->height - b->height;
+
+    if (diff > 1)
+    {
+        // rotate c up
+        const uint32_t if_ = c->left;
+        const uint32_t ig = c->right;
+        sp_bvh_node_t* f = &nodes[if_];
+        sp_bvh_node_t* g = &nodes[ig];
+
+        c->left = ia;
+        c->parent = a->parent;
+        a->parent = ic;
+        replace_child(bvh, c->parent, ia, ic);
+
+        if (f->height > g->height)
+        {
+            c->right = if_;
+            a->right = ig;
+            g->parent = ia;
+            a->aabb = aabb_union(&b->aabb, &g->aabb);
+            c->aabb = aabb_union(&a->aabb, &f->aabb);
+            a->height = 1 + max_height(b->height, g->height);
+            c->height = 1 + max_height(a->height, f->height);
+        }
+        else
+        {
+            c->right = ig;
+            a->right = if_;
+            f->parent = ia;
+            a->aabb = aabb_union(&b->aabb, &f->aabb);
+            c->aabb = aabb_union(&a->aabb, &g->aabb);
+            a->height = 1 + max_height(b->height, f->height);
+            c->height = 1 + max_height(a->height, g->height);
+        }
+        return ic;
+    }
+
+    if (diff < -1)
+    {
+        // rotate b up
+        const uint32_t id = b->left;
+        const uint32_t ie = b->right;
+        sp_bvh_node_t* d = &nodes[id];
+        sp_bvh_node_t* e = &nodes[ie];
+
+        b->left = ia;
+        b->parent = a->parent;
+        a->parent = ib;
+        replace_child(bvh, b->parent, ia, ib);
+
+        if (d->height > e->height)
+        {
+            b->right = id;
+            a->left = ie;
+            e->parent = ia;
+            a->aabb = aabb_union(&c->aabb, &e->aabb);
+            b->aabb = aabb_union(&a->aabb, &d->aabb);
+            a->height = 1 + max_height(c->height, e->height);
+            b->height = 1 + max_height(a->height, d->height);
+        }
+        else
+        {
+            b->right = ie;
+            a->left = id;
+            d->parent = ia;
+            a->aabb = aabb_union(&c->aabb, &d->aabb);
+            b->aabb = aabb_union(&a->aabb, &e->aabb);
+            a->height = 1 + max_height(c->height, d->height);
+            b->height = 1 + max_height(a->height, e->height);
+        }
+        return ib;
+    }
+
+    return ia;
+}
+
+// refits boxes and heights from index up to the root, rotating on the way
+static void refit(sp_bvh_t* bvh, uint32_t index)
+{
+    while (index != SP_BVH_NULL)
+    {
+        index = balance(bvh, index);
+        sp_bvh_node_t* node = &bvh->nodes_arr[index];
+        const sp_bvh_node_t* left = &bvh->nodes_arr[node->left];
+        const sp_bvh_node_t* right = &bvh->nodes_arr[node->right];
+        node->height = 1 + max_height(left->height, right->height);
+        node->aabb = aabb_union(&left->aabb, &right->aabb);
+        index = node->parent;
+    }
+}
+
+static void insert_leaf(sp_bvh_t* bvh, uint32_t leaf)
+{
+    if (bvh->root == SP_BVH_NULL)
+    {
+        bvh->root = leaf;
+        bvh->nodes_arr[leaf].parent = SP_BVH_NULL;
+        return;
+    }
+
+    // descend to the sibling that costs the least surface area, counting the growth of the ancestors
+    const sp_aabb_t leaf_aabb = bvh->nodes_arr[leaf].aabb;
+    uint32_t index = bvh->root;
+    while (!is_leaf(&bvh->nodes_arr[index]))
+    {
+        const sp_bvh_node_t* node = &bvh->nodes_arr[index];
+        const sp_aabb_t combined = aabb_union(&node->aabb, &leaf_aabb);
+        const float combined_area = aabb_area(&combined);
+        // new parent for this node and the leaf
+        const float cost = 2.0f * combined_area;
+        // pushing the leaf further down grows this node
+        const float inheritance_cost = 2.0f * (combined_area - aabb_area(&node->aabb));
+
+        float child_costs[2];
+        const uint32_t children[2] = { node->left, node->right };
+        for (uint32_t i = 0; i < 2; ++i)
+        {
+            const sp_bvh_node_t* child = &bvh->nodes_arr[children[i]];
+            const sp_aabb_t child_combined = aabb_union(&child->aabb, &leaf_aabb);
+            child_costs[i] = aabb_area(&child_combined) + inheritance_cost;
+            if (!is_leaf(child))
+                child_costs[i] -= aabb_area(&child->aabb);
+        }
+
+        if (cost < child_costs[0] && cost < child_costs[1])
+            break;
+        index = child_costs[0] < child_costs[1] ? children[0] : children[1];
+    }
+
+    const uint32_t sibling = index;
+    const uint32_t old_parent = bvh->nodes_arr[sibling].parent;
+    const uint32_t new_parent = allocate_node(bvh);
+    sp_bvh_node_t* nodes = bvh->nodes_arr;
+    nodes[new_parent].parent = old_parent;
+    nodes[new_parent].aabb = aabb_union(&leaf_aabb, &nodes[sibling].aabb);
+    nodes[new_parent].height = nodes[sibling].height + 1;
+    nodes[new_parent].left = sibling;
+    nodes[new_parent].right = leaf;
+    replace_child(bvh, old_parent, sibling, new_parent);
+    nodes[sibling].parent = new_parent;
+    nodes[leaf].parent = new_parent;
+
+    refit(bvh, new_parent);
+}
+
+static void remove_leaf(sp_bvh_t* bvh, uint32_t leaf)
+{
+    if (leaf == bvh->root)
+    {
+        bvh->root = SP_BVH_NULL;
+        return;
+    }
+
+    sp_bvh_node_t* nodes = bvh->nodes_arr;
+    const uint32_t parent = nodes[leaf].parent;
+    const uint32_t grand_parent = nodes[parent].parent;
+    const uint32_t sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+    replace_child(bvh, grand_parent, parent, sibling);
+    nodes[sibling].parent = grand_parent;
+    free_node(bvh, parent);
+    refit(bvh, grand_parent);
+}
+
+static sp_aabb_t fatten(const sp_bvh_t* bvh, const sp_aabb_t* aabb)
+{
+    const float m = bvh->margin;
+    return (sp_aabb_t){
+        .min = { aabb->min.x - m, aabb->min.y - m, aabb->min.z - m },
+        .max = { aabb->max.x + m, aabb->max.y + m, aabb->max.z + m },
+    };
+}
+
+void sp_bvh_init(sp_bvh_t* bvh, float margin, sp_allocator_i* allocator)
+{
+    memset(bvh, 0, sizeof(sp_bvh_t));
+    bvh->allocator = allocator;
+    bvh->margin = margin;
+    bvh->root = SP_BVH_NULL;
+    bvh->free_list = SP_BVH_NULL;
+}
+
+void sp_bvh_destroy(sp_bvh_t* bvh)
+{
+    sp_array_free(bvh->nodes_arr, bvh->allocator);
+    bvh->root = SP_BVH_NULL;
+    bvh->free_list = SP_BVH_NULL;
+    bvh->num_leaves = 0;
+}
+
+void sp_bvh_clear(sp_bvh_t* bvh)
+{
+    if (bvh->nodes_arr)
+        sp_array_header(bvh->nodes_arr)->size = 0;
+    bvh->root = SP_BVH_NULL;
+    bvh->free_list = SP_BVH_NULL;
+    bvh->num_leaves = 0;
+}
+
+uint32_t sp_bvh_insert(sp_bvh_t* bvh, const sp_aabb_t* aabb, uint32_t user_data)
+{
+    const uint32_t leaf = allocate_node(bvh);
+    bvh->nodes_arr[leaf].aabb = fatten(bvh, aabb);
+    bvh->nodes_arr[leaf].user_data = user_data;
+    insert_leaf(bvh, leaf);
+    ++bvh->num_leaves;
+    return leaf;
+}
+
+void sp_bvh_remove(sp_bvh_t* bvh, uint32_t leaf)
+{
+    remove_leaf(bvh, leaf);
+    free_node(bvh, leaf);
+    --bvh->num_leaves;
+}
+
+bool sp_bvh_move(sp_bvh_t* bvh, uint32_t leaf, const sp_aabb_t* aabb)
+{
+    if (aabb_contains(&bvh->nodes_arr[leaf].aabb, aabb))
+        return false;
+    remove_leaf(bvh, leaf);
+    bvh->nodes_arr[leaf].aabb = fatten(bvh, aabb);
+    insert_leaf(bvh, leaf);
+    return true;
+}
+
+typedef struct build_context_t
+{
+    sp_bvh_node_t* nodes;
+    // leaf node indices, partitioned in place
+    uint32_t* leaves;
+    // internal node indices, the range [begin, end) of leaves uses end - begin - 1 of them from slot
+    const uint32_t* internals;
+} build_context_t;
+
+typedef struct build_task_t
+{
+    build_context_t* context;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t slot;
+    uint32_t depth;
+    uint32_t num_threads;
+    uint32_t result;
+} build_task_t;
+
+static sp_vec3_t centroid(const sp_aabb_t* aabb)
+{
+    return (sp_vec3_t){ (aabb->min.x + aabb->max.x) * 0.5f, (aabb->min.y + aabb->max.y) * 0.5f, (aabb->min.z + aabb->max.z) * 0.5f };
+}
+
+static void build_range(build_task_t* task);
+
+static void build_thread(void* user_data)
+{
+    build_range(user_data);
+}
+
+// splits [begin, end) with the binned SAH cost, returns the first index of the right half
+static uint32_t partition_sah(build_context_t* context, uint32_t begin, uint32_t end, uint32_t depth)
+{
+    const uint32_t mid = begin + (end - begin) / 2;
+    sp_bvh_node_t* nodes = context->nodes;
+    uint32_t* leaves = context->leaves;
+
+    sp_vec3_t c0 = centroid(&nodes[leaves[begin]].aabb);
+    sp_aabb_t centroid_bounds = { c0, c0 };
+    for (uint32_t i = begin + 1; i < end; ++i)
+    {
+        const sp_vec3_t c = centroid(&nodes[leaves[i]].aabb);
+        const sp_aabb_t point = { c, c };
+        centroid_bounds = aabb_union(&centroid_bounds, &point);
+    }
+
+    float best_cost = INFINITY;
+    uint32_t best_axis = 0;
+    uint32_t best_bin = 0;
+    for (uint32_t axis = 0; axis < 3 && depth < BVH_MAX_SAH_DEPTH; ++axis)
+    {
+        const float lo = aabb_axis(&centroid_bounds.min, axis);
+        const float extent = aabb_axis(&centroid_bounds.max, axis) - lo;
+        if (extent <= 0.0f)
+            continue;
+
+        uint32_t counts[BVH_SAH_BINS] = {0};
+        sp_aabb_t bounds[BVH_SAH_BINS];
+        const float scale = BVH_SAH_BINS / extent;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            const sp_aabb_t* aabb = &nodes[leaves[i]].aabb;
+            const sp_vec3_t c = centroid(aabb);
+            uint32_t bin = (uint32_t)((aabb_axis(&c, axis) - lo) * scale);
+            bin = bin < BVH_SAH_BINS ? bin : BVH_SAH_BINS - 1;
+            bounds[bin] = counts[bin]++ ? aabb_union(&bounds[bin], aabb) : *aabb;
+        }
+
+        // right side areas and counts for a split after bin i
+        float right_areas[BVH_SAH_BINS];
+        uint32_t right_counts[BVH_SAH_BINS];
+        sp_aabb_t right_bounds = {0};
+        uint32_t right_count = 0;
+        for (uint32_t i = BVH_SAH_BINS - 1; i > 0; --i)
+        {
+            if (counts[i])
+                right_bounds = right_count ? aabb_union(&right_bounds, &bounds[i]) : bounds[i];
+            right_count += counts[i];
+            right_counts[i - 1] = right_count;
+            right_areas[i - 1] = right_count ? aabb_area(&right_bounds) : 0.0f;
+        }
+
+        sp_aabb_t left_bounds = {0};
+        uint32_t left_count = 0;
+        for (uint32_t i = 0; i < BVH_SAH_BINS - 1; ++i)
+        {
+            if (counts[i])
+                left_bounds = left_count ? aabb_union(&left_bounds, &bounds[i]) : bounds[i];
+            left_count += counts[i];
+            if (!left_count || !right_counts[i])
+                continue;
+            const float cost = left_count * aabb_area(&left_bounds) + right_counts[i] * right_areas[i];
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = i;
+            }
+        }
+    }
+
+    // all centroids in one point or too deep - any even split will do
+    if (best_cost == INFINITY)
+        return mid;
+
+    const float lo = aabb_axis(&centroid_bounds.min, best_axis);
+    const float scale = BVH_SAH_BINS / (aabb_axis(&centroid_bounds.max, best_axis) - lo);
+    uint32_t i = begin;
+    uint32_t j = end;
+    while (i < j)
+    {
+        const sp_vec3_t c = centroid(&nodes[leaves[i]].aabb);
+        uint32_t bin = (uint32_t)((aabb_axis(&c, best_axis) - lo) * scale);
+        bin = bin < BVH_SAH_BINS ? bin : BVH_SAH_BINS - 1;
+        if (bin <= best_bin)
+        {
+            ++i;
+        }
+        else
+        {
+            const uint32_t tmp = leaves[i];
+            leaves[i] = leaves[--j];
+            leaves[j] = tmp;
+        }
+    }
+    return (i == begin || i == end) ? mid : i;
+}
+
+static void build_range(build_task_t* task)
+{
+    build_context_t* context = task->context;
+    const uint32_t begin = task->begin;
+    const uint32_t end = task->end;
+    if (end - begin == 1)
+    {
+        task->result = context->leaves[begin];
+        return;
+    }
+
+    const uint32_t split = partition_sah(context, begin, end, task->depth);
+    const uint32_t index = context->internals[task->slot];
+    build_task_t left = {
+        .context = context, .begin = begin, .end = split, .slot = task->slot + 1, .depth = task->depth + 1,
+        .num_threads = task->num_threads / 2,
+    };
+    build_task_t right = {
+        .context = context, .begin = split, .end = end, .slot = task->slot + (split - begin), .depth = task->depth + 1,
+        .num_threads = task->num_threads - task->num_threads / 2,
+    };
+
+    // the halves touch disjoint leaf ranges and internal slots, so the left one can be built on another thread
+    if (task->num_threads > 1 && end - begin >= BVH_PARALLEL_MIN_LEAVES)
+    {
+        sp_thread_t thread;
+        sp_thread_create(&thread, build_thread, &left);
+        build_range(&right);
+        sp_thread_join(&thread);
+    }
+    else
+    {
+        left.num_threads = right.num_threads = 1;
+        build_range(&left);
+        build_range(&right);
+    }
+
+    sp_bvh_node_t* nodes = context->nodes;
+    sp_bvh_node_t* node = &nodes[index];
+    node->left = left.result;
+    node->right = right.result;
+    node->aabb = aabb_union(&nodes[left.result].aabb, &nodes[right.result].aabb);
+    node->height = 1 + max_height(nodes[left.result].height, nodes[right.result].height);
+    nodes[left.result].parent = index;
+    nodes[right.result].parent = index;
+    task->result = index;
+}
+
+void sp_bvh_rebuild(sp_bvh_t* bvh, uint32_t num_threads)
+{
+    if (bvh->num_leaves < 2)
+        return;
+
+    // a tree with n leaves has n - 1 internal nodes, the rebuild reuses them
+    SP_INIT_SCRATCH_ALLOCATOR(scratch);
+    uint32_t* leaves = sp_alloc(scratch, bvh->num_leaves * sizeof(uint32_t));
+    uint32_t* internals = sp_alloc(scratch, (bvh->num_leaves - 1) * sizeof(uint32_t));
+    uint32_t num_leaves = 0;
+    uint32_t num_internals = 0;
+    const uint32_t num_nodes = (uint32_t)sp_array_size(bvh->nodes_arr);
+    for (uint32_t i = 0; i < num_nodes; ++i)
+    {
+        if (bvh->nodes_arr[i].height == 0)
+            leaves[num_leaves++] = i;
+        else if (bvh->nodes_arr[i].height > 0)
+            internals[num_internals++] = i;
+    }
+
+    build_context_t context = { .nodes = bvh->nodes_arr, .leaves = leaves, .internals = internals };
+    build_task_t task = { .context = &context, .begin = 0, .end = num_leaves, .num_threads = num_threads ? num_threads : 1 };
+    build_range(&task);
+    bvh->root = task.result;
+    bvh->nodes_arr[bvh->root].parent = SP_BVH_NULL;
+    SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+}
+
+void sp_bvh_build(sp_bvh_t* bvh, const sp_aabb_t* aabbs, uint32_t count, uint32_t num_threads)
+{
+    sp_bvh_clear(bvh);
+    if (!count)
+        return;
+
+    // leaves first, then the internal nodes the rebuild links them with
+    sp_array_ensure(bvh->nodes_arr, 2 * count - 1, bvh->allocator);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const uint32_t leaf = allocate_node(bvh);
+        bvh->nodes_arr[leaf].aabb = fatten(bvh, &aabbs[i]);
+        bvh->nodes_arr[leaf].user_data = i;
+    }
+    for (uint32_t i = 1; i < count; ++i)
+        bvh->nodes_arr[allocate_node(bvh)].height = 1;
+    bvh->num_leaves = count;
+    bvh->root = 0;
+    sp_bvh_rebuild(bvh, num_threads);
+}
+
+// entries a depth first traversal needs. Every pop pushes at most the two children one level down, so the stack
+// never holds more than one pending node per level plus the two just pushed
+static uint32_t traversal_stack_size(const sp_bvh_t* bvh)
+{
+    return (uint32_t)bvh->nodes_arr[bvh->root].height + 2;
+}
+
+// local when the tree is shallow enough for it, otherwise on the scratch arena
+static void* traversal_stack(void* local, uint32_t stack_size, uint64_t element_size, sp_allocator_i* scratch)
+{
+    return stack_size <= BVH_STACK_SIZE ? local : sp_alloc(scratch, stack_size * element_size);
+}
+
+void sp_bvh_query_aabb(const sp_bvh_t* bvh, const sp_aabb_t* aabb, uint32_t** result_arr, sp_allocator_i* allocator)
+{
+    if (bvh->root == SP_BVH_NULL)
+        return;
+    uint32_t local_stack[BVH_STACK_SIZE];
+    const uint32_t stack_size = traversal_stack_size(bvh);
+    SP_INIT_SCRATCH_ALLOCATOR(scratch);
+    uint32_t* stack = traversal_stack(local_stack, stack_size, sizeof(uint32_t), scratch);
+    uint32_t size = 0;
+    stack[size++] = bvh->root;
+    while (size)
+    {
+        const sp_bvh_node_t* node = &bvh->nodes_arr[stack[--size]];
+        if (!aabb_overlap(&node->aabb, aabb))
+            continue;
+        if (is_leaf(node))
+        {
+            sp_array_push(*result_arr, node->user_data, allocator);
+        }
+        else
+        {
+            assert(size + 2 <= stack_size);
+            stack[size++] = node->left;
+            stack[size++] = node->right;
+        }
+    }
+    SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+}
+
+static float aabb_distance_squared(const sp_aabb_t* aabb, sp_vec3_t p)
+{
+    const float dx = fmaxf(fmaxf(aabb->min.x - p.x, 0.0f), p.x - aabb->max.x);
+    const float dy = fmaxf(fmaxf(aabb->min.y - p.y, 0.0f), p.y - aabb->max.y);
+    const float dz = fmaxf(fmaxf(aabb->min.z - p.z, 0.0f), p.z - aabb->max.z);
+    return dx * dx + dy * dy + dz * dz;
+}
+
+void sp_bvh_query_sphere(const sp_bvh_t* bvh, sp_vec3_t center, float radius, uint32_t** result_arr, sp_allocator_i* allocator)
+{
+    if (bvh->root == SP_BVH_NULL)
+        return;
+    const float radius_squared = radius * radius;
+    uint32_t local_stack[BVH_STACK_SIZE];
+    const uint32_t stack_size = traversal_stack_size(bvh);
+    SP_INIT_SCRATCH_ALLOCATOR(scratch);
+    uint32_t* stack = traversal_stack(local_stack, stack_size, sizeof(uint32_t), scratch);
+    uint32_t size = 0;
+    stack[size++] = bvh->root;
+    while (size)
+    {
+        const sp_bvh_node_t* node = &bvh->nodes_arr[stack[--size]];
+        if (aabb_distance_squared(&node->aabb, center) > radius_squared)
+            continue;
+        if (is_leaf(node))
+        {
+            sp_array_push(*result_arr, node->user_data, allocator);
+        }
+        else
+        {
+            assert(size + 2 <= stack_size);
+            stack[size++] = node->left;
+            stack[size++] = node->right;
+        }
+    }
+    SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+}
+
+enum frustum_test
+{
+    FRUSTUM_OUTSIDE,
+    FRUSTUM_INTERSECTS,
+    FRUSTUM_INSIDE,
+};
+
+static enum frustum_test frustum_test_aabb(const sp_vec4_t planes[6], const sp_aabb_t* aabb)
+{
+    enum frustum_test result = FRUSTUM_INSIDE;
+    for (uint32_t i = 0; i < 6; ++i)
+    {
+        const sp_vec4_t p = planes[i];
+        // the corner furthest along the plane normal, and the one furthest against it
+        const float d_max = p.x * (p.x >= 0 ? aabb->max.x : aabb->min.x) + p.y * (p.y >= 0 ? aabb->max.y : aabb->min.y) + p.z * (p.z >= 0 ? aabb->max.z : aabb->min.z) + p.w;
+        if (d_max < 0)
+            return FRUSTUM_OUTSIDE;
+        const float d_min = p.x * (p.x >= 0 ? aabb->min.x : aabb->max.x) + p.y * (p.y >= 0 ? aabb->min.y : aabb->max.y) + p.z * (p.z >= 0 ? aabb->min.z : aabb->max.z) + p.w;
+        if (d_min < 0)
+            result = FRUSTUM_INTERSECTS;
+    }
+    return result;
+}
+
+void sp_bvh_query_frustum(const sp_bvh_t* bvh, const sp_vec4_t planes[6], uint32_t** result_arr, sp_allocator_i* allocator)
+{
+    if (bvh->root == SP_BVH_NULL)
+        return;
+    // the second half of each entry flags subtrees already known to be inside, they skip the plane tests
+    uint32_t local_stack[BVH_STACK_SIZE];
+    bool local_inside[BVH_STACK_SIZE];
+    const uint32_t stack_size = traversal_stack_size(bvh);
+    SP_INIT_SCRATCH_ALLOCATOR(scratch);
+    uint32_t* stack = traversal_stack(local_stack, stack_size, sizeof(uint32_t), scratch);
+    bool* inside = traversal_stack(local_inside, stack_size, sizeof(bool), scratch);
+    uint32_t size = 0;
+    stack[size] = bvh->root;
+    inside[size++] = false;
+    while (size)
+    {
+        --size;
+        const sp_bvh_node_t* node = &bvh->nodes_arr[stack[size]];
+        bool node_inside = inside[size];
+        if (!node_inside)
+        {
+            const enum frustum_test test = frustum_test_aabb(planes, &node->aabb);
+            if (test == FRUSTUM_OUTSIDE)
+                continue;
+            node_inside = test == FRUSTUM_INSIDE;
+        }
+        if (is_leaf(node))
+        {
+            sp_array_push(*result_arr, node->user_data, allocator);
+        }
+        else
+        {
+            assert(size + 2 <= stack_size);
+            stack[size] = node->left;
+            inside[size++] = node_inside;
+            stack[size] = node->right;
+            inside[size++] = node_inside;
+        }
+    }
+    SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+}
+
+// distance at which the ray enters the box, INFINITY when it misses it within max_distance
+static float ray_aabb(const sp_aabb_t* aabb, sp_vec3_t origin, sp_vec3_t inv_direction, float max_distance)
+{
+    const float tx0 = (aabb->min.x - origin.x) * inv_direction.x;
+    const float tx1 = (aabb->max.x - origin.x) * inv_direction.x;
+    const float ty0 = (aabb->min.y - origin.y) * inv_direction.y;
+    const float ty1 = (aabb->max.y - origin.y) * inv_direction.y;
+    const float tz0 = (aabb->min.z - origin.z) * inv_direction.z;
+    const float tz1 = (aabb->max.z - origin.z) * inv_direction.z;
+    const float t_enter = fmaxf(fmaxf(fminf(tx0, tx1), fminf(ty0, ty1)), fmaxf(fminf(tz0, tz1), 0.0f));
+    const float t_exit = fminf(fminf(fmaxf(tx0, tx1), fmaxf(ty0, ty1)), fminf(fmaxf(tz0, tz1), max_distance));
+    return t_enter <= t_exit ? t_enter : INFINITY;
+}
+
+bool sp_bvh_ray_cast(const sp_bvh_t* bvh, sp_vec3_t origin, sp_vec3_t direction, float max_distance, sp_bvh_ray_hit_f hit_f, void* user, sp_bvh_ray_hit_t* hit)
+{
+    if (bvh->root == SP_BVH_NULL)
+        return false;
+
+    const sp_vec3_t inv_direction = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+    bool found = false;
+    uint32_t local_stack[BVH_STACK_SIZE];
+    float local_distances[BVH_STACK_SIZE];
+    const uint32_t stack_size = traversal_stack_size(bvh);
+    SP_INIT_SCRATCH_ALLOCATOR(scratch);
+    uint32_t* stack = traversal_stack(local_stack, stack_size, sizeof(uint32_t), scratch);
+    float* distances = traversal_stack(local_distances, stack_size, sizeof(float), scratch);
+    uint32_t size = 0;
+    const float d_root = ray_aabb(&bvh->nodes_arr[bvh->root].aabb, origin, inv_direction, max_distance);
+    if (d_root != INFINITY)
+    {
+        stack[size] = bvh->root;
+        distances[size++] = d_root;
+    }
+    while (size)
+    {
+        --size;
+        // the entry was pushed before a closer hit shortened the ray
+        if (distances[size] > max_distance)
+            continue;
+        const sp_bvh_node_t* node = &bvh->nodes_arr[stack[size]];
+        if (is_leaf(node))
+        {
+            const float distance = hit_f ? hit_f(user, node->user_data, origin, direction, max_distance) : distances[size];
+            if (distance >= 0.0f && distance <= max_distance)
+            {
+                max_distance = distance;
+                hit->user_data = node->user_data;
+                hit->distance = distance;
+                found = true;
+            }
+            continue;
+        }
+
+        const float d_left = ray_aabb(&bvh->nodes_arr[node->left].aabb, origin, inv_direction, max_distance);
+        const float d_right = ray_aabb(&bvh->nodes_arr[node->right].aabb, origin, inv_direction, max_distance);
+        assert(size + 2 <= stack_size);
+        // the nearer child is popped first, missed children are not pushed
+        const bool left_first = d_left <= d_right;
+        const uint32_t near_child = left_first ? node->left : node->right;
+        const uint32_t far_child = left_first ? node->right : node->left;
+        const float d_near = left_first ? d_left : d_right;
+        const float d_far = left_first ? d_right : d_left;
+        if (d_far != INFINITY)
+        {
+            stack[size] = far_child;
+            distances[size++] = d_far;
+        }
+        if (d_near != INFINITY)
+        {
+            stack[size] = near_child;
+            distances[size++] = d_near;
+        }
+    }
+    SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+    return found;
+}
+
+sp_aabb_t sp_aabb_transform(const sp_aabb_t* aabb, const sp_mat4x4_t* m)
+{
+    // row vectors - the center is transformed as a point, the extents by the absolute rotation and scale
+    const sp_vec3_t c = centroid(aabb);
+    const sp_vec3_t e = { (aabb->max.x - aabb->min.x) * 0.5f, (aabb->max.y - aabb->min.y) * 0.5f, (aabb->max.z - aabb->min.z) * 0.5f };
+    const sp_vec3_t wc = {
+        c.x * m->xx + c.y * m->yx + c.z * m->zx + m->wx,
+        c.x * m->xy + c.y * m->yy + c.z * m->zy + m->wy,
+        c.x * m->xz + c.y * m->yz + c.z * m->zz + m->wz,
+    };
+    const sp_vec3_t we = {
+        e.x * fabsf(m->xx) + e.y * fabsf(m->yx) + e.z * fabsf(m->zx),
+        e.x * fabsf(m->xy) + e.y * fabsf(m->yy) + e.z * fabsf(m->zy),
+        e.x * fabsf(m->xz) + e.y * fabsf(m->yz) + e.z * fabsf(m->zz),
+    };
+    return (sp_aabb_t){
+        .min = { wc.x - we.x, wc.y - we.y, wc.z - we.z },
+        .max = { wc.x + we.x, wc.y + we.y, wc.z + we.z },
+    };
+}
+
+void sp_frustum_planes_from_matrix(sp_vec4_t planes[6], const sp_mat4x4_t* m)
+{
+    // clip = p * m, so the clip coordinates are dot products with the matrix columns
+    const sp_vec4_t cx = { m->xx, m->yx, m->zx, m->wx };
+    const sp_vec4_t cy = { m->xy, m->yy, m->zy, m->wy };
+    const sp_vec4_t cz = { m->xz, m->yz, m->zz, m->wz };
+    const sp_vec4_t cw = { m->xw, m->yw, m->zw, m->ww };
+    // -w <= x <= w, -w <= y <= w, -w <= z <= w. With a 0..1 depth range the near plane is z >= 0, the wider
+    // plane only keeps a few objects right in front of the camera
+    planes[0] = (sp_vec4_t){ cw.x + cx.x, cw.y + cx.y, cw.z + cx.z, cw.w + cx.w };
+    planes[1] = (sp_vec4_t){ cw.x - cx.x, cw.y - cx.y, cw.z - cx.z, cw.w - cx.w };
+    planes[2] = (sp_vec4_t){ cw.x + cy.x, cw.y + cy.y, cw.z + cy.z, cw.w + cy.w };
+    planes[3] = (sp_vec4_t){ cw.x - cy.x, cw.y - cy.y, cw.z - cy.z, cw.w - cy.w };
+    planes[4] = (sp_vec4_t){ cw.x + cz.x, cw.y + cz.y, cw.z + cz.z, cw.w + cz.w };
+    planes[5] = (sp_vec4_t){ cw.x - cz.x, cw.y - cz.y, cw.z - cz.z, cw.w - cz.w };
+}
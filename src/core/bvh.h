@@ -0,0 +1,86 @@
+#pragma once
+
+#include "sapphire_types.h"
+
+typedef struct sp_allocator_i sp_allocator_i;
+
+// Dynamic bounding volume hierarchy over axis aligned boxes.
+//
+// Every object is a leaf holding its box, enlarged by the tree margin, and a user value. Leaves are inserted
+// next to the sibling that grows the tree surface area the least and the tree is kept balanced with AVL
+// rotations as insertions and removals walk back to the root. Moving an object only touches the tree when
+// the new box leaves the enlarged one. sp_bvh_rebuild() rebuilds all internal nodes with a binned SAH split,
+// after bulk insertions, optionally on several threads.
+//
+// Leaf ids are node indices and stay valid until the leaf is removed, rebuilding the tree keeps them.
+
+#define SP_BVH_NULL UINT32_MAX
+
+typedef struct sp_aabb_t
+{
+    sp_vec3_t min;
+    sp_vec3_t max;
+} sp_aabb_t;
+
+typedef struct sp_bvh_node_t
+{
+    sp_aabb_t aabb;
+    // next free node for nodes on the free list
+    uint32_t parent;
+    uint32_t left;
+    uint32_t right;
+    // leaves only
+    uint32_t user_data;
+    // 0 for leaves, -1 for free nodes
+    int32_t height;
+} sp_bvh_node_t;
+
+typedef struct sp_bvh_t
+{
+    sp_allocator_i* allocator;
+    sp_bvh_node_t* nodes_arr;
+    uint32_t root;
+    uint32_t free_list;
+    uint32_t num_leaves;
+    // leaf boxes are enlarged by margin on every side
+    float margin;
+} sp_bvh_t;
+
+void sp_bvh_init(sp_bvh_t* bvh, float margin, sp_allocator_i* allocator);
+void sp_bvh_destroy(sp_bvh_t* bvh);
+void sp_bvh_clear(sp_bvh_t* bvh);
+
+// returns the leaf id
+uint32_t sp_bvh_insert(sp_bvh_t* bvh, const sp_aabb_t* aabb, uint32_t user_data);
+void sp_bvh_remove(sp_bvh_t* bvh, uint32_t leaf);
+// returns true when the leaf had to be reinserted
+bool sp_bvh_move(sp_bvh_t* bvh, uint32_t leaf, const sp_aabb_t* aabb);
+
+// rebuilds the internal nodes top down with a binned SAH split. Subtrees of large ranges are built on up to
+// num_threads threads
+void sp_bvh_rebuild(sp_bvh_t* bvh, uint32_t num_threads);
+// clears the tree and builds it over count boxes, leaf user data is the box index
+void sp_bvh_build(sp_bvh_t* bvh, const sp_aabb_t* aabbs, uint32_t count, uint32_t num_threads);
+
+// queries push the user data of the overlapping leaves to the result array
+void sp_bvh_query_aabb(const sp_bvh_t* bvh, const sp_aabb_t* aabb, uint32_t** result_arr, sp_allocator_i* allocator);
+void sp_bvh_query_sphere(const sp_bvh_t* bvh, sp_vec3_t center, float radius, uint32_t** result_arr, sp_allocator_i* allocator);
+// planes point inside the frustum, a point p is inside a plane when dot(plane.xyz, p) + plane.w >= 0
+void sp_bvh_query_frustum(const sp_bvh_t* bvh, const sp_vec4_t planes[6], uint32_t** result_arr, sp_allocator_i* allocator);
+
+// narrow phase of a ray cast, returns the distance of the hit along the ray or a negative value on a miss
+typedef float (*sp_bvh_ray_hit_f)(void* user, uint32_t user_data, sp_vec3_t origin, sp_vec3_t direction, float max_distance);
+
+typedef struct sp_bvh_ray_hit_t
+{
+    uint32_t user_data;
+    float distance;
+} sp_bvh_ray_hit_t;
+
+// closest hit along the ray, children are visited front to back. Without hit_f the leaf boxes are hit
+bool sp_bvh_ray_cast(const sp_bvh_t* bvh, sp_vec3_t origin, sp_vec3_t direction, float max_distance, sp_bvh_ray_hit_f hit_f, void* user, sp_bvh_ray_hit_t* hit);
+
+// box of an object space box transformed by a world matrix
+sp_aabb_t sp_aabb_transform(const sp_aabb_t* aabb, const sp_mat4x4_t* world);
+// frustum planes of a (row vector) view projection matrix, for 0..1 and -1..1 depth ranges
+void sp_frustum_planes_from_matrix(sp_vec4_t planes[6], const sp_mat4x4_t* view_projection);
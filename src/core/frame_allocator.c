@@ -0,0 +1,255 @@
+#include "frame_allocator.h"
+
+#include <memory.h>
+
+#if defined(_MSC_VER)
+#define SP_THREAD_LOCAL __declspec(thread)
+#else
+#define SP_THREAD_LOCAL _Thread_local
+#endif
+
+#define ARENA_ALIGNMENT 16
+#define DEFAULT_SCRATCH_ARENA_SIZE (1024 * 1024)
+
+// allocation that didn't fit in the arena, freed when the arena is reset or rewound past it
+typedef struct overflow_block_t
+{
+    struct overflow_block_t* next;
+    uint64_t size;
+} overflow_block_t;
+
+typedef struct sp_arena_t
+{
+    // first member, the allocator callbacks cast it back to the arena
+    sp_allocator_i allocator;
+
+    uint8_t* base;
+    uint64_t capacity;
+    uint64_t used;
+    // offset of the last allocation, it can grow in place
+    uint64_t last_offset;
+    uint64_t high_water;
+
+    overflow_block_t* overflow;
+    uint64_t overflow_bytes;
+    uint32_t overflow_count;
+} sp_arena_t;
+
+static uint64_t align_size(uint64_t size)
+{
+    return (size + ARENA_ALIGNMENT - 1) & ~(uint64_t)(ARENA_ALIGNMENT - 1);
+}
+
+static void update_high_water(sp_arena_t* arena)
+{
+    const uint64_t total = arena->used + arena->overflow_bytes;
+    if (total > arena->high_water)
+        arena->high_water = total;
+}
+
+static void* arena_alloc(sp_arena_t* arena, uint64_t size)
+{
+    const uint64_t aligned_size = align_size(size);
+    if (arena->used + aligned_size <= arena->capacity)
+    {
+        arena->last_offset = arena->used;
+        arena->used += aligned_size;
+        update_high_water(arena);
+        return arena->base + arena->last_offset;
+    }
+
+    // the header keeps the block 16 bytes aligned
+    const uint64_t block_size = align_size(sizeof(overflow_block_t)) + aligned_size;
+    overflow_block_t* block = sp_alloc(sp_allocator_api->system_allocator, block_size);
+    block->next = arena->overflow;
+    block->size = block_size;
+    arena->overflow = block;
+    arena->overflow_bytes += block_size;
+    ++arena->overflow_count;
+    update_high_water(arena);
+    return (uint8_t*)block + align_size(sizeof(overflow_block_t));
+}
+
+static void arena_free_overflow(sp_arena_t* arena, void* until)
+{
+    while (arena->overflow && arena->overflow != until)
+    {
+        overflow_block_t* block = arena->overflow;
+        arena->overflow = block->next;
+        arena->overflow_bytes -= block->size;
+        --arena->overflow_count;
+        sp_free(sp_allocator_api->system_allocator, block, block->size);
+    }
+}
+
+static void arena_rewind(sp_arena_t* arena, uint64_t used, void* overflow)
+{
+    arena_free_overflow(arena, overflow);
+    arena->used = used;
+    arena->last_offset = used;
+}
+
+static void* arena_realloc(sp_allocator_i* a, void* ptr, uint64_t old_size, uint64_t new_size, const char* file, uint32_t line)
+{
+    (void)file;
+    (void)line;
+    sp_arena_t* arena = (sp_arena_t*)a;
+    if (!new_size)
+        return NULL;
+    if (ptr && new_size <= old_size)
+        return ptr;
+
+    // grow the last allocation in place, the common case for an sp_array being filled
+    if (ptr && ptr == arena->base + arena->last_offset && arena->last_offset + align_size(new_size) <= arena->capacity)
+    {
+        arena->used = arena->last_offset + align_size(new_size);
+        update_high_water(arena);
+        return ptr;
+    }
+
+    void* new_ptr = arena_alloc(arena, new_size);
+    if (ptr)
+        memcpy(new_ptr, ptr, old_size);
+    return new_ptr;
+}
+
+static void arena_init(sp_arena_t* arena, uint64_t capacity)
+{
+    memset(arena, 0, sizeof(sp_arena_t));
+    arena->allocator.realloc = arena_realloc;
+    arena->capacity = align_size(capacity);
+    arena->base = sp_alloc(sp_allocator_api->system_allocator, arena->capacity);
+}
+
+static void arena_destroy(sp_arena_t* arena)
+{
+    arena_free_overflow(arena, NULL);
+    if (arena->base)
+        sp_free(sp_allocator_api->system_allocator, arena->base, arena->capacity);
+    memset(arena, 0, sizeof(sp_arena_t));
+}
+
+static sp_arena_stats_t arena_stats(const sp_arena_t* arena)
+{
+    return (sp_arena_stats_t){
+        .capacity = arena->capacity,
+        .used = arena->used,
+        .high_water = arena->high_water,
+        .overflow_bytes = arena->overflow_bytes,
+        .overflow_count = arena->overflow_count,
+    };
+}
+
+static struct
+{
+    sp_arena_t frames[SP_FRAME_ALLOCATOR_MAX_FRAMES];
+    uint32_t num_frames;
+    uint32_t current_frame;
+    uint64_t scratch_arena_size;
+} g_frame_allocator = { .scratch_arena_size = DEFAULT_SCRATCH_ARENA_SIZE };
+
+static SP_THREAD_LOCAL sp_arena_t g_scratch_arena;
+
+static void init(uint32_t num_frames, uint64_t frame_arena_size, uint64_t scratch_arena_size)
+{
+    g_frame_allocator.num_frames = num_frames < SP_FRAME_ALLOCATOR_MAX_FRAMES ? (num_frames ? num_frames : 1) : SP_FRAME_ALLOCATOR_MAX_FRAMES;
+    g_frame_allocator.current_frame = 0;
+    g_frame_allocator.scratch_arena_size = scratch_arena_size;
+    for (uint32_t i = 0; i < g_frame_allocator.num_frames; ++i)
+        arena_init(&g_frame_allocator.frames[i], frame_arena_size);
+}
+
+static void shutdown(void)
+{
+    for (uint32_t i = 0; i < g_frame_allocator.num_frames; ++i)
+        arena_destroy(&g_frame_allocator.frames[i]);
+    g_frame_allocator.num_frames = 0;
+    arena_destroy(&g_scratch_arena);
+}
+
+static void begin_frame(uint64_t frame_index)
+{
+    if (!g_frame_allocator.num_frames)
+        return;
+    g_frame_allocator.current_frame = (uint32_t)(frame_index % g_frame_allocator.num_frames);
+    sp_arena_t* arena = &g_frame_allocator.frames[g_frame_allocator.current_frame];
+    arena_rewind(arena, 0, NULL);
+}
+
+static void* frame_alloc(uint64_t size)
+{
+    return arena_alloc(&g_frame_allocator.frames[g_frame_allocator.current_frame], size);
+}
+
+static sp_allocator_i* frame_allocator(void)
+{
+    return &g_frame_allocator.frames[g_frame_allocator.current_frame].allocator;
+}
+
+// high water and overflow over all frame arenas
+static sp_arena_stats_t frame_stats(void)
+{
+    sp_arena_stats_t stats = arena_stats(&g_frame_allocator.frames[g_frame_allocator.current_frame]);
+    for (uint32_t i = 0; i < g_frame_allocator.num_frames; ++i)
+    {
+        const sp_arena_t* arena = &g_frame_allocator.frames[i];
+        if (arena->high_water > stats.high_water)
+            stats.high_water = arena->high_water;
+    }
+    return stats;
+}
+
+static sp_arena_t* thread_scratch_arena(void)
+{
+    if (!g_scratch_arena.base)
+        arena_init(&g_scratch_arena, g_frame_allocator.scratch_arena_size);
+    return &g_scratch_arena;
+}
+
+static sp_scratch_mark_t scratch_begin(void)
+{
+    sp_arena_t* arena = thread_scratch_arena();
+    return (sp_scratch_mark_t){ .used = arena->used, .overflow = arena->overflow };
+}
+
+static void* scratch_alloc(uint64_t size)
+{
+    return arena_alloc(thread_scratch_arena(), size);
+}
+
+static void scratch_end(sp_scratch_mark_t mark)
+{
+    arena_rewind(&g_scratch_arena, mark.used, mark.overflow);
+}
+
+static sp_allocator_i* scratch_allocator(void)
+{
+    return &thread_scratch_arena()->allocator;
+}
+
+static sp_arena_stats_t scratch_stats(void)
+{
+    return arena_stats(&g_scratch_arena);
+}
+
+static void scratch_release(void)
+{
+    arena_destroy(&g_scratch_arena);
+}
+
+static struct sp_frame_allocator_api frame_allocator_api = {
+    .init = init,
+    .shutdown = shutdown,
+    .begin_frame = begin_frame,
+    .frame_alloc = frame_alloc,
+    .frame_allocator = frame_allocator,
+    .frame_stats = frame_stats,
+    .scratch_begin = scratch_begin,
+    .scratch_alloc = scratch_alloc,
+    .scratch_end = scratch_end,
+    .scratch_allocator = scratch_allocator,
+    .scratch_stats = scratch_stats,
+    .scratch_release = scratch_release,
+};
+
+struct sp_frame_allocator_api* sp_frame_allocator_api = &frame_allocator_api;
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "sapphire_types.h"
+#include "allocator.h"
+
+// Linear allocators for short lived data.
+//
+// Frame arenas: one arena per frame in flight, begin_frame() resets the arena of the new frame, so data
+// allocated in a frame stays valid while the GPU may still read it, for SP_FRAME_ALLOCATOR_MAX_FRAMES - 1
+// more frames at most. Frame allocations are for the main thread only.
+//
+// Scratch arenas: one per thread, created on first use. Allocations are released in stack order by
+// rewinding to a mark, typically with SP_INIT_SCRATCH_ALLOCATOR / SP_SHUTDOWN_SCRATCH_ALLOCATOR around a
+// function body. Threads that used their scratch arena call scratch_release() before exiting.
+//
+// When an arena is full, allocations fall back to the system allocator and are released with the arena, the
+// overflow is reported in the stats so the arena sizes can be tuned.
+
+#define SP_FRAME_ALLOCATOR_MAX_FRAMES 3
+
+typedef struct sp_arena_stats_t
+{
+    uint64_t capacity;
+    uint64_t used;
+    // highest used + overflow_bytes since init
+    uint64_t high_water;
+    // currently allocated outside of the arena
+    uint64_t overflow_bytes;
+    uint32_t overflow_count;
+} sp_arena_stats_t;
+
+typedef struct sp_scratch_mark_t
+{
+    uint64_t used;
+    void* overflow;
+} sp_scratch_mark_t;
+
+struct sp_frame_allocator_api
+{
+    // num_frames arenas of frame_arena_size bytes, num_frames <= SP_FRAME_ALLOCATOR_MAX_FRAMES. Scratch arenas
+    // created after this call are scratch_arena_size bytes
+    void (*init)(uint32_t num_frames, uint64_t frame_arena_size, uint64_t scratch_arena_size);
+    void (*shutdown)(void);
+
+    // resets the arena of frame_index % num_frames, call once at the start of every frame
+    void (*begin_frame)(uint64_t frame_index);
+
+    // 16 bytes aligned, valid until the arena of this frame is reset again
+    void* (*frame_alloc)(uint64_t size);
+    // allocator view of the current frame arena, free is a no-op and growing the last allocation is done
+    // in place, so sp_array works on it
+    sp_allocator_i* (*frame_allocator)(void);
+    sp_arena_stats_t (*frame_stats)(void);
+
+    sp_scratch_mark_t (*scratch_begin)(void);
+    void* (*scratch_alloc)(uint64_t size);
+    // frees everything allocated on this thread's scratch arena since the mark
+    void (*scratch_end)(sp_scratch_mark_t mark);
+    sp_allocator_i* (*scratch_allocator)(void);
+    // stats of the calling thread's scratch arena
+    sp_arena_stats_t (*scratch_stats)(void);
+    // frees the calling thread's scratch arena
+    void (*scratch_release)(void);
+};
+
+extern struct sp_frame_allocator_api* sp_frame_allocator_api;
+
+// declares an allocator a on the thread's scratch arena, everything allocated from it is freed by
+// SP_SHUTDOWN_SCRATCH_ALLOCATOR(a)
+#define SP_INIT_SCRATCH_ALLOCATOR(a)                                                \
+    const sp_scratch_mark_t a##_scratch_mark = sp_frame_allocator_api->scratch_begin(); \
+    sp_allocator_i* a = sp_frame_allocator_api->scratch_allocator()
+
+#define SP_SHUTDOWN_SCRATCH_ALLOCATOR(a) sp_frame_allocator_api->scratch_end(a##_scratch_mark)
@@ -0,0 +1,94 @@
+#include "handle_table.h"
+#include "allocator.h"
+#include "array.h"
+
+#include <assert.h>
+#include <memory.h>
+
+#define FREE_LIST_END UINT32_MAX
+
+void sp_handle_table_init(sp_handle_table_t* table, sp_allocator_i* allocator)
+{
+    memset(table, 0, sizeof(sp_handle_table_t));
+    table->allocator = allocator;
+    table->free_list_head = FREE_LIST_END;
+}
+
+void sp_handle_table_destroy(sp_handle_table_t* table)
+{
+    sp_array_free(table->generations_arr, table->allocator);
+    sp_array_free(table->slot_to_dense_arr, table->allocator);
+    sp_array_free(table->dense_to_slot_arr, table->allocator);
+    table->free_list_head = FREE_LIST_END;
+    table->num_alive = 0;
+}
+
+uint32_t sp_handle_table_alloc(sp_handle_table_t* table)
+{
+    uint32_t slot;
+    if (table->free_list_head != FREE_LIST_END)
+    {
+        slot = table->free_list_head;
+        table->free_list_head = table->slot_to_dense_arr[slot];
+    }
+    else
+    {
+        slot = (uint32_t)sp_array_size(table->generations_arr);
+        assert(slot <= SP_HANDLE_INDEX_MASK);
+        uint32_t first_generation = 1;
+        sp_array_push(table->generations_arr, first_generation, table->allocator);
+        sp_array_push(table->slot_to_dense_arr, slot, table->allocator);
+    }
+
+    uint32_t dense_index = table->num_alive++;
+    table->slot_to_dense_arr[slot] = dense_index;
+    if (dense_index < sp_array_size(table->dense_to_slot_arr))
+    {
+        table->dense_to_slot_arr[dense_index] = slot;
+    }
+    else
+    {
+        sp_array_push(table->dense_to_slot_arr, slot, table->allocator);
+    }
+
+    return (table->generations_arr[slot] << SP_HANDLE_INDEX_BITS) | slot;
+}
+
+uint32_t sp_handle_table_release(sp_handle_table_t* table, uint32_t handle)
+{
+    assert(sp_handle_table_valid(table, handle));
+
+    uint32_t slot = sp_handle_index(handle);
+    uint32_t dense_index = table->slot_to_dense_arr[slot];
+
+    // move the last dense element into the hole
+    uint32_t last = --table->num_alive;
+    if (dense_index != last)
+    {
+        uint32_t moved_slot = table->dense_to_slot_arr[last];
+        table->dense_to_slot_arr[dense_index] = moved_slot;
+        table->slot_to_dense_arr[moved_slot] = dense_index;
+    }
+
+    // bump the generation, skipping 0 so a zeroed handle never validates
+    uint32_t generation = (table->generations_arr[slot] + 1) & SP_HANDLE_GENERATION_MASK;
+    table->generations_arr[slot] = generation ? generation : 1;
+
+    table->slot_to_dense_arr[slot] = table->free_list_head;
+    table->free_list_head = slot;
+
+    return dense_index;
+}
+
+bool sp_handle_table_valid(const sp_handle_table_t* table, uint32_t handle)
+{
+    uint32_t slot = sp_handle_index(handle);
+    return handle != SP_INVALID_HANDLE && slot < sp_array_size(table->generations_arr) &&
+        table->generations_arr[slot] == sp_handle_generation(handle);
+}
+
+uint32_t sp_handle_table_dense_index(const sp_handle_table_t* table, uint32_t handle)
+{
+    assert(sp_handle_table_valid(table, handle) && "stale or invalid handle");
+    return table->slot_to_dense_arr[sp_handle_index(handle)];
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "sapphire_types.h"
+
+typedef struct sp_allocator_i sp_allocator_i;
+
+// Generational handle table (slot map).
+//
+// A handle holds a slot index in the lower SP_HANDLE_INDEX_BITS bits and the slot generation in the
+// upper bits. Releasing a slot bumps its generation, so a handle that outlived its object no longer
+// validates once the slot is reused. Generations start at 1, which makes a zeroed handle invalid.
+//
+// Live objects are also kept in a dense array: the owner of the table stores its per-object data
+// packed by dense index and iterates `0 .. num_alive` every frame. When a handle is released the last
+// dense element is moved into the hole, the owner mirrors that move in its own arrays.
+
+#define SP_HANDLE_INDEX_BITS 20
+#define SP_HANDLE_INDEX_MASK ((1u << SP_HANDLE_INDEX_BITS) - 1)
+#define SP_HANDLE_GENERATION_MASK ((1u << (32 - SP_HANDLE_INDEX_BITS)) - 1)
+#define SP_INVALID_HANDLE 0u
+
+typedef struct sp_handle_table_t
+{
+    sp_allocator_i* allocator;
+    // per slot - current generation
+    uint32_t* generations_arr;
+    // per slot - dense index of a live slot, next free slot of a released one
+    uint32_t* slot_to_dense_arr;
+    // dense index -> slot
+    uint32_t* dense_to_slot_arr;
+    // head of the released slots list, UINT32_MAX when empty
+    uint32_t free_list_head;
+    uint32_t num_alive;
+} sp_handle_table_t;
+
+static inline uint32_t sp_handle_index(uint32_t handle)
+{
+    return handle & SP_HANDLE_INDEX_MASK;
+}
+
+static inline uint32_t sp_handle_generation(uint32_t handle)
+{
+    return handle >> SP_HANDLE_INDEX_BITS;
+}
+
+void sp_handle_table_init(sp_handle_table_t* table, sp_allocator_i* allocator);
+void sp_handle_table_destroy(sp_handle_table_t* table);
+
+// returns a new handle, its dense index is `num_alive - 1`
+uint32_t sp_handle_table_alloc(sp_handle_table_t* table);
+
+// releases the handle and returns the dense index it occupied. The object at dense index `num_alive`
+// (the value after the call) was moved to the returned index, unless they are equal.
+uint32_t sp_handle_table_release(sp_handle_table_t* table, uint32_t handle);
+
+bool sp_handle_table_valid(const sp_handle_table_t* table, uint32_t handle);
+
+// dense index of a live handle. Stale handles assert in debug builds.
+uint32_t sp_handle_table_dense_index(const sp_handle_table_t* table, uint32_t handle);
+
+// handle of the object at a dense index - used when iterating the dense array
+static inline uint32_t sp_handle_table_handle_at(const sp_handle_table_t* table, uint32_t dense_index)
+{
+    uint32_t slot = table->dense_to_slot_arr[dense_index];
+    return (table->generations_arr[slot] << SP_HANDLE_INDEX_BITS) | slot;
+}
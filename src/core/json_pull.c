@@ -0,0 +1,460 @@
+#include "json_pull.h"
+
+#include "json.h"
+#include "sprintf.h"
+
+#include <memory.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+enum json_frame_type
+{
+    JSON_FRAME_OBJECT,
+    JSON_FRAME_ARRAY,
+    // closed by the end of the text instead of '}'
+    JSON_FRAME_IMPLICIT_OBJECT,
+};
+
+enum json_frame_state
+{
+    // just opened, a member or the closing bracket
+    JSON_FRAME_EXPECT_FIRST,
+    // a key was read, its value comes next
+    JSON_FRAME_EXPECT_VALUE,
+    // after a value, a comma or the closing bracket
+    JSON_FRAME_EXPECT_NEXT,
+};
+
+#define JSON_END_OF_STREAM -1
+
+static void init(sp_json_pull_t* pull, sp_json_read_f read, void* stream, uint32_t flags)
+{
+    memset(pull, 0, offsetof(sp_json_pull_t, string));
+    pull->read = read;
+    pull->stream = stream;
+    pull->flags = flags;
+    pull->line = 1;
+    pull->column = 1;
+}
+
+// records the first error, returns false
+static bool fail(sp_json_pull_t* pull, const char* message)
+{
+    if (!pull->failed)
+    {
+        sp_sprintf_api->print(pull->error, sizeof(pull->error), "%u:%u: %s", pull->line, pull->column, message);
+        pull->failed = true;
+    }
+    return false;
+}
+
+static inline sp_json_token_t failed_token(void)
+{
+    return (sp_json_token_t){ .type = SP_JSON_TOKEN_ERROR };
+}
+
+static sp_json_token_t error_token(sp_json_pull_t* pull, const char* message)
+{
+    fail(pull, message);
+    return failed_token();
+}
+
+static inline int peek_char(sp_json_pull_t* pull)
+{
+    if (pull->pos == pull->size)
+    {
+        if (pull->end_of_stream)
+            return JSON_END_OF_STREAM;
+        pull->size = pull->read(pull->stream, pull->buffer, sizeof(pull->buffer));
+        pull->pos = 0;
+        if (!pull->size)
+        {
+            pull->end_of_stream = true;
+            return JSON_END_OF_STREAM;
+        }
+    }
+    return (uint8_t)pull->buffer[pull->pos];
+}
+
+static inline void advance(sp_json_pull_t* pull)
+{
+    if (pull->buffer[pull->pos++] == '\n')
+    {
+        ++pull->line;
+        pull->column = 1;
+    }
+    else
+    {
+        ++pull->column;
+    }
+}
+
+static inline bool is_delimiter(int c)
+{
+    switch (c)
+    {
+    case JSON_END_OF_STREAM:
+    case ' ':
+    case '\t':
+    case '\n':
+    case '\r':
+    case '{':
+    case '}':
+    case '[':
+    case ']':
+    case ':':
+    case ',':
+    case '=':
+    case '"':
+    case '/':
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool skip_whitespace_and_comments(sp_json_pull_t* pull)
+{
+    while (true)
+    {
+        int c = peek_char(pull);
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+        {
+            advance(pull);
+            continue;
+        }
+        if (c != '/')
+            return true;
+
+        if (!(pull->flags & SP_JSON_PARSE_EXT_ALLOW_COMMENTS))
+            return fail(pull, "comments are not allowed");
+        advance(pull);
+        c = peek_char(pull);
+        if (c == '/')
+        {
+            while (c != '\n' && c != JSON_END_OF_STREAM)
+            {
+                advance(pull);
+                c = peek_char(pull);
+            }
+        }
+        else if (c == '*')
+        {
+            advance(pull);
+            bool star = false;
+            while (true)
+            {
+                c = peek_char(pull);
+                if (c == JSON_END_OF_STREAM)
+                    return fail(pull, "unterminated comment");
+                advance(pull);
+                if (star && c == '/')
+                    break;
+                star = c == '*';
+            }
+        }
+        else
+        {
+            return fail(pull, "unexpected '/'");
+        }
+    }
+}
+
+static bool append_string(sp_json_pull_t* pull, uint32_t* length, char c)
+{
+    if (*length + 1 >= SP_JSON_PULL_MAX_STRING)
+        return fail(pull, "string too long");
+    pull->string[(*length)++] = c;
+    return true;
+}
+
+static bool read_hex4(sp_json_pull_t* pull, uint32_t* value)
+{
+    *value = 0;
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        const int c = peek_char(pull);
+        uint32_t digit;
+        if (c >= '0' && c <= '9')
+            digit = (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f')
+            digit = (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            digit = (uint32_t)(c - 'A' + 10);
+        else
+            return fail(pull, "invalid unicode escape");
+        advance(pull);
+        *value = (*value << 4) | digit;
+    }
+    return true;
+}
+
+static bool append_utf8(sp_json_pull_t* pull, uint32_t* length, uint32_t codepoint)
+{
+    if (codepoint < 0x80)
+        return append_string(pull, length, (char)codepoint);
+    if (codepoint < 0x800)
+        return append_string(pull, length, (char)(0xC0 | (codepoint >> 6))) && append_string(pull, length, (char)(0x80 | (codepoint & 0x3F)));
+    if (codepoint < 0x10000)
+        return append_string(pull, length, (char)(0xE0 | (codepoint >> 12))) && append_string(pull, length, (char)(0x80 | ((codepoint >> 6) & 0x3F))) && append_string(pull, length, (char)(0x80 | (codepoint & 0x3F)));
+    return append_string(pull, length, (char)(0xF0 | (codepoint >> 18))) && append_string(pull, length, (char)(0x80 | ((codepoint >> 12) & 0x3F))) && append_string(pull, length, (char)(0x80 | ((codepoint >> 6) & 0x3F))) && append_string(pull, length, (char)(0x80 | (codepoint & 0x3F)));
+}
+
+// reads a quoted string into pull->string, the opening quote is the current char
+static sp_json_token_t read_string(sp_json_pull_t* pull, uint32_t type)
+{
+    uint32_t length = 0;
+    advance(pull);
+    while (true)
+    {
+        int c = peek_char(pull);
+        if (c == JSON_END_OF_STREAM)
+            return error_token(pull, "unterminated string");
+        advance(pull);
+        if (c == '"')
+            break;
+        if (c == '\\')
+        {
+            c = peek_char(pull);
+            if (c == JSON_END_OF_STREAM)
+                return error_token(pull, "unterminated string");
+            advance(pull);
+            switch (c)
+            {
+            case '"':
+            case '\\':
+            case '/':
+                break;
+            case 'b':
+                c = '\b';
+                break;
+            case 'f':
+                c = '\f';
+                break;
+            case 'n':
+                c = '\n';
+                break;
+            case 'r':
+                c = '\r';
+                break;
+            case 't':
+                c = '\t';
+                break;
+            case 'u':
+            {
+                uint32_t codepoint;
+                if (!read_hex4(pull, &codepoint))
+                    return failed_token();
+                if (codepoint >= 0xD800 && codepoint < 0xDC00)
+                {
+                    uint32_t low;
+                    if (peek_char(pull) != '\\')
+                        return error_token(pull, "invalid unicode surrogate pair");
+                    advance(pull);
+                    if (peek_char(pull) != 'u')
+                        return error_token(pull, "invalid unicode surrogate pair");
+                    advance(pull);
+                    if (!read_hex4(pull, &low) || low < 0xDC00 || low >= 0xE000)
+                        return error_token(pull, "invalid unicode surrogate pair");
+                    codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                }
+                if (!append_utf8(pull, &length, codepoint))
+                    return failed_token();
+                continue;
+            }
+            default:
+                return error_token(pull, "invalid escape sequence");
+            }
+        }
+        if (!append_string(pull, &length, (char)c))
+            return failed_token();
+    }
+
+    pull->string[length] = 0;
+    return (sp_json_token_t){ .type = type, .length = length, .string = pull->string };
+}
+
+// reads an unquoted run of chars into pull->string
+static bool read_literal(sp_json_pull_t* pull, uint32_t* length)
+{
+    *length = 0;
+    for (int c = peek_char(pull); !is_delimiter(c); c = peek_char(pull))
+    {
+        if (!append_string(pull, length, (char)c))
+            return false;
+        advance(pull);
+    }
+    pull->string[*length] = 0;
+    return true;
+}
+
+static sp_json_token_t read_value(sp_json_pull_t* pull, int c)
+{
+    if (c == '{' || c == '[')
+    {
+        if (pull->depth == SP_JSON_PULL_MAX_DEPTH)
+            return error_token(pull, "nesting too deep");
+        advance(pull);
+        pull->frame_types[pull->depth] = c == '{' ? JSON_FRAME_OBJECT : JSON_FRAME_ARRAY;
+        pull->frame_states[pull->depth] = JSON_FRAME_EXPECT_FIRST;
+        ++pull->depth;
+        return (sp_json_token_t){ .type = c == '{' ? SP_JSON_TOKEN_OBJECT_BEGIN : SP_JSON_TOKEN_ARRAY_BEGIN };
+    }
+    if (c == '"')
+        return read_string(pull, SP_JSON_TOKEN_STRING);
+    if (is_delimiter(c))
+        return error_token(pull, c == JSON_END_OF_STREAM ? "unexpected end of file, expected a value" : "expected a value");
+
+    uint32_t length;
+    if (!read_literal(pull, &length))
+        return failed_token();
+    const char* s = pull->string;
+    if (length == 4 && memcmp(s, "true", 4) == 0)
+        return (sp_json_token_t){ .type = SP_JSON_TOKEN_TRUE };
+    if (length == 5 && memcmp(s, "false", 5) == 0)
+        return (sp_json_token_t){ .type = SP_JSON_TOKEN_FALSE };
+    if (length == 4 && memcmp(s, "null", 4) == 0)
+        return (sp_json_token_t){ .type = SP_JSON_TOKEN_NULL };
+
+    char* end;
+    const double number = strtod(s, &end);
+    if (end != s + length || !((s[0] >= '0' && s[0] <= '9') || s[0] == '-'))
+        return error_token(pull, "invalid literal");
+    return (sp_json_token_t){ .type = SP_JSON_TOKEN_NUMBER, .number = number };
+}
+
+static sp_json_token_t next(sp_json_pull_t* pull)
+{
+    if (pull->failed)
+        return failed_token();
+
+    while (true)
+    {
+        if (!skip_whitespace_and_comments(pull))
+            return failed_token();
+        const int c = peek_char(pull);
+
+        if (pull->depth == 0)
+        {
+            if (pull->root_started)
+            {
+                if (c == JSON_END_OF_STREAM)
+                    return (sp_json_token_t){ .type = SP_JSON_TOKEN_END };
+                return error_token(pull, "unexpected data after the root value");
+            }
+            pull->root_started = true;
+            if ((pull->flags & SP_JSON_PARSE_EXT_IMPLICIT_ROOT_OBJECT) && c != '{')
+            {
+                pull->frame_types[0] = JSON_FRAME_IMPLICIT_OBJECT;
+                pull->frame_states[0] = JSON_FRAME_EXPECT_FIRST;
+                pull->depth = 1;
+                return (sp_json_token_t){ .type = SP_JSON_TOKEN_OBJECT_BEGIN };
+            }
+            return read_value(pull, c);
+        }
+
+        const uint32_t frame = pull->depth - 1;
+        const uint8_t frame_type = pull->frame_types[frame];
+        uint8_t* state = &pull->frame_states[frame];
+
+        if (*state == JSON_FRAME_EXPECT_VALUE)
+        {
+            *state = JSON_FRAME_EXPECT_NEXT;
+            return read_value(pull, c);
+        }
+
+        const int closing = frame_type == JSON_FRAME_OBJECT ? '}' : frame_type == JSON_FRAME_ARRAY ? ']' : JSON_END_OF_STREAM;
+        if (c == closing)
+        {
+            if (c != JSON_END_OF_STREAM)
+                advance(pull);
+            --pull->depth;
+            return (sp_json_token_t){ .type = frame_type == JSON_FRAME_ARRAY ? SP_JSON_TOKEN_ARRAY_END : SP_JSON_TOKEN_OBJECT_END };
+        }
+        if (c == JSON_END_OF_STREAM)
+            return error_token(pull, frame_type == JSON_FRAME_OBJECT ? "unexpected end of file, expected '}'" : "unexpected end of file, expected ']'");
+
+        if (*state == JSON_FRAME_EXPECT_NEXT)
+        {
+            if (c == ',')
+            {
+                advance(pull);
+                // a trailing comma is followed by the closing bracket
+                *state = JSON_FRAME_EXPECT_FIRST;
+                continue;
+            }
+            if (!(pull->flags & SP_JSON_PARSE_EXT_OPTIONAL_COMMAS))
+                return error_token(pull, frame_type == JSON_FRAME_ARRAY ? "expected ',' or ']'" : "expected ',' or '}'");
+        }
+
+        if (frame_type == JSON_FRAME_ARRAY)
+        {
+            *state = JSON_FRAME_EXPECT_NEXT;
+            return read_value(pull, c);
+        }
+
+        sp_json_token_t key;
+        if (c == '"')
+        {
+            key = read_string(pull, SP_JSON_TOKEN_KEY);
+            if (key.type == SP_JSON_TOKEN_ERROR)
+                return key;
+        }
+        else if ((pull->flags & SP_JSON_PARSE_EXT_ALLOW_UNQUOTED_KEYS) && !is_delimiter(c))
+        {
+            uint32_t length;
+            if (!read_literal(pull, &length))
+                return failed_token();
+            key = (sp_json_token_t){ .type = SP_JSON_TOKEN_KEY, .length = length, .string = pull->string };
+        }
+        else
+        {
+            return error_token(pull, "expected key");
+        }
+
+        if (!skip_whitespace_and_comments(pull))
+            return failed_token();
+        const int separator = peek_char(pull);
+        if (separator != ':' && !(separator == '=' && (pull->flags & SP_JSON_PARSE_EXT_EQUALS_FOR_COLON)))
+            return error_token(pull, "expected ':' after key");
+        advance(pull);
+        *state = JSON_FRAME_EXPECT_VALUE;
+        return key;
+    }
+}
+
+static bool skip(sp_json_pull_t* pull)
+{
+    uint32_t depth = 0;
+    do
+    {
+        const sp_json_token_t token = next(pull);
+        switch (token.type)
+        {
+        case SP_JSON_TOKEN_ERROR:
+        case SP_JSON_TOKEN_END:
+            return false;
+        case SP_JSON_TOKEN_OBJECT_BEGIN:
+        case SP_JSON_TOKEN_ARRAY_BEGIN:
+            ++depth;
+            break;
+        case SP_JSON_TOKEN_OBJECT_END:
+        case SP_JSON_TOKEN_ARRAY_END:
+            if (!depth)
+                return false;
+            --depth;
+            break;
+        default:
+            break;
+        }
+    } while (depth);
+    return true;
+}
+
+static struct sp_json_pull_api json_pull_api = {
+    .init = init,
+    .next = next,
+    .skip = skip,
+};
+
+struct sp_json_pull_api* sp_json_pull_api = &json_pull_api;
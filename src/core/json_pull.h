@@ -0,0 +1,87 @@
+#pragma once
+
+#include "sapphire_types.h"
+
+// Pull parser for JSON files too big to hold in memory, with the same SP_JSON_PARSE_EXT_* dialect as
+// sp_json_api.
+//
+// The text is read in chunks through a read callback and returned as a stream of tokens, no config is
+// built. Memory use is the sp_json_pull_t struct whatever the size of the file. With
+// SP_JSON_PARSE_EXT_IMPLICIT_ROOT_OBJECT the implicit root is reported like a regular object, so callers
+// always see OBJECT_BEGIN ... OBJECT_END around the root members.
+
+#define SP_JSON_PULL_BUFFER_SIZE 16384
+// longest key, string or literal
+#define SP_JSON_PULL_MAX_STRING 1024
+#define SP_JSON_PULL_MAX_DEPTH 64
+#define SP_JSON_PULL_ERROR_LENGTH 256
+
+enum sp_json_token_type
+{
+    SP_JSON_TOKEN_ERROR,
+    SP_JSON_TOKEN_OBJECT_BEGIN,
+    SP_JSON_TOKEN_OBJECT_END,
+    SP_JSON_TOKEN_ARRAY_BEGIN,
+    SP_JSON_TOKEN_ARRAY_END,
+    SP_JSON_TOKEN_KEY,
+    SP_JSON_TOKEN_STRING,
+    SP_JSON_TOKEN_NUMBER,
+    SP_JSON_TOKEN_TRUE,
+    SP_JSON_TOKEN_FALSE,
+    SP_JSON_TOKEN_NULL,
+    // end of the text after the root value
+    SP_JSON_TOKEN_END,
+};
+
+typedef struct sp_json_token_t
+{
+    uint32_t type;
+    // KEY and STRING, NUL terminated and valid until the next token
+    uint32_t length;
+    const char* string;
+    // NUMBER
+    double number;
+} sp_json_token_t;
+
+// fills buffer with up to size bytes, returns the number of bytes read, 0 at the end of the stream
+typedef uint32_t (*sp_json_read_f)(void* stream, char* buffer, uint32_t size);
+
+// ~17KB, allocate it rather than putting it on the stack
+typedef struct sp_json_pull_t
+{
+    sp_json_read_f read;
+    void* stream;
+    uint32_t flags;
+
+    uint32_t pos;
+    uint32_t size;
+    bool end_of_stream;
+    bool failed;
+    bool root_started;
+
+    uint32_t depth;
+    uint8_t frame_types[SP_JSON_PULL_MAX_DEPTH];
+    uint8_t frame_states[SP_JSON_PULL_MAX_DEPTH];
+
+    uint32_t line;
+    uint32_t column;
+    // set when a token of type SP_JSON_TOKEN_ERROR is returned, "line:column: message"
+    char error[SP_JSON_PULL_ERROR_LENGTH];
+
+    char string[SP_JSON_PULL_MAX_STRING];
+    char buffer[SP_JSON_PULL_BUFFER_SIZE];
+} sp_json_pull_t;
+
+struct sp_json_pull_api
+{
+    void (*init)(sp_json_pull_t* pull, sp_json_read_f read, void* stream, uint32_t flags);
+
+    // once an ERROR or END token was returned every following call returns it again
+    sp_json_token_t (*next)(sp_json_pull_t* pull);
+
+    // skips the next value including everything nested in it, typically the value of an unknown key.
+    // Returns false on errors
+    bool (*skip)(sp_json_pull_t* pull);
+};
+
+extern struct sp_json_pull_api* sp_json_pull_api;
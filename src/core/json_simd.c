@@ -0,0 +1,790 @@
+#include "json_simd.h"
+
+#include "allocator.h"
+#include "array.h"
+#include "config.h"
+#include "json.h"
+#include "sprintf.h"
+#include "temp_allocator.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define JSON_SIMD_SSE2 1
+#include <emmintrin.h>
+#else
+#define JSON_SIMD_SSE2 0
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define JSON_BLOCK_SIZE 64
+#define JSON_MAX_DEPTH 1024
+
+enum json_char_class
+{
+    JSON_CLASS_WS = 1,
+    // { } [ ] : , =
+    JSON_CLASS_OP = 2,
+    JSON_CLASS_QUOTE = 4,
+    JSON_CLASS_BACKSLASH = 8,
+    JSON_CLASS_SLASH = 16,
+};
+
+// characters that end a literal or an unquoted key
+#define JSON_CLASS_DELIMITER (JSON_CLASS_WS | JSON_CLASS_OP | JSON_CLASS_QUOTE | JSON_CLASS_SLASH)
+
+static const uint8_t char_class[256] = {
+    [' '] = JSON_CLASS_WS,
+    ['\t'] = JSON_CLASS_WS,
+    ['\n'] = JSON_CLASS_WS,
+    ['\r'] = JSON_CLASS_WS,
+    ['{'] = JSON_CLASS_OP,
+    ['}'] = JSON_CLASS_OP,
+    ['['] = JSON_CLASS_OP,
+    [']'] = JSON_CLASS_OP,
+    [':'] = JSON_CLASS_OP,
+    [','] = JSON_CLASS_OP,
+    ['='] = JSON_CLASS_OP,
+    ['"'] = JSON_CLASS_QUOTE,
+    ['\\'] = JSON_CLASS_BACKSLASH,
+    ['/'] = JSON_CLASS_SLASH,
+};
+
+static inline uint32_t trailing_zeros(uint64_t x)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (uint32_t)index;
+#else
+    return (uint32_t)__builtin_ctzll(x);
+#endif
+}
+
+// bit i is the xor of bits 0..i, turns quote positions into an inside string mask
+static inline uint64_t prefix_xor(uint64_t x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// one bit per byte of a 64 byte block
+typedef struct json_block_t
+{
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t slash;
+    uint64_t op;
+    uint64_t ws;
+} json_block_t;
+
+#if JSON_SIMD_SSE2
+
+static inline uint64_t eq_mask(__m128i v, char c)
+{
+    return (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+
+static void classify_block(const uint8_t* p, json_block_t* block)
+{
+    memset(block, 0, sizeof(json_block_t));
+    const __m128i lower_case = _mm_set1_epi8(0x20);
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(p + i * 16));
+        const uint32_t shift = i * 16;
+        // '[' and ']' are '{' and '}' with bit 5 cleared
+        const __m128i v_lower = _mm_or_si128(v, lower_case);
+        const uint64_t op = eq_mask(v_lower, '{') | eq_mask(v_lower, '}') | eq_mask(v, ':') | eq_mask(v, ',') | eq_mask(v, '=');
+        const uint64_t ws = eq_mask(v, ' ') | eq_mask(v, '\n') | eq_mask(v, '\t') | eq_mask(v, '\r');
+
+        block->quote |= eq_mask(v, '"') << shift;
+        block->backslash |= eq_mask(v, '\\') << shift;
+        block->slash |= eq_mask(v, '/') << shift;
+        block->op |= op << shift;
+        block->ws |= ws << shift;
+    }
+}
+
+#else
+
+static void classify_block(const uint8_t* p, json_block_t* block)
+{
+    memset(block, 0, sizeof(json_block_t));
+    for (uint32_t i = 0; i < JSON_BLOCK_SIZE; ++i)
+    {
+        const uint8_t c = char_class[p[i]];
+        const uint64_t bit = 1ull << i;
+        block->quote |= (c & JSON_CLASS_QUOTE) ? bit : 0;
+        block->backslash |= (c & JSON_CLASS_BACKSLASH) ? bit : 0;
+        block->slash |= (c & JSON_CLASS_SLASH) ? bit : 0;
+        block->op |= (c & JSON_CLASS_OP) ? bit : 0;
+        block->ws |= (c & JSON_CLASS_WS) ? bit : 0;
+    }
+}
+
+#endif
+
+// characters preceded by an odd run of backslashes, prev_escaped carries a run crossing the block end
+static inline uint64_t find_escaped(uint64_t backslash, uint64_t* prev_escaped)
+{
+    const uint64_t even_bits = 0x5555555555555555ull;
+    backslash &= ~*prev_escaped;
+    const uint64_t follows_escape = (backslash << 1) | *prev_escaped;
+    const uint64_t odd_sequence_starts = backslash & ~even_bits & ~follows_escape;
+    const uint64_t sequences_starting_on_even_bits = odd_sequence_starts + backslash;
+    *prev_escaped = sequences_starting_on_even_bits < odd_sequence_starts ? 1 : 0;
+    const uint64_t invert_mask = sequences_starting_on_even_bits << 1;
+    return (even_bits ^ invert_mask) & follows_escape;
+}
+
+enum json_comment
+{
+    JSON_COMMENT_NONE,
+    JSON_COMMENT_LINE,
+    JSON_COMMENT_BLOCK,
+};
+
+typedef struct json_parser_t
+{
+    const char* text;
+    uint32_t len;
+    uint32_t flags;
+    sp_config_i* config;
+    char* error;
+    sp_allocator_i* allocator;
+
+    // positions of the structural characters, string starts and literal starts
+    uint32_t* indices_arr;
+    uint32_t num_indices;
+    uint32_t cur;
+
+    // decoded strings and keys, keys stay on it while their value is parsed
+    char* scratch_arr;
+    uint32_t depth;
+} json_parser_t;
+
+// carried from one block to the next
+typedef struct json_stage1_state_t
+{
+    uint64_t prev_escaped;
+    uint64_t prev_in_string;
+    uint64_t prev_literal;
+    uint32_t comment;
+    bool pending_slash;
+    bool pending_star;
+} json_stage1_state_t;
+
+static bool parse_error(json_parser_t* p, uint32_t pos, const char* message)
+{
+    uint32_t line = 1;
+    uint32_t line_start = 0;
+    for (uint32_t i = 0; i < pos && i < p->len; ++i)
+    {
+        if (p->text[i] == '\n')
+        {
+            ++line;
+            line_start = i + 1;
+        }
+    }
+    sp_sprintf_api->print(p->error, SP_JSON_SIMD_ERROR_LENGTH, "%u:%u: %s", line, pos - line_start + 1, message);
+    return false;
+}
+
+static inline void push_indices(json_parser_t* p, uint32_t base, uint64_t bits)
+{
+    while (bits)
+    {
+        p->indices_arr[p->num_indices++] = base + trailing_zeros(bits);
+        bits &= bits - 1;
+    }
+}
+
+// byte at a time fallback for blocks with comments, also reports stray slashes
+static bool stage1_block_scalar(json_parser_t* p, const uint8_t* block, uint32_t base, json_stage1_state_t* s)
+{
+    bool in_string = s->prev_in_string != 0;
+    bool escaped = s->prev_escaped != 0;
+    bool prev_literal = s->prev_literal != 0;
+    uint64_t structurals = 0;
+
+    for (uint32_t i = 0; i < JSON_BLOCK_SIZE; ++i)
+    {
+        const uint8_t c = block[i];
+        if (s->comment == JSON_COMMENT_LINE)
+        {
+            if (c == '\n')
+                s->comment = JSON_COMMENT_NONE;
+            continue;
+        }
+        if (s->comment == JSON_COMMENT_BLOCK)
+        {
+            if (s->pending_star && c == '/')
+                s->comment = JSON_COMMENT_NONE;
+            s->pending_star = c == '*';
+            continue;
+        }
+        if (s->pending_slash)
+        {
+            s->pending_slash = false;
+            if (c == '/')
+            {
+                s->comment = JSON_COMMENT_LINE;
+                continue;
+            }
+            if (c == '*')
+            {
+                s->comment = JSON_COMMENT_BLOCK;
+                s->pending_star = false;
+                continue;
+            }
+            return parse_error(p, base + i - 1, "unexpected '/'");
+        }
+        if (in_string)
+        {
+            if (escaped)
+                escaped = false;
+            else if (c == '\\')
+                escaped = true;
+            else if (c == '"')
+                in_string = false;
+            continue;
+        }
+
+        const uint8_t cls = char_class[c];
+        if (cls & JSON_CLASS_SLASH)
+        {
+            if (!(p->flags & SP_JSON_PARSE_EXT_ALLOW_COMMENTS))
+                return parse_error(p, base + i, "comments are not allowed");
+            s->pending_slash = true;
+            prev_literal = false;
+        }
+        else if (cls & (JSON_CLASS_QUOTE | JSON_CLASS_OP))
+        {
+            in_string = cls & JSON_CLASS_QUOTE;
+            structurals |= 1ull << i;
+            prev_literal = false;
+        }
+        else if (cls & JSON_CLASS_WS)
+        {
+            prev_literal = false;
+        }
+        else
+        {
+            if (!prev_literal)
+                structurals |= 1ull << i;
+            prev_literal = true;
+        }
+    }
+
+    s->prev_in_string = in_string ? ~0ull : 0;
+    s->prev_escaped = escaped ? 1 : 0;
+    s->prev_literal = prev_literal ? 1 : 0;
+    push_indices(p, base, structurals);
+    return true;
+}
+
+static bool stage1_block(json_parser_t* p, const uint8_t* block, uint32_t base, json_stage1_state_t* s)
+{
+    json_block_t b;
+    classify_block(block, &b);
+
+    uint64_t prev_escaped = s->prev_escaped;
+    const uint64_t escaped = find_escaped(b.backslash, &prev_escaped);
+    const uint64_t quotes = b.quote & ~escaped;
+    // covers the opening quote and the string, not the closing quote
+    const uint64_t in_string = prefix_xor(quotes) ^ s->prev_in_string;
+
+    // the in string mask is only right up to the first comment, let the scalar path redo the block
+    if (s->comment != JSON_COMMENT_NONE || s->pending_slash || (b.slash & ~in_string))
+        return stage1_block_scalar(p, block, base, s);
+
+    const uint64_t string_starts = quotes & in_string;
+    const uint64_t literal = ~(b.ws | b.op | b.quote | in_string);
+    const uint64_t literal_starts = literal & ~((literal << 1) | s->prev_literal);
+
+    s->prev_escaped = prev_escaped;
+    s->prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+    s->prev_literal = literal >> 63;
+
+    push_indices(p, base, (b.op & ~in_string) | string_starts | literal_starts);
+    return true;
+}
+
+static bool stage1(json_parser_t* p)
+{
+    json_stage1_state_t s = { 0 };
+    uint32_t pos = 0;
+    for (; pos + JSON_BLOCK_SIZE <= p->len; pos += JSON_BLOCK_SIZE)
+    {
+        sp_array_ensure(p->indices_arr, p->num_indices + JSON_BLOCK_SIZE, p->allocator);
+        if (!stage1_block(p, (const uint8_t*)p->text + pos, pos, &s))
+            return false;
+    }
+
+    // the tail is padded with whitespace
+    uint8_t tail[JSON_BLOCK_SIZE];
+    memset(tail, ' ', sizeof(tail));
+    memcpy(tail, p->text + pos, p->len - pos);
+    sp_array_ensure(p->indices_arr, p->num_indices + JSON_BLOCK_SIZE, p->allocator);
+    if (!stage1_block(p, tail, pos, &s))
+        return false;
+
+    if (s.prev_in_string)
+        return parse_error(p, p->len, "unterminated string");
+    if (s.comment == JSON_COMMENT_BLOCK)
+        return parse_error(p, p->len, "unterminated comment");
+    if (s.pending_slash)
+        return parse_error(p, p->len - 1, "unexpected '/'");
+    return true;
+}
+
+static inline char peek(const json_parser_t* p)
+{
+    return p->cur < p->num_indices ? p->text[p->indices_arr[p->cur]] : 0;
+}
+
+static inline uint32_t peek_pos(const json_parser_t* p)
+{
+    return p->cur < p->num_indices ? p->indices_arr[p->cur] : p->len;
+}
+
+static inline uint32_t literal_end(const json_parser_t* p, uint32_t pos)
+{
+    while (pos < p->len && !(char_class[(uint8_t)p->text[pos]] & JSON_CLASS_DELIMITER))
+    {
+        ++pos;
+    }
+    return pos;
+}
+
+static void scratch_append(json_parser_t* p, const char* s, uint32_t len)
+{
+    if (!len)
+        return;
+    const uint64_t size = sp_array_size(p->scratch_arr);
+    sp_array_ensure(p->scratch_arr, size + len, p->allocator);
+    memcpy(p->scratch_arr + size, s, len);
+    sp_array_header(p->scratch_arr)->size = size + len;
+}
+
+static void scratch_append_utf8(json_parser_t* p, uint32_t codepoint)
+{
+    char utf8[4];
+    uint32_t len;
+    if (codepoint < 0x80)
+    {
+        utf8[0] = (char)codepoint;
+        len = 1;
+    }
+    else if (codepoint < 0x800)
+    {
+        utf8[0] = (char)(0xC0 | (codepoint >> 6));
+        utf8[1] = (char)(0x80 | (codepoint & 0x3F));
+        len = 2;
+    }
+    else if (codepoint < 0x10000)
+    {
+        utf8[0] = (char)(0xE0 | (codepoint >> 12));
+        utf8[1] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        utf8[2] = (char)(0x80 | (codepoint & 0x3F));
+        len = 3;
+    }
+    else
+    {
+        utf8[0] = (char)(0xF0 | (codepoint >> 18));
+        utf8[1] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+        utf8[2] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        utf8[3] = (char)(0x80 | (codepoint & 0x3F));
+        len = 4;
+    }
+    scratch_append(p, utf8, len);
+}
+
+static bool parse_hex4(const char* s, uint32_t* value)
+{
+    *value = 0;
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        const char c = s[i];
+        uint32_t digit;
+        if (c >= '0' && c <= '9')
+            digit = (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f')
+            digit = (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            digit = (uint32_t)(c - 'A' + 10);
+        else
+            return false;
+        *value = (*value << 4) | digit;
+    }
+    return true;
+}
+
+// decodes the string starting at the quote at pos to the scratch buffer, offset is where it starts
+static bool parse_string(json_parser_t* p, uint32_t pos, uint32_t* offset)
+{
+    const char* s = p->text + pos + 1;
+    const char* end = p->text + p->len;
+    *offset = (uint32_t)sp_array_size(p->scratch_arr);
+
+    while (true)
+    {
+        const char* run = s;
+        while (s < end && *s != '"' && *s != '\\')
+        {
+            ++s;
+        }
+        scratch_append(p, run, (uint32_t)(s - run));
+        if (s >= end)
+            return parse_error(p, pos, "unterminated string");
+        if (*s == '"')
+            break;
+
+        const uint32_t escape_pos = (uint32_t)(s - p->text);
+        if (s + 1 >= end)
+            return parse_error(p, escape_pos, "unterminated string");
+        char c = s[1];
+        s += 2;
+        switch (c)
+        {
+        case '"':
+        case '\\':
+        case '/':
+            break;
+        case 'b':
+            c = '\b';
+            break;
+        case 'f':
+            c = '\f';
+            break;
+        case 'n':
+            c = '\n';
+            break;
+        case 'r':
+            c = '\r';
+            break;
+        case 't':
+            c = '\t';
+            break;
+        case 'u':
+        {
+            uint32_t codepoint;
+            if (end - s < 4 || !parse_hex4(s, &codepoint))
+                return parse_error(p, escape_pos, "invalid unicode escape");
+            s += 4;
+            // surrogate pair
+            if (codepoint >= 0xD800 && codepoint < 0xDC00)
+            {
+                uint32_t low;
+                if (end - s < 6 || s[0] != '\\' || s[1] != 'u' || !parse_hex4(s + 2, &low) || low < 0xDC00 || low >= 0xE000)
+                    return parse_error(p, escape_pos, "invalid unicode surrogate pair");
+                s += 6;
+                codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+            }
+            scratch_append_utf8(p, codepoint);
+            continue;
+        }
+        default:
+            return parse_error(p, escape_pos, "invalid escape sequence");
+        }
+        scratch_append(p, &c, 1);
+    }
+
+    scratch_append(p, "", 1);
+    return true;
+}
+
+static const double pow10_table[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// numbers with up to 19 digits and small exponents are exact as mantissa * 10^exponent in doubles,
+// everything else goes through strtod
+static bool parse_number(json_parser_t* p, uint32_t pos, uint32_t end_pos, double* value)
+{
+    const char* s = p->text + pos;
+    const char* end = p->text + end_pos;
+    bool negative = false;
+    if (*s == '-')
+    {
+        negative = true;
+        ++s;
+    }
+
+    uint64_t mantissa = 0;
+    int32_t num_digits = 0;
+    int32_t exponent = 0;
+    const char* digits = s;
+    for (; s < end && *s >= '0' && *s <= '9'; ++s, ++num_digits)
+    {
+        mantissa = mantissa * 10 + (uint64_t)(*s - '0');
+    }
+    if (s == digits)
+        return false;
+
+    if (s < end && *s == '.')
+    {
+        const char* fraction = ++s;
+        for (; s < end && *s >= '0' && *s <= '9'; ++s, ++num_digits)
+        {
+            mantissa = mantissa * 10 + (uint64_t)(*s - '0');
+        }
+        if (s == fraction)
+            return false;
+        exponent -= (int32_t)(s - fraction);
+    }
+
+    if (s < end && (*s == 'e' || *s == 'E'))
+    {
+        ++s;
+        bool negative_exponent = false;
+        if (s < end && (*s == '-' || *s == '+'))
+            negative_exponent = *s++ == '-';
+        const char* exponent_digits = s;
+        int32_t e = 0;
+        for (; s < end && *s >= '0' && *s <= '9'; ++s)
+        {
+            if (e < 100000)
+                e = e * 10 + (*s - '0');
+        }
+        if (s == exponent_digits)
+            return false;
+        exponent += negative_exponent ? -e : e;
+    }
+
+    if (s != end)
+        return false;
+
+    if (num_digits <= 19 && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22)
+    {
+        double d = (double)mantissa;
+        d = exponent < 0 ? d / pow10_table[-exponent] : d * pow10_table[exponent];
+        *value = negative ? -d : d;
+        return true;
+    }
+
+    const uint32_t offset = (uint32_t)sp_array_size(p->scratch_arr);
+    scratch_append(p, p->text + pos, end_pos - pos);
+    scratch_append(p, "", 1);
+    *value = strtod(p->scratch_arr + offset, NULL);
+    sp_array_header(p->scratch_arr)->size = offset;
+    return true;
+}
+
+static bool parse_value(json_parser_t* p, sp_config_item_t* item);
+
+static inline bool is_key_value_separator(const json_parser_t* p, char c)
+{
+    return c == ':' || (c == '=' && (p->flags & SP_JSON_PARSE_EXT_EQUALS_FOR_COLON));
+}
+
+// parses members up to and including closing, closing is 0 for the implicit root object
+static bool parse_object_members(json_parser_t* p, sp_config_item_t object, char closing)
+{
+    sp_config_i* config = p->config;
+    while (true)
+    {
+        if (p->cur >= p->num_indices)
+        {
+            if (!closing)
+                return true;
+            return parse_error(p, p->len, "unexpected end of file, expected '}'");
+        }
+
+        const uint32_t pos = peek_pos(p);
+        const char c = p->text[pos];
+        if (c == closing)
+        {
+            ++p->cur;
+            return true;
+        }
+
+        uint32_t key_offset;
+        if (c == '"')
+        {
+            ++p->cur;
+            if (!parse_string(p, pos, &key_offset))
+                return false;
+        }
+        else if ((p->flags & SP_JSON_PARSE_EXT_ALLOW_UNQUOTED_KEYS) && !(char_class[(uint8_t)c] & JSON_CLASS_DELIMITER))
+        {
+            ++p->cur;
+            key_offset = (uint32_t)sp_array_size(p->scratch_arr);
+            scratch_append(p, p->text + pos, literal_end(p, pos) - pos);
+            scratch_append(p, "", 1);
+        }
+        else
+        {
+            return parse_error(p, pos, "expected key");
+        }
+
+        if (!is_key_value_separator(p, peek(p)))
+            return parse_error(p, peek_pos(p), "expected ':' after key");
+        ++p->cur;
+
+        sp_config_item_t value;
+        if (!parse_value(p, &value))
+            return false;
+        config->object_set(config->inst, object, p->scratch_arr + key_offset, value);
+        sp_array_header(p->scratch_arr)->size = key_offset;
+
+        const char next = peek(p);
+        if (next == ',')
+            ++p->cur;
+        else if (next && next != closing && !(p->flags & SP_JSON_PARSE_EXT_OPTIONAL_COMMAS))
+            return parse_error(p, peek_pos(p), "expected ',' or '}'");
+    }
+}
+
+static bool parse_array_elements(json_parser_t* p, sp_config_item_t array)
+{
+    sp_config_i* config = p->config;
+    while (true)
+    {
+        const char c = peek(p);
+        if (!c)
+            return parse_error(p, p->len, "unexpected end of file, expected ']'");
+        if (c == ']')
+        {
+            ++p->cur;
+            return true;
+        }
+
+        sp_config_item_t value;
+        if (!parse_value(p, &value))
+            return false;
+        config->array_push(config->inst, array, value);
+
+        const char next = peek(p);
+        if (next == ',')
+            ++p->cur;
+        else if (next && next != ']' && !(p->flags & SP_JSON_PARSE_EXT_OPTIONAL_COMMAS))
+            return parse_error(p, peek_pos(p), "expected ',' or ']'");
+    }
+}
+
+static bool parse_value(json_parser_t* p, sp_config_item_t* item)
+{
+    sp_config_i* config = p->config;
+    const uint32_t pos = peek_pos(p);
+    if (pos == p->len)
+        return parse_error(p, pos, "unexpected end of file, expected a value");
+
+    const char c = p->text[pos];
+    ++p->cur;
+    switch (c)
+    {
+    case '{':
+    case '[':
+    {
+        if (++p->depth > JSON_MAX_DEPTH)
+            return parse_error(p, pos, "nesting too deep");
+        bool res;
+        if (c == '{')
+        {
+            *item = config->add_object(config->inst);
+            res = parse_object_members(p, *item, '}');
+        }
+        else
+        {
+            *item = config->add_array(config->inst);
+            res = parse_array_elements(p, *item);
+        }
+        --p->depth;
+        return res;
+    }
+    case '"':
+    {
+        uint32_t offset;
+        if (!parse_string(p, pos, &offset))
+            return false;
+        *item = config->add_string(config->inst, p->scratch_arr + offset);
+        sp_array_header(p->scratch_arr)->size = offset;
+        return true;
+    }
+    default:
+        break;
+    }
+
+    if (char_class[(uint8_t)c] & JSON_CLASS_DELIMITER)
+        return parse_error(p, pos, "expected a value");
+
+    const uint32_t end = literal_end(p, pos);
+    const uint32_t len = end - pos;
+    if (len == 4 && memcmp(p->text + pos, "true", 4) == 0)
+    {
+        *item = sp_config_api->c_true;
+        return true;
+    }
+    if (len == 5 && memcmp(p->text + pos, "false", 5) == 0)
+    {
+        *item = sp_config_api->c_false;
+        return true;
+    }
+    if (len == 4 && memcmp(p->text + pos, "null", 4) == 0)
+    {
+        *item = sp_config_api->c_null;
+        return true;
+    }
+
+    double number;
+    if (!parse_number(p, pos, end, &number))
+        return parse_error(p, pos, "invalid literal");
+    *item = config->add_number(config->inst, number);
+    return true;
+}
+
+static bool parse(const char* s, sp_config_i* config, uint32_t flags, char* error)
+{
+    SP_INIT_TEMP_ALLOCATOR_WITH_ADAPTER(ta, a);
+
+    json_parser_t p = {
+        .text = s,
+        .len = (uint32_t)strlen(s),
+        .flags = flags,
+        .config = config,
+        .error = error,
+        .allocator = a,
+    };
+
+    bool res = stage1(&p);
+    if (res)
+    {
+        sp_config_item_t root;
+        if ((flags & SP_JSON_PARSE_EXT_IMPLICIT_ROOT_OBJECT) && peek(&p) != '{')
+        {
+            root = config->add_object(config->inst);
+            res = parse_object_members(&p, root, 0);
+        }
+        else
+        {
+            res = parse_value(&p, &root);
+            if (res && p.cur < p.num_indices)
+                res = parse_error(&p, peek_pos(&p), "unexpected data after the root value");
+        }
+        if (res)
+            config->set_root(config->inst, root);
+    }
+
+    sp_array_free(p.indices_arr, a);
+    sp_array_free(p.scratch_arr, a);
+    SP_SHUTDOWN_TEMP_ALLOCATOR(ta);
+    return res;
+}
+
+static struct sp_json_simd_api json_simd_api = {
+    .parse = parse,
+};
+
+struct sp_json_simd_api* sp_json_simd_api = &json_simd_api;
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "sapphire_types.h"
+
+typedef struct sp_config_i sp_config_i;
+
+// Two stage JSON parser, a drop in replacement for sp_json_api->parse on large files.
+//
+// Stage one classifies the text 64 bytes at a time with SIMD compares (quotes, escapes, brackets and
+// separators, whitespace) and builds an index of the structural characters, string starts and literal
+// starts outside of strings. Stage two walks that index and builds the config. Blocks holding comments
+// fall back to a scalar state machine, so the SP_JSON_PARSE_EXT_* dialect flags all keep working.
+
+// error must hold at least SP_JSON_SIMD_ERROR_LENGTH chars
+#define SP_JSON_SIMD_ERROR_LENGTH 256
+
+struct sp_json_simd_api
+{
+    // parses s into config using the SP_JSON_PARSE_EXT_* flags of json.h. On failure returns false and
+    // writes "line:column: message" to error
+    bool (*parse)(const char* s, sp_config_i* config, uint32_t flags, char* error);
+};
+
+extern struct sp_json_simd_api* sp_json_simd_api;
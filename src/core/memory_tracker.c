@@ -0,0 +1,266 @@
+#include "memory_tracker.h"
+#include "thread.h"
+#include "os.h"
+#include "sprintf.h"
+
+#include <memory.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <execinfo.h>
+#endif
+
+#define HEADER_ALIGNMENT 16
+
+typedef struct allocation_header_t
+{
+    struct allocation_header_t* prev;
+    struct allocation_header_t* next;
+    uint64_t size;
+    const char* file;
+    uint32_t line;
+    uint32_t num_frames;
+    // SP_MEMORY_TRACKER_MAX_FRAMES entries when the allocator captures stacks
+    void* frames[];
+} allocation_header_t;
+
+typedef struct tracked_allocator_t
+{
+    // first member, the allocator callbacks cast it back to the tracked allocator
+    sp_allocator_i allocator;
+    sp_allocator_i* parent;
+    uint32_t flags;
+    // offset from the header to the user memory, keeps the user memory aligned
+    uint32_t header_size;
+
+    sp_mutex_t mutex;
+    allocation_header_t* live;
+    sp_memory_scope_stats_t stats;
+} tracked_allocator_t;
+
+static struct
+{
+    tracked_allocator_t scopes[SP_MEMORY_TRACKER_MAX_SCOPES];
+    uint32_t num_scopes;
+} g_tracker;
+
+static uint32_t capture_stack(void** frames, uint32_t max_frames)
+{
+#if defined(_WIN32)
+    // skips capture_stack and tracked_realloc
+    return RtlCaptureStackBackTrace(2, max_frames, frames, NULL);
+#else
+    const int num_frames = backtrace(frames, (int)max_frames);
+    return num_frames > 0 ? (uint32_t)num_frames : 0;
+#endif
+}
+
+static void* tracked_realloc(sp_allocator_i* a, void* ptr, uint64_t old_size, uint64_t new_size, const char* file, uint32_t line)
+{
+    (void)old_size;
+    tracked_allocator_t* t = (tracked_allocator_t*)a;
+    allocation_header_t* header = ptr ? (allocation_header_t*)((uint8_t*)ptr - t->header_size) : NULL;
+
+    // the header holds the real size, the caller's old size isn't trusted
+    const uint64_t block_old_size = header ? header->size + t->header_size : 0;
+    if (header)
+    {
+        sp_mutex_lock(&t->mutex);
+        if (header->prev)
+            header->prev->next = header->next;
+        else
+            t->live = header->next;
+        if (header->next)
+            header->next->prev = header->prev;
+        t->stats.live_bytes -= header->size;
+        --t->stats.live_allocations;
+        sp_mutex_unlock(&t->mutex);
+    }
+
+    const uint64_t block_new_size = new_size ? new_size + t->header_size : 0;
+    header = t->parent->realloc(t->parent, header, block_old_size, block_new_size, file, line);
+    if (!new_size)
+        return NULL;
+
+    header->size = new_size;
+    header->file = file;
+    header->line = line;
+    header->num_frames = (t->flags & SP_MEMORY_TRACKER_CAPTURE_STACKS) ? capture_stack(header->frames, SP_MEMORY_TRACKER_MAX_FRAMES) : 0;
+
+    sp_mutex_lock(&t->mutex);
+    header->prev = NULL;
+    header->next = t->live;
+    if (t->live)
+        t->live->prev = header;
+    t->live = header;
+    t->stats.live_bytes += new_size;
+    ++t->stats.live_allocations;
+    if (!ptr)
+        ++t->stats.total_allocations;
+    if (t->stats.live_bytes > t->stats.peak_bytes)
+        t->stats.peak_bytes = t->stats.live_bytes;
+    sp_mutex_unlock(&t->mutex);
+
+    return (uint8_t*)header + t->header_size;
+}
+
+static sp_allocator_i* create_allocator(sp_allocator_i* parent, const char* name, uint32_t flags)
+{
+    if (g_tracker.num_scopes == SP_MEMORY_TRACKER_MAX_SCOPES)
+        return parent;
+
+    tracked_allocator_t* t = &g_tracker.scopes[g_tracker.num_scopes++];
+    memset(t, 0, sizeof(tracked_allocator_t));
+    t->allocator.realloc = tracked_realloc;
+    t->parent = parent;
+    t->flags = flags;
+    uint64_t header_size = sizeof(allocation_header_t);
+    if (flags & SP_MEMORY_TRACKER_CAPTURE_STACKS)
+        header_size += SP_MEMORY_TRACKER_MAX_FRAMES * sizeof(void*);
+    t->header_size = (uint32_t)((header_size + HEADER_ALIGNMENT - 1) & ~(uint64_t)(HEADER_ALIGNMENT - 1));
+    sp_mutex_init(&t->mutex);
+    sp_sprintf_api->print(t->stats.name, sizeof(t->stats.name), "%s", name);
+    return &t->allocator;
+}
+
+static void destroy_allocator(sp_allocator_i* allocator)
+{
+    for (uint32_t i = 0; i < g_tracker.num_scopes; ++i)
+    {
+        if (&g_tracker.scopes[i].allocator == allocator)
+            g_tracker.scopes[i].stats.destroyed = true;
+    }
+}
+
+static uint32_t scopes(sp_memory_scope_stats_t* stats, uint32_t max_scopes)
+{
+    for (uint32_t i = 0; i < g_tracker.num_scopes && i < max_scopes; ++i)
+    {
+        tracked_allocator_t* t = &g_tracker.scopes[i];
+        sp_mutex_lock(&t->mutex);
+        stats[i] = t->stats;
+        sp_mutex_unlock(&t->mutex);
+    }
+    return g_tracker.num_scopes;
+}
+
+typedef struct json_writer_t
+{
+    struct sp_os_file_io_api* io;
+    sp_file_o file;
+    bool valid;
+} json_writer_t;
+
+static void write_text(json_writer_t* writer, const char* text)
+{
+    const uint64_t length = strlen(text);
+    if (length && !writer->io->write(writer->file, text, length))
+        writer->valid = false;
+}
+
+// file names from __FILE__ have backslashes on Windows
+static void write_json_string(json_writer_t* writer, const char* s)
+{
+    char buffer[512];
+    uint32_t length = 0;
+    buffer[length++] = '"';
+    for (; s && *s && length < sizeof(buffer) - 3; ++s)
+    {
+        if (*s == '"' || *s == '\\')
+            buffer[length++] = '\\';
+        buffer[length++] = (uint8_t)*s < 0x20 ? ' ' : *s;
+    }
+    buffer[length++] = '"';
+    buffer[length] = 0;
+    write_text(writer, buffer);
+}
+
+static void write_scope(json_writer_t* writer, tracked_allocator_t* t)
+{
+    char line[256];
+    write_text(writer, "    {\n      \"name\": ");
+    write_json_string(writer, t->stats.name);
+    sp_sprintf_api->print(line, sizeof(line),
+        ",\n      \"live_bytes\": %llu,\n      \"peak_bytes\": %llu,\n      \"live_allocations\": %llu,\n      \"total_allocations\": %llu,\n      \"destroyed\": %s",
+        (unsigned long long)t->stats.live_bytes, (unsigned long long)t->stats.peak_bytes,
+        (unsigned long long)t->stats.live_allocations, (unsigned long long)t->stats.total_allocations,
+        t->stats.destroyed ? "true" : "false");
+    write_text(writer, line);
+
+    // live allocations of a destroyed scope are leaks, stacks are raw return addresses to symbolize offline
+    if (t->stats.destroyed && t->live)
+    {
+        write_text(writer, ",\n      \"leaks\": [\n");
+        for (allocation_header_t* header = t->live; header; header = header->next)
+        {
+            sp_sprintf_api->print(line, sizeof(line), "        { \"size\": %llu, \"file\": ", (unsigned long long)header->size);
+            write_text(writer, line);
+            write_json_string(writer, header->file);
+            sp_sprintf_api->print(line, sizeof(line), ", \"line\": %u, \"stack\": [", header->line);
+            write_text(writer, line);
+            for (uint32_t i = 0; i < header->num_frames; ++i)
+            {
+                sp_sprintf_api->print(line, sizeof(line), "%s\"0x%llx\"", i ? ", " : "", (unsigned long long)(uintptr_t)header->frames[i]);
+                write_text(writer, line);
+            }
+            write_text(writer, header->next ? "] },\n" : "] }\n");
+        }
+        write_text(writer, "      ]");
+    }
+    write_text(writer, "\n    }");
+}
+
+static bool dump_json(const char* file)
+{
+    json_writer_t writer = { .io = sp_os_api->file_io };
+    writer.file = writer.io->open_output(file);
+    if (!writer.file.valid)
+        return false;
+    writer.valid = true;
+
+    write_text(&writer, "{\n  \"scopes\": [\n");
+    for (uint32_t i = 0; i < g_tracker.num_scopes; ++i)
+    {
+        tracked_allocator_t* t = &g_tracker.scopes[i];
+        sp_mutex_lock(&t->mutex);
+        write_scope(&writer, t);
+        sp_mutex_unlock(&t->mutex);
+        write_text(&writer, i + 1 < g_tracker.num_scopes ? ",\n" : "\n");
+    }
+    write_text(&writer, "  ]\n}\n");
+    writer.io->close(writer.file);
+    return writer.valid;
+}
+
+static uint64_t shutdown(const char* report_file)
+{
+    // everything still allocated now is a leak
+    for (uint32_t i = 0; i < g_tracker.num_scopes; ++i)
+        g_tracker.scopes[i].stats.destroyed = true;
+    if (report_file)
+        dump_json(report_file);
+
+    uint64_t num_leaks = 0;
+    for (uint32_t i = 0; i < g_tracker.num_scopes; ++i)
+    {
+        tracked_allocator_t* t = &g_tracker.scopes[i];
+        num_leaks += t->stats.live_allocations;
+        sp_mutex_destroy(&t->mutex);
+    }
+    // leaked memory is left alone, it may still be referenced
+    g_tracker.num_scopes = 0;
+    return num_leaks;
+}
+
+static struct sp_memory_tracker_api memory_tracker_api = {
+    .create_allocator = create_allocator,
+    .destroy_allocator = destroy_allocator,
+    .scopes = scopes,
+    .dump_json = dump_json,
+    .shutdown = shutdown,
+};
+
+struct sp_memory_tracker_api* sp_memory_tracker_api = &memory_tracker_api;
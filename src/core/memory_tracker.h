@@ -0,0 +1,62 @@
+#pragma once
+
+#include "sapphire_types.h"
+#include "allocator.h"
+
+// Named tracking allocators, one per subsystem, for memory budgets and leak reports.
+//
+// A tracking allocator forwards to its parent allocator and counts live bytes, peak bytes and allocations.
+// Each allocation gets a small header linking it into the allocator's live list with the file and line of
+// the allocation, and the call stack when SP_MEMORY_TRACKER_CAPTURE_STACKS is set. Whatever is still on the
+// live lists at shutdown is reported as leaked. Tracking allocators are thread safe.
+//
+// Memory must be freed through the allocator it was allocated with.
+
+#define SP_MEMORY_TRACKER_MAX_SCOPES 64
+#define SP_MEMORY_TRACKER_NAME_LENGTH 64
+#define SP_MEMORY_TRACKER_MAX_FRAMES 16
+
+enum sp_memory_tracker_flags
+{
+    // records the call stack of every allocation for the leak report, costs a stack walk per allocation
+    SP_MEMORY_TRACKER_CAPTURE_STACKS = 1,
+};
+
+// stack capture in debug builds only
+#if defined(_DEBUG)
+#define SP_MEMORY_TRACKING_FLAGS SP_MEMORY_TRACKER_CAPTURE_STACKS
+#else
+#define SP_MEMORY_TRACKING_FLAGS 0
+#endif
+
+typedef struct sp_memory_scope_stats_t
+{
+    char name[SP_MEMORY_TRACKER_NAME_LENGTH];
+    uint64_t live_bytes;
+    uint64_t peak_bytes;
+    uint64_t live_allocations;
+    uint64_t total_allocations;
+    // set once destroy_allocator() was called, a destroyed scope with live allocations has leaked
+    bool destroyed;
+} sp_memory_scope_stats_t;
+
+struct sp_memory_tracker_api
+{
+    // the parent is typically sp_allocator_api->system_allocator, names are truncated to
+    // SP_MEMORY_TRACKER_NAME_LENGTH. Returns the parent when all scopes are in use
+    sp_allocator_i* (*create_allocator)(sp_allocator_i* parent, const char* name, uint32_t flags);
+    // the scope and its allocations stay listed until shutdown so leaks are still reported
+    void (*destroy_allocator)(sp_allocator_i* allocator);
+
+    // copies the stats of up to max_scopes scopes, returns the number of scopes
+    uint32_t (*scopes)(sp_memory_scope_stats_t* stats, uint32_t max_scopes);
+
+    // writes the scope stats and the live allocations of destroyed scopes as JSON
+    bool (*dump_json)(const char* file);
+
+    // writes a final dump_json() report when report_file is set and frees all scopes. Returns the number of
+    // leaked allocations
+    uint64_t (*shutdown)(const char* report_file);
+};
+
+extern struct sp_memory_tracker_api* sp_memory_tracker_api;
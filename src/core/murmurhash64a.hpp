@@ -0,0 +1,58 @@
+#pragma once
+
+#include "sapphire_types.h"
+
+#include <type_traits>
+
+// Compile-time version of sp_murmur_hash_string() for C++ code, SP_KEY("name") is a constant with the same
+// value as sp_murmur_hash_string("name"). The config key generator checks both versions agree for every key
+// in config_keys.inl. C code uses the generated SP_KEY_<ID> constants from config_keys.h instead.
+
+constexpr uint64_t sp_murmur_hash_constexpr(const char* key, uint64_t len, uint64_t seed)
+{
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+
+    uint64_t h = seed ^ (len * m);
+
+    // 8 byte blocks, read little endian like the runtime version does on our platforms
+    const uint64_t num_blocks = len / 8;
+    for (uint64_t i = 0; i < num_blocks; ++i)
+    {
+        uint64_t k = 0;
+        for (uint64_t b = 0; b < 8; ++b)
+            k |= (uint64_t)(uint8_t)key[i * 8 + b] << (b * 8);
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h ^= k;
+        h *= m;
+    }
+
+    const char* tail = key + num_blocks * 8;
+    const uint64_t tail_len = len & 7;
+    if (tail_len)
+    {
+        for (uint64_t b = tail_len; b > 0; --b)
+            h ^= (uint64_t)(uint8_t)tail[b - 1] << ((b - 1) * 8);
+        h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+constexpr sp_strhash_t sp_murmur_hash_string_constexpr(const char* s)
+{
+    uint64_t len = 0;
+    while (s[len])
+        ++len;
+    return sp_murmur_hash_constexpr(s, len, 0);
+}
+
+// forces evaluation at compile time, C++17 has no consteval
+#define SP_KEY(s) (std::integral_constant<sp_strhash_t, sp_murmur_hash_string_constexpr(s)>::value)
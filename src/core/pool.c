@@ -0,0 +1,54 @@
+#include "pool.h"
+#include "allocator.h"
+#include "array.h"
+
+#include <memory.h>
+
+static uint64_t page_size(const sp_pool_t* pool)
+{
+    return (uint64_t)pool->element_size << pool->page_shift;
+}
+
+void sp_pool_init(sp_pool_t* pool, uint32_t element_size, uint32_t page_shift, sp_allocator_i* allocator)
+{
+    memset(pool, 0, sizeof(sp_pool_t));
+    pool->allocator = allocator;
+    pool->element_size = element_size;
+    pool->page_shift = page_shift;
+}
+
+void sp_pool_destroy(sp_pool_t* pool)
+{
+    const uint32_t num_pages = (uint32_t)sp_array_size(pool->pages_arr);
+    for (uint32_t i = 0; i < num_pages; ++i)
+        sp_free(pool->allocator, pool->pages_arr[i], page_size(pool));
+    sp_array_free(pool->pages_arr, pool->allocator);
+}
+
+void sp_pool_ensure(sp_pool_t* pool, uint32_t count)
+{
+    const uint32_t num_pages = (uint32_t)(((uint64_t)count + (1u << pool->page_shift) - 1) >> pool->page_shift);
+    while (sp_array_size(pool->pages_arr) < num_pages)
+    {
+        uint8_t* page = sp_alloc(pool->allocator, page_size(pool));
+        memset(page, 0, page_size(pool));
+        sp_array_push(pool->pages_arr, page, pool->allocator);
+    }
+}
+
+void sp_pool_trim(sp_pool_t* pool, uint32_t count)
+{
+    const uint32_t num_pages = (uint32_t)sp_array_size(pool->pages_arr);
+    const uint32_t num_kept = (uint32_t)(((uint64_t)count + (1u << pool->page_shift) - 1) >> pool->page_shift) + 1;
+    if (num_pages <= num_kept)
+        return;
+
+    for (uint32_t i = num_kept; i < num_pages; ++i)
+        sp_free(pool->allocator, pool->pages_arr[i], page_size(pool));
+    sp_array_header(pool->pages_arr)->size = num_kept;
+}
+
+uint32_t sp_pool_capacity(const sp_pool_t* pool)
+{
+    return (uint32_t)sp_array_size(pool->pages_arr) << pool->page_shift;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "sapphire_types.h"
+
+typedef struct sp_allocator_i sp_allocator_i;
+
+// Paged storage for fixed size records.
+//
+// Records live in pages of 2^page_shift records. The pool grows a page at a time and pages never move, so
+// memory follows the number of records instead of a worst case capacity, and a record pointer stays valid
+// while the pool grows. Records are addressed by index, typically the dense index of a handle table: the
+// handle table hands out and recycles the slots, the pool holds the data. Pools with the same page_shift
+// indexed by the same dense index make SoA storage.
+
+typedef struct sp_pool_t
+{
+    sp_allocator_i* allocator;
+    uint32_t element_size;
+    uint32_t page_shift;
+    // array of pages of element_size << page_shift bytes
+    uint8_t** pages_arr;
+} sp_pool_t;
+
+void sp_pool_init(sp_pool_t* pool, uint32_t element_size, uint32_t page_shift, sp_allocator_i* allocator);
+void sp_pool_destroy(sp_pool_t* pool);
+
+// makes records 0 .. count - 1 addressable, new pages are zeroed
+void sp_pool_ensure(sp_pool_t* pool, uint32_t count);
+
+// frees the pages past the ones needed for count records. One spare page is kept, so adding and removing a
+// record at a page boundary doesn't allocate every time
+void sp_pool_trim(sp_pool_t* pool, uint32_t count);
+
+// number of addressable records
+uint32_t sp_pool_capacity(const sp_pool_t* pool);
+
+static inline void* sp_pool_at(const sp_pool_t* pool, uint32_t index)
+{
+    const uint32_t mask = (1u << pool->page_shift) - 1;
+    return pool->pages_arr[index >> pool->page_shift] + (uint64_t)(index & mask) * pool->element_size;
+}
+
+#define sp_pool_get(pool, type, index) ((type*)sp_pool_at((pool), (index)))
@@ -0,0 +1,149 @@
+#include "thread.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <semaphore.h>
+#endif
+
+#if defined(_WIN32)
+
+_Static_assert(sizeof(CRITICAL_SECTION) <= sizeof(sp_mutex_t), "sp_mutex_t too small");
+
+static DWORD WINAPI thread_entry(LPVOID param)
+{
+    sp_thread_t* thread = param;
+    thread->entry(thread->user_data);
+    return 0;
+}
+
+void sp_thread_create(sp_thread_t* thread, sp_thread_entry_f entry, void* user_data)
+{
+    thread->entry = entry;
+    thread->user_data = user_data;
+    thread->handle = (uint64_t)CreateThread(NULL, 0, thread_entry, thread, 0, NULL);
+}
+
+void sp_thread_join(sp_thread_t* thread)
+{
+    WaitForSingleObject((HANDLE)thread->handle, INFINITE);
+    CloseHandle((HANDLE)thread->handle);
+    thread->handle = 0;
+}
+
+void sp_mutex_init(sp_mutex_t* mutex)
+{
+    InitializeCriticalSection((CRITICAL_SECTION*)mutex->opaque);
+}
+
+void sp_mutex_destroy(sp_mutex_t* mutex)
+{
+    DeleteCriticalSection((CRITICAL_SECTION*)mutex->opaque);
+}
+
+void sp_mutex_lock(sp_mutex_t* mutex)
+{
+    EnterCriticalSection((CRITICAL_SECTION*)mutex->opaque);
+}
+
+void sp_mutex_unlock(sp_mutex_t* mutex)
+{
+    LeaveCriticalSection((CRITICAL_SECTION*)mutex->opaque);
+}
+
+void sp_semaphore_init(sp_semaphore_t* semaphore, uint32_t initial_count)
+{
+    semaphore->opaque[0] = (uint64_t)CreateSemaphoreA(NULL, initial_count, LONG_MAX, NULL);
+}
+
+void sp_semaphore_destroy(sp_semaphore_t* semaphore)
+{
+    CloseHandle((HANDLE)semaphore->opaque[0]);
+}
+
+void sp_semaphore_post(sp_semaphore_t* semaphore, uint32_t count)
+{
+    ReleaseSemaphore((HANDLE)semaphore->opaque[0], count, NULL);
+}
+
+void sp_semaphore_wait(sp_semaphore_t* semaphore)
+{
+    WaitForSingleObject((HANDLE)semaphore->opaque[0], INFINITE);
+}
+
+#else
+
+_Static_assert(sizeof(pthread_mutex_t) <= sizeof(sp_mutex_t), "sp_mutex_t too small");
+_Static_assert(sizeof(sem_t) <= sizeof(sp_semaphore_t), "sp_semaphore_t too small");
+
+static void* thread_entry(void* param)
+{
+    sp_thread_t* thread = param;
+    thread->entry(thread->user_data);
+    return NULL;
+}
+
+void sp_thread_create(sp_thread_t* thread, sp_thread_entry_f entry, void* user_data)
+{
+    thread->entry = entry;
+    thread->user_data = user_data;
+    pthread_t pthread;
+    pthread_create(&pthread, NULL, thread_entry, thread);
+    thread->handle = (uint64_t)pthread;
+}
+
+void sp_thread_join(sp_thread_t* thread)
+{
+    pthread_join((pthread_t)thread->handle, NULL);
+    thread->handle = 0;
+}
+
+void sp_mutex_init(sp_mutex_t* mutex)
+{
+    pthread_mutex_init((pthread_mutex_t*)mutex->opaque, NULL);
+}
+
+void sp_mutex_destroy(sp_mutex_t* mutex)
+{
+    pthread_mutex_destroy((pthread_mutex_t*)mutex->opaque);
+}
+
+void sp_mutex_lock(sp_mutex_t* mutex)
+{
+    pthread_mutex_lock((pthread_mutex_t*)mutex->opaque);
+}
+
+void sp_mutex_unlock(sp_mutex_t* mutex)
+{
+    pthread_mutex_unlock((pthread_mutex_t*)mutex->opaque);
+}
+
+void sp_semaphore_init(sp_semaphore_t* semaphore, uint32_t initial_count)
+{
+    sem_init((sem_t*)semaphore->opaque, 0, initial_count);
+}
+
+void sp_semaphore_destroy(sp_semaphore_t* semaphore)
+{
+    sem_destroy((sem_t*)semaphore->opaque);
+}
+
+void sp_semaphore_post(sp_semaphore_t* semaphore, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        sem_post((sem_t*)semaphore->opaque);
+    }
+}
+
+void sp_semaphore_wait(sp_semaphore_t* semaphore)
+{
+    // retry when interrupted by a signal
+    while (sem_wait((sem_t*)semaphore->opaque) != 0)
+    {
+    }
+}
+
+#endif
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "sapphire_types.h"
+
+// Minimal OS threading primitives - Win32 threads or pthreads.
+//
+// The primitives are plain structs with opaque storage so they can be embedded in other structs. None of
+// them may be moved once initialized.
+
+typedef void (*sp_thread_entry_f)(void* user_data);
+
+typedef struct sp_thread_t
+{
+    uint64_t handle;
+    sp_thread_entry_f entry;
+    void* user_data;
+} sp_thread_t;
+
+typedef struct sp_mutex_t
+{
+    uint64_t opaque[8];
+} sp_mutex_t;
+
+typedef struct sp_semaphore_t
+{
+    uint64_t opaque[4];
+} sp_semaphore_t;
+
+void sp_thread_create(sp_thread_t* thread, sp_thread_entry_f entry, void* user_data);
+void sp_thread_join(sp_thread_t* thread);
+
+void sp_mutex_init(sp_mutex_t* mutex);
+void sp_mutex_destroy(sp_mutex_t* mutex);
+void sp_mutex_lock(sp_mutex_t* mutex);
+void sp_mutex_unlock(sp_mutex_t* mutex);
+
+void sp_semaphore_init(sp_semaphore_t* semaphore, uint32_t initial_count);
+void sp_semaphore_destroy(sp_semaphore_t* semaphore);
+void sp_semaphore_post(sp_semaphore_t* semaphore, uint32_t count);
+void sp_semaphore_wait(sp_semaphore_t* semaphore);
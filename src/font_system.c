@@ -1,13 +1,23 @@
 #include "core/sapphire_types.h"
 #include "core/sapphire_math.h"
 #include "core/json.h"
+#include "core/json_simd.h"
 #include "core/config.h"
 #include "core/allocator.h"
 #include "core/temp_allocator.h"
 #include "core/os.h"
 #include "core/murmurhash64a.h"
+#include "core/array.h"
+#include "core/sprintf.h"
 #include "config_utils.h"
+#include "config_keys.h"
+#include "text_layout.h"
+#include "sdf_atlas.h"
+#include "game_ui.h"
+#include "font_system.h"
 #include <memory.h>
+#include <math.h>
+#include <time.h>
 #include "RenderDevice.h"
 #include "SwapChain.h"
 #include "DeviceContext.h"
@@ -15,60 +25,76 @@
 
 #include "GraphicsUtilities.h"
 #include "TextureUtilities.h"
+#include "TextureLoader.h"
 
 
-#define MAX_FONT_VERTICES 2048
 #define FONT_CONTEXT_MAX_FONTS 16
-
-typedef struct font_vertex_t
-{
-    sp_vec2_t pos;
-    sp_vec2_t uv;
-
-} font_vertex_t;
-
-#define MAX_FONT_GLYPHS 256
-#define MAX_KERNING_PAIRS 256
-typedef struct font_glyph_t
-{
-    uint32_t code;
-    float u0, u1, v0, v1; // texture coordinates
-    float x_advance;
-    float x_top, y_top;
-    float width; //?
-    float height; //?
-} sp_font_glyph_t;
-
-typedef struct sp_font_t
-{
-    sp_font_glyph_t glyphs[MAX_FONT_GLYPHS];
-    uint32_t        kerning_pairs[MAX_KERNING_PAIRS];
-    int16_t         kerning_values[MAX_KERNING_PAIRS];
-    uint32_t        num_gliphs;
-    uint32_t        num_kerning_pairs;
-    float           ascender;
-    float           descender;
-    float           line_height;
-} sp_font_t;
+#define FONT_PATH_LEN 256
+// font 0 and its bitmap atlas, relative to the assets root
+#define FONT_FILE "fonts/first.fnt"
+#define FONT_ATLAS_FILE "fonts/first_0.png"
+// layouts of recently drawn strings kept by the layout cache
+#define FONT_LAYOUT_CACHE_MAX_ENTRIES 4096
+#define FONT_LAYOUT_CACHE_MAX_VERTICES (1u << 18)
+// distance field atlas of font 0, from the outlines of its typeface or from its bitmap atlas. The spread bounds
+// the outline width and shadow offset, in font texels
+#define FONT_SDF_SPREAD 8
+#define FONT_SDF_DOWNSCALE 2
+#define FONT_SDF_MAX_ATLAS_SIZE 4096
+// initial capacity of the gpu vertex buffer in quads, it grows to the next power of two when a frame needs more
+#define FONT_MIN_GPU_QUADS 1024
 
 typedef struct font_rendering_context_t
 {
+    sp_allocator_i* allocator;
     uint32_t state_font_index;
     uint32_t state_color;
-    font_vertex_t vertices[MAX_FONT_VERTICES];
-    uint32_t num_vertices;
+    // 4 vertices per glyph quad, emptied every frame. It keeps its memory, after the first frames it holds the
+    // busiest frame and strings are copied in without growing it
+    font_vertex_t* vertices_arr;
     uint32_t num_fonts;
     sp_font_t fonts[FONT_CONTEXT_MAX_FONTS];
+    // typeface a font was baked from, its "ttf" key. Empty when the font file doesn't name one
+    char ttf_files[FONT_CONTEXT_MAX_FONTS][FONT_PATH_LEN];
+    // strings drawn again with the same font, width and style only copy their vertices
+    text_layout_cache_t layout_cache;
+    // quads the gpu vertex and index buffers hold
+    uint32_t gpu_quads_capacity;
+    // the atlas is a distance field, drawn with font_sdf.psh. Falls back to the bitmap when it can't be built
+    bool sdf;
+    float sdf_spread;
+    float sdf_atlas_width;
+    float sdf_atlas_height;
+    sp_vec4_t outline_color;
+    float outline_width;
+    sp_vec4_t shadow_color;
+    float shadow_softness;
+    sp_vec2_t shadow_offset;
+    // fully covered texel of the distance field atlas
+    sp_vec2_t solid_uv;
+    // game ui drawn with font 0, under the immediate text. Its quads come first in the vertex buffer
+    ui_context_t ui;
+    uint32_t num_ui_quads;
+    font_frame_stats_t stats;
 
 } font_rendering_context_t;
 
+typedef struct font_sdf_constants_t
+{
+    sp_vec4_t outline_color;
+    sp_vec4_t shadow_color;
+    sp_vec4_t params;
+} font_sdf_constants_t;
+
 static IRenderDevice* g_pDevice = NULL;
 static ISwapChain* g_pSwapChain = NULL;
 
 static IBuffer* g_pPSConstants = NULL;
+static IBuffer* g_pSdfConstants = NULL;
 static IPipelineState* g_pPSO = NULL;
 static IShaderResourceBinding* g_pSRB = NULL;
 static IBuffer* g_pFontVertexBuffer = NULL;
+static IBuffer* g_pFontIndexBuffer = NULL;
 
 static float g_renderTargetWidth;
 static float g_renderTargetHeight;
@@ -80,8 +106,10 @@ const char* read_file(const char* file, sp_temp_allocator_i* ta)
     const sp_file_stat_t stat = sp_os_api->file_system->stat(file);
     const uint64_t size = stat.size;
     struct sp_os_file_io_api* io = sp_os_api->file_io;
-    char* text = sp_temp_alloc(ta, size + 2);
     sp_file_o f = io->open_input(file);
+    if (!f.valid)
+        return NULL;
+    char* text = sp_temp_alloc(ta, size + 2);
     io->read(f, text, size);
     io->close(f);
 
@@ -103,185 +131,288 @@ const char* read_file(const char* file, sp_temp_allocator_i* ta)
     return text;
 }
 
-static sp_vec2_t add_glyph_vertices(const sp_font_t* font, int32_t code, int32_t prev_code, float x, float y, float scale, float spacing, font_vertex_t* vertices, uint32_t* buffer_index)
+static void reset_font_rendering_context(font_rendering_context_t* frc)
 {
-    sp_vec2_t advance = {0};
+    frc->state_font_index = 0;    
+    if (frc->vertices_arr)
+        sp_array_header(frc->vertices_arr)->size = 0;
+    frc->state_color = 0xFF0000FF;
+}
 
-    const sp_font_glyph_t* glyph = &font->glyphs[code];
-    uint32_t curr_index = *buffer_index;
+// draws a utf-8 string with the current font, x y is the top left of the layout. Returns the layout, valid
+// until the next string is drawn
+static const text_layout_t* font_render_text(font_rendering_context_t* frc, float x, float y, const char* str, float max_width, const text_style_t* style)
+{
+    const uint32_t font_index = frc->state_font_index;
+    const text_layout_t* layout = text_layout_cache_get(&frc->layout_cache, &frc->fonts[font_index], font_index, str, max_width, style);
+
+    const uint32_t num_vertices = (uint32_t)sp_array_size(layout->vertices_arr);
+    if (!num_vertices)
+        return layout;
+    // the whole string is reserved at once, not grown glyph by glyph
+    const uint32_t first_vertex = (uint32_t)sp_array_size(frc->vertices_arr);
+    sp_array_ensure(frc->vertices_arr, first_vertex + num_vertices, frc->allocator);
+    font_vertex_t* vertices = frc->vertices_arr + first_vertex;
+    for (uint32_t i = 0; i < num_vertices; ++i)
+    {
+        vertices[i] = layout->vertices_arr[i];
+        vertices[i].pos.x += x;
+        vertices[i].pos.y += y;
+    }
+    sp_array_header(frc->vertices_arr)->size = first_vertex + num_vertices;
+    return layout;
+}
 
-    float x0 = (x + glyph->x_top * scale);
-    float y0 = (y + glyph->y_top * scale);
-    float x1 = (x + (glyph->x_top + glyph->width) * scale);
-    float y1 = (y + (glyph->y_top + glyph->height) * scale);
+// single line in the current colour. Returns the advance of the string
+static float font_render_string(font_rendering_context_t* frc, float x, float y, const char* str)
+{
+    const text_style_t style = { .scale = 1.0f, .spacing = 0.0f, .color = frc->state_color, .align = TEXT_ALIGN_LEFT };
+    return font_render_text(frc, x, y, str, 0.0f, &style)->width;
+}
 
-    
+// index buffer of quads, 0 3 1 0 2 3 + 4 * quad
+static IBuffer* create_quads_index_buffer(IRenderDevice* pDevice, uint32_t num_quads)
+{
+    SP_INIT_SCRATCH_ALLOCATOR(scratch);
+    uint32_t* indices = sp_alloc(scratch, sizeof(uint32_t) * 6 * num_quads);
+    for (uint32_t i = 0; i < num_quads; ++i)
+    {
+        const uint32_t v = i * 4;
+        uint32_t* quad = indices + i * 6;
+        quad[0] = v;
+        quad[1] = v + 3;
+        quad[2] = v + 1;
+        quad[3] = v;
+        quad[4] = v + 2;
+        quad[5] = v + 3;
+    }
 
-    // first triangle
-    vertices[curr_index].pos.x = x0;
-    vertices[curr_index].pos.y = y0;
-    vertices[curr_index].uv.x = glyph->u0;
-    vertices[curr_index].uv.y = glyph->v0;
-    curr_index++;
-
-    vertices[curr_index].pos.x = x1;
-    vertices[curr_index].pos.y = y1;
-    vertices[curr_index].uv.x = glyph->u1;
-    vertices[curr_index].uv.y = glyph->v1;
-    curr_index++;
-
-    vertices[curr_index].pos.x = x1;
-    vertices[curr_index].pos.y = y0;
-    vertices[curr_index].uv.x = glyph->u1;
-    vertices[curr_index].uv.y = glyph->v0;
-    curr_index++;
-
-    // second triangle
-
-    vertices[curr_index].pos.x = x0;
-    vertices[curr_index].pos.y = y0;
-    vertices[curr_index].uv.x = glyph->u0;
-    vertices[curr_index].uv.y = glyph->v0;
-    curr_index++;
-
-    vertices[curr_index].pos.x = x0;
-    vertices[curr_index].pos.y = y1;
-    vertices[curr_index].uv.x = glyph->u0;
-    vertices[curr_index].uv.y = glyph->v1;
-    curr_index++;
-
-    vertices[curr_index].pos.x = x1;
-    vertices[curr_index].pos.y = y1;
-    vertices[curr_index].uv.x = glyph->u1;
-    vertices[curr_index].uv.y = glyph->v1;
-    curr_index++;
-    
-    // update the buffer index to the new position
-    *buffer_index = curr_index;
+    BufferDesc ind_buff_desc;
+    memset(&ind_buff_desc, 0, sizeof(ind_buff_desc));
+    ind_buff_desc._DeviceObjectAttribs.Name = "Font index buffer";
+    ind_buff_desc.Usage = USAGE_IMMUTABLE;
+    ind_buff_desc.BindFlags = BIND_INDEX_BUFFER;
+    ind_buff_desc.Size = sizeof(uint32_t) * 6 * num_quads;
+    ind_buff_desc.ImmediateContextMask = 1;
+
+    BufferData ib_data;
+    ib_data.pContext = NULL;
+    ib_data.pData = indices;
+    ib_data.DataSize = ind_buff_desc.Size;
+
+    IBuffer* p_buffer = NULL;
+    IRenderDevice_CreateBuffer(pDevice, &ind_buff_desc, &ib_data, &p_buffer);
+    SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+    return p_buffer;
+}
 
-    // TODO: add pair kerning if exists
-    advance.x += glyph->x_advance * scale + spacing;
+static void CreateVertexBuffer(IRenderDevice* pDevice, uint32_t num_quads)
+{
+    BufferDesc VertBuffDesc;
+    memset(&VertBuffDesc, 0, sizeof(VertBuffDesc));
+    VertBuffDesc._DeviceObjectAttribs.Name = "Font vertex buffer";
 
-    return advance;
+    VertBuffDesc.Usage = USAGE_DYNAMIC;
+    VertBuffDesc.BindFlags = BIND_VERTEX_BUFFER;
+    VertBuffDesc.CPUAccessFlags = CPU_ACCESS_WRITE;
+    VertBuffDesc.Size = sizeof(font_vertex_t) * 4 * num_quads;
+    VertBuffDesc.ImmediateContextMask = 1;
 
+    IRenderDevice_CreateBuffer(pDevice, &VertBuffDesc, NULL, &g_pFontVertexBuffer);
+    g_pFontIndexBuffer = create_quads_index_buffer(pDevice, num_quads);
+    g_frc.gpu_quads_capacity = num_quads;
 }
 
-static void reset_font_rendering_context(font_rendering_context_t* frc)
+// grows the gpu buffers to hold num_quads. The old buffers may still be in use by frames in flight, the engine
+// keeps them alive until the gpu is done with them
+static void ensure_gpu_quads(IRenderDevice* pDevice, uint32_t num_quads)
 {
-    frc->state_font_index = 0;    
-    frc->num_vertices = 0;
-    frc->state_color = 0xFF0000FF;
+    if (num_quads <= g_frc.gpu_quads_capacity)
+        return;
+    uint32_t capacity = g_frc.gpu_quads_capacity ? g_frc.gpu_quads_capacity : FONT_MIN_GPU_QUADS;
+    while (capacity < num_quads)
+        capacity *= 2;
+    IObject_Release(g_pFontVertexBuffer);
+    IObject_Release(g_pFontIndexBuffer);
+    CreateVertexBuffer(pDevice, capacity);
 }
 
-static void font_render_string(font_rendering_context_t* frc, float x, float y, const char* str)
+static double now_seconds(void)
 {
-    size_t len = strlen(str);
-    const sp_font_t* font = &frc->fonts[frc->state_font_index];
-    int32_t char_code;
-    int32_t prev_code = -1;
-    float cur_x = x;
-    float cur_y = y;
-    uint32_t ver_index = frc->num_vertices;
-    for (uint32_t i = 0; i < len; ++i)
-    {
-        char_code = str[i];
-        sp_vec2_t advance = add_glyph_vertices(font, char_code, prev_code, cur_x, cur_y, 1.0f, 0.0f, frc->vertices, &ver_index);
-        cur_x += advance.x;
-        prev_code = char_code;
-    }
-    frc->num_vertices = ver_index;
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
 }
 
 static void fill_font_buffer(IDeviceContext* pContext)
 {
-    reset_font_rendering_context(&g_frc);
-    
-    font_render_string(&g_frc, 0, 0, "ofer rundstein");    
-    font_render_string(&g_frc, 0, g_frc.fonts[0].line_height, "OFER RUNDSTEIN");
-
+    const double start = now_seconds();
+
+    // the ui geometry is only rebuilt when a widget changed, otherwise it is just copied
+    ui_set_viewport(&g_frc.ui, g_renderTargetWidth, g_renderTargetHeight);
+    g_frc.stats.ui_rebuilt = ui_update(&g_frc.ui);
+    g_frc.stats.ui_update_ms = (float)((now_seconds() - start) * 1000.0);
+    const uint32_t num_ui_vertices = (uint32_t)sp_array_size(g_frc.ui.vertices_arr);
+    g_frc.num_ui_quads = num_ui_vertices / 4;
+
+    const uint32_t num_text_vertices = (uint32_t)sp_array_size(g_frc.vertices_arr);
+    g_frc.stats.num_ui_quads = g_frc.num_ui_quads;
+    g_frc.stats.num_text_quads = num_text_vertices / 4;
+    if (!num_ui_vertices && !num_text_vertices)
+    {
+        g_frc.stats.fill_ms = (float)((now_seconds() - start) * 1000.0);
+        return;
+    }
+    ensure_gpu_quads(g_pDevice, (num_ui_vertices + num_text_vertices) / 4);
     {
         // Map the buffer and write current world-view-projection matrix
-        void* pCBData = NULL;
-        IDeviceContext_MapBuffer(pContext, g_pFontVertexBuffer, MAP_WRITE, MAP_FLAG_DISCARD, &pCBData);
-        memcpy(pCBData, g_frc.vertices, sizeof(font_vertex_t) * g_frc.num_vertices);
+        font_vertex_t* p_vertices = NULL;
+        IDeviceContext_MapBuffer(pContext, g_pFontVertexBuffer, MAP_WRITE, MAP_FLAG_DISCARD, &p_vertices);
+        if (num_ui_vertices)
+            memcpy(p_vertices, g_frc.ui.vertices_arr, sizeof(font_vertex_t) * num_ui_vertices);
+        if (num_text_vertices)
+            memcpy(p_vertices + num_ui_vertices, g_frc.vertices_arr, sizeof(font_vertex_t) * num_text_vertices);
         
         IDeviceContext_UnmapBuffer(pContext, g_pFontVertexBuffer, MAP_WRITE);
     }
+    g_frc.stats.fill_ms = (float)((now_seconds() - start) * 1000.0);
 }
 
-
-
-static void load_font_file(const char* font_file)
+// loads a font into the next free font slot and returns its index, FONT_CONTEXT_MAX_FONTS on failure
+static uint32_t load_font_file(const char* font_file)
 {
+    if (g_frc.num_fonts == FONT_CONTEXT_MAX_FONTS)
+        return FONT_CONTEXT_MAX_FONTS;
+
     //SP_INIT_TEMP_ALLOCATOR(ta);
     SP_INIT_TEMP_ALLOCATOR_WITH_ADAPTER(ta, a);
 
     const char* text = read_file(font_file, ta);
+    if (!text)
+    {
+        SP_SHUTDOWN_TEMP_ALLOCATOR(ta);
+        return FONT_CONTEXT_MAX_FONTS;
+    }
 
     char error[256];
     const uint32_t parse_flags = SP_JSON_PARSE_EXT_ALLOW_UNQUOTED_KEYS | SP_JSON_PARSE_EXT_ALLOW_COMMENTS | SP_JSON_PARSE_EXT_IMPLICIT_ROOT_OBJECT | SP_JSON_PARSE_EXT_OPTIONAL_COMMAS | SP_JSON_PARSE_EXT_EQUALS_FOR_COLON;
     sp_config_i* fnt_config = sp_config_api->create(a);
-    bool res = sp_json_api->parse(text, fnt_config, parse_flags, error);
+    bool res = sp_json_simd_api->parse(text, fnt_config, parse_flags, error);
     if (!res)
     {
-        return;
+        SP_SHUTDOWN_TEMP_ALLOCATOR(ta);
+        return FONT_CONTEXT_MAX_FONTS;
     }
 
+    sp_allocator_i* allocator = g_frc.allocator;
     sp_font_t font_o;
+    font_init(&font_o, allocator);
 
     sp_config_item_t root = fnt_config->root(fnt_config->inst);
-    sp_strhash_t s_glyphs_hash = sp_murmur_hash_string("glyphs");
-    sp_strhash_t s_scale_w_hash = sp_murmur_hash_string("scale_w");
-    sp_strhash_t s_scale_h_hash = sp_murmur_hash_string("scale_h");
-    sp_strhash_t s_line_height_hash = sp_murmur_hash_string("line_height");
-    sp_strhash_t s_code_hash = sp_murmur_hash_string("id_code");
-    sp_strhash_t s_x_hash = sp_murmur_hash_string("x");
-    sp_strhash_t s_y_hash = sp_murmur_hash_string("y");
-    sp_strhash_t s_width_hash = sp_murmur_hash_string("width");
-    sp_strhash_t s_height_hash = sp_murmur_hash_string("height");
-    sp_strhash_t s_xoffset_hash = sp_murmur_hash_string("xoffset");
-    sp_strhash_t s_yoffset_hash = sp_murmur_hash_string("yoffset");
-    sp_strhash_t s_xadvance_hash = sp_murmur_hash_string("xadvance");
-
-    float scale_w = (float)get_attribute_as_number(fnt_config, root, s_scale_w_hash);
-    float scale_h = (float)get_attribute_as_number(fnt_config, root, s_scale_h_hash);
-
-    float line_height = (float)get_attribute_as_number(fnt_config, root, s_line_height_hash);
+    config_object_index_t root_index;
+    config_object_index_build(&root_index, fnt_config, root, a);
+
+    float scale_w = (float)get_indexed_attribute_as_number(&root_index, SP_KEY_SCALE_W);
+    float scale_h = (float)get_indexed_attribute_as_number(&root_index, SP_KEY_SCALE_H);
+
+    float line_height = (float)get_indexed_attribute_as_number(&root_index, SP_KEY_LINE_HEIGHT);
+    char ttf_name[FONT_PATH_LEN] = { 0 };
+    get_indexed_attribute_as_string(&root_index, SP_KEY_TTF, ttf_name);
+    // a relative typeface is next to the font file
+    char ttf_file[FONT_PATH_LEN] = { 0 };
+    if (ttf_name[0])
+    {
+        const char* slash = strrchr(font_file, '/');
+        const bool absolute = ttf_name[0] == '/' || strchr(ttf_name, ':');
+        const size_t dir_len = slash && !absolute ? (size_t)(slash - font_file) + 1 : 0;
+        if (dir_len + strlen(ttf_name) < FONT_PATH_LEN)
+        {
+            memcpy(ttf_file, font_file, dir_len);
+            memcpy(ttf_file + dir_len, ttf_name, strlen(ttf_name) + 1);
+        }
+    }
 
     font_o.line_height = line_height;
 
-    sp_config_item_t glyphs = fnt_config->object_get(fnt_config->inst, root, s_glyphs_hash);
+    // one pass over the members of each glyph and kerning instead of a lookup per attribute
+    config_cursor_t cursor;
+    config_cursor_init(&cursor, fnt_config);
+
+    sp_config_item_t glyphs = config_object_index_get(&root_index, SP_KEY_GLYPHS);
     sp_config_item_t* glyphs_array = NULL;
     uint32_t num_glyphs = fnt_config->to_array(fnt_config->inst, glyphs, &glyphs_array);
     for (uint32_t i = 0; i < num_glyphs; ++i)
     {
-        sp_config_item_t glyph_item = glyphs_array[i];
-        uint32_t code_id = (uint32_t)get_attribute_as_number(fnt_config, glyph_item, s_code_hash);
-        float x = (float)get_attribute_as_number(fnt_config, glyph_item, s_x_hash);
-        float y = (float)get_attribute_as_number(fnt_config, glyph_item, s_y_hash);
-        float width = (float)get_attribute_as_number(fnt_config, glyph_item, s_width_hash);
-        float height = (float)get_attribute_as_number(fnt_config, glyph_item, s_height_hash);
-        float xoffset = (float)get_attribute_as_number(fnt_config, glyph_item, s_xoffset_hash);
-        float yoffset = (float)get_attribute_as_number(fnt_config, glyph_item, s_yoffset_hash);
-        float xadvance = (float)get_attribute_as_number(fnt_config, glyph_item, s_xadvance_hash);
-        sp_font_glyph_t* font_glyph = &font_o.glyphs[code_id];
-        font_glyph->code = code_id;
-        font_glyph->width = width;
-        font_glyph->height = height;
-        font_glyph->x_top = xoffset;
-        font_glyph->y_top = yoffset;
-        font_glyph->x_advance = xadvance;
-        font_glyph->u0 = x / scale_w;
-        font_glyph->v0 = y / scale_h;
-        font_glyph->u1 = (x + width) / scale_w;
-        font_glyph->v1 = (y + height) / scale_h;
-        
-        
+        uint32_t code_id = 0;
+        float x = 0, y = 0, width = 0, height = 0, xoffset = 0, yoffset = 0, xadvance = 0;
+        config_cursor_begin(&cursor, glyphs_array[i]);
+        sp_strhash_t key_hash;
+        sp_config_item_t value;
+        while (config_cursor_next(&cursor, &key_hash, &value))
+        {
+            const float number = (float)fnt_config->to_number(fnt_config->inst, value);
+            if (key_hash == SP_KEY_ID_CODE)
+                code_id = (uint32_t)number;
+            else if (key_hash == SP_KEY_X)
+                x = number;
+            else if (key_hash == SP_KEY_Y)
+                y = number;
+            else if (key_hash == SP_KEY_WIDTH)
+                width = number;
+            else if (key_hash == SP_KEY_HEIGHT)
+                height = number;
+            else if (key_hash == SP_KEY_XOFFSET)
+                xoffset = number;
+            else if (key_hash == SP_KEY_YOFFSET)
+                yoffset = number;
+            else if (key_hash == SP_KEY_XADVANCE)
+                xadvance = number;
+        }
+        sp_font_glyph_t font_glyph;
+        font_glyph.code = code_id;
+        font_glyph.width = width;
+        font_glyph.height = height;
+        font_glyph.x_top = xoffset;
+        font_glyph.y_top = yoffset;
+        font_glyph.x_advance = xadvance;
+        font_glyph.u0 = x / scale_w;
+        font_glyph.v0 = y / scale_h;
+        font_glyph.u1 = (x + width) / scale_w;
+        font_glyph.v1 = (y + height) / scale_h;
+        font_add_glyph(&font_o, &font_glyph, allocator);
+    }
+
+    sp_config_item_t kernings = config_object_index_get(&root_index, SP_KEY_KERNINGS);
+    sp_config_item_t* kernings_array = NULL;
+    uint32_t num_kernings = fnt_config->to_array(fnt_config->inst, kernings, &kernings_array);
+    for (uint32_t i = 0; i < num_kernings; ++i)
+    {
+        uint32_t first = 0, second = 0;
+        float amount = 0;
+        config_cursor_begin(&cursor, kernings_array[i]);
+        sp_strhash_t key_hash;
+        sp_config_item_t value;
+        while (config_cursor_next(&cursor, &key_hash, &value))
+        {
+            const double number = fnt_config->to_number(fnt_config->inst, value);
+            if (key_hash == SP_KEY_FIRST)
+                first = (uint32_t)number;
+            else if (key_hash == SP_KEY_SECOND)
+                second = (uint32_t)number;
+            else if (key_hash == SP_KEY_AMOUNT)
+                amount = (float)number;
+        }
+        font_add_kerning(&font_o, first, second, amount, allocator);
     }
+    config_object_index_free(&root_index);
+    font_finalize(&font_o);
     
-    g_frc.fonts[0] = font_o;
+    const uint32_t font_index = g_frc.num_fonts++;
+    g_frc.fonts[font_index] = font_o;
+    memcpy(g_frc.ttf_files[font_index], ttf_file, sizeof(ttf_file));
 
     SP_SHUTDOWN_TEMP_ALLOCATOR(ta);
+    return font_index;
 }
 
 static void CreatePipelineState(IRenderDevice* pDevice, ISwapChain* pSwapChain)
@@ -334,6 +465,8 @@ static void CreatePipelineState(IRenderDevice* pDevice, ISwapChain* pSwapChain)
     PSOCreateInfo.GraphicsPipeline.RasterizerDesc.FillMode = FILL_MODE_SOLID;
     PSOCreateInfo.GraphicsPipeline.RasterizerDesc.CullMode = CULL_MODE_NONE;
     PSOCreateInfo.GraphicsPipeline.RasterizerDesc.DepthClipEnable = True;
+    // ui batches clip to their widgets
+    PSOCreateInfo.GraphicsPipeline.RasterizerDesc.ScissorEnable = True;
 
     BlendStateDesc bd;
     bd.AlphaToCoverageEnable = False;
@@ -391,17 +524,19 @@ static void CreatePipelineState(IRenderDevice* pDevice, ISwapChain* pSwapChain)
 
         ShaderCI.Desc.ShaderType = SHADER_TYPE_PIXEL;
         ShaderCI.EntryPoint = "main";
-        ShaderCI.FilePath = "font.psh";
+        ShaderCI.FilePath = g_frc.sdf ? "font_sdf.psh" : "font.psh";
         IRenderDevice_CreateShader(pDevice, &ShaderCI, &pPS, NULL);
 
         // Create dynamic uniform buffer that will store our transformation matrix
         // Dynamic buffers can be frequently updated by the CPU
         Diligent_CreateUniformBuffer(pDevice, sizeof(sp_vec4_t) * 2, "PS constants CB", &g_pPSConstants,
             USAGE_DYNAMIC, BIND_UNIFORM_BUFFER, CPU_ACCESS_WRITE, NULL);
+        Diligent_CreateUniformBuffer(pDevice, sizeof(font_sdf_constants_t), "Font sdf constants CB", &g_pSdfConstants,
+            USAGE_DYNAMIC, BIND_UNIFORM_BUFFER, CPU_ACCESS_WRITE, NULL);
     }
 
     // Define vertex shader input layout
-    LayoutElement LayoutElems[2];
+    LayoutElement LayoutElems[3];
     LayoutElems[0].HLSLSemantic = "ATTRIB";
     LayoutElems[0].InputIndex = 0;
     LayoutElems[0].BufferSlot = 0;
@@ -424,11 +559,22 @@ static void CreatePipelineState(IRenderDevice* pDevice, ISwapChain* pSwapChain)
     LayoutElems[1].Frequency = INPUT_ELEMENT_FREQUENCY_PER_VERTEX;
     LayoutElems[1].InstanceDataStepRate = 1;
 
+    LayoutElems[2].HLSLSemantic = "ATTRIB";
+    LayoutElems[2].InputIndex = 2;
+    LayoutElems[2].BufferSlot = 0;
+    LayoutElems[2].NumComponents = 4;
+    LayoutElems[2].ValueType = VT_UINT8;
+    LayoutElems[2].IsNormalized = True;
+    LayoutElems[2].RelativeOffset = LAYOUT_ELEMENT_AUTO_OFFSET;
+    LayoutElems[2].Stride = LAYOUT_ELEMENT_AUTO_STRIDE;
+    LayoutElems[2].Frequency = INPUT_ELEMENT_FREQUENCY_PER_VERTEX;
+    LayoutElems[2].InstanceDataStepRate = 1;
+
     PSOCreateInfo.pVS = pVS;
     PSOCreateInfo.pPS = pPS;
 
     PSOCreateInfo.GraphicsPipeline.InputLayout.LayoutElements = LayoutElems;
-    PSOCreateInfo.GraphicsPipeline.InputLayout.NumElements = 2;
+    PSOCreateInfo.GraphicsPipeline.InputLayout.NumElements = 3;
 
     // Define variable type that will be used by default
     pPSODesc->ResourceLayout.DefaultVariableType = SHADER_RESOURCE_VARIABLE_TYPE_STATIC;
@@ -475,6 +621,11 @@ static void CreatePipelineState(IRenderDevice* pDevice, ISwapChain* pSwapChain)
     {
         IShaderResourceVariable_Set(pVar, (IDeviceObject*)g_pPSConstants, SET_SHADER_RESOURCE_FLAG_NONE);
     }
+    pVar = IPipelineState_GetStaticVariableByName(g_pPSO, SHADER_TYPE_PIXEL, "SdfConstants");
+    if (pVar)
+    {
+        IShaderResourceVariable_Set(pVar, (IDeviceObject*)g_pSdfConstants, SET_SHADER_RESOURCE_FLAG_NONE);
+    }
     
 
     // Since we are using mutable variable, we must create a shader resource binding object
@@ -486,30 +637,135 @@ static void CreatePipelineState(IRenderDevice* pDevice, ISwapChain* pSwapChain)
     IObject_Release(pShaderSourceFactory);
 }
 
-static void CreateVertexBuffer(IRenderDevice* pDevice)
+// distance field of the outlines of a typeface, false when the file can't be read, isn't a font or doesn't fit
+static bool build_sdf_atlas_from_ttf(sdf_atlas_t* atlas, const char* ttf_file, sp_font_t* font, const sdf_atlas_desc_t* desc)
 {
-   
-
-    BufferDesc VertBuffDesc;
-    memset(&VertBuffDesc, 0, sizeof(VertBuffDesc));
-    VertBuffDesc._DeviceObjectAttribs.Name = "Font vertex buffer";
-
-    VertBuffDesc.Usage = USAGE_DYNAMIC;
-    VertBuffDesc.BindFlags = BIND_VERTEX_BUFFER;
-    VertBuffDesc.CPUAccessFlags = CPU_ACCESS_WRITE;
-    VertBuffDesc.Size = sizeof(float) * (4 * 6 * 2048);
-    VertBuffDesc.ImmediateContextMask = 1;
+    const sp_file_stat_t stat = sp_os_api->file_system->stat(ttf_file);
+    if (!stat.exists || !stat.size)
+        return false;
+    struct sp_os_file_io_api* io = sp_os_api->file_io;
+    sp_file_o f = io->open_input(ttf_file);
+    if (!f.valid)
+        return false;
+    uint8_t* ttf = sp_alloc(g_frc.allocator, stat.size);
+    const bool read = io->read(f, ttf, stat.size) == stat.size;
+    io->close(f);
+    const bool built = read && sdf_atlas_build_from_outlines(atlas, font, ttf, stat.size, desc, g_frc.allocator);
+    sp_free(g_frc.allocator, ttf, stat.size);
+    return built;
+}
 
-    IRenderDevice_CreateBuffer(g_pDevice, &VertBuffDesc, NULL, &g_pFontVertexBuffer);
+// distance field of the coverage of the bitmap atlas
+static bool build_sdf_atlas_from_bitmap(sdf_atlas_t* atlas, const char* atlas_file, sp_font_t* font, const sdf_atlas_desc_t* desc)
+{
+    TextureLoadInfo loadInfo;
+    memset(&loadInfo, 0, sizeof(loadInfo));
+    loadInfo.IsSRGB = false;
+    loadInfo.Usage = USAGE_IMMUTABLE;
+    loadInfo.BindFlags = BIND_SHADER_RESOURCE;
+    loadInfo.GenerateMips = False;
+
+    ITextureLoader* pLoader = NULL;
+    Diligent_CreateTextureLoaderFromFile(atlas_file, IMAGE_FILE_FORMAT_UNKNOWN, &loadInfo, &pLoader);
+    if (!pLoader)
+        return false;
+    const TextureDesc* pDesc = ITextureLoader_GetTextureDesc(pLoader);
+    const TextureSubResData* pData = ITextureLoader_GetSubresourceData(pLoader, 0, 0);
+    const uint8_t* pixels = (const uint8_t*)pData->pData;
+
+    // coverage is in the alpha of rgba atlases, unless they are opaque
+    uint32_t bytes_per_pixel = 1;
+    uint32_t channel = 0;
+    if (pDesc->Format == TEX_FORMAT_RG8_UNORM)
+    {
+        bytes_per_pixel = 2;
+        channel = 1;
+    }
+    else if (pDesc->Format == TEX_FORMAT_RGBA8_UNORM || pDesc->Format == TEX_FORMAT_RGBA8_UNORM_SRGB)
+    {
+        bytes_per_pixel = 4;
+        channel = 0;
+        for (uint32_t y = 0; y < pDesc->Height && channel == 0; ++y)
+        {
+            for (uint32_t x = 0; x < pDesc->Width; ++x)
+            {
+                if (pixels[(uint64_t)y * pData->Stride + x * 4 + 3] != 0xFF)
+                {
+                    channel = 3;
+                    break;
+                }
+            }
+        }
+    }
 
-   
+    const bool built = sdf_atlas_build(atlas, font, pixels, pDesc->Width, pDesc->Height, (uint32_t)pData->Stride, bytes_per_pixel, channel, desc, g_frc.allocator);
+    IObject_Release((IObject*)pLoader);
+    return built;
 }
 
+// distance field texture of a font, its glyphs are moved to the new atlas. Rendered from the outlines when the
+// font names its typeface, from the bitmap atlas otherwise. NULL when neither loads or the glyphs don't fit
+static ITextureView* create_sdf_atlas_texture(IRenderDevice* pDevice, const char* atlas_file, const char* ttf_file, sp_font_t* font)
+{
+    const sdf_atlas_desc_t sdf_desc = { .spread = FONT_SDF_SPREAD, .downscale = FONT_SDF_DOWNSCALE, .max_size = FONT_SDF_MAX_ATLAS_SIZE };
+    sdf_atlas_t atlas;
+    if (!(ttf_file[0] && build_sdf_atlas_from_ttf(&atlas, ttf_file, font, &sdf_desc)) && !build_sdf_atlas_from_bitmap(&atlas, atlas_file, font, &sdf_desc))
+        return NULL;
+
+    TextureDesc texture_desc;
+    memset(&texture_desc, 0, sizeof(texture_desc));
+    texture_desc._DeviceObjectAttribs.Name = "Font sdf atlas";
+    texture_desc.Type = RESOURCE_DIM_TEX_2D;
+    texture_desc.Width = atlas.width;
+    texture_desc.Height = atlas.height;
+    texture_desc.ArraySize = 1;
+    texture_desc.MipLevels = 1;
+    texture_desc.SampleCount = 1;
+    texture_desc.Usage = USAGE_IMMUTABLE;
+    texture_desc.Format = TEX_FORMAT_R8_UNORM;
+    texture_desc.BindFlags = BIND_SHADER_RESOURCE;
+    texture_desc.ImmediateContextMask = 1;
+
+    TextureSubResData subresource;
+    memset(&subresource, 0, sizeof(subresource));
+    subresource.pData = atlas.texels;
+    subresource.Stride = atlas.width;
+    TextureData texture_data;
+    memset(&texture_data, 0, sizeof(texture_data));
+    texture_data.pSubResources = &subresource;
+    texture_data.NumSubresources = 1;
 
+    ITexture* pTex = NULL;
+    IRenderDevice_CreateTexture(pDevice, &texture_desc, &texture_data, &pTex);
+    g_frc.sdf_spread = atlas.spread;
+    g_frc.sdf_atlas_width = (float)atlas.width;
+    g_frc.sdf_atlas_height = (float)atlas.height;
+    g_frc.solid_uv = atlas.solid_uv;
+    sdf_atlas_free(&atlas);
+    if (!pTex)
+        return NULL;
 
+    ITextureView* pTextureSRV = ITexture_GetDefaultView(pTex, TEXTURE_VIEW_SHADER_RESOURCE);
+    IObject_AddRef((IObject*)pTextureSRV);
+    IObject_Release((IObject*)pTex);
+    return pTextureSRV;
+}
 
-static void LoadTexture(IRenderDevice* pDevice)
+// srv of the font atlas with a reference held. Tries the distance field first, the glyphs of font 0 address
+// whichever atlas is returned
+static ITextureView* load_font_atlas(IRenderDevice* pDevice, const char* atlas_file)
 {
+    g_frc.sdf = false;
+    if (g_frc.num_fonts)
+    {
+        ITextureView* pSdfSRV = create_sdf_atlas_texture(pDevice, atlas_file, g_frc.ttf_files[0], &g_frc.fonts[0]);
+        if (pSdfSRV)
+        {
+            g_frc.sdf = true;
+            return pSdfSRV;
+        }
+    }
+
     TextureLoadInfo loadInfo;
     memset(&loadInfo, 0, sizeof(loadInfo));
     loadInfo.IsSRGB = true;
@@ -518,23 +774,57 @@ static void LoadTexture(IRenderDevice* pDevice)
     loadInfo.GenerateMips = True;
 
     ITexture* pTex = NULL;
-    Diligent_CreateTextureFromFile("test_0.png", &loadInfo, pDevice, &pTex);
+    Diligent_CreateTextureFromFile(atlas_file, &loadInfo, pDevice, &pTex);
+    if (!pTex)
+        return NULL;
     // Get shader resource view from the texture
     ITextureView* pTextureSRV = ITexture_GetDefaultView(pTex, TEXTURE_VIEW_SHADER_RESOURCE);
+    IObject_AddRef((IObject*)pTextureSRV);
+    IObject_Release((IObject*)pTex);
+    return pTextureSRV;
+}
 
+static void LoadTexture(ITextureView* pTextureSRV)
+{
     // Set texture SRV in the SRB
     IShaderResourceVariable* pVar = IShaderResourceBinding_GetVariableByName(g_pSRB, SHADER_TYPE_PIXEL, "g_Texture");
     if (pVar)
     {
         IShaderResourceVariable_Set(pVar, (IDeviceObject*)pTextureSRV, SET_SHADER_RESOURCE_FLAG_NONE);
     }
-    
-    IObject_Release((IObject*)pTex);
+}
+
+ui_context_t* font_get_ui(void)
+{
+    // the allocator is set by CreateResources and cleared by ReleaseResources
+    return g_frc.allocator ? &g_frc.ui : NULL;
+}
+
+font_frame_stats_t font_get_frame_stats(void)
+{
+    return g_frc.stats;
+}
+
+void font_draw_text(float x, float y, const char* str, uint32_t color)
+{
+    if (!g_frc.num_fonts)
+        return;
+    g_frc.state_color = color;
+    font_render_string(&g_frc, x, y, str);
+}
+
+void font_set_sdf_effects(sp_vec4_t outline_color, float outline_width, sp_vec4_t shadow_color, float shadow_softness, sp_vec2_t shadow_offset)
+{
+    g_frc.outline_color = outline_color;
+    g_frc.outline_width = outline_width;
+    g_frc.shadow_color = shadow_color;
+    g_frc.shadow_softness = shadow_softness;
+    g_frc.shadow_offset = shadow_offset;
 }
 
 
 
-void CreateResources(IRenderDevice* pDevice, ISwapChain* pSwapChain)
+void CreateResources(IRenderDevice* pDevice, ISwapChain* pSwapChain, const char* assets_root)
 {
     g_pDevice = pDevice;
     IObject_AddRef(g_pDevice);
@@ -544,12 +834,31 @@ void CreateResources(IRenderDevice* pDevice, ISwapChain* pSwapChain)
 
     
 
+    g_frc.allocator = sp_allocator_api->system_allocator;
+    text_layout_cache_init(&g_frc.layout_cache, FONT_LAYOUT_CACHE_MAX_ENTRIES, FONT_LAYOUT_CACHE_MAX_VERTICES, g_frc.allocator);
+    reset_font_rendering_context(&g_frc);
+
+    // the distance field atlas moves the glyphs, the font is loaded first
+    char font_file[FONT_PATH_LEN];
+    char atlas_file[FONT_PATH_LEN];
+    sp_sprintf_api->print(font_file, sizeof(font_file), "%s/%s", assets_root, FONT_FILE);
+    sp_sprintf_api->print(atlas_file, sizeof(atlas_file), "%s/%s", assets_root, FONT_ATLAS_FILE);
+    load_font_file(font_file);
+    ITextureView* pAtlasSRV = load_font_atlas(pDevice, atlas_file);
+
     CreatePipelineState(pDevice, pSwapChain);
-    CreateVertexBuffer(pDevice);
+    CreateVertexBuffer(pDevice, FONT_MIN_GPU_QUADS);
     
-    LoadTexture(pDevice);
+    if (pAtlasSRV)
+    {
+        LoadTexture(pAtlasSRV);
+        IObject_Release((IObject*)pAtlasSRV);
+    }
 
-    load_font_file("C:/Users/oferr/Documents/temp/bitmapfont/first.fnt");
+    // only the distance field atlas has a solid texel, over the bitmap atlas panels aren't drawn
+    ui_init(&g_frc.ui, &g_frc.fonts[0], g_frc.allocator);
+    if (g_frc.sdf)
+        ui_set_solid_uv(&g_frc.ui, g_frc.solid_uv);
 
     
 }
@@ -557,12 +866,26 @@ void CreateResources(IRenderDevice* pDevice, ISwapChain* pSwapChain)
 void ReleaseResources()
 {
     
+    for (uint32_t i = 0; i < g_frc.num_fonts; ++i)
+        font_destroy(&g_frc.fonts[i], g_frc.allocator);
+    g_frc.num_fonts = 0;
+    text_layout_cache_destroy(&g_frc.layout_cache);
+    ui_destroy(&g_frc.ui);
+    sp_array_free(g_frc.vertices_arr, g_frc.allocator);
+    memset(&g_frc, 0, sizeof(g_frc));
+
     if (g_pFontVertexBuffer)
     {
         IObject_Release(g_pFontVertexBuffer);
         g_pFontVertexBuffer = NULL;
     }
 
+    if (g_pFontIndexBuffer)
+    {
+        IObject_Release(g_pFontIndexBuffer);
+        g_pFontIndexBuffer = NULL;
+    }
+
     if (g_pSRB)
     {
         IObject_Release(g_pSRB);
@@ -581,6 +904,12 @@ void ReleaseResources()
         g_pPSConstants = NULL;
     }
 
+    if (g_pSdfConstants)
+    {
+        IObject_Release(g_pSdfConstants);
+        g_pSdfConstants = NULL;
+    }
+
     if (g_pSwapChain)
     {
         IObject_Release(g_pSwapChain);
@@ -597,37 +926,55 @@ void ReleaseResources()
 // Render a frame
 void render(IDeviceContext* pContext)
 {
+    // drawn over the frame, the swap chain may have been resized since the last one
+    const SwapChainDesc* pSCDesc = ISwapChain_GetDesc(g_pSwapChain);
+    g_renderTargetWidth = (float)pSCDesc->Width;
+    g_renderTargetHeight = (float)pSCDesc->Height;
     ITextureView* pRTV = ISwapChain_GetCurrentBackBufferRTV(g_pSwapChain);
     ITextureView* pDSV = ISwapChain_GetDepthBufferDSV(g_pSwapChain);
     IDeviceContext_SetRenderTargets(pContext, 1, &pRTV, pDSV, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
-    // Clear the back buffer
-    const float ClearColor[] = { 0.850f, 0.350f, 0.350f, 1.0f };
-    IDeviceContext_ClearRenderTarget(pContext, pRTV, ClearColor, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
-    IDeviceContext_ClearDepthStencil(pContext, pDSV, CLEAR_DEPTH_FLAG, 1.f, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
 
     fill_font_buffer(pContext);
+    const uint32_t num_text_quads = (uint32_t)sp_array_size(g_frc.vertices_arr) / 4;
+    // the text is uploaded, strings drawn from here on are for the next frame
+    reset_font_rendering_context(&g_frc);
+    if (!g_frc.num_ui_quads && !num_text_quads)
+        return;
     {
         // Map the buffer and write current world-view-projection matrix
         void* pCBData = NULL;
         IDeviceContext_MapBuffer(pContext, g_pPSConstants, MAP_WRITE, MAP_FLAG_DISCARD, &pCBData);
         float* p_floats = (float* )pCBData;
-        sp_vec4_t color;
-        color.w = (g_frc.state_color & 0xFF) / 255.0f;
-        color.z = ((g_frc.state_color >> 8) & 0xFF) / 255.0f;
-        color.y = ((g_frc.state_color >> 16) & 0xFF) / 255.0f;
-        color.x = ((g_frc.state_color >> 24) & 0xFF) / 255.0f;
+        // text colours are per vertex, this tints all of it
+        const sp_vec4_t color = { 1.0f, 1.0f, 1.0f, 1.0f };
         memcpy(pCBData, &color, sizeof(color));
         p_floats[4] = g_renderTargetWidth;
         p_floats[5] = g_renderTargetHeight;
         IDeviceContext_UnmapBuffer(pContext, g_pPSConstants, MAP_WRITE);
     }
+    if (g_frc.sdf)
+    {
+        // font texels to field units and atlas uv
+        const float field_scale = 0.5f / (g_frc.sdf_spread * FONT_SDF_DOWNSCALE);
+        font_sdf_constants_t* p_constants = NULL;
+        IDeviceContext_MapBuffer(pContext, g_pSdfConstants, MAP_WRITE, MAP_FLAG_DISCARD, &p_constants);
+        p_constants->outline_color = g_frc.outline_color;
+        p_constants->shadow_color = g_frc.shadow_color;
+        p_constants->params = (sp_vec4_t){
+            g_frc.outline_width * field_scale,
+            g_frc.shadow_softness * field_scale,
+            g_frc.shadow_offset.x / (FONT_SDF_DOWNSCALE * g_frc.sdf_atlas_width),
+            g_frc.shadow_offset.y / (FONT_SDF_DOWNSCALE * g_frc.sdf_atlas_height),
+        };
+        IDeviceContext_UnmapBuffer(pContext, g_pSdfConstants, MAP_WRITE);
+    }
 
     // Bind vertex and index buffers
     const Uint64 offset = 0;
     IBuffer* pBuffs[1];
     pBuffs[0] = g_pFontVertexBuffer;
     IDeviceContext_SetVertexBuffers(pContext, 0, 1, pBuffs, &offset, RESOURCE_STATE_TRANSITION_MODE_TRANSITION, SET_VERTEX_BUFFERS_FLAG_RESET);
-    //IDeviceContext_SetIndexBuffer(pContext, g_pCubeIndexBuffer, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+    IDeviceContext_SetIndexBuffer(pContext, g_pFontIndexBuffer, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
 
     // Set the pipeline state
     IDeviceContext_SetPipelineState(pContext, g_pPSO);
@@ -635,13 +982,37 @@ void render(IDeviceContext* pContext)
     // makes sure that resources are transitioned to required states.
     IDeviceContext_CommitShaderResources(pContext, g_pSRB, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
 
-    DrawAttribs draw_attrs;
+    DrawIndexedAttribs draw_attrs;
     memset(&draw_attrs, 0, sizeof(draw_attrs));
-    draw_attrs.NumVertices = g_frc.num_vertices;
+    draw_attrs.IndexType = VT_UINT32;
     draw_attrs.NumInstances = 1;
     // Verify the state of vertex and index buffers
     draw_attrs.Flags = DRAW_FLAG_VERIFY_ALL;
 
- 
-    IDeviceContext_Draw(pContext, &draw_attrs);
+    // a draw per ui clip rect, then the immediate text unclipped
+    const Uint32 rt_width = (Uint32)g_renderTargetWidth;
+    const Uint32 rt_height = (Uint32)g_renderTargetHeight;
+    const uint32_t num_batches = (uint32_t)sp_array_size(g_frc.ui.batches_arr);
+    for (uint32_t i = 0; i < num_batches; ++i)
+    {
+        const ui_batch_t* batch = &g_frc.ui.batches_arr[i];
+        Rect scissor;
+        scissor.left = (Int32)batch->clip.x0;
+        scissor.top = (Int32)batch->clip.y0;
+        scissor.right = (Int32)ceilf(batch->clip.x1);
+        scissor.bottom = (Int32)ceilf(batch->clip.y1);
+        IDeviceContext_SetScissorRects(pContext, 1, &scissor, rt_width, rt_height);
+        draw_attrs.FirstIndexLocation = batch->first_quad * 6;
+        draw_attrs.NumIndices = batch->num_quads * 6;
+        IDeviceContext_DrawIndexed(pContext, &draw_attrs);
+    }
+
+    if (num_text_quads)
+    {
+        Rect scissor = { 0, 0, (Int32)rt_width, (Int32)rt_height };
+        IDeviceContext_SetScissorRects(pContext, 1, &scissor, rt_width, rt_height);
+        draw_attrs.FirstIndexLocation = g_frc.num_ui_quads * 6;
+        draw_attrs.NumIndices = num_text_quads * 6;
+        IDeviceContext_DrawIndexed(pContext, &draw_attrs);
+    }
 }
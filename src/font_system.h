@@ -0,0 +1,33 @@
+#pragma once
+
+#include "core/sapphire_types.h"
+#include "game_ui.h"
+
+// Text and game ui over the frame.
+//
+// CreateResources loads the font and its atlas from the assets root and creates the ui, render draws the ui and
+// then the immediate text into the back buffer, ReleaseResources frees everything. They take Diligent objects and
+// are declared by the app. The ui is built and changed through font_get_ui with the game_ui.h api, render lays it
+// out and uploads its geometry. Immediate text is drawn with font_draw_text and lasts for the next render only.
+
+// cpu cost of the text and ui of the last frame
+typedef struct font_frame_stats_t
+{
+    // ui_update, a layout and geometry rebuild only when a widget changed
+    float ui_update_ms;
+    // the ui update, the immediate text and the vertex upload
+    float fill_ms;
+    uint32_t num_ui_quads;
+    uint32_t num_text_quads;
+    // the ui geometry was rebuilt this frame
+    bool ui_rebuilt;
+} font_frame_stats_t;
+
+// the game ui drawn every frame, NULL while the font resources aren't created
+ui_context_t* font_get_ui(void);
+// single line of text in the next render, x y is its top left in pixels and color is 0xRRGGBBAA
+void font_draw_text(float x, float y, const char* str, uint32_t color);
+// outline and drop shadow of distance field text, in font texels. Widths and offsets past the field spread are
+// cut off, transparent colours turn the effects off
+void font_set_sdf_effects(sp_vec4_t outline_color, float outline_width, sp_vec4_t shadow_color, float shadow_softness, sp_vec2_t shadow_offset);
+font_frame_stats_t font_get_frame_stats(void);
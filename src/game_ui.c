@@ -0,0 +1,509 @@
+#include "game_ui.h"
+
+#include "core/allocator.h"
+#include "core/array.h"
+
+#include <memory.h>
+#include <string.h>
+
+static bool widget_valid(const ui_context_t* ui, ui_widget_handle_t handle)
+{
+    return handle != SP_INVALID_HANDLE && sp_handle_table_valid(&ui->table, handle);
+}
+
+static ui_widget_t* get_widget(const ui_context_t* ui, ui_widget_handle_t handle)
+{
+    return &ui->widgets_arr[sp_handle_index(handle)];
+}
+
+static ui_rect_t place_rect(const ui_rect_t* parent, const ui_placement_t* placement)
+{
+    const float width = parent->x1 - parent->x0;
+    const float height = parent->y1 - parent->y0;
+    ui_rect_t rect;
+    rect.x0 = parent->x0 + placement->anchor_min.x * width + placement->offset_min.x;
+    rect.y0 = parent->y0 + placement->anchor_min.y * height + placement->offset_min.y;
+    rect.x1 = parent->x0 + placement->anchor_max.x * width + placement->offset_max.x;
+    rect.y1 = parent->y0 + placement->anchor_max.y * height + placement->offset_max.y;
+    return rect;
+}
+
+static ui_rect_t intersect_rects(const ui_rect_t* a, const ui_rect_t* b)
+{
+    ui_rect_t rect;
+    rect.x0 = a->x0 > b->x0 ? a->x0 : b->x0;
+    rect.y0 = a->y0 > b->y0 ? a->y0 : b->y0;
+    rect.x1 = a->x1 < b->x1 ? a->x1 : b->x1;
+    rect.y1 = a->y1 < b->y1 ? a->y1 : b->y1;
+    return rect;
+}
+
+static bool rect_contains(const ui_rect_t* rect, float x, float y)
+{
+    return x >= rect->x0 && x < rect->x1 && y >= rect->y0 && y < rect->y1;
+}
+
+static void mark_layout_dirty(ui_context_t* ui)
+{
+    ui->layout_dirty = true;
+    ui->geometry_dirty = true;
+}
+
+static void free_text(ui_context_t* ui, ui_widget_t* widget)
+{
+    if (widget->text)
+        sp_free(ui->allocator, widget->text, widget->text_size);
+    widget->text = NULL;
+    widget->text_size = 0;
+}
+
+static void copy_text(ui_context_t* ui, ui_widget_t* widget, const char* str)
+{
+    free_text(ui, widget);
+    widget->text_size = strlen(str) + 1;
+    widget->text = sp_alloc(ui->allocator, widget->text_size);
+    memcpy(widget->text, str, widget->text_size);
+    widget->text_dirty = true;
+}
+
+static ui_widget_handle_t create_widget(ui_context_t* ui, ui_widget_handle_t parent, ui_widget_type_t type, const ui_placement_t* placement)
+{
+    uint32_t parent_slot = UI_NO_WIDGET;
+    if (parent != SP_INVALID_HANDLE)
+    {
+        if (!widget_valid(ui, parent))
+            return SP_INVALID_HANDLE;
+        parent_slot = sp_handle_index(parent);
+    }
+
+    const ui_widget_handle_t handle = sp_handle_table_alloc(&ui->table);
+    const uint32_t slot = sp_handle_index(handle);
+    while (sp_array_size(ui->widgets_arr) <= slot)
+    {
+        ui_widget_t unused = { 0 };
+        sp_array_push(ui->widgets_arr, unused, ui->allocator);
+    }
+
+    ui_widget_t* widget = &ui->widgets_arr[slot];
+    memset(widget, 0, sizeof(ui_widget_t));
+    widget->handle = handle;
+    widget->type = type;
+    widget->placement = *placement;
+    widget->color = 0xFFFFFFFF;
+    widget->visible = true;
+    widget->parent = parent_slot;
+    widget->first_child = UI_NO_WIDGET;
+    widget->last_child = UI_NO_WIDGET;
+    widget->next_sibling = UI_NO_WIDGET;
+
+    // appended, so it is drawn over its older siblings
+    uint32_t* first = parent_slot == UI_NO_WIDGET ? &ui->first_root : &ui->widgets_arr[parent_slot].first_child;
+    uint32_t* last = parent_slot == UI_NO_WIDGET ? &ui->last_root : &ui->widgets_arr[parent_slot].last_child;
+    widget->prev_sibling = *last;
+    if (*last != UI_NO_WIDGET)
+        ui->widgets_arr[*last].next_sibling = slot;
+    else
+        *first = slot;
+    *last = slot;
+
+    mark_layout_dirty(ui);
+    return handle;
+}
+
+static void remove_subtree(ui_context_t* ui, uint32_t slot)
+{
+    while (ui->widgets_arr[slot].first_child != UI_NO_WIDGET)
+        remove_subtree(ui, ui->widgets_arr[slot].first_child);
+
+    ui_widget_t* widget = &ui->widgets_arr[slot];
+    uint32_t* first = widget->parent == UI_NO_WIDGET ? &ui->first_root : &ui->widgets_arr[widget->parent].first_child;
+    uint32_t* last = widget->parent == UI_NO_WIDGET ? &ui->last_root : &ui->widgets_arr[widget->parent].last_child;
+    if (widget->prev_sibling != UI_NO_WIDGET)
+        ui->widgets_arr[widget->prev_sibling].next_sibling = widget->next_sibling;
+    else
+        *first = widget->next_sibling;
+    if (widget->next_sibling != UI_NO_WIDGET)
+        ui->widgets_arr[widget->next_sibling].prev_sibling = widget->prev_sibling;
+    else
+        *last = widget->prev_sibling;
+
+    free_text(ui, widget);
+    text_layout_free(&widget->text_layout, ui->allocator);
+    sp_handle_table_release(&ui->table, widget->handle);
+    widget->handle = SP_INVALID_HANDLE;
+}
+
+void ui_init(ui_context_t* ui, const sp_font_t* font, sp_allocator_i* allocator)
+{
+    memset(ui, 0, sizeof(ui_context_t));
+    ui->allocator = allocator;
+    ui->font = font;
+    ui->first_root = UI_NO_WIDGET;
+    ui->last_root = UI_NO_WIDGET;
+    sp_handle_table_init(&ui->table, allocator);
+}
+
+void ui_destroy(ui_context_t* ui)
+{
+    while (ui->first_root != UI_NO_WIDGET)
+        remove_subtree(ui, ui->first_root);
+    sp_handle_table_destroy(&ui->table);
+    sp_array_free(ui->widgets_arr, ui->allocator);
+    sp_array_free(ui->vertices_arr, ui->allocator);
+    sp_array_free(ui->batches_arr, ui->allocator);
+}
+
+void ui_set_viewport(ui_context_t* ui, float width, float height)
+{
+    if (ui->width == width && ui->height == height)
+        return;
+    ui->width = width;
+    ui->height = height;
+    mark_layout_dirty(ui);
+}
+
+void ui_set_solid_uv(ui_context_t* ui, sp_vec2_t uv)
+{
+    ui->solid_uv = uv;
+    ui->has_solid_uv = true;
+    ui->geometry_dirty = true;
+}
+
+ui_widget_handle_t ui_create_panel(ui_context_t* ui, ui_widget_handle_t parent, const ui_placement_t* placement, uint32_t color)
+{
+    const ui_widget_handle_t handle = create_widget(ui, parent, UI_WIDGET_PANEL, placement);
+    if (handle != SP_INVALID_HANDLE)
+        get_widget(ui, handle)->color = color;
+    return handle;
+}
+
+ui_widget_handle_t ui_create_image(ui_context_t* ui, ui_widget_handle_t parent, const ui_placement_t* placement, uint32_t icon, uint32_t color)
+{
+    const ui_widget_handle_t handle = create_widget(ui, parent, UI_WIDGET_IMAGE, placement);
+    if (handle != SP_INVALID_HANDLE)
+    {
+        ui_widget_t* widget = get_widget(ui, handle);
+        widget->icon = icon;
+        widget->color = color;
+    }
+    return handle;
+}
+
+ui_widget_handle_t ui_create_text(ui_context_t* ui, ui_widget_handle_t parent, const ui_placement_t* placement, const char* str, const text_style_t* style)
+{
+    const ui_widget_handle_t handle = create_widget(ui, parent, UI_WIDGET_TEXT, placement);
+    if (handle != SP_INVALID_HANDLE)
+    {
+        ui_widget_t* widget = get_widget(ui, handle);
+        widget->style = *style;
+        copy_text(ui, widget, str);
+    }
+    return handle;
+}
+
+void ui_remove(ui_context_t* ui, ui_widget_handle_t handle)
+{
+    if (!widget_valid(ui, handle))
+        return;
+    remove_subtree(ui, sp_handle_index(handle));
+    mark_layout_dirty(ui);
+}
+
+bool ui_valid(const ui_context_t* ui, ui_widget_handle_t handle)
+{
+    return widget_valid(ui, handle);
+}
+
+void ui_set_placement(ui_context_t* ui, ui_widget_handle_t handle, const ui_placement_t* placement)
+{
+    if (!widget_valid(ui, handle))
+        return;
+    ui_widget_t* widget = get_widget(ui, handle);
+    if (memcmp(&widget->placement, placement, sizeof(ui_placement_t)) == 0)
+        return;
+    widget->placement = *placement;
+    mark_layout_dirty(ui);
+}
+
+void ui_set_stack(ui_context_t* ui, ui_widget_handle_t handle, ui_stack_t stack, float padding, float spacing)
+{
+    if (!widget_valid(ui, handle))
+        return;
+    ui_widget_t* widget = get_widget(ui, handle);
+    if (widget->stack == stack && widget->padding == padding && widget->spacing == spacing)
+        return;
+    widget->stack = stack;
+    widget->padding = padding;
+    widget->spacing = spacing;
+    mark_layout_dirty(ui);
+}
+
+void ui_set_color(ui_context_t* ui, ui_widget_handle_t handle, uint32_t color)
+{
+    if (!widget_valid(ui, handle))
+        return;
+    ui_widget_t* widget = get_widget(ui, handle);
+    if (widget->color == color)
+        return;
+    widget->color = color;
+    ui->geometry_dirty = true;
+}
+
+void ui_set_icon(ui_context_t* ui, ui_widget_handle_t handle, uint32_t icon)
+{
+    if (!widget_valid(ui, handle))
+        return;
+    ui_widget_t* widget = get_widget(ui, handle);
+    if (widget->icon == icon)
+        return;
+    widget->icon = icon;
+    ui->geometry_dirty = true;
+}
+
+void ui_set_text(ui_context_t* ui, ui_widget_handle_t handle, const char* str)
+{
+    if (!widget_valid(ui, handle))
+        return;
+    ui_widget_t* widget = get_widget(ui, handle);
+    if (widget->text && strcmp(widget->text, str) == 0)
+        return;
+    copy_text(ui, widget, str);
+    mark_layout_dirty(ui);
+}
+
+void ui_set_text_style(ui_context_t* ui, ui_widget_handle_t handle, const text_style_t* style)
+{
+    if (!widget_valid(ui, handle))
+        return;
+    ui_widget_t* widget = get_widget(ui, handle);
+    if (memcmp(&widget->style, style, sizeof(text_style_t)) == 0)
+        return;
+    widget->style = *style;
+    widget->text_dirty = true;
+    mark_layout_dirty(ui);
+}
+
+void ui_set_visible(ui_context_t* ui, ui_widget_handle_t handle, bool visible)
+{
+    if (!widget_valid(ui, handle))
+        return;
+    ui_widget_t* widget = get_widget(ui, handle);
+    if (widget->visible == visible)
+        return;
+    widget->visible = visible;
+    // stacks close the gap
+    mark_layout_dirty(ui);
+}
+
+void ui_set_clip(ui_context_t* ui, ui_widget_handle_t handle, bool clip)
+{
+    if (!widget_valid(ui, handle))
+        return;
+    ui_widget_t* widget = get_widget(ui, handle);
+    if (widget->clip == clip)
+        return;
+    widget->clip = clip;
+    ui->geometry_dirty = true;
+}
+
+ui_rect_t ui_get_rect(const ui_context_t* ui, ui_widget_handle_t handle)
+{
+    if (!widget_valid(ui, handle))
+        return (ui_rect_t){ 0 };
+    return get_widget(ui, handle)->rect;
+}
+
+// topmost widget of the subtree under the point, children are over their parent and later siblings over
+// earlier ones
+static uint32_t widget_at(const ui_context_t* ui, uint32_t slot, float x, float y)
+{
+    const ui_widget_t* widget = &ui->widgets_arr[slot];
+    if (!widget->visible)
+        return UI_NO_WIDGET;
+    const bool inside = rect_contains(&widget->rect, x, y);
+    if (widget->clip && !inside)
+        return UI_NO_WIDGET;
+    for (uint32_t child = widget->last_child; child != UI_NO_WIDGET; child = ui->widgets_arr[child].prev_sibling)
+    {
+        const uint32_t hit = widget_at(ui, child, x, y);
+        if (hit != UI_NO_WIDGET)
+            return hit;
+    }
+    return inside ? slot : UI_NO_WIDGET;
+}
+
+ui_widget_handle_t ui_widget_at(const ui_context_t* ui, float x, float y)
+{
+    for (uint32_t root = ui->last_root; root != UI_NO_WIDGET; root = ui->widgets_arr[root].prev_sibling)
+    {
+        const uint32_t hit = widget_at(ui, root, x, y);
+        if (hit != UI_NO_WIDGET)
+            return ui->widgets_arr[hit].handle;
+    }
+    return SP_INVALID_HANDLE;
+}
+
+sp_strhash_t ui_hit_link(const ui_context_t* ui, ui_widget_handle_t handle, float x, float y)
+{
+    if (!widget_valid(ui, handle))
+        return 0;
+    const ui_widget_t* widget = get_widget(ui, handle);
+    if (widget->type != UI_WIDGET_TEXT)
+        return 0;
+    return text_layout_hit_link(&widget->text_layout, x - widget->rect.x0, y - widget->rect.y0);
+}
+
+// lays out the text of a widget if its string, style or width changed since the last time
+static void layout_text(ui_context_t* ui, ui_widget_t* widget, float width)
+{
+    if (!widget->text_dirty && widget->text_layout_width == width)
+        return;
+    text_layout_free(&widget->text_layout, ui->allocator);
+    text_layout(ui->font, widget->text, width > 0.0f ? width : 0.0f, &widget->style, &widget->text_layout, ui->allocator);
+    widget->text_layout_width = width;
+    widget->text_dirty = false;
+}
+
+static void layout_widget(ui_context_t* ui, uint32_t slot, ui_rect_t rect)
+{
+    ui_widget_t* widget = &ui->widgets_arr[slot];
+    if (widget->type == UI_WIDGET_TEXT)
+    {
+        layout_text(ui, widget, rect.x1 - rect.x0);
+        // text without a height takes the height of its lines
+        if (rect.y1 <= rect.y0)
+            rect.y1 = rect.y0 + widget->text_layout.height;
+    }
+    widget->rect = rect;
+
+    const ui_rect_t content = {
+        rect.x0 + widget->padding,
+        rect.y0 + widget->padding,
+        rect.x1 - widget->padding,
+        rect.y1 - widget->padding,
+    };
+    float cursor = widget->stack == UI_STACK_HORIZONTAL ? content.x0 : content.y0;
+    for (uint32_t child = widget->first_child; child != UI_NO_WIDGET; child = ui->widgets_arr[child].next_sibling)
+    {
+        const ui_widget_t* child_widget = &ui->widgets_arr[child];
+        if (!child_widget->visible)
+            continue;
+        ui_rect_t child_rect = place_rect(&content, &child_widget->placement);
+        // stacked children keep their size along the stack and are moved to the cursor
+        if (widget->stack == UI_STACK_VERTICAL)
+        {
+            child_rect.y1 = cursor + (child_rect.y1 - child_rect.y0);
+            child_rect.y0 = cursor;
+        }
+        else if (widget->stack == UI_STACK_HORIZONTAL)
+        {
+            child_rect.x1 = cursor + (child_rect.x1 - child_rect.x0);
+            child_rect.x0 = cursor;
+        }
+        layout_widget(ui, child, child_rect);
+
+        const ui_rect_t* placed = &ui->widgets_arr[child].rect;
+        if (widget->stack == UI_STACK_VERTICAL)
+            cursor = placed->y1 + widget->spacing;
+        else if (widget->stack == UI_STACK_HORIZONTAL)
+            cursor = placed->x1 + widget->spacing;
+    }
+}
+
+// quads continue the last batch while the clip rect is the same
+static void add_batch_quads(ui_context_t* ui, uint32_t first_quad, uint32_t num_quads, const ui_rect_t* clip)
+{
+    if (!num_quads)
+        return;
+    const uint32_t num_batches = (uint32_t)sp_array_size(ui->batches_arr);
+    if (num_batches)
+    {
+        ui_batch_t* last = &ui->batches_arr[num_batches - 1];
+        if (memcmp(&last->clip, clip, sizeof(ui_rect_t)) == 0)
+        {
+            last->num_quads += num_quads;
+            return;
+        }
+    }
+    const ui_batch_t batch = { .first_quad = first_quad, .num_quads = num_quads, .clip = *clip };
+    sp_array_push(ui->batches_arr, batch, ui->allocator);
+}
+
+static void push_quad(ui_context_t* ui, const ui_rect_t* rect, float u0, float v0, float u1, float v1, uint32_t color)
+{
+    const font_vertex_t quad[4] = {
+        { { rect->x0, rect->y0 }, { u0, v0 }, color },
+        { { rect->x1, rect->y0 }, { u1, v0 }, color },
+        { { rect->x0, rect->y1 }, { u0, v1 }, color },
+        { { rect->x1, rect->y1 }, { u1, v1 }, color },
+    };
+    for (uint32_t i = 0; i < 4; ++i)
+        sp_array_push(ui->vertices_arr, quad[i], ui->allocator);
+}
+
+static void build_widget(ui_context_t* ui, uint32_t slot, const ui_rect_t* clip)
+{
+    const ui_widget_t* widget = &ui->widgets_arr[slot];
+    if (!widget->visible)
+        return;
+
+    const uint32_t first_quad = (uint32_t)sp_array_size(ui->vertices_arr) / 4;
+    if (widget->type == UI_WIDGET_PANEL)
+    {
+        if (ui->has_solid_uv && (widget->color & 0xFF))
+            push_quad(ui, &widget->rect, ui->solid_uv.x, ui->solid_uv.y, ui->solid_uv.x, ui->solid_uv.y, font_vertex_color(widget->color));
+    }
+    else if (widget->type == UI_WIDGET_IMAGE && (widget->color & 0xFF))
+    {
+        const sp_font_glyph_t* glyph = font_find_glyph(ui->font, widget->icon);
+        if (glyph)
+            push_quad(ui, &widget->rect, glyph->u0, glyph->v0, glyph->u1, glyph->v1, font_vertex_color(widget->color));
+    }
+    else if (widget->type == UI_WIDGET_TEXT)
+    {
+        const uint32_t num_vertices = (uint32_t)sp_array_size(widget->text_layout.vertices_arr);
+        for (uint32_t i = 0; i < num_vertices; ++i)
+        {
+            font_vertex_t vertex = widget->text_layout.vertices_arr[i];
+            vertex.pos.x += widget->rect.x0;
+            vertex.pos.y += widget->rect.y0;
+            sp_array_push(ui->vertices_arr, vertex, ui->allocator);
+        }
+    }
+    add_batch_quads(ui, first_quad, (uint32_t)sp_array_size(ui->vertices_arr) / 4 - first_quad, clip);
+
+    if (widget->first_child == UI_NO_WIDGET)
+        return;
+    const ui_rect_t children_clip = widget->clip ? intersect_rects(clip, &widget->rect) : *clip;
+    if (children_clip.x1 <= children_clip.x0 || children_clip.y1 <= children_clip.y0)
+        return;
+    for (uint32_t child = widget->first_child; child != UI_NO_WIDGET; child = ui->widgets_arr[child].next_sibling)
+        build_widget(ui, child, &children_clip);
+}
+
+bool ui_update(ui_context_t* ui)
+{
+    if (!ui->layout_dirty && !ui->geometry_dirty)
+        return false;
+
+    const ui_rect_t viewport = { 0.0f, 0.0f, ui->width, ui->height };
+    if (ui->layout_dirty)
+    {
+        for (uint32_t root = ui->first_root; root != UI_NO_WIDGET; root = ui->widgets_arr[root].next_sibling)
+        {
+            if (ui->widgets_arr[root].visible)
+                layout_widget(ui, root, place_rect(&viewport, &ui->widgets_arr[root].placement));
+        }
+    }
+
+    if (ui->vertices_arr)
+        sp_array_header(ui->vertices_arr)->size = 0;
+    if (ui->batches_arr)
+        sp_array_header(ui->batches_arr)->size = 0;
+    for (uint32_t root = ui->first_root; root != UI_NO_WIDGET; root = ui->widgets_arr[root].next_sibling)
+        build_widget(ui, root, &viewport);
+
+    ui->layout_dirty = false;
+    ui->geometry_dirty = false;
+    return true;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "core/sapphire_types.h"
+#include "core/handle_table.h"
+#include "text_layout.h"
+
+typedef struct sp_allocator_i sp_allocator_i;
+
+// Retained mode game UI.
+//
+// Widgets form a tree, children are drawn over their parent in the order they were added and top level widgets
+// are placed in the viewport. A widget is placed by anchors, fractions of its parent rect, and pixel offsets
+// from them. A parent with a stack places its visible children one after the other instead, only their size is
+// taken from the offsets.
+//
+// Setters only mark what changed. ui_update does nothing when the tree is clean, otherwise it lays out the tree
+// if a placement, stack, text or the viewport changed and rebuilds the geometry. Text is laid out again only for
+// the text widgets whose string, style or width changed, so a colour change or a moved panel costs a walk over
+// the widgets and no text layout.
+//
+// The geometry is quads of font vertices addressing the font atlas: text and images are glyphs of the font,
+// images being baked into it as icons in the private use area, and panels sample a texel that is fully covered
+// (sdf_atlas_t::solid_uv). An atlas without such a texel doesn't draw panels at all. The whole UI is drawn with the font pipeline from one vertex buffer, batches only
+// split where the clip rect changes.
+
+typedef uint32_t ui_widget_handle_t;
+
+// slot index that refers to no widget
+#define UI_NO_WIDGET UINT32_MAX
+
+typedef enum ui_widget_type_t
+{
+    // solid quad
+    UI_WIDGET_PANEL,
+    // icon glyph stretched over the rect
+    UI_WIDGET_IMAGE,
+    // text wrapped at the width of the rect
+    UI_WIDGET_TEXT,
+} ui_widget_type_t;
+
+typedef enum ui_stack_t
+{
+    UI_STACK_NONE,
+    UI_STACK_VERTICAL,
+    UI_STACK_HORIZONTAL,
+} ui_stack_t;
+
+typedef struct ui_rect_t
+{
+    float x0, y0, x1, y1;
+} ui_rect_t;
+
+typedef struct ui_placement_t
+{
+    // fractions of the parent rect, min is the top left
+    sp_vec2_t anchor_min;
+    sp_vec2_t anchor_max;
+    // pixels added to the anchored corners
+    sp_vec2_t offset_min;
+    sp_vec2_t offset_max;
+} ui_placement_t;
+
+typedef struct ui_batch_t
+{
+    uint32_t first_quad;
+    uint32_t num_quads;
+    // pixels, y down
+    ui_rect_t clip;
+} ui_batch_t;
+
+typedef struct ui_widget_t
+{
+    ui_widget_handle_t handle;
+    ui_widget_type_t type;
+    ui_placement_t placement;
+    ui_stack_t stack;
+    // stacks: space around and between the children
+    float padding;
+    float spacing;
+    // 0xRRGGBBAA, of panels and images. Text takes its colour from the style
+    uint32_t color;
+    // code point of the icon of images
+    uint32_t icon;
+    // owned copy of the string of text widgets
+    char* text;
+    uint64_t text_size;
+    text_style_t style;
+    text_layout_t text_layout;
+    // width text_layout was wrapped at
+    float text_layout_width;
+    bool text_dirty;
+    bool visible;
+    // clips the widget and its children to its rect
+    bool clip;
+    // slot indices
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t last_child;
+    uint32_t prev_sibling;
+    uint32_t next_sibling;
+    // as of the last update
+    ui_rect_t rect;
+} ui_widget_t;
+
+typedef struct ui_context_t
+{
+    sp_allocator_i* allocator;
+    const sp_font_t* font;
+    sp_handle_table_t table;
+    // by slot, released slots keep their memory
+    ui_widget_t* widgets_arr;
+    // top level widgets
+    uint32_t first_root;
+    uint32_t last_root;
+    float width;
+    float height;
+    sp_vec2_t solid_uv;
+    // panels are laid out but not drawn until a solid texel is set
+    bool has_solid_uv;
+    bool layout_dirty;
+    bool geometry_dirty;
+    // 4 vertices per quad like text layouts, rebuilt by ui_update
+    font_vertex_t* vertices_arr;
+    ui_batch_t* batches_arr;
+} ui_context_t;
+
+void ui_init(ui_context_t* ui, const sp_font_t* font, sp_allocator_i* allocator);
+void ui_destroy(ui_context_t* ui);
+void ui_set_viewport(ui_context_t* ui, float width, float height);
+// a texel of the font atlas that is fully covered, panels are drawn with it. Without one they aren't drawn
+void ui_set_solid_uv(ui_context_t* ui, sp_vec2_t uv);
+
+// parent is SP_INVALID_HANDLE for a top level widget. Returns SP_INVALID_HANDLE if the parent is stale
+ui_widget_handle_t ui_create_panel(ui_context_t* ui, ui_widget_handle_t parent, const ui_placement_t* placement, uint32_t color);
+ui_widget_handle_t ui_create_image(ui_context_t* ui, ui_widget_handle_t parent, const ui_placement_t* placement, uint32_t icon, uint32_t color);
+ui_widget_handle_t ui_create_text(ui_context_t* ui, ui_widget_handle_t parent, const ui_placement_t* placement, const char* str, const text_style_t* style);
+// removes the widget and its children
+void ui_remove(ui_context_t* ui, ui_widget_handle_t handle);
+bool ui_valid(const ui_context_t* ui, ui_widget_handle_t handle);
+
+void ui_set_placement(ui_context_t* ui, ui_widget_handle_t handle, const ui_placement_t* placement);
+void ui_set_stack(ui_context_t* ui, ui_widget_handle_t handle, ui_stack_t stack, float padding, float spacing);
+void ui_set_color(ui_context_t* ui, ui_widget_handle_t handle, uint32_t color);
+void ui_set_icon(ui_context_t* ui, ui_widget_handle_t handle, uint32_t icon);
+// the string is copied, setting the same string again doesn't invalidate anything
+void ui_set_text(ui_context_t* ui, ui_widget_handle_t handle, const char* str);
+void ui_set_text_style(ui_context_t* ui, ui_widget_handle_t handle, const text_style_t* style);
+void ui_set_visible(ui_context_t* ui, ui_widget_handle_t handle, bool visible);
+void ui_set_clip(ui_context_t* ui, ui_widget_handle_t handle, bool clip);
+
+// rect as of the last update
+ui_rect_t ui_get_rect(const ui_context_t* ui, ui_widget_handle_t handle);
+// topmost visible widget under a point as of the last update, SP_INVALID_HANDLE when there is none
+ui_widget_handle_t ui_widget_at(const ui_context_t* ui, float x, float y);
+// link of a text widget under a point, 0 when there is none
+sp_strhash_t ui_hit_link(const ui_context_t* ui, ui_widget_handle_t handle, float x, float y);
+
+// lays out and rebuilds the geometry if anything changed. Returns true when vertices_arr and batches_arr were
+// rebuilt
+bool ui_update(ui_context_t* ui);
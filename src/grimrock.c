@@ -256,7 +256,7 @@ void grimrock_read_nodes(uint32_t num_nodes, sapphire_mesh_gpu_load_t* p_mesh_lo
 		(void)name;
 		mat_4x3_t localToParent = read_matrix4x3(&p_curr);
 		(void)localToParent;
-		int32_t parent = *(const int32_t*)(&p_curr);
+		int32_t parent = *(const int32_t*)(p_curr);
 		(void)parent;
 		p_curr += sizeof(int32_t);
 
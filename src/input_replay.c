@@ -0,0 +1,261 @@
+#include "input_replay.h"
+
+#include "core/allocator.h"
+#include "core/array.h"
+#include "core/os.h"
+#include "core/sprintf.h"
+
+#include <memory.h>
+
+#define INPUT_REPLAY_PATH_LEN 1024
+
+struct input_replay_o
+{
+    sp_allocator_i* allocator;
+    bool recording;
+    char file[INPUT_REPLAY_PATH_LEN];
+    uint32_t num_keys;
+    double step_dt;
+    // steps recorded or played
+    uint32_t num_steps;
+    // state as of the last step, records are the changes to it
+    input_snapshot_t state;
+
+    // recorder - encoded records, step of the last record
+    uint8_t* data_arr;
+    uint32_t last_record_step;
+
+    // player - the whole file after the header
+    uint8_t* data;
+    uint64_t data_size;
+    uint64_t read_offset;
+    uint32_t num_recorded_steps;
+    // step of the next record, UINT32_MAX after the last one
+    uint32_t next_record_step;
+};
+
+static void write_bytes(input_replay_o* replay, const void* bytes, uint32_t size)
+{
+    for (uint32_t i = 0; i < size; ++i)
+        sp_array_push(replay->data_arr, ((const uint8_t*)bytes)[i], replay->allocator);
+}
+
+static void write_varint(input_replay_o* replay, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        const uint8_t byte = (uint8_t)(value | 0x80);
+        sp_array_push(replay->data_arr, byte, replay->allocator);
+        value >>= 7;
+    }
+    const uint8_t byte = (uint8_t)value;
+    sp_array_push(replay->data_arr, byte, replay->allocator);
+}
+
+// reads past the end of the data fail, the player stops there
+static bool read_bytes(input_replay_o* replay, void* bytes, uint32_t size)
+{
+    if (replay->read_offset + size > replay->data_size)
+        return false;
+    memcpy(bytes, replay->data + replay->read_offset, size);
+    replay->read_offset += size;
+    return true;
+}
+
+static bool read_varint(input_replay_o* replay, uint32_t* value)
+{
+    *value = 0;
+    for (uint32_t shift = 0; shift < 32; shift += 7)
+    {
+        uint8_t byte;
+        if (!read_bytes(replay, &byte, 1))
+            return false;
+        *value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+input_replay_o* input_recorder_create(const char* file, uint32_t num_keys, double step_dt, sp_allocator_i* allocator)
+{
+    if (num_keys > INPUT_REPLAY_MAX_KEYS)
+        return NULL;
+    input_replay_o* replay = sp_alloc(allocator, sizeof(input_replay_o));
+    memset(replay, 0, sizeof(input_replay_o));
+    replay->allocator = allocator;
+    replay->recording = true;
+    replay->num_keys = num_keys;
+    replay->step_dt = step_dt;
+    sp_sprintf_api->print(replay->file, sizeof(replay->file), "%s", file);
+    return replay;
+}
+
+void input_recorder_record_step(input_replay_o* replay, const input_snapshot_t* snapshot)
+{
+    const uint32_t step = replay->num_steps++;
+    input_snapshot_t* state = &replay->state;
+
+    uint8_t changed_keys[INPUT_REPLAY_MAX_KEYS];
+    uint8_t num_changed_keys = 0;
+    for (uint32_t i = 0; i < replay->num_keys; ++i)
+    {
+        if (snapshot->keys[i] != state->keys[i])
+            changed_keys[num_changed_keys++] = (uint8_t)i;
+    }
+    uint8_t mask = 0;
+    mask |= num_changed_keys ? INPUT_REPLAY_CHANGED_KEYS : 0;
+    mask |= snapshot->mouse_x != state->mouse_x || snapshot->mouse_y != state->mouse_y ? INPUT_REPLAY_CHANGED_MOUSE_POSITION : 0;
+    mask |= snapshot->mouse_buttons != state->mouse_buttons ? INPUT_REPLAY_CHANGED_MOUSE_BUTTONS : 0;
+    mask |= snapshot->mouse_wheel != state->mouse_wheel ? INPUT_REPLAY_CHANGED_MOUSE_WHEEL : 0;
+    if (!mask)
+        return;
+
+    const bool first_record = !replay->data_arr;
+    write_varint(replay, first_record ? step : step - replay->last_record_step);
+    write_bytes(replay, &mask, 1);
+    if (mask & INPUT_REPLAY_CHANGED_KEYS)
+    {
+        write_bytes(replay, &num_changed_keys, 1);
+        for (uint32_t i = 0; i < num_changed_keys; ++i)
+        {
+            const uint8_t key[2] = { changed_keys[i], snapshot->keys[changed_keys[i]] };
+            write_bytes(replay, key, 2);
+        }
+    }
+    if (mask & INPUT_REPLAY_CHANGED_MOUSE_POSITION)
+    {
+        write_bytes(replay, &snapshot->mouse_x, sizeof(float));
+        write_bytes(replay, &snapshot->mouse_y, sizeof(float));
+    }
+    if (mask & INPUT_REPLAY_CHANGED_MOUSE_BUTTONS)
+        write_bytes(replay, &snapshot->mouse_buttons, 1);
+    if (mask & INPUT_REPLAY_CHANGED_MOUSE_WHEEL)
+        write_bytes(replay, &snapshot->mouse_wheel, sizeof(float));
+
+    *state = *snapshot;
+    replay->last_record_step = step;
+}
+
+// reads the step delta of the next record, or marks the end of the records
+static void read_next_record_step(input_replay_o* replay, uint32_t previous_step)
+{
+    uint32_t delta;
+    replay->next_record_step = read_varint(replay, &delta) ? previous_step + delta : UINT32_MAX;
+}
+
+input_replay_o* input_player_create(const char* file, uint32_t num_keys, sp_allocator_i* allocator)
+{
+    struct sp_os_file_io_api* io = sp_os_api->file_io;
+    sp_file_o f = io->open_input(file);
+    if (!f.valid)
+        return NULL;
+
+    input_replay_header_t header;
+    if (io->read(f, &header, sizeof(header)) != sizeof(header) || header.magic != INPUT_REPLAY_MAGIC || header.version != INPUT_REPLAY_VERSION || header.num_keys != num_keys)
+    {
+        io->close(f);
+        return NULL;
+    }
+
+    input_replay_o* replay = sp_alloc(allocator, sizeof(input_replay_o));
+    memset(replay, 0, sizeof(input_replay_o));
+    replay->allocator = allocator;
+    replay->num_keys = num_keys;
+    replay->step_dt = header.step_dt;
+    replay->num_recorded_steps = header.num_steps;
+    replay->data_size = header.data_size;
+    sp_sprintf_api->print(replay->file, sizeof(replay->file), "%s", file);
+    if (header.data_size)
+    {
+        replay->data = sp_alloc(allocator, header.data_size);
+        // a short read plays as an empty recording
+        if (io->read(f, replay->data, header.data_size) != header.data_size)
+            replay->read_offset = header.data_size;
+    }
+    io->close(f);
+
+    read_next_record_step(replay, 0);
+    return replay;
+}
+
+bool input_player_next_step(input_replay_o* replay, input_snapshot_t* snapshot)
+{
+    if (replay->num_steps >= replay->num_recorded_steps)
+        return false;
+    const uint32_t step = replay->num_steps++;
+
+    input_snapshot_t* state = &replay->state;
+    if (step == replay->next_record_step)
+    {
+        uint8_t mask = 0;
+        bool valid = read_bytes(replay, &mask, 1);
+        if (valid && (mask & INPUT_REPLAY_CHANGED_KEYS))
+        {
+            uint8_t num_changed_keys = 0;
+            valid = read_bytes(replay, &num_changed_keys, 1);
+            for (uint32_t i = 0; valid && i < num_changed_keys; ++i)
+            {
+                uint8_t key[2];
+                valid = read_bytes(replay, key, 2) && key[0] < replay->num_keys;
+                if (valid)
+                    state->keys[key[0]] = key[1];
+            }
+        }
+        if (valid && (mask & INPUT_REPLAY_CHANGED_MOUSE_POSITION))
+            valid = read_bytes(replay, &state->mouse_x, sizeof(float)) && read_bytes(replay, &state->mouse_y, sizeof(float));
+        if (valid && (mask & INPUT_REPLAY_CHANGED_MOUSE_BUTTONS))
+            valid = read_bytes(replay, &state->mouse_buttons, 1);
+        if (valid && (mask & INPUT_REPLAY_CHANGED_MOUSE_WHEEL))
+            valid = read_bytes(replay, &state->mouse_wheel, sizeof(float));
+
+        // a truncated recording keeps its last complete state
+        if (valid)
+            read_next_record_step(replay, step);
+        else
+            replay->next_record_step = UINT32_MAX;
+    }
+    *snapshot = *state;
+    return true;
+}
+
+double input_player_step_dt(const input_replay_o* replay)
+{
+    return replay->step_dt;
+}
+
+bool input_replay_destroy(input_replay_o* replay)
+{
+    sp_allocator_i* allocator = replay->allocator;
+    bool res = true;
+    if (replay->recording)
+    {
+        const uint64_t data_size = sp_array_size(replay->data_arr);
+        input_replay_header_t header = {
+            .magic = INPUT_REPLAY_MAGIC,
+            .version = INPUT_REPLAY_VERSION,
+            .step_dt = replay->step_dt,
+            .num_keys = replay->num_keys,
+            .num_steps = replay->num_steps,
+            .data_size = data_size,
+        };
+        struct sp_os_file_io_api* io = sp_os_api->file_io;
+        sp_file_o f = io->open_output(replay->file);
+        if (f.valid)
+        {
+            res = io->write(f, &header, sizeof(header));
+            if (data_size)
+                res = io->write(f, replay->data_arr, data_size) && res;
+            io->close(f);
+        }
+        else
+        {
+            res = false;
+        }
+        sp_array_free(replay->data_arr, allocator);
+    }
+    if (replay->data)
+        sp_free(allocator, replay->data, replay->data_size);
+    sp_free(allocator, replay, sizeof(input_replay_o));
+    return res;
+}
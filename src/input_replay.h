@@ -0,0 +1,69 @@
+#pragma once
+
+#include "core/sapphire_types.h"
+
+typedef struct sp_allocator_i sp_allocator_i;
+
+// Input recording and replay of the fixed step loop.
+//
+// The recorder takes the input the fixed step loop sees, once per step, and buffers it in memory. Only the
+// steps where something changed are stored, as the step delta and the changed fields, so a recording is a few
+// bytes per input event rather than per step. The buffer is written out when the recording is closed, there
+// is no file access while recording.
+//
+// The player hands the same input back step by step. With the same step length the simulation sees identical
+// input on every run, which together with a fixed frame time makes benchmark runs of the same gameplay
+// comparable across builds.
+//
+// File layout: input_replay_header_t, then one record per changed step:
+//   varint   steps since the previous record (the first record counts from step 0)
+//   uint8_t  INPUT_REPLAY_CHANGED_* mask
+//   keys     uint8_t count, then count pairs of uint8_t key index and uint8_t key state
+//   position float x, float y
+//   buttons  uint8_t
+//   wheel    float
+
+#define INPUT_REPLAY_MAGIC 0x52495053 // 'SPIR'
+#define INPUT_REPLAY_VERSION 1
+#define INPUT_REPLAY_MAX_KEYS 32
+
+#define INPUT_REPLAY_CHANGED_KEYS 0x01
+#define INPUT_REPLAY_CHANGED_MOUSE_POSITION 0x02
+#define INPUT_REPLAY_CHANGED_MOUSE_BUTTONS 0x04
+#define INPUT_REPLAY_CHANGED_MOUSE_WHEEL 0x08
+
+typedef struct input_replay_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    // seconds per fixed step the recording was made with
+    double step_dt;
+    uint32_t num_keys;
+    uint32_t num_steps;
+    uint64_t data_size;
+} input_replay_header_t;
+
+// input of one fixed step. Key states and mouse buttons are the flags of the input controller, stored as is
+typedef struct input_snapshot_t
+{
+    uint8_t keys[INPUT_REPLAY_MAX_KEYS];
+    float mouse_x;
+    float mouse_y;
+    float mouse_wheel;
+    uint8_t mouse_buttons;
+} input_snapshot_t;
+
+typedef struct input_replay_o input_replay_o;
+
+// num_keys is the number of keys of the snapshots, at most INPUT_REPLAY_MAX_KEYS
+input_replay_o* input_recorder_create(const char* file, uint32_t num_keys, double step_dt, sp_allocator_i* allocator);
+void input_recorder_record_step(input_replay_o* replay, const input_snapshot_t* snapshot);
+
+// NULL if the file can't be read, isn't a recording or was made with a different number of keys
+input_replay_o* input_player_create(const char* file, uint32_t num_keys, sp_allocator_i* allocator);
+// input of the next step. Returns false once all recorded steps were played, the snapshot is left unchanged
+bool input_player_next_step(input_replay_o* replay, input_snapshot_t* snapshot);
+double input_player_step_dt(const input_replay_o* replay);
+
+// writes the file of a recorder. Returns false if a recording couldn't be written
+bool input_replay_destroy(input_replay_o* replay);
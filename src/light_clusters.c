@@ -0,0 +1,264 @@
+#include "light_clusters.h"
+
+#include "core/allocator.h"
+#include "core/array.h"
+
+#include <math.h>
+#include <memory.h>
+
+enum light_clusters_pass
+{
+    LIGHT_CLUSTERS_PASS_BOUNDS,
+    LIGHT_CLUSTERS_PASS_COUNT,
+    LIGHT_CLUSTERS_PASS_FILL,
+};
+
+static uint32_t cluster_index(uint32_t x, uint32_t y, uint32_t z)
+{
+    return x + LIGHT_CLUSTERS_X * (y + LIGHT_CLUSTERS_Y * z);
+}
+
+static float plane_distance(const sp_vec4_t* plane, const sp_vec4_t* sphere)
+{
+    return plane->x * sphere->x + plane->y * sphere->y + plane->z * sphere->z + plane->w;
+}
+
+static sp_vec4_t normalize_plane(sp_vec4_t plane)
+{
+    const float length = sqrtf(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+    const float inv_length = length > 0.0f ? 1.0f / length : 0.0f;
+    return (sp_vec4_t){ plane.x * inv_length, plane.y * inv_length, plane.z * inv_length, plane.w * inv_length };
+}
+
+// boundary b of the tile grid along an axis: the points with clip.axis = b * clip.w
+static sp_vec4_t boundary_plane(const sp_vec4_t* axis_column, const sp_vec4_t* w_column, float b)
+{
+    return normalize_plane((sp_vec4_t){ axis_column->x - b * w_column->x, axis_column->y - b * w_column->y, axis_column->z - b * w_column->z, axis_column->w - b * w_column->w });
+}
+
+static uint32_t depth_slice(const light_clusters_t* clusters, float depth)
+{
+    const float slice = logf(depth) * clusters->z_scale + clusters->z_bias;
+    if (slice <= 0.0f)
+        return 0;
+    return slice >= LIGHT_CLUSTERS_Z - 1 ? LIGHT_CLUSTERS_Z - 1 : (uint32_t)slice;
+}
+
+// tiles overlapped by the sphere along one axis. The test is against the planes through the eye, so it is
+// exact per axis and conservative for the tile rectangle
+static bool tile_range(const sp_vec4_t* planes, uint32_t num_tiles, const sp_vec4_t* sphere, uint8_t* min_tile, uint8_t* max_tile)
+{
+    uint32_t first = UINT32_MAX;
+    uint32_t last = 0;
+    float d_min = plane_distance(&planes[0], sphere);
+    for (uint32_t i = 0; i < num_tiles; ++i)
+    {
+        const float d_max = plane_distance(&planes[i + 1], sphere);
+        if (d_min >= -sphere->w && d_max <= sphere->w)
+        {
+            first = first == UINT32_MAX ? i : first;
+            last = i;
+        }
+        d_min = d_max;
+    }
+    *min_tile = (uint8_t)(first == UINT32_MAX ? 1 : first);
+    *max_tile = (uint8_t)last;
+    return first != UINT32_MAX;
+}
+
+static void compute_bounds(light_clusters_t* clusters, uint32_t light)
+{
+    const sp_vec4_t* sphere = &clusters->spheres[light];
+    light_cluster_bounds_t* bounds = &clusters->bounds_arr[light];
+    // empty unless every axis overlaps
+    *bounds = (light_cluster_bounds_t){ .min_x = 1, .min_y = 1, .min_z = 1 };
+
+    const float depth = plane_distance(&clusters->depth_plane, sphere);
+    if (depth + sphere->w < clusters->near_plane || depth - sphere->w > clusters->far_plane)
+        return;
+
+    light_cluster_bounds_t b;
+    if (!tile_range(clusters->x_planes, LIGHT_CLUSTERS_X, sphere, &b.min_x, &b.max_x))
+        return;
+    if (!tile_range(clusters->y_planes, LIGHT_CLUSTERS_Y, sphere, &b.min_y, &b.max_y))
+        return;
+    b.min_z = (uint8_t)depth_slice(clusters, fmaxf(depth - sphere->w, clusters->near_plane));
+    b.max_z = (uint8_t)depth_slice(clusters, fminf(depth + sphere->w, clusters->far_plane));
+    *bounds = b;
+}
+
+// clusters are owned by depth slice, thread t handles slices t, t + num_threads, ... which also spreads the
+// dense near slices over the threads
+static void run_pass(light_clusters_t* clusters, uint32_t thread_index)
+{
+    const uint32_t stride = clusters->num_threads;
+    if (clusters->pass == LIGHT_CLUSTERS_PASS_BOUNDS)
+    {
+        for (uint32_t light = thread_index; light < clusters->num_lights; light += stride)
+            compute_bounds(clusters, light);
+        return;
+    }
+
+    for (uint32_t z = thread_index; z < LIGHT_CLUSTERS_Z; z += stride)
+    {
+        const uint32_t slice_begin = cluster_index(0, 0, z);
+        const uint32_t slice_size = LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y;
+        if (clusters->pass == LIGHT_CLUSTERS_PASS_COUNT)
+        {
+            for (uint32_t c = slice_begin; c < slice_begin + slice_size; ++c)
+                clusters->clusters[c].count = 0;
+        }
+        else
+        {
+            memset(clusters->fill_counts + slice_begin, 0, slice_size * sizeof(uint32_t));
+        }
+    }
+
+    // one walk over the lights, visiting only the owned slices of each
+    for (uint32_t light = 0; light < clusters->num_lights; ++light)
+    {
+        const light_cluster_bounds_t* b = &clusters->bounds_arr[light];
+        if (b->min_z > b->max_z)
+            continue;
+        const uint32_t first_z = b->min_z + (thread_index + stride - b->min_z % stride) % stride;
+        for (uint32_t z = first_z; z <= b->max_z; z += stride)
+        {
+            for (uint32_t y = b->min_y; y <= b->max_y; ++y)
+            {
+                const uint32_t row = cluster_index(0, y, z);
+                if (clusters->pass == LIGHT_CLUSTERS_PASS_COUNT)
+                {
+                    for (uint32_t x = b->min_x; x <= b->max_x; ++x)
+                        ++clusters->clusters[row + x].count;
+                }
+                else
+                {
+                    for (uint32_t x = b->min_x; x <= b->max_x; ++x)
+                    {
+                        light_cluster_t* cluster = &clusters->clusters[row + x];
+                        if (clusters->fill_counts[row + x] < cluster->count)
+                            clusters->indices[cluster->offset + clusters->fill_counts[row + x]++] = light;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void worker_thread(void* user_data)
+{
+    light_clusters_worker_t* worker = user_data;
+    light_clusters_t* clusters = worker->clusters;
+    for (;;)
+    {
+        sp_semaphore_wait(&worker->work);
+        if (clusters->quit)
+            break;
+        run_pass(clusters, worker->index);
+        sp_semaphore_post(&clusters->done, 1);
+    }
+}
+
+static void run_pass_on_all_threads(light_clusters_t* clusters, uint32_t pass)
+{
+    clusters->pass = pass;
+    const uint32_t num_workers = clusters->num_threads - 1;
+    for (uint32_t i = 0; i < num_workers; ++i)
+        sp_semaphore_post(&clusters->workers[i].work, 1);
+    run_pass(clusters, 0);
+    for (uint32_t i = 0; i < num_workers; ++i)
+        sp_semaphore_wait(&clusters->done);
+}
+
+void light_clusters_init(light_clusters_t* clusters, uint32_t max_indices, uint32_t num_threads, sp_allocator_i* allocator)
+{
+    memset(clusters, 0, sizeof(light_clusters_t));
+    clusters->allocator = allocator;
+    clusters->max_indices = max_indices;
+    clusters->clusters = sp_alloc(allocator, LIGHT_CLUSTERS_COUNT * sizeof(light_cluster_t));
+    memset(clusters->clusters, 0, LIGHT_CLUSTERS_COUNT * sizeof(light_cluster_t));
+    clusters->fill_counts = sp_alloc(allocator, LIGHT_CLUSTERS_COUNT * sizeof(uint32_t));
+    clusters->indices = sp_alloc(allocator, max_indices * sizeof(uint32_t));
+
+    clusters->num_threads = num_threads ? num_threads : 1;
+    sp_semaphore_init(&clusters->done, 0);
+    const uint32_t num_workers = clusters->num_threads - 1;
+    if (num_workers)
+    {
+        clusters->workers = sp_alloc(allocator, num_workers * sizeof(light_clusters_worker_t));
+        for (uint32_t i = 0; i < num_workers; ++i)
+        {
+            light_clusters_worker_t* worker = &clusters->workers[i];
+            worker->clusters = clusters;
+            worker->index = i + 1;
+            sp_semaphore_init(&worker->work, 0);
+            sp_thread_create(&worker->thread, worker_thread, worker);
+        }
+    }
+}
+
+void light_clusters_destroy(light_clusters_t* clusters)
+{
+    const uint32_t num_workers = clusters->num_threads - 1;
+    clusters->quit = true;
+    for (uint32_t i = 0; i < num_workers; ++i)
+    {
+        sp_semaphore_post(&clusters->workers[i].work, 1);
+        sp_thread_join(&clusters->workers[i].thread);
+        sp_semaphore_destroy(&clusters->workers[i].work);
+    }
+    if (num_workers)
+        sp_free(clusters->allocator, clusters->workers, num_workers * sizeof(light_clusters_worker_t));
+    sp_semaphore_destroy(&clusters->done);
+
+    sp_free(clusters->allocator, clusters->clusters, LIGHT_CLUSTERS_COUNT * sizeof(light_cluster_t));
+    sp_free(clusters->allocator, clusters->fill_counts, LIGHT_CLUSTERS_COUNT * sizeof(uint32_t));
+    sp_free(clusters->allocator, clusters->indices, clusters->max_indices * sizeof(uint32_t));
+    sp_array_free(clusters->bounds_arr, clusters->allocator);
+}
+
+void light_clusters_bin(light_clusters_t* clusters, const sp_mat4x4_t* view_projection, float near_plane, float far_plane, const sp_vec4_t* spheres, uint32_t num_lights)
+{
+    // row vectors - clip = p * view_projection, the columns give the clip coordinates as planes in world space
+    const sp_mat4x4_t* m = view_projection;
+    const sp_vec4_t column_x = { m->xx, m->yx, m->zx, m->wx };
+    const sp_vec4_t column_y = { m->xy, m->yy, m->zy, m->wy };
+    const sp_vec4_t column_w = { m->xw, m->yw, m->zw, m->ww };
+    for (uint32_t i = 0; i <= LIGHT_CLUSTERS_X; ++i)
+        clusters->x_planes[i] = boundary_plane(&column_x, &column_w, -1.0f + 2.0f * (float)i / LIGHT_CLUSTERS_X);
+    for (uint32_t i = 0; i <= LIGHT_CLUSTERS_Y; ++i)
+        clusters->y_planes[i] = boundary_plane(&column_y, &column_w, -1.0f + 2.0f * (float)i / LIGHT_CLUSTERS_Y);
+    // clip.w of a perspective projection is the view depth
+    clusters->depth_plane = normalize_plane(column_w);
+    clusters->near_plane = near_plane;
+    clusters->far_plane = far_plane;
+    clusters->z_scale = (float)LIGHT_CLUSTERS_Z / logf(far_plane / near_plane);
+    clusters->z_bias = -logf(near_plane) * clusters->z_scale;
+
+    clusters->spheres = spheres;
+    clusters->num_lights = num_lights;
+    sp_array_ensure(clusters->bounds_arr, num_lights, clusters->allocator);
+
+    run_pass_on_all_threads(clusters, LIGHT_CLUSTERS_PASS_BOUNDS);
+    run_pass_on_all_threads(clusters, LIGHT_CLUSTERS_PASS_COUNT);
+
+    // ranges of the clusters in the index list, clusters that don't fit are cut short
+    uint32_t offset = 0;
+    clusters->num_dropped = 0;
+    for (uint32_t c = 0; c < LIGHT_CLUSTERS_COUNT; ++c)
+    {
+        light_cluster_t* cluster = &clusters->clusters[c];
+        const uint32_t available = clusters->max_indices - offset;
+        if (cluster->count > available)
+        {
+            clusters->num_dropped += cluster->count - available;
+            cluster->count = available;
+        }
+        cluster->offset = offset;
+        offset += cluster->count;
+    }
+    clusters->num_indices = offset;
+
+    run_pass_on_all_threads(clusters, LIGHT_CLUSTERS_PASS_FILL);
+    clusters->spheres = NULL;
+}
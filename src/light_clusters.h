@@ -0,0 +1,89 @@
+#pragma once
+
+#include "core/sapphire_types.h"
+#include "core/thread.h"
+
+typedef struct sp_allocator_i sp_allocator_i;
+
+// Clustered light binning.
+//
+// The view frustum is split into a LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y grid of screen tiles and
+// LIGHT_CLUSTERS_Z depth slices, exponentially spaced between the near and far plane. Every frame the light
+// bounding spheres are binned into the clusters they touch, producing per cluster a range into one compact
+// light index list. The pixel shader finds its cluster from its clip position and only shades those lights.
+//
+// Binning runs in three passes - light tile ranges, cluster counts and filling the index list - each split
+// over the worker threads created at init. Clusters are owned by depth slice so the counting and filling
+// passes don't need any synchronization. The workers point back at the light_clusters_t, it may not be moved
+// once initialized.
+
+#define LIGHT_CLUSTERS_X 16
+#define LIGHT_CLUSTERS_Y 9
+#define LIGHT_CLUSTERS_Z 24
+#define LIGHT_CLUSTERS_COUNT (LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_Z)
+
+// lights of a cluster, indices_arr[offset .. offset + count)
+typedef struct light_cluster_t
+{
+    uint32_t offset;
+    uint32_t count;
+} light_cluster_t;
+
+// clusters touched by a light, inclusive. Empty (min > max) when the light is outside the frustum
+typedef struct light_cluster_bounds_t
+{
+    uint8_t min_x, max_x;
+    uint8_t min_y, max_y;
+    uint8_t min_z, max_z;
+} light_cluster_bounds_t;
+
+typedef struct light_clusters_worker_t
+{
+    struct light_clusters_t* clusters;
+    uint32_t index;
+    sp_thread_t thread;
+    sp_semaphore_t work;
+} light_clusters_worker_t;
+
+typedef struct light_clusters_t
+{
+    sp_allocator_i* allocator;
+    // LIGHT_CLUSTERS_COUNT, indexed by x + LIGHT_CLUSTERS_X * (y + LIGHT_CLUSTERS_Y * z)
+    light_cluster_t* clusters;
+    // light indices of all clusters, max_indices long. Lights that don't fit are dropped
+    uint32_t* indices;
+    uint32_t max_indices;
+    uint32_t num_indices;
+    uint32_t num_dropped;
+    // depth slice of a view depth d: log(d) * z_scale + z_bias
+    float z_scale;
+    float z_bias;
+
+    // state of the binning in progress
+    const sp_vec4_t* spheres;
+    uint32_t num_lights;
+    light_cluster_bounds_t* bounds_arr;
+    // written lights per cluster while filling
+    uint32_t* fill_counts;
+    // normalized planes of the tile boundaries, a point is right of / above a boundary when its distance is >= 0
+    sp_vec4_t x_planes[LIGHT_CLUSTERS_X + 1];
+    sp_vec4_t y_planes[LIGHT_CLUSTERS_Y + 1];
+    // view depth of a point: dot(depth_plane.xyz, p) + depth_plane.w
+    sp_vec4_t depth_plane;
+    float near_plane;
+    float far_plane;
+    uint32_t pass;
+    bool quit;
+
+    // the calling thread works as well, there are num_threads - 1 workers
+    uint32_t num_threads;
+    light_clusters_worker_t* workers;
+    sp_semaphore_t done;
+} light_clusters_t;
+
+void light_clusters_init(light_clusters_t* clusters, uint32_t max_indices, uint32_t num_threads, sp_allocator_i* allocator);
+void light_clusters_destroy(light_clusters_t* clusters);
+
+// bins the light bounding spheres (xyz center, w radius) for a (row vector) view projection matrix with a
+// perspective projection. Cluster ranges and indices are valid until the next call
+void light_clusters_bin(light_clusters_t* clusters, const sp_mat4x4_t* view_projection, float near_plane, float far_plane, const sp_vec4_t* spheres, uint32_t num_lights);
@@ -3,6 +3,10 @@
 #include "imgui/cimguizmo.h"
 
 #include <memory.h>
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+#include <assert.h>
 #include "RenderDevice.h"
 #include "SwapChain.h"
 #include "DeviceContext.h"
@@ -16,17 +20,22 @@
 #include "core/sapphire_types.h"
 #include "core/sapphire_math.h"
 #include "core/json.h"
+#include "core/json_simd.h"
 #include "core/config.h"
 #include "core/allocator.h"
 #include "core/temp_allocator.h"
+#include "core/frame_allocator.h"
+#include "core/memory_tracker.h"
 #include "core/os.h"
 #include "core/murmurhash64a.h"
 #include "core/array.h"
 #include "core/hash.h"
 #include "core/camera.h"
 #include "core/sprintf.h"
+#include "core/thread.h"
 #include "sapphire_renderer.h"
 #include "config_utils.h"
+#include "config_keys.h"
 #include "renderer.h"
 #include "scene.h"
 
@@ -63,6 +72,71 @@ typedef struct cb_drawcall_t
 
 } cb_drawcall_t;
 
+// light grid of the clustered lighting, matches cbClusterAttribs in ClusteredLighting.fxh
+typedef struct cb_cluster_attribs_t
+{
+    // clusters x, y, z, number of lights
+    uint32_t grid[4];
+    // depth slice of a view depth d: log(d) * x + y
+    sp_vec4_t depth_slices;
+} cb_cluster_attribs_t;
+
+// ClusterLight in ClusteredLighting.fxh
+typedef struct gpu_cluster_light_t
+{
+    sp_vec3_t position;
+    float range;
+    // color * intensity
+    sp_vec3_t color;
+    // below -1 for point lights
+    float spot_cos_outer;
+    sp_vec3_t direction;
+    float spot_cos_inner;
+    // first view in the shadow view buffer, UINT32_MAX without a shadow. Point lights have six, one per cube face
+    uint32_t shadow_view;
+    float pad[3];
+} gpu_cluster_light_t;
+
+// ShadowAtlasView in ShadowAtlas.fxh
+typedef struct gpu_shadow_view_t
+{
+    sp_mat4x4_t view_projection;
+    // atlas uv of the tile - offset, size
+    sp_vec4_t uv_rect;
+    // depth bias, divided by the view depth in the shader, and the size of a texel in atlas uv
+    float depth_bias;
+    float texel_size;
+    float pad[2];
+} gpu_shadow_view_t;
+
+// cascaded shadow map of the directional light, matches cbShadowAttribs in CascadedShadows.fxh
+typedef struct cb_shadow_attribs_t
+{
+    sp_mat4x4_t view_projections[SHADOW_CASCADES_MAX];
+    // view depth each cascade ends at
+    sp_vec4_t splits;
+    // constant depth bias of each cascade
+    sp_vec4_t depth_biases;
+    // map size, 1 / map size, number of cascades
+    sp_vec4_t map_attribs;
+} cb_shadow_attribs_t;
+
+// cbShadowCascade in shadow.vsh
+typedef struct cb_shadow_cascade_t
+{
+    sp_mat4x4_t view_projection;
+} cb_shadow_cascade_t;
+
+// records shadow cascade `cascade` on deferred context `cascade` when signaled
+typedef struct shadow_worker_t
+{
+    uint32_t cascade;
+    sp_thread_t thread;
+    sp_semaphore_t work;
+    ICommandList* p_command_list;
+    bool quit;
+} shadow_worker_t;
+
 typedef struct viewer_t
 {
     //tm_vec3_t damped_translation;
@@ -101,20 +175,26 @@ bool read_grimrock_model_from_stream(const uint8_t* p_stream, uint64_t size, sap
 
 void init_materials_manager(sapphire_materials_manager_t* materials_manager, sp_allocator_i* allocator);
 void init_textures_manager(sapphire_textures_manager_t* textures_manager, sp_allocator_i* allocator);
-void init_buffers_manager(sapphire_buffers_manager_t* buffers_manager);
-void init_renderer(sapphire_renderer_t* p_renderer);
+void init_buffers_manager(sapphire_buffers_manager_t* buffers_manager, sp_allocator_i* allocator);
+void init_renderer(sapphire_renderer_t* p_renderer, sp_allocator_i* allocator);
+static void init_frame_fence(IRenderDevice* pDevice, rendering_context_t* rendering_context_o);
 
 
 void destroy_buffers_manager(sapphire_buffers_manager_t* buffers_manager);
 void destroy_textures_manager(sapphire_textures_manager_t* textures_manager);
 void destroy_materials_manager(sapphire_materials_manager_t* materials_manager);
+void destroy_renderer(sapphire_renderer_t* p_renderer);
 
-sp_mat_handle_t material_manager_lookup_material(sapphire_materials_manager_t* manager, sp_strhash_t mat_name_hash);
-
-sp_mat_handle_t material_manager_lookup_material(sapphire_materials_manager_t* manager, sp_strhash_t mat_name_hash);
 static IPipelineState* create_rt_pipeline_state(IRenderDevice* pDevice, ISwapChain* pSwapChain);
 static void init_picking_buffers(IRenderDevice* pDevice, rendering_context_t* rendering_context_o);
 static void init_uniform_buffers(IRenderDevice* pDevice, rendering_context_t* rendering_context_o);
+static void init_light_buffers(IRenderDevice* pDevice, rendering_context_t* rendering_context_o);
+static void init_shadow_resources(IRenderDevice* pDevice, rendering_context_t* rendering_context_o);
+static void destroy_shadow_resources(rendering_context_t* rendering_context_o);
+static bool create_shadow_pso_srb(IRenderDevice* pDevice, IPipelineState** pp_pso, IShaderResourceBinding** pp_srb);
+static IPipelineState* create_shadow_clear_pso(IRenderDevice* pDevice);
+static bool create_shadow_copy_pso_srbs(IRenderDevice* pDevice, IPipelineState** pp_pso, IShaderResourceBinding** pp_srbs);
+static bool create_depth_prepass_pso_srb(IRenderDevice* pDevice, IPipelineState** pp_pso, IShaderResourceBinding** pp_srb);
 
 
 ///
@@ -135,21 +215,35 @@ rendering_context_t* rendering_context_create(IRenderDevice* p_device, ISwapChai
 
     g_rendering_context_o->p_rt_pso = create_rt_pipeline_state(p_device, p_swap_chain);
 
-    init_materials_manager(&g_rendering_context_o->materials_manager, allocator);
-    init_textures_manager(&g_rendering_context_o->textures_manager, allocator);
+    // each manager gets its own tracking allocator, for the memory stats and leak reports
+    init_materials_manager(&g_rendering_context_o->materials_manager, sp_memory_tracker_api->create_allocator(allocator, "renderer/materials", SP_MEMORY_TRACKING_FLAGS));
+    init_textures_manager(&g_rendering_context_o->textures_manager, sp_memory_tracker_api->create_allocator(allocator, "renderer/textures", SP_MEMORY_TRACKING_FLAGS));
     init_picking_buffers(p_device, g_rendering_context_o);
     init_uniform_buffers(p_device, g_rendering_context_o);
-    init_buffers_manager(&g_rendering_context_o->buffers_manager);
-    init_renderer(&g_rendering_context_o->renderer);
+    init_light_buffers(p_device, g_rendering_context_o);
+    init_shadow_resources(p_device, g_rendering_context_o);
+    create_depth_prepass_pso_srb(p_device, &g_rendering_context_o->p_depth_prepass_pso, &g_rendering_context_o->p_depth_prepass_srb);
+    init_buffers_manager(&g_rendering_context_o->buffers_manager, sp_memory_tracker_api->create_allocator(allocator, "renderer/buffers", SP_MEMORY_TRACKING_FLAGS));
+    init_renderer(&g_rendering_context_o->renderer, sp_memory_tracker_api->create_allocator(allocator, "renderer/meshes", SP_MEMORY_TRACKING_FLAGS));
+    init_frame_fence(p_device, g_rendering_context_o);
 
     return g_rendering_context_o;
 }
 
 void rendering_context_destroy(rendering_context_t* p_rendering_context)
 {
+    sp_allocator_i* managers_allocators[] = {
+        g_rendering_context_o->textures_manager.allocator,
+        g_rendering_context_o->materials_manager.allocator,
+        g_rendering_context_o->buffers_manager.allocator,
+        g_rendering_context_o->renderer.mesh_table.allocator,
+    };
     destroy_textures_manager(&g_rendering_context_o->textures_manager);
     destroy_materials_manager(&g_rendering_context_o->materials_manager);
     destroy_buffers_manager(&g_rendering_context_o->buffers_manager);
+    destroy_renderer(&g_rendering_context_o->renderer);
+    for (uint32_t i = 0; i < SP_ARRAY_COUNT(managers_allocators); ++i)
+        sp_memory_tracker_api->destroy_allocator(managers_allocators[i]);
     if (g_rendering_context_o->picking_buffer)
     {
         IObject_Release(g_rendering_context_o->picking_buffer);
@@ -180,11 +274,44 @@ void rendering_context_destroy(rendering_context_t* p_rendering_context)
         g_rendering_context_o->cb_drawcall = NULL;
     }
 
+    IBuffer** light_buffers[] = {
+        &g_rendering_context_o->cb_cluster_attribs,
+        &g_rendering_context_o->lights_buffer,
+        &g_rendering_context_o->light_clusters_buffer,
+        &g_rendering_context_o->light_indices_buffer,
+    };
+    for (uint32_t i = 0; i < SP_ARRAY_COUNT(light_buffers); ++i)
+    {
+        if (*light_buffers[i])
+        {
+            IObject_Release(*light_buffers[i]);
+            *light_buffers[i] = NULL;
+        }
+    }
+
+    destroy_shadow_resources(g_rendering_context_o);
+
+    if (g_rendering_context_o->p_frame_fence)
+    {
+        IObject_Release(g_rendering_context_o->p_frame_fence);
+        g_rendering_context_o->p_frame_fence = NULL;
+    }
+
     if (g_rendering_context_o->p_rt_pso)
     {
         IObject_Release(g_rendering_context_o->p_rt_pso);
     }
 
+    if (g_rendering_context_o->p_depth_prepass_srb)
+    {
+        IObject_Release(g_rendering_context_o->p_depth_prepass_srb);
+    }
+
+    if (g_rendering_context_o->p_depth_prepass_pso)
+    {
+        IObject_Release(g_rendering_context_o->p_depth_prepass_pso);
+    }
+
     if (g_rendering_context_o->p_color_rtv)
     {
         IObject_Release(g_rendering_context_o->p_color_rtv);
@@ -266,6 +393,210 @@ static void init_uniform_buffers(IRenderDevice* pDevice, rendering_context_t* re
         USAGE_DYNAMIC, BIND_UNIFORM_BUFFER, CPU_ACCESS_WRITE, NULL);
 }
 
+static IBuffer* create_structured_buffer(IRenderDevice* pDevice, const char* name, uint32_t element_size, uint32_t num_elements)
+{
+    BufferDesc buffer_desc;
+    memset(&buffer_desc, 0, sizeof(buffer_desc));
+    buffer_desc._DeviceObjectAttribs.Name = name;
+    buffer_desc.Usage = USAGE_DEFAULT;
+    buffer_desc.BindFlags = BIND_SHADER_RESOURCE;
+    buffer_desc.Mode = BUFFER_MODE_STRUCTURED;
+    buffer_desc.ElementByteStride = element_size;
+    buffer_desc.Size = (Uint64)element_size * num_elements;
+    buffer_desc.ImmediateContextMask = 1;
+
+    IBuffer* p_buffer = NULL;
+    IRenderDevice_CreateBuffer(pDevice, &buffer_desc, NULL, &p_buffer);
+    return p_buffer;
+}
+
+// buffers are sized for the limits and updated every frame, so the static shader bindings never change
+static void init_light_buffers(IRenderDevice* pDevice, rendering_context_t* rendering_context_o)
+{
+    rendering_context_o->cb_cluster_attribs = NULL;
+    Diligent_CreateUniformBuffer(pDevice, sizeof(cb_cluster_attribs_t), "cluster attribs CB", &rendering_context_o->cb_cluster_attribs,
+        USAGE_DYNAMIC, BIND_UNIFORM_BUFFER, CPU_ACCESS_WRITE, NULL);
+    rendering_context_o->lights_buffer = create_structured_buffer(pDevice, "cluster lights", sizeof(gpu_cluster_light_t), RENDERING_MAX_LIGHTS);
+    rendering_context_o->light_clusters_buffer = create_structured_buffer(pDevice, "light clusters", sizeof(light_cluster_t), LIGHT_CLUSTERS_COUNT);
+    rendering_context_o->light_indices_buffer = create_structured_buffer(pDevice, "light indices", sizeof(uint32_t), RENDERING_MAX_LIGHT_INDICES);
+}
+
+static ITexture* create_shadow_texture(IRenderDevice* pDevice, const char* name, RESOURCE_DIMENSION dimension, uint32_t size, uint32_t array_size)
+{
+    TextureDesc texture_desc;
+    memset(&texture_desc, 0, sizeof(texture_desc));
+    texture_desc._DeviceObjectAttribs.Name = name;
+    texture_desc.Type = dimension;
+    texture_desc.Width = size;
+    texture_desc.Height = size;
+    texture_desc.ArraySize = array_size;
+    texture_desc.MipLevels = 1;
+    texture_desc.SampleCount = 1;
+    texture_desc.Usage = USAGE_DEFAULT;
+    texture_desc.Format = TEX_FORMAT_D32_FLOAT;
+    texture_desc.BindFlags = BIND_SHADER_RESOURCE | BIND_DEPTH_STENCIL;
+    texture_desc.ClearValue.Format = TEX_FORMAT_D32_FLOAT;
+    texture_desc.ClearValue.DepthStencil.Depth = 1.0f;
+    texture_desc.ImmediateContextMask = 1;
+    ITexture* p_texture = NULL;
+    IRenderDevice_CreateTexture(pDevice, &texture_desc, NULL, &p_texture);
+    return p_texture;
+}
+
+// view of one slice of a texture array
+static ITextureView* create_shadow_slice_view(ITexture* p_texture, const char* name, TEXTURE_VIEW_TYPE view_type, uint32_t slice)
+{
+    TextureViewDesc view_desc;
+    memset(&view_desc, 0, sizeof(view_desc));
+    view_desc._DeviceObjectAttribs.Name = name;
+    view_desc.ViewType = view_type;
+    view_desc.TextureDim = RESOURCE_DIM_TEX_2D_ARRAY;
+    view_desc.NumMipLevels = 1;
+    view_desc.FirstArraySlice = slice;
+    view_desc.NumArraySlices = 1;
+    ITextureView* p_view = NULL;
+    ITexture_CreateView(p_texture, &view_desc, &p_view);
+    return p_view;
+}
+
+static ITextureView* get_default_view(ITexture* p_texture, TEXTURE_VIEW_TYPE view_type)
+{
+    ITextureView* p_view = ITexture_GetDefaultView(p_texture, view_type);
+    IObject_AddRef(p_view);
+    return p_view;
+}
+
+// the shadow map holds every cascade, so the static shader bindings never change with the cascade count
+static void init_shadow_resources(IRenderDevice* pDevice, rendering_context_t* rendering_context_o)
+{
+    rendering_context_o->shadow_map = create_shadow_texture(pDevice, "shadow cascades", RESOURCE_DIM_TEX_2D_ARRAY, RENDERING_SHADOW_MAP_SIZE, SHADOW_CASCADES_MAX);
+    rendering_context_o->shadow_map_srv = get_default_view(rendering_context_o->shadow_map, TEXTURE_VIEW_SHADER_RESOURCE);
+    rendering_context_o->shadow_cache = create_shadow_texture(pDevice, "static shadow cascades", RESOURCE_DIM_TEX_2D_ARRAY, RENDERING_SHADOW_MAP_SIZE, SHADOW_CASCADES_MAX);
+    for (uint32_t i = 0; i < SHADOW_CASCADES_MAX; ++i)
+    {
+        rendering_context_o->shadow_map_dsvs[i] = create_shadow_slice_view(rendering_context_o->shadow_map, "shadow cascade DSV", TEXTURE_VIEW_DEPTH_STENCIL, i);
+        rendering_context_o->shadow_cache_dsvs[i] = create_shadow_slice_view(rendering_context_o->shadow_cache, "static shadow cascade DSV", TEXTURE_VIEW_DEPTH_STENCIL, i);
+        rendering_context_o->shadow_cache_srvs[i] = create_shadow_slice_view(rendering_context_o->shadow_cache, "static shadow cascade SRV", TEXTURE_VIEW_SHADER_RESOURCE, i);
+    }
+
+    Diligent_CreateUniformBuffer(pDevice, sizeof(cb_shadow_attribs_t), "shadow attribs CB", &rendering_context_o->cb_shadow_attribs,
+        USAGE_DYNAMIC, BIND_UNIFORM_BUFFER, CPU_ACCESS_WRITE, NULL);
+    Diligent_CreateUniformBuffer(pDevice, sizeof(cb_shadow_cascade_t), "shadow cascade CB", &rendering_context_o->cb_shadow_cascade,
+        USAGE_DYNAMIC, BIND_UNIFORM_BUFFER, CPU_ACCESS_WRITE, NULL);
+    create_shadow_pso_srb(pDevice, &rendering_context_o->p_shadow_pso, &rendering_context_o->p_shadow_srb);
+    rendering_context_o->p_shadow_clear_pso = create_shadow_clear_pso(pDevice);
+
+    rendering_context_o->shadow_atlas = create_shadow_texture(pDevice, "shadow atlas", RESOURCE_DIM_TEX_2D, RENDERING_SHADOW_ATLAS_SIZE, 1);
+    rendering_context_o->shadow_atlas_srv = get_default_view(rendering_context_o->shadow_atlas, TEXTURE_VIEW_SHADER_RESOURCE);
+    rendering_context_o->shadow_atlas_dsv = get_default_view(rendering_context_o->shadow_atlas, TEXTURE_VIEW_DEPTH_STENCIL);
+    // an array of one, the copy shader reads the cascade caches and the atlas cache the same way
+    rendering_context_o->shadow_atlas_cache = create_shadow_texture(pDevice, "static shadow atlas", RESOURCE_DIM_TEX_2D_ARRAY, RENDERING_SHADOW_ATLAS_SIZE, 1);
+    rendering_context_o->shadow_atlas_cache_srv = get_default_view(rendering_context_o->shadow_atlas_cache, TEXTURE_VIEW_SHADER_RESOURCE);
+    rendering_context_o->shadow_atlas_cache_dsv = get_default_view(rendering_context_o->shadow_atlas_cache, TEXTURE_VIEW_DEPTH_STENCIL);
+    rendering_context_o->shadow_views_buffer = create_structured_buffer(pDevice, "shadow atlas views", sizeof(gpu_shadow_view_t), RENDERING_SHADOW_ATLAS_MAX_VIEWS);
+    create_shadow_copy_pso_srbs(pDevice, &rendering_context_o->p_shadow_copy_pso, rendering_context_o->p_shadow_copy_srbs);
+
+    // gpu cost per cascade, only where the device supports duration queries
+    const RenderDeviceInfo* p_device_info = IRenderDevice_GetDeviceInfo(pDevice);
+    if (p_device_info->Features.DurationQueries != DEVICE_FEATURE_STATE_DISABLED)
+    {
+        QueryDesc query_desc;
+        memset(&query_desc, 0, sizeof(query_desc));
+        query_desc._DeviceObjectAttribs.Name = "shadow cascade duration";
+        query_desc.Type = QUERY_TYPE_DURATION;
+        for (uint32_t frame = 0; frame < RENDERING_SHADOW_QUERY_FRAMES; ++frame)
+        {
+            for (uint32_t i = 0; i < SHADOW_CASCADES_MAX; ++i)
+                IRenderDevice_CreateQuery(pDevice, &query_desc, &rendering_context_o->shadow_queries[frame][i]);
+        }
+    }
+}
+
+static void destroy_shadow_resources(rendering_context_t* rendering_context_o)
+{
+    const uint32_t num_workers = rendering_context_o->num_deferred_contexts ? rendering_context_o->num_deferred_contexts - 1 : 0;
+    for (uint32_t i = 0; i < num_workers; ++i)
+    {
+        shadow_worker_t* worker = &rendering_context_o->shadow_workers[i];
+        worker->quit = true;
+        sp_semaphore_post(&worker->work, 1);
+        sp_thread_join(&worker->thread);
+        sp_semaphore_destroy(&worker->work);
+    }
+    if (rendering_context_o->num_deferred_contexts)
+    {
+        if (num_workers)
+            sp_free(sp_allocator_api->system_allocator, rendering_context_o->shadow_workers, num_workers * sizeof(shadow_worker_t));
+        sp_semaphore_destroy(&rendering_context_o->shadow_workers_done);
+    }
+    for (uint32_t i = 0; i < rendering_context_o->num_deferred_contexts; ++i)
+        IObject_Release(rendering_context_o->p_deferred_contexts[i]);
+    rendering_context_o->num_deferred_contexts = 0;
+
+    for (uint32_t frame = 0; frame < RENDERING_SHADOW_QUERY_FRAMES; ++frame)
+    {
+        for (uint32_t i = 0; i < SHADOW_CASCADES_MAX; ++i)
+        {
+            if (rendering_context_o->shadow_queries[frame][i])
+                IObject_Release(rendering_context_o->shadow_queries[frame][i]);
+        }
+    }
+    for (uint32_t i = 0; i < SHADOW_CASCADES_MAX; ++i)
+    {
+        IObject* slice_views[] = {
+            (IObject*)rendering_context_o->shadow_map_dsvs[i],
+            (IObject*)rendering_context_o->shadow_cache_dsvs[i],
+            (IObject*)rendering_context_o->shadow_cache_srvs[i],
+        };
+        for (uint32_t view = 0; view < SP_ARRAY_COUNT(slice_views); ++view)
+        {
+            if (slice_views[view])
+                IObject_Release(slice_views[view]);
+        }
+    }
+    for (uint32_t i = 0; i < SHADOW_CASCADES_MAX + 1; ++i)
+    {
+        if (rendering_context_o->p_shadow_copy_srbs[i])
+            IObject_Release(rendering_context_o->p_shadow_copy_srbs[i]);
+    }
+    IObject* shadow_objects[] = {
+        (IObject*)rendering_context_o->shadow_map_srv,
+        (IObject*)rendering_context_o->shadow_map,
+        (IObject*)rendering_context_o->cb_shadow_attribs,
+        (IObject*)rendering_context_o->cb_shadow_cascade,
+        (IObject*)rendering_context_o->p_shadow_srb,
+        (IObject*)rendering_context_o->p_shadow_pso,
+        (IObject*)rendering_context_o->p_shadow_clear_pso,
+        (IObject*)rendering_context_o->shadow_atlas_srv,
+        (IObject*)rendering_context_o->shadow_atlas_dsv,
+        (IObject*)rendering_context_o->shadow_atlas,
+        (IObject*)rendering_context_o->shadow_views_buffer,
+        (IObject*)rendering_context_o->shadow_cache,
+        (IObject*)rendering_context_o->shadow_atlas_cache_srv,
+        (IObject*)rendering_context_o->shadow_atlas_cache_dsv,
+        (IObject*)rendering_context_o->shadow_atlas_cache,
+        (IObject*)rendering_context_o->p_shadow_copy_pso,
+    };
+    for (uint32_t i = 0; i < SP_ARRAY_COUNT(shadow_objects); ++i)
+    {
+        if (shadow_objects[i])
+            IObject_Release(shadow_objects[i]);
+    }
+}
+
+static void init_frame_fence(IRenderDevice* pDevice, rendering_context_t* rendering_context_o)
+{
+    FenceDesc fence_desc;
+    memset(&fence_desc, 0, sizeof(fence_desc));
+    fence_desc._DeviceObjectAttribs.Name = "frame fence";
+    fence_desc.Type = FENCE_TYPE_CPU_WAIT_ONLY;
+
+    IFence* p_fence = NULL;
+    IRenderDevice_CreateFence(pDevice, &fence_desc, &p_fence);
+    rendering_context_o->p_frame_fence = p_fence;
+    rendering_context_o->frame_fence_value = 0;
+}
+
 IBuffer* create_mesh_vertex_buffer(IRenderDevice* pDevice, const uint8_t* vertices, uint32_t size)
 {
     BufferDesc vert_buffer_desc;
@@ -309,13 +640,13 @@ IBuffer* create_mesh_index_buffer(IRenderDevice* pDevice, const uint8_t* indices
 
 }
 
-sp_ib_handle_t buffers_manager_allocate_vb(IRenderDevice* pDevice, const uint8_t* vertices, uint32_t size)
+sp_vb_handle_t buffers_manager_allocate_vb(IRenderDevice* pDevice, const uint8_t* vertices, uint32_t size)
 {
     sapphire_buffers_manager_t* buffers_manager = &g_rendering_context_o->buffers_manager;
     IBuffer* vb = create_mesh_vertex_buffer(pDevice, vertices, size);
-    sp_ib_handle_t handle = buffers_manager->num_vertex_buffers;
-    buffers_manager->vertex_buffers[handle] = vb;
-    ++(buffers_manager->num_vertex_buffers);
+    sp_vb_handle_t handle = sp_handle_table_alloc(&buffers_manager->vb_table);
+    sp_pool_ensure(&buffers_manager->vertex_buffers, buffers_manager->vb_table.num_alive);
+    *sp_pool_get(&buffers_manager->vertex_buffers, IBuffer*, buffers_manager->vb_table.num_alive - 1) = vb;
     return handle;
 }
 
@@ -323,161 +654,784 @@ sp_ib_handle_t buffers_manager_allocate_ib(IRenderDevice* pDevice, const uint8_t
 {
     sapphire_buffers_manager_t* buffers_manager = &g_rendering_context_o->buffers_manager;
     IBuffer* ib = create_mesh_index_buffer(pDevice, indices, size);
-    sp_ib_handle_t handle = buffers_manager->num_index_buffers;
-    buffers_manager->index_buffers[handle] = ib;
-    ++(buffers_manager->num_index_buffers);
+    sp_ib_handle_t handle = sp_handle_table_alloc(&buffers_manager->ib_table);
+    sp_pool_ensure(&buffers_manager->index_buffers, buffers_manager->ib_table.num_alive);
+    *sp_pool_get(&buffers_manager->index_buffers, IBuffer*, buffers_manager->ib_table.num_alive - 1) = ib;
     return handle;
 }
 
-inline sp_mesh_handle_t allocate_renderer_mesh(sapphire_renderer_t* renderer, sapphire_mesh_t** p_mesh)
+inline IBuffer* buffers_manager_get_vb(sapphire_buffers_manager_t* buffers_manager, sp_vb_handle_t handle)
 {
-    sp_mesh_handle_t mesh_handle = renderer->num_meshes;
-    *p_mesh = &renderer->meshes[mesh_handle];
-    ++renderer->num_meshes;
-    return mesh_handle;
+    return *sp_pool_get(&buffers_manager->vertex_buffers, IBuffer*, sp_handle_table_dense_index(&buffers_manager->vb_table, handle));
 }
 
-#define CENTIMETERS_TO_METERS(x) (x) *= 0.01f
+inline IBuffer* buffers_manager_get_ib(sapphire_buffers_manager_t* buffers_manager, sp_ib_handle_t handle)
+{
+    return *sp_pool_get(&buffers_manager->index_buffers, IBuffer*, sp_handle_table_dense_index(&buffers_manager->ib_table, handle));
+}
 
-void merge_vertex_streams_to_buffer(sapphire_mesh_gpu_load_t* mesh_load_data, uint32_t attribute_flags, uint8_t* vertices_data)
+// queue a gpu object for release once the frame fence passes fence_value
+static void buffers_manager_defer_release(sapphire_buffers_manager_t* buffers_manager, IObject* p_object, uint64_t fence_value)
 {
-    uint8_t* p_curr = vertices_data;
-    for (uint32_t i = 0; i < mesh_load_data->num_vertices; ++i)
+    sp_deferred_release_t release = { .p_object = p_object, .fence_value = fence_value };
+    sp_array_push(buffers_manager->deferred_release_arr, release, buffers_manager->allocator);
+}
+
+// the handle is invalid right away, the IBuffer itself lives on in the deferred release queue
+void buffers_manager_release_vb(sapphire_buffers_manager_t* buffers_manager, sp_vb_handle_t handle, uint64_t fence_value)
+{
+    if (!sp_handle_table_valid(&buffers_manager->vb_table, handle))
+        return;
+    uint32_t index = sp_handle_table_release(&buffers_manager->vb_table, handle);
+    IBuffer** vertex_buffer = sp_pool_get(&buffers_manager->vertex_buffers, IBuffer*, index);
+    buffers_manager_defer_release(buffers_manager, (IObject*)*vertex_buffer, fence_value);
+    *vertex_buffer = *sp_pool_get(&buffers_manager->vertex_buffers, IBuffer*, buffers_manager->vb_table.num_alive);
+    sp_pool_trim(&buffers_manager->vertex_buffers, buffers_manager->vb_table.num_alive);
+}
+
+void buffers_manager_release_ib(sapphire_buffers_manager_t* buffers_manager, sp_ib_handle_t handle, uint64_t fence_value)
+{
+    if (!sp_handle_table_valid(&buffers_manager->ib_table, handle))
+        return;
+    uint32_t index = sp_handle_table_release(&buffers_manager->ib_table, handle);
+    IBuffer** index_buffer = sp_pool_get(&buffers_manager->index_buffers, IBuffer*, index);
+    buffers_manager_defer_release(buffers_manager, (IObject*)*index_buffer, fence_value);
+    *index_buffer = *sp_pool_get(&buffers_manager->index_buffers, IBuffer*, buffers_manager->ib_table.num_alive);
+    sp_pool_trim(&buffers_manager->index_buffers, buffers_manager->ib_table.num_alive);
+}
+
+// release all queued objects the gpu is done with
+void buffers_manager_collect_garbage(sapphire_buffers_manager_t* buffers_manager, uint64_t completed_fence_value)
+{
+    uint32_t num_pending = (uint32_t)sp_array_size(buffers_manager->deferred_release_arr);
+    uint32_t num_kept = 0;
+    for (uint32_t i = 0; i < num_pending; ++i)
     {
-        for (uint32_t att_index = 0; att_index < MAX_VERTEX_ATTRIBUTE_STREAMS; ++att_index)
+        sp_deferred_release_t* release = &buffers_manager->deferred_release_arr[i];
+        if (release->fence_value <= completed_fence_value)
         {
-            uint32_t stride = mesh_load_data->vertex_stream_stride_size[att_index];
-            if (stride > 0 && (attribute_flags & (0x1 << att_index)))
-            {                
-                memcpy(p_curr, mesh_load_data->vertices[att_index] + stride * i, stride);                
-                if (att_index == 0)
-                {
-                    // convert centimeters to meters
-                    float* vertex_pos = (float* )p_curr;
-                    CENTIMETERS_TO_METERS(vertex_pos[0]);
-                    CENTIMETERS_TO_METERS(vertex_pos[1]);
-                    CENTIMETERS_TO_METERS(vertex_pos[2]);
-                    
-                }
-                p_curr += stride;
-            }
-            
+            IObject_Release(release->p_object);
         }
-        
-       
+        else
+        {
+            buffers_manager->deferred_release_arr[num_kept++] = *release;
+        }
+    }
+    if (buffers_manager->deferred_release_arr)
+    {
+        sp_array_header(buffers_manager->deferred_release_arr)->size = num_kept;
     }
 }
 
-void create_cube_mesh_load_data(sp_temp_allocator_i* ta, const char* material, sapphire_mesh_gpu_load_t* p_mesh_load_data)
+inline sp_mesh_handle_t allocate_renderer_mesh(sapphire_renderer_t* renderer, sapphire_mesh_t** p_mesh)
 {
-    typedef struct Vertex
-    {
-        sp_vec3_t pos;
-        sp_vec3_t normal;
-        sp_vec2_t uv;
-    } Vertex;
+    sp_mesh_handle_t mesh_handle = sp_handle_table_alloc(&renderer->mesh_table);
+    sp_pool_ensure(&renderer->meshes, renderer->mesh_table.num_alive);
+    *p_mesh = sp_pool_get(&renderer->meshes, sapphire_mesh_t, renderer->mesh_table.num_alive - 1);
+    memset(*p_mesh, 0, sizeof(sapphire_mesh_t));
+    // the loader holds the first reference
+    (*p_mesh)->ref_count = 1;
+    return mesh_handle;
+}
 
-    Vertex CubeVerts[] =
-    {
-        {.pos = {-1,-1,-1}, .normal = {0, 0, -1}, .uv = {0,1}},
-        {.pos = {-1,+1,-1}, .normal = {0, 0, -1},.uv = {0,0}},
-        {.pos = {+1,+1,-1}, .normal = {0, 0, -1},.uv = {1,0}},
-        {.pos = {+1,-1,-1}, .normal = {0, 0, -1},.uv = {1,1}},
+inline sapphire_mesh_t* renderer_get_mesh(sapphire_renderer_t* renderer, sp_mesh_handle_t mesh_handle)
+{
+    return sp_pool_get(&renderer->meshes, sapphire_mesh_t, sp_handle_table_dense_index(&renderer->mesh_table, mesh_handle));
+}
 
-        {.pos = {-1,-1,-1}, .normal = {0, -1, 0},.uv = {0,1}},
-        {.pos = {-1,-1,+1}, .normal = {0, -1, 0},.uv = {0,0}},
-        {.pos = {+1,-1,+1}, .normal = {0, -1, 0},.uv = {1,0}},
-        {.pos = {+1,-1,-1}, .normal = {0, -1, 0},.uv = {1,1}},
+bool renderer_is_mesh_valid(const sapphire_renderer_t* renderer, sp_mesh_handle_t mesh_handle)
+{
+    return sp_handle_table_valid(&renderer->mesh_table, mesh_handle);
+}
 
-        {.pos = {+1,-1,-1}, .normal = {1, 0, 0},.uv = {0,1} },
-        {.pos = {+1,-1,+1}, .normal = {1, 0, 0},.uv = {1,1}},
-        {.pos = {+1,+1,+1}, .normal = {1, 0, 0},.uv = {1,0}},
-        {.pos = {+1,+1,-1}, .normal = {1, 0, 0},.uv = {0,0}},
+void renderer_add_mesh_ref(sapphire_renderer_t* renderer, sp_mesh_handle_t mesh_handle)
+{
+    if (!renderer_is_mesh_valid(renderer, mesh_handle))
+        return;
+    ++renderer_get_mesh(renderer, mesh_handle)->ref_count;
+}
 
-        {.pos = {+1,+1,-1}, .normal = {0, 1, 0}, .uv = {0,1}},
-        {.pos = {+1,+1,+1}, .normal = {0, 1, 0},.uv = {0,0}},
-        {.pos = {-1,+1,+1}, .normal = {0, 1, 0},.uv = {1,0}},
-        {.pos = {-1,+1,-1}, .normal = {0, 1, 0},.uv = {1,1}},
+static void release_mesh_collision(sapphire_renderer_t* renderer, sapphire_mesh_t* p_mesh)
+{
+    sp_array_free(p_mesh->positions_arr, renderer->allocator);
+    sp_array_free(p_mesh->indices_arr, renderer->allocator);
+    sp_bvh_destroy(&p_mesh->triangles_bvh);
+}
 
-        {.pos = {-1,+1,-1}, .normal = {-1, 0, 0},.uv = {1,0}},
-        {.pos = {-1,+1,+1}, .normal = {-1, 0, 0},.uv = {0,0}},
-        {.pos = {-1,-1,+1}, .normal = {-1, 0, 0},.uv = {0,1}},
-        {.pos = {-1,-1,-1}, .normal = {-1, 0, 0},.uv = {1,1}},
+void renderer_release_mesh(rendering_context_t* p_rendering_context, sp_mesh_handle_t mesh_handle)
+{
+    sapphire_renderer_t* renderer = &p_rendering_context->renderer;
+    if (!renderer_is_mesh_valid(renderer, mesh_handle))
+        return;
 
-        {.pos = {-1,-1,+1}, .normal = {0, 0, 1},.uv = {1,1}},
-        {.pos = {+1,-1,+1}, .normal = {0, 0, 1},.uv = {0,1}},
-        {.pos = {+1,+1,+1}, .normal = {0, 0, 1},.uv = {0,0}},
-        {.pos = {-1,+1,+1}, .normal = {0, 0, 1},.uv = {1,0}}
-    };
+    sapphire_mesh_t* p_mesh = renderer_get_mesh(renderer, mesh_handle);
+    if (--p_mesh->ref_count > 0)
+        return;
 
-    Uint32 Indices[] =
-    {
-        2,0,1,    2,3,0,
-        4,6,5,    4,7,6,
-        8,10,9,   8,11,10,
-        12,14,13, 12,15,14,
-        16,18,17, 16,19,18,
-        20,21,22, 20,22,23
-    };
+    // frames that are already recorded may still draw the mesh, release its buffers after the next frame fence
+    uint64_t fence_value = p_rendering_context->frame_fence_value + 1;
+    buffers_manager_release_vb(&p_rendering_context->buffers_manager, p_mesh->vb_handle, fence_value);
+    buffers_manager_release_vb(&p_rendering_context->buffers_manager, p_mesh->position_vb_handle, fence_value);
+    buffers_manager_release_ib(&p_rendering_context->buffers_manager, p_mesh->ib_handle, fence_value);
+    release_mesh_collision(renderer, p_mesh);
 
-    uint8_t* indices = sp_temp_alloc(ta, sizeof(Indices));
-    memcpy(indices, &Indices, sizeof(Indices));
+    uint32_t index = sp_handle_table_release(&renderer->mesh_table, mesh_handle);
+    *sp_pool_get(&renderer->meshes, sapphire_mesh_t, index) = *sp_pool_get(&renderer->meshes, sapphire_mesh_t, renderer->mesh_table.num_alive);
+    sp_pool_trim(&renderer->meshes, renderer->mesh_table.num_alive);
+}
 
-    uint8_t* vertices = sp_temp_alloc(ta, sizeof(CubeVerts));
-    memcpy(vertices, &CubeVerts, sizeof(CubeVerts));
-    
+bool renderer_is_render_object_valid(const sapphire_renderer_t* renderer, sp_render_handle_t render_handle)
+{
+    return sp_handle_table_valid(&renderer->render_object_table, render_handle);
+}
 
-    memset(p_mesh_load_data, 0, sizeof(sapphire_mesh_gpu_load_t));
-    p_mesh_load_data->num_indices = 36;
-    p_mesh_load_data->num_submeshes = 1;
-    p_mesh_load_data->num_vertices = 24;
-    p_mesh_load_data->vertex_stride = 32;
-    p_mesh_load_data->vertices_data_size = p_mesh_load_data->num_vertices * p_mesh_load_data->vertex_stride;
-    p_mesh_load_data->indices_data_size = sizeof(uint32_t) * p_mesh_load_data->num_indices;
-    p_mesh_load_data->indices = (const uint8_t*)indices;
-    p_mesh_load_data->vertices[0] = (const uint8_t*)vertices;
-    p_mesh_load_data->vertex_stream_stride_size[0] = p_mesh_load_data->vertex_stride;
-    p_mesh_load_data->sub_meshes[0].indices_start = 0;
-    p_mesh_load_data->sub_meshes[0].indices_count = 36;
-    p_mesh_load_data->sub_meshes[0].material_hash = sp_murmur_hash_string(material);
-    p_mesh_load_data->bounding_box_min = (struct sp_vec3_t){ -1,-1,-1 };
-    p_mesh_load_data->bounding_box_max = (struct sp_vec3_t){ 1,1,1 };
-    p_mesh_load_data->bounding_sphere_center = (struct sp_vec3_t){ 0 };
-    p_mesh_load_data->bounding_sphere_radius = 1.732f;
+// the cached shadow atlas views that see the box are re-rendered
+static void invalidate_shadows(sapphire_renderer_t* renderer, const sp_aabb_t* aabb)
+{
+    if (renderer->shadow_invalidate_all)
+        return;
+    if (sp_array_size(renderer->shadow_invalidations_arr) >= RENDERING_SHADOW_MAX_INVALIDATIONS)
+    {
+        renderer->shadow_invalidate_all = true;
+        return;
+    }
+    sp_array_push(renderer->shadow_invalidations_arr, *aabb, renderer->allocator);
+}
 
-    
+static void remove_dynamic_render_object(sapphire_renderer_t* renderer, uint32_t slot)
+{
+    // keep dynamic_arr packed - the last dynamic render object was moved into the slot
+    const uint32_t last = (uint32_t)sp_array_size(renderer->dynamic_arr) - 1;
+    const sp_render_handle_t moved = renderer->dynamic_arr[last];
+    renderer->dynamic_arr[slot] = moved;
+    *sp_pool_get(&renderer->dynamic_slots, uint32_t, sp_handle_table_dense_index(&renderer->render_object_table, moved)) = slot;
+    sp_array_header(renderer->dynamic_arr)->size = last;
 }
 
-void create_sphere_mesh_load_data(sp_temp_allocator_i* ta, const char* material, uint32_t lod_level, sapphire_mesh_gpu_load_t* p_mesh_load_data)
+static void set_render_object_dynamic(sapphire_renderer_t* renderer, sp_render_handle_t render_handle, uint32_t index, bool dynamic)
 {
-    typedef struct Vertex
+    uint32_t* slot = sp_pool_get(&renderer->dynamic_slots, uint32_t, index);
+    if (dynamic == (*slot != UINT32_MAX))
+        return;
+    // the static caches that see the render object gain or lose it
+    const uint32_t leaf = *sp_pool_get(&renderer->bvh_leaves, uint32_t, index);
+    invalidate_shadows(renderer, &renderer->bvh.nodes_arr[leaf].aabb);
+    if (dynamic)
     {
-        sp_vec3_t pos;
-        sp_vec3_t normal;
-        sp_vec2_t uv;
-    } Vertex;
-    const int baseSegments = 32; // Base number of segments (latitude lines)
-    const int baseRings = 16; // Base number of rings (longitude lines)
+        *slot = (uint32_t)sp_array_size(renderer->dynamic_arr);
+        sp_array_push(renderer->dynamic_arr, render_handle, renderer->allocator);
+    }
+    else
+    {
+        remove_dynamic_render_object(renderer, *slot);
+        *slot = UINT32_MAX;
+    }
+}
 
-    int numSegments = baseSegments * (1 << lod_level); // Adjust segments based on LOD
-    int numRings = baseRings * (1 << lod_level); // Adjust rings based on LOD
-    int num_vertices = numSegments * numRings;
-    Vertex* vertices = (Vertex*)sp_temp_alloc(ta, num_vertices * sizeof(Vertex));
-    uint32_t index = 0;
-    for (int ring = 0; ring <= numRings; ++ring) {
-        float phi = (float)(ring) / numRings * 2.0f * SP_PI;
-        for (int segment = 0; segment <= numSegments; ++segment) {
-            float theta = (float)(segment) / numSegments * SP_PI;
+// world box of a render object for the bvh
+static sp_aabb_t render_object_aabb(sapphire_renderer_t* renderer, sp_mesh_handle_t mesh_handle, const sp_mat4x4_t* world_matrix)
+{
+    const sapphire_mesh_t* mesh = renderer_get_mesh(renderer, mesh_handle);
+    const sp_aabb_t mesh_aabb = { .min = mesh->bounding_box_min, .max = mesh->bounding_box_max };
+    return sp_aabb_transform(&mesh_aabb, world_matrix);
+}
 
-            Vertex vertex;
-            vertex.pos.x = sinf(theta) * cosf(phi);
-            vertex.pos.y = cosf(theta);
-            vertex.pos.z = sinf(theta) * sinf(phi);
+sp_render_handle_t renderer_add_render_object(rendering_context_t* p_rendering_context, sp_mesh_handle_t mesh_handle, const sp_mat4x4_t* world_matrix)
+{
+    sapphire_renderer_t* renderer = &p_rendering_context->renderer;
+    if (!renderer_is_mesh_valid(renderer, mesh_handle))
+        return SP_INVALID_HANDLE;
+
+    sp_render_handle_t render_handle = sp_handle_table_alloc(&renderer->render_object_table);
+    uint32_t num_render_objects = renderer->render_object_table.num_alive;
+    sp_pool_ensure(&renderer->mesh_handles, num_render_objects);
+    sp_pool_ensure(&renderer->world_matrices, num_render_objects);
+    sp_pool_ensure(&renderer->bvh_leaves, num_render_objects);
+    sp_pool_ensure(&renderer->identities, num_render_objects);
+    sp_pool_ensure(&renderer->dynamic_slots, num_render_objects);
+    *sp_pool_get(&renderer->identities, uint64_t, num_render_objects - 1) = render_handle;
+    *sp_pool_get(&renderer->dynamic_slots, uint32_t, num_render_objects - 1) = UINT32_MAX;
+    *sp_pool_get(&renderer->mesh_handles, sp_mesh_handle_t, num_render_objects - 1) = mesh_handle;
+    *sp_pool_get(&renderer->world_matrices, sp_mat4x4_t, num_render_objects - 1) = *world_matrix;
+    sp_aabb_t aabb = render_object_aabb(renderer, mesh_handle, world_matrix);
+    *sp_pool_get(&renderer->bvh_leaves, uint32_t, num_render_objects - 1) = sp_bvh_insert(&renderer->bvh, &aabb, render_handle);
+    invalidate_shadows(renderer, &aabb);
+
+    renderer_add_mesh_ref(renderer, mesh_handle);
+    return render_handle;
+}
 
-            // Calculate normals (same as positions for a unit sphere)
-            vertex.normal = vertex.pos;
+void renderer_set_render_object_transform(rendering_context_t* p_rendering_context, sp_render_handle_t render_handle, const sp_mat4x4_t* world_matrix)
+{
+    sapphire_renderer_t* renderer = &p_rendering_context->renderer;
+    if (!renderer_is_render_object_valid(renderer, render_handle))
+        return;
+    uint32_t index = sp_handle_table_dense_index(&renderer->render_object_table, render_handle);
+    sp_mat4x4_t* current = sp_pool_get(&renderer->world_matrices, sp_mat4x4_t, index);
+    // setting the matrix it already has is not a move and keeps a static render object static
+    if (memcmp(current, world_matrix, sizeof(sp_mat4x4_t)) == 0)
+        return;
+    *current = *world_matrix;
+    sp_aabb_t aabb = render_object_aabb(renderer, *sp_pool_get(&renderer->mesh_handles, sp_mesh_handle_t, index), world_matrix);
+    // a moving render object is drawn over the static shadows every frame, so its moves invalidate nothing.
+    // The leaf box still holds the old position, which leaves the static caches
+    set_render_object_dynamic(renderer, render_handle, index, true);
+    sp_bvh_move(&renderer->bvh, *sp_pool_get(&renderer->bvh_leaves, uint32_t, index), &aabb);
+}
 
-            // Calculate UV coordinates
+void renderer_set_render_object_static(rendering_context_t* p_rendering_context, sp_render_handle_t render_handle, bool is_static)
+{
+    sapphire_renderer_t* renderer = &p_rendering_context->renderer;
+    if (!renderer_is_render_object_valid(renderer, render_handle))
+        return;
+    uint32_t index = sp_handle_table_dense_index(&renderer->render_object_table, render_handle);
+    set_render_object_dynamic(renderer, render_handle, index, !is_static);
+}
+
+void renderer_rebuild_bvh(rendering_context_t* p_rendering_context, uint32_t num_threads)
+{
+    sp_bvh_rebuild(&p_rendering_context->renderer.bvh, num_threads);
+}
+
+static void free_light_shadow_tiles(shadow_atlas_t* atlas, sp_light_shadow_t* shadow)
+{
+    for (uint32_t i = 0; i < shadow->num_views; ++i)
+    {
+        shadow_atlas_free(atlas, shadow->views[i].tile);
+        shadow->views[i].tile = SHADOW_ATLAS_NULL;
+    }
+    shadow->tile_size = 0;
+    shadow->num_views = 0;
+    shadow->valid_mask = 0;
+    shadow->dirty_mask = 0;
+    shadow->dynamic_mask = 0;
+}
+
+// all the views of a light or none
+static bool alloc_light_shadow_tiles(shadow_atlas_t* atlas, sp_light_shadow_t* shadow, uint32_t num_views, uint32_t tile_size)
+{
+    for (uint32_t i = 0; i < num_views; ++i)
+    {
+        shadow->views[i].tile = shadow_atlas_alloc(atlas, tile_size);
+        if (shadow->views[i].tile == SHADOW_ATLAS_NULL)
+        {
+            shadow->num_views = i;
+            free_light_shadow_tiles(atlas, shadow);
+            return false;
+        }
+    }
+    shadow->tile_size = tile_size;
+    shadow->num_views = num_views;
+    shadow->valid_mask = 0;
+    shadow->dirty_mask = 0;
+    return true;
+}
+
+sp_light_handle_t renderer_add_light(rendering_context_t* p_rendering_context, const sp_light_t* light)
+{
+    sapphire_renderer_t* renderer = &p_rendering_context->renderer;
+    sp_light_handle_t light_handle = sp_handle_table_alloc(&renderer->light_table);
+    sp_pool_ensure(&renderer->lights, renderer->light_table.num_alive);
+    sp_pool_ensure(&renderer->light_shadows, renderer->light_table.num_alive);
+    *sp_pool_get(&renderer->lights, sp_light_t, renderer->light_table.num_alive - 1) = *light;
+    sp_light_shadow_t* shadow = sp_pool_get(&renderer->light_shadows, sp_light_shadow_t, renderer->light_table.num_alive - 1);
+    memset(shadow, 0, sizeof(sp_light_shadow_t));
+    shadow->gpu_view = UINT32_MAX;
+    return light_handle;
+}
+
+void renderer_remove_light(rendering_context_t* p_rendering_context, sp_light_handle_t light_handle)
+{
+    sapphire_renderer_t* renderer = &p_rendering_context->renderer;
+    if (!sp_handle_table_valid(&renderer->light_table, light_handle))
+        return;
+    uint32_t index = sp_handle_table_release(&renderer->light_table, light_handle);
+    uint32_t last = renderer->light_table.num_alive;
+    free_light_shadow_tiles(&renderer->shadow_atlas, sp_pool_get(&renderer->light_shadows, sp_light_shadow_t, index));
+    *sp_pool_get(&renderer->lights, sp_light_t, index) = *sp_pool_get(&renderer->lights, sp_light_t, last);
+    *sp_pool_get(&renderer->light_shadows, sp_light_shadow_t, index) = *sp_pool_get(&renderer->light_shadows, sp_light_shadow_t, last);
+    sp_pool_trim(&renderer->lights, last);
+    sp_pool_trim(&renderer->light_shadows, last);
+}
+
+void renderer_set_light(rendering_context_t* p_rendering_context, sp_light_handle_t light_handle, const sp_light_t* light)
+{
+    sapphire_renderer_t* renderer = &p_rendering_context->renderer;
+    if (!sp_handle_table_valid(&renderer->light_table, light_handle))
+        return;
+    const uint32_t index = sp_handle_table_dense_index(&renderer->light_table, light_handle);
+    sp_light_t* current = sp_pool_get(&renderer->lights, sp_light_t, index);
+    sp_light_shadow_t* shadow = sp_pool_get(&renderer->light_shadows, sp_light_shadow_t, index);
+    // a light that changed type needs a different number of tiles
+    if (!light->cast_shadows || light->type != current->type)
+        free_light_shadow_tiles(&renderer->shadow_atlas, shadow);
+    shadow->dirty_mask = (uint8_t)((1u << shadow->num_views) - 1);
+    *current = *light;
+}
+
+void renderer_set_shadow_atlas_budget(rendering_context_t* p_rendering_context, uint32_t views_per_frame)
+{
+    p_rendering_context->renderer.shadow_atlas_budget = views_per_frame;
+}
+
+void renderer_set_depth_prepass(rendering_context_t* p_rendering_context, bool enabled)
+{
+    p_rendering_context->renderer.depth_prepass = enabled;
+}
+
+void renderer_set_shadow_config(rendering_context_t* p_rendering_context, const shadow_cascades_config_t* config)
+{
+    shadow_cascades_config_t* shadow_config = &p_rendering_context->renderer.shadow_config;
+    *shadow_config = *config;
+    shadow_config->num_cascades = config->num_cascades < 1 ? 1 : (config->num_cascades > SHADOW_CASCADES_MAX ? SHADOW_CASCADES_MAX : config->num_cascades);
+    shadow_config->map_size = RENDERING_SHADOW_MAP_SIZE;
+}
+
+// bounding sphere of the lit volume. A spot light is bounded by its cone, which is much smaller than the
+// range sphere for narrow cones
+static sp_vec4_t light_bounding_sphere(const sp_light_t* light)
+{
+    if (light->type != SP_LIGHT_TYPE_SPOT)
+        return (sp_vec4_t){ light->position.x, light->position.y, light->position.z, light->range };
+
+    const float angle = light->spot_outer_angle;
+    float distance, radius;
+    if (angle > 0.25f * SP_PI)
+    {
+        distance = light->range * cosf(angle);
+        radius = light->range * sinf(angle);
+    }
+    else
+    {
+        distance = light->range / (2.0f * cosf(angle));
+        radius = distance;
+    }
+    return (sp_vec4_t){ light->position.x + light->direction.x * distance, light->position.y + light->direction.y * distance, light->position.z + light->direction.z * distance, radius };
+}
+
+// bins the lights into the view clusters and uploads the lights, cluster ranges and light indices
+static void update_light_clusters(IDeviceContext* pContext, const viewer_t* viewer)
+{
+    sapphire_renderer_t* renderer = &g_rendering_context_o->renderer;
+    uint32_t num_lights = renderer->light_table.num_alive;
+    if (num_lights > RENDERING_MAX_LIGHTS)
+        num_lights = RENDERING_MAX_LIGHTS;
+
+    SP_INIT_SCRATCH_ALLOCATOR(scratch);
+    sp_vec4_t* spheres = sp_alloc(scratch, sizeof(sp_vec4_t) * (num_lights + 1));
+    gpu_cluster_light_t* gpu_lights = sp_alloc(scratch, sizeof(gpu_cluster_light_t) * (num_lights + 1));
+    for (uint32_t i = 0; i < num_lights; ++i)
+    {
+        const sp_light_t* light = sp_pool_get(&renderer->lights, sp_light_t, i);
+        const bool spot = light->type == SP_LIGHT_TYPE_SPOT;
+        spheres[i] = light_bounding_sphere(light);
+        gpu_lights[i] = (gpu_cluster_light_t){
+            .position = light->position,
+            .range = light->range,
+            .color = { light->color.x * light->intensity, light->color.y * light->intensity, light->color.z * light->intensity },
+            .spot_cos_outer = spot ? cosf(light->spot_outer_angle) : -2.0f,
+            .direction = light->direction,
+            .spot_cos_inner = spot ? cosf(light->spot_inner_angle) : -2.0f,
+            .shadow_view = sp_pool_get(&renderer->light_shadows, sp_light_shadow_t, i)->gpu_view,
+        };
+    }
+
+    light_clusters_t* clusters = &renderer->light_clusters;
+    light_clusters_bin(clusters, &viewer->view_projection, viewer->camera.near_plane, viewer->camera.far_plane, spheres, num_lights);
+
+    if (num_lights)
+        IDeviceContext_UpdateBuffer(pContext, g_rendering_context_o->lights_buffer, 0, sizeof(gpu_cluster_light_t) * num_lights, gpu_lights, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+    IDeviceContext_UpdateBuffer(pContext, g_rendering_context_o->light_clusters_buffer, 0, sizeof(light_cluster_t) * LIGHT_CLUSTERS_COUNT, clusters->clusters, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+    if (clusters->num_indices)
+        IDeviceContext_UpdateBuffer(pContext, g_rendering_context_o->light_indices_buffer, 0, sizeof(uint32_t) * clusters->num_indices, clusters->indices, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+    SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+
+    cb_cluster_attribs_t* p_cb_data = NULL;
+    IDeviceContext_MapBuffer(pContext, g_rendering_context_o->cb_cluster_attribs, MAP_WRITE, MAP_FLAG_DISCARD, &p_cb_data);
+    *p_cb_data = (cb_cluster_attribs_t){
+        .grid = { LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y, LIGHT_CLUSTERS_Z, num_lights },
+        .depth_slices = { clusters->z_scale, clusters->z_bias, 0, 0 },
+    };
+    IDeviceContext_UnmapBuffer(pContext, g_rendering_context_o->cb_cluster_attribs, MAP_WRITE);
+}
+
+void renderer_set_render_object_identity(rendering_context_t* p_rendering_context, sp_render_handle_t render_handle, uint64_t identity)
+{
+    sapphire_renderer_t* renderer = &p_rendering_context->renderer;
+    if (!renderer_is_render_object_valid(renderer, render_handle))
+        return;
+    uint32_t index = sp_handle_table_dense_index(&renderer->render_object_table, render_handle);
+    *sp_pool_get(&renderer->identities, uint64_t, index) = identity;
+}
+
+void renderer_remove_render_object(rendering_context_t* p_rendering_context, sp_render_handle_t render_handle)
+{
+    sapphire_renderer_t* renderer = &p_rendering_context->renderer;
+    if (!renderer_is_render_object_valid(renderer, render_handle))
+        return;
+
+    // while the handle is alive, the dynamic render object moved into the slot may be this one
+    const uint32_t dynamic_slot = *sp_pool_get(&renderer->dynamic_slots, uint32_t, sp_handle_table_dense_index(&renderer->render_object_table, render_handle));
+    if (dynamic_slot != UINT32_MAX)
+        remove_dynamic_render_object(renderer, dynamic_slot);
+
+    uint32_t index = sp_handle_table_release(&renderer->render_object_table, render_handle);
+    sp_mesh_handle_t mesh_handle = *sp_pool_get(&renderer->mesh_handles, sp_mesh_handle_t, index);
+    const uint32_t leaf = *sp_pool_get(&renderer->bvh_leaves, uint32_t, index);
+    if (dynamic_slot == UINT32_MAX)
+        invalidate_shadows(renderer, &renderer->bvh.nodes_arr[leaf].aabb);
+    sp_bvh_remove(&renderer->bvh, leaf);
+
+    // keep the render object pools packed - the last object was moved into the removed one's place
+    uint32_t last = renderer->render_object_table.num_alive;
+    *sp_pool_get(&renderer->world_matrices, sp_mat4x4_t, index) = *sp_pool_get(&renderer->world_matrices, sp_mat4x4_t, last);
+    *sp_pool_get(&renderer->mesh_handles, sp_mesh_handle_t, index) = *sp_pool_get(&renderer->mesh_handles, sp_mesh_handle_t, last);
+    *sp_pool_get(&renderer->bvh_leaves, uint32_t, index) = *sp_pool_get(&renderer->bvh_leaves, uint32_t, last);
+    *sp_pool_get(&renderer->identities, uint64_t, index) = *sp_pool_get(&renderer->identities, uint64_t, last);
+    *sp_pool_get(&renderer->dynamic_slots, uint32_t, index) = *sp_pool_get(&renderer->dynamic_slots, uint32_t, last);
+    sp_pool_trim(&renderer->world_matrices, last);
+    sp_pool_trim(&renderer->mesh_handles, last);
+    sp_pool_trim(&renderer->bvh_leaves, last);
+    sp_pool_trim(&renderer->identities, last);
+    sp_pool_trim(&renderer->dynamic_slots, last);
+
+    renderer_release_mesh(p_rendering_context, mesh_handle);
+}
+
+////
+// cpu picking
+
+typedef struct pick_context_t
+{
+    sapphire_renderer_t* renderer;
+    // set by the narrow phase of the closest render object hit so far
+    uint32_t triangle;
+} pick_context_t;
+
+typedef struct pick_mesh_context_t
+{
+    const sapphire_mesh_t* mesh;
+} pick_mesh_context_t;
+
+// general 4x4 inverse, returns false for a singular matrix
+static bool mat4x4_inverse(sp_mat4x4_t* res, const sp_mat4x4_t* m)
+{
+    const float* a = &m->xx;
+    float inv[16];
+    inv[0] = a[5] * a[10] * a[15] - a[5] * a[11] * a[14] - a[9] * a[6] * a[15] + a[9] * a[7] * a[14] + a[13] * a[6] * a[11] - a[13] * a[7] * a[10];
+    inv[4] = -a[4] * a[10] * a[15] + a[4] * a[11] * a[14] + a[8] * a[6] * a[15] - a[8] * a[7] * a[14] - a[12] * a[6] * a[11] + a[12] * a[7] * a[10];
+    inv[8] = a[4] * a[9] * a[15] - a[4] * a[11] * a[13] - a[8] * a[5] * a[15] + a[8] * a[7] * a[13] + a[12] * a[5] * a[11] - a[12] * a[7] * a[9];
+    inv[12] = -a[4] * a[9] * a[14] + a[4] * a[10] * a[13] + a[8] * a[5] * a[14] - a[8] * a[6] * a[13] - a[12] * a[5] * a[10] + a[12] * a[6] * a[9];
+    inv[1] = -a[1] * a[10] * a[15] + a[1] * a[11] * a[14] + a[9] * a[2] * a[15] - a[9] * a[3] * a[14] - a[13] * a[2] * a[11] + a[13] * a[3] * a[10];
+    inv[5] = a[0] * a[10] * a[15] - a[0] * a[11] * a[14] - a[8] * a[2] * a[15] + a[8] * a[3] * a[14] + a[12] * a[2] * a[11] - a[12] * a[3] * a[10];
+    inv[9] = -a[0] * a[9] * a[15] + a[0] * a[11] * a[13] + a[8] * a[1] * a[15] - a[8] * a[3] * a[13] - a[12] * a[1] * a[11] + a[12] * a[3] * a[9];
+    inv[13] = a[0] * a[9] * a[14] - a[0] * a[10] * a[13] - a[8] * a[1] * a[14] + a[8] * a[2] * a[13] + a[12] * a[1] * a[10] - a[12] * a[2] * a[9];
+    inv[2] = a[1] * a[6] * a[15] - a[1] * a[7] * a[14] - a[5] * a[2] * a[15] + a[5] * a[3] * a[14] + a[13] * a[2] * a[7] - a[13] * a[3] * a[6];
+    inv[6] = -a[0] * a[6] * a[15] + a[0] * a[7] * a[14] + a[4] * a[2] * a[15] - a[4] * a[3] * a[14] - a[12] * a[2] * a[7] + a[12] * a[3] * a[6];
+    inv[10] = a[0] * a[5] * a[15] - a[0] * a[7] * a[13] - a[4] * a[1] * a[15] + a[4] * a[3] * a[13] + a[12] * a[1] * a[7] - a[12] * a[3] * a[5];
+    inv[14] = -a[0] * a[5] * a[14] + a[0] * a[6] * a[13] + a[4] * a[1] * a[14] - a[4] * a[2] * a[13] - a[12] * a[1] * a[6] + a[12] * a[2] * a[5];
+    inv[3] = -a[1] * a[6] * a[11] + a[1] * a[7] * a[10] + a[5] * a[2] * a[11] - a[5] * a[3] * a[10] - a[9] * a[2] * a[7] + a[9] * a[3] * a[6];
+    inv[7] = a[0] * a[6] * a[11] - a[0] * a[7] * a[10] - a[4] * a[2] * a[11] + a[4] * a[3] * a[10] + a[8] * a[2] * a[7] - a[8] * a[3] * a[6];
+    inv[11] = -a[0] * a[5] * a[11] + a[0] * a[7] * a[9] + a[4] * a[1] * a[11] - a[4] * a[3] * a[9] - a[8] * a[1] * a[7] + a[8] * a[3] * a[5];
+    inv[15] = a[0] * a[5] * a[10] - a[0] * a[6] * a[9] - a[4] * a[1] * a[10] + a[4] * a[2] * a[9] + a[8] * a[1] * a[6] - a[8] * a[2] * a[5];
+
+    const float det = a[0] * inv[0] + a[1] * inv[4] + a[2] * inv[8] + a[3] * inv[12];
+    if (det == 0.0f)
+        return false;
+    const float inv_det = 1.0f / det;
+    float* r = &res->xx;
+    for (uint32_t i = 0; i < 16; ++i)
+        r[i] = inv[i] * inv_det;
+    return true;
+}
+
+// row vectors: p * m
+static sp_vec3_t transform_point(const sp_mat4x4_t* m, sp_vec3_t p)
+{
+    return (sp_vec3_t){
+        p.x * m->xx + p.y * m->yx + p.z * m->zx + m->wx,
+        p.x * m->xy + p.y * m->yy + p.z * m->zy + m->wy,
+        p.x * m->xz + p.y * m->yz + p.z * m->zz + m->wz,
+    };
+}
+
+static sp_vec3_t transform_vector(const sp_mat4x4_t* m, sp_vec3_t v)
+{
+    return (sp_vec3_t){
+        v.x * m->xx + v.y * m->yx + v.z * m->zx,
+        v.x * m->xy + v.y * m->yy + v.z * m->zy,
+        v.x * m->xz + v.y * m->yz + v.z * m->zz,
+    };
+}
+
+static sp_vec3_t vec3_sub(sp_vec3_t a, sp_vec3_t b)
+{
+    return (sp_vec3_t){ a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+static sp_vec3_t vec3_cross(sp_vec3_t a, sp_vec3_t b)
+{
+    return (sp_vec3_t){ a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+static float vec3_dot(sp_vec3_t a, sp_vec3_t b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static sp_vec3_t vec3_normalize(sp_vec3_t v)
+{
+    const float length = sqrtf(vec3_dot(v, v));
+    return length > 0.0f ? (sp_vec3_t){ v.x / length, v.y / length, v.z / length } : v;
+}
+
+// Moller-Trumbore, double sided. Returns the distance along the ray in units of direction or a negative value
+static float ray_triangle(sp_vec3_t origin, sp_vec3_t direction, sp_vec3_t a, sp_vec3_t b, sp_vec3_t c)
+{
+    const sp_vec3_t e1 = vec3_sub(b, a);
+    const sp_vec3_t e2 = vec3_sub(c, a);
+    const sp_vec3_t p = vec3_cross(direction, e2);
+    const float det = vec3_dot(e1, p);
+    if (fabsf(det) < 1e-12f)
+        return -1.0f;
+    const float inv_det = 1.0f / det;
+    const sp_vec3_t s = vec3_sub(origin, a);
+    const float u = vec3_dot(s, p) * inv_det;
+    if (u < 0.0f || u > 1.0f)
+        return -1.0f;
+    const sp_vec3_t q = vec3_cross(s, e1);
+    const float v = vec3_dot(direction, q) * inv_det;
+    if (v < 0.0f || u + v > 1.0f)
+        return -1.0f;
+    return vec3_dot(e2, q) * inv_det;
+}
+
+// narrow phase of the triangle bvh, the ray is in object space
+static float pick_triangle(void* user, uint32_t triangle, sp_vec3_t origin, sp_vec3_t direction, float max_distance)
+{
+    const sapphire_mesh_t* mesh = ((pick_mesh_context_t*)user)->mesh;
+    const uint32_t* tri = mesh->indices_arr + triangle * 3;
+    const float distance = ray_triangle(origin, direction, mesh->positions_arr[tri[0]], mesh->positions_arr[tri[1]], mesh->positions_arr[tri[2]]);
+    return distance <= max_distance ? distance : -1.0f;
+}
+
+// narrow phase of the render object bvh - casts the ray against the mesh triangles in object space. The object
+// space direction is not normalized so distances stay in world units
+static float pick_render_object(void* user, uint32_t render_handle, sp_vec3_t origin, sp_vec3_t direction, float max_distance)
+{
+    pick_context_t* context = user;
+    sapphire_renderer_t* renderer = context->renderer;
+    const uint32_t index = sp_handle_table_dense_index(&renderer->render_object_table, render_handle);
+    const sapphire_mesh_t* mesh = renderer_get_mesh(renderer, *sp_pool_get(&renderer->mesh_handles, sp_mesh_handle_t, index));
+
+    sp_mat4x4_t world_to_object;
+    if (!mat4x4_inverse(&world_to_object, sp_pool_get(&renderer->world_matrices, sp_mat4x4_t, index)))
+        return -1.0f;
+
+    pick_mesh_context_t mesh_context = { .mesh = mesh };
+    sp_bvh_ray_hit_t hit;
+    if (!sp_bvh_ray_cast(&mesh->triangles_bvh, transform_point(&world_to_object, origin), transform_vector(&world_to_object, direction), max_distance, pick_triangle, &mesh_context, &hit))
+        return -1.0f;
+
+    // the outer cast takes every hit it is given, it is the closest so far
+    context->triangle = hit.user_data;
+    return hit.distance;
+}
+
+bool renderer_pick_ray(rendering_context_t* p_rendering_context, sp_vec3_t origin, sp_vec3_t direction, float max_distance, renderer_pick_result_t* result)
+{
+    sapphire_renderer_t* renderer = &p_rendering_context->renderer;
+    direction = vec3_normalize(direction);
+
+    pick_context_t context = { .renderer = renderer };
+    sp_bvh_ray_hit_t hit;
+    if (!sp_bvh_ray_cast(&renderer->bvh, origin, direction, max_distance, pick_render_object, &context, &hit))
+        return false;
+
+    const uint32_t index = sp_handle_table_dense_index(&renderer->render_object_table, hit.user_data);
+    const sapphire_mesh_t* mesh = renderer_get_mesh(renderer, *sp_pool_get(&renderer->mesh_handles, sp_mesh_handle_t, index));
+    const sp_mat4x4_t* world = sp_pool_get(&renderer->world_matrices, sp_mat4x4_t, index);
+    const uint32_t* tri = mesh->indices_arr + context.triangle * 3;
+    const sp_vec3_t a = transform_point(world, mesh->positions_arr[tri[0]]);
+    const sp_vec3_t b = transform_point(world, mesh->positions_arr[tri[1]]);
+    const sp_vec3_t c = transform_point(world, mesh->positions_arr[tri[2]]);
+    sp_vec3_t normal = vec3_normalize(vec3_cross(vec3_sub(b, a), vec3_sub(c, a)));
+    if (vec3_dot(normal, direction) > 0.0f)
+        normal = (sp_vec3_t){ -normal.x, -normal.y, -normal.z };
+
+    *result = (renderer_pick_result_t){
+        .render_handle = hit.user_data,
+        .identity = *sp_pool_get(&renderer->identities, uint64_t, index),
+        .triangle = context.triangle,
+        .distance = hit.distance,
+        .position = { origin.x + direction.x * hit.distance, origin.y + direction.y * hit.distance, origin.z + direction.z * hit.distance },
+        .normal = normal,
+    };
+    return true;
+}
+
+bool renderer_pick_screen(rendering_context_t* p_rendering_context, const viewer_t* viewer, sp_vec2_t screen_position, sp_vec2_t screen_size, renderer_pick_result_t* result)
+{
+    sp_mat4x4_t inv_view_projection;
+    if (!mat4x4_inverse(&inv_view_projection, &viewer->view_projection))
+        return false;
+
+    // unproject a point on the depth 1 plane, whichever clip plane that is it lies on the ray from the camera
+    const float ndc_x = (screen_position.x / screen_size.x) * 2.0f - 1.0f;
+    const float ndc_y = 1.0f - (screen_position.y / screen_size.y) * 2.0f;
+    const sp_mat4x4_t* m = &inv_view_projection;
+    const float w = ndc_x * m->xw + ndc_y * m->yw + m->zw + m->ww;
+    const sp_vec3_t point = {
+        (ndc_x * m->xx + ndc_y * m->yx + m->zx + m->wx) / w,
+        (ndc_x * m->xy + ndc_y * m->yy + m->zy + m->wy) / w,
+        (ndc_x * m->xz + ndc_y * m->yz + m->zz + m->wz) / w,
+    };
+
+    const sp_vec3_t origin = viewer->camera_transform.position;
+    return renderer_pick_ray(p_rendering_context, origin, vec3_sub(point, origin), viewer->camera.far_plane, result);
+}
+
+#define CENTIMETERS_TO_METERS(x) (x) *= 0.01f
+
+void merge_vertex_streams_to_buffer(sapphire_mesh_gpu_load_t* mesh_load_data, uint32_t attribute_flags, uint8_t* vertices_data)
+{
+    uint8_t* p_curr = vertices_data;
+    for (uint32_t i = 0; i < mesh_load_data->num_vertices; ++i)
+    {
+        for (uint32_t att_index = 0; att_index < MAX_VERTEX_ATTRIBUTE_STREAMS; ++att_index)
+        {
+            uint32_t stride = mesh_load_data->vertex_stream_stride_size[att_index];
+            if (stride > 0 && (attribute_flags & (0x1 << att_index)))
+            {                
+                memcpy(p_curr, mesh_load_data->vertices[att_index] + stride * i, stride);                
+                if (att_index == 0)
+                {
+                    // convert centimeters to meters
+                    float* vertex_pos = (float* )p_curr;
+                    CENTIMETERS_TO_METERS(vertex_pos[0]);
+                    CENTIMETERS_TO_METERS(vertex_pos[1]);
+                    CENTIMETERS_TO_METERS(vertex_pos[2]);
+                    
+                }
+                p_curr += stride;
+            }
+            
+        }
+        
+       
+    }
+}
+
+void create_cube_mesh_load_data(sp_temp_allocator_i* ta, const char* material, sapphire_mesh_gpu_load_t* p_mesh_load_data)
+{
+    typedef struct Vertex
+    {
+        sp_vec3_t pos;
+        sp_vec3_t normal;
+        sp_vec2_t uv;
+    } Vertex;
+
+    Vertex CubeVerts[] =
+    {
+        {.pos = {-1,-1,-1}, .normal = {0, 0, -1}, .uv = {0,1}},
+        {.pos = {-1,+1,-1}, .normal = {0, 0, -1},.uv = {0,0}},
+        {.pos = {+1,+1,-1}, .normal = {0, 0, -1},.uv = {1,0}},
+        {.pos = {+1,-1,-1}, .normal = {0, 0, -1},.uv = {1,1}},
+
+        {.pos = {-1,-1,-1}, .normal = {0, -1, 0},.uv = {0,1}},
+        {.pos = {-1,-1,+1}, .normal = {0, -1, 0},.uv = {0,0}},
+        {.pos = {+1,-1,+1}, .normal = {0, -1, 0},.uv = {1,0}},
+        {.pos = {+1,-1,-1}, .normal = {0, -1, 0},.uv = {1,1}},
+
+        {.pos = {+1,-1,-1}, .normal = {1, 0, 0},.uv = {0,1} },
+        {.pos = {+1,-1,+1}, .normal = {1, 0, 0},.uv = {1,1}},
+        {.pos = {+1,+1,+1}, .normal = {1, 0, 0},.uv = {1,0}},
+        {.pos = {+1,+1,-1}, .normal = {1, 0, 0},.uv = {0,0}},
+
+        {.pos = {+1,+1,-1}, .normal = {0, 1, 0}, .uv = {0,1}},
+        {.pos = {+1,+1,+1}, .normal = {0, 1, 0},.uv = {0,0}},
+        {.pos = {-1,+1,+1}, .normal = {0, 1, 0},.uv = {1,0}},
+        {.pos = {-1,+1,-1}, .normal = {0, 1, 0},.uv = {1,1}},
+
+        {.pos = {-1,+1,-1}, .normal = {-1, 0, 0},.uv = {1,0}},
+        {.pos = {-1,+1,+1}, .normal = {-1, 0, 0},.uv = {0,0}},
+        {.pos = {-1,-1,+1}, .normal = {-1, 0, 0},.uv = {0,1}},
+        {.pos = {-1,-1,-1}, .normal = {-1, 0, 0},.uv = {1,1}},
+
+        {.pos = {-1,-1,+1}, .normal = {0, 0, 1},.uv = {1,1}},
+        {.pos = {+1,-1,+1}, .normal = {0, 0, 1},.uv = {0,1}},
+        {.pos = {+1,+1,+1}, .normal = {0, 0, 1},.uv = {0,0}},
+        {.pos = {-1,+1,+1}, .normal = {0, 0, 1},.uv = {1,0}}
+    };
+
+    Uint32 Indices[] =
+    {
+        2,0,1,    2,3,0,
+        4,6,5,    4,7,6,
+        8,10,9,   8,11,10,
+        12,14,13, 12,15,14,
+        16,18,17, 16,19,18,
+        20,21,22, 20,22,23
+    };
+
+    uint8_t* indices = sp_temp_alloc(ta, sizeof(Indices));
+    memcpy(indices, &Indices, sizeof(Indices));
+
+    uint8_t* vertices = sp_temp_alloc(ta, sizeof(CubeVerts));
+    memcpy(vertices, &CubeVerts, sizeof(CubeVerts));
+    
+
+    memset(p_mesh_load_data, 0, sizeof(sapphire_mesh_gpu_load_t));
+    p_mesh_load_data->num_indices = 36;
+    p_mesh_load_data->num_submeshes = 1;
+    p_mesh_load_data->num_vertices = 24;
+    p_mesh_load_data->vertex_stride = 32;
+    p_mesh_load_data->vertices_data_size = p_mesh_load_data->num_vertices * p_mesh_load_data->vertex_stride;
+    p_mesh_load_data->indices_data_size = sizeof(uint32_t) * p_mesh_load_data->num_indices;
+    p_mesh_load_data->indices = (const uint8_t*)indices;
+    p_mesh_load_data->vertices[0] = (const uint8_t*)vertices;
+    p_mesh_load_data->vertex_stream_stride_size[0] = p_mesh_load_data->vertex_stride;
+    p_mesh_load_data->sub_meshes[0].indices_start = 0;
+    p_mesh_load_data->sub_meshes[0].indices_count = 36;
+    p_mesh_load_data->sub_meshes[0].material_hash = sp_murmur_hash_string(material);
+    p_mesh_load_data->bounding_box_min = (struct sp_vec3_t){ -1,-1,-1 };
+    p_mesh_load_data->bounding_box_max = (struct sp_vec3_t){ 1,1,1 };
+    p_mesh_load_data->bounding_sphere_center = (struct sp_vec3_t){ 0 };
+    p_mesh_load_data->bounding_sphere_radius = 1.732f;
+
+    
+}
+
+void create_sphere_mesh_load_data(sp_temp_allocator_i* ta, const char* material, uint32_t lod_level, sapphire_mesh_gpu_load_t* p_mesh_load_data)
+{
+    typedef struct Vertex
+    {
+        sp_vec3_t pos;
+        sp_vec3_t normal;
+        sp_vec2_t uv;
+    } Vertex;
+    const int baseSegments = 32; // Base number of segments (latitude lines)
+    const int baseRings = 16; // Base number of rings (longitude lines)
+
+    int numSegments = baseSegments * (1 << lod_level); // Adjust segments based on LOD
+    int numRings = baseRings * (1 << lod_level); // Adjust rings based on LOD
+    int num_vertices = numSegments * numRings;
+    Vertex* vertices = (Vertex*)sp_temp_alloc(ta, num_vertices * sizeof(Vertex));
+    uint32_t index = 0;
+    for (int ring = 0; ring <= numRings; ++ring) {
+        float phi = (float)(ring) / numRings * 2.0f * SP_PI;
+        for (int segment = 0; segment <= numSegments; ++segment) {
+            float theta = (float)(segment) / numSegments * SP_PI;
+
+            Vertex vertex;
+            vertex.pos.x = sinf(theta) * cosf(phi);
+            vertex.pos.y = cosf(theta);
+            vertex.pos.z = sinf(theta) * sinf(phi);
+
+            // Calculate normals (same as positions for a unit sphere)
+            vertex.normal = vertex.pos;
+
+            // Calculate UV coordinates
             vertex.uv.x = (float)(segment) / numSegments;
             vertex.uv.y = (float)(ring) / numRings;
 
@@ -530,22 +1484,64 @@ void create_sphere_mesh_load_data(sp_temp_allocator_i* ta, const char* material,
 }
 
 
-sp_mesh_handle_t load_mesh_to_gpu(IRenderDevice* pDevice, rendering_context_t* p_rendering_context, sapphire_mesh_gpu_load_t* mesh_load_data)
+// keeps the positions and indices of the mesh on the cpu and builds the triangle bvh used by picking
+static void build_mesh_collision(sapphire_renderer_t* renderer, sapphire_mesh_t* p_mesh, const sapphire_mesh_gpu_load_t* mesh_load_data)
 {
-    
+    sp_bvh_init(&p_mesh->triangles_bvh, 0.0f, renderer->allocator);
+    if (!mesh_load_data->num_vertices || mesh_load_data->num_indices < 3)
+        return;
+
+    // separate streams have the positions in stream 0 in centimeters, interleaved vertices start with the position
+    const uint32_t stride = mesh_load_data->flags ? mesh_load_data->vertex_stream_stride_size[0] : mesh_load_data->vertex_stride;
+    const float scale = mesh_load_data->flags ? 0.01f : 1.0f;
+    sp_array_ensure(p_mesh->positions_arr, mesh_load_data->num_vertices, renderer->allocator);
+    for (uint32_t i = 0; i < mesh_load_data->num_vertices; ++i)
+    {
+        const float* pos = (const float*)(mesh_load_data->vertices[0] + (uint64_t)stride * i);
+        sp_vec3_t position = { pos[0] * scale, pos[1] * scale, pos[2] * scale };
+        sp_array_push(p_mesh->positions_arr, position, renderer->allocator);
+    }
+
+    const uint32_t num_triangles = mesh_load_data->num_indices / 3;
+    const uint32_t* indices = (const uint32_t*)mesh_load_data->indices;
+    sp_array_ensure(p_mesh->indices_arr, num_triangles * 3, renderer->allocator);
+    for (uint32_t i = 0; i < num_triangles * 3; ++i)
+        sp_array_push(p_mesh->indices_arr, indices[i], renderer->allocator);
+
+    SP_INIT_SCRATCH_ALLOCATOR(scratch);
+    sp_aabb_t* triangle_boxes = sp_alloc(scratch, sizeof(sp_aabb_t) * num_triangles);
+    for (uint32_t i = 0; i < num_triangles; ++i)
+    {
+        const sp_vec3_t a = p_mesh->positions_arr[indices[i * 3 + 0]];
+        const sp_vec3_t b = p_mesh->positions_arr[indices[i * 3 + 1]];
+        const sp_vec3_t c = p_mesh->positions_arr[indices[i * 3 + 2]];
+        triangle_boxes[i] = (sp_aabb_t){
+            .min = { fminf(a.x, fminf(b.x, c.x)), fminf(a.y, fminf(b.y, c.y)), fminf(a.z, fminf(b.z, c.z)) },
+            .max = { fmaxf(a.x, fmaxf(b.x, c.x)), fmaxf(a.y, fmaxf(b.y, c.y)), fmaxf(a.z, fmaxf(b.z, c.z)) },
+        };
+    }
+    sp_bvh_build(&p_mesh->triangles_bvh, triangle_boxes, num_triangles, 1);
+    SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+}
+
+sp_mesh_handle_t load_mesh_to_gpu(IRenderDevice* pDevice, rendering_context_t* p_rendering_context, sapphire_mesh_gpu_load_t* mesh_load_data)
+{
+    
     // allocate mesh
     sapphire_mesh_t* p_mesh;
     sp_mesh_handle_t mesh_handle = allocate_renderer_mesh(&p_rendering_context->renderer, &p_mesh);
+    if (!p_mesh)
+        return SP_INVALID_HANDLE;
 
-    sp_allocator_i* allocator = sp_allocator_api->system_allocator;
-    uint8_t* vertices_data = NULL;
+    // the interleaved vertices only live until they are copied to the vertex buffer
+    SP_INIT_SCRATCH_ALLOCATOR(scratch);
     const uint8_t* p_final_vertices = NULL;
     if (mesh_load_data->flags)
     {
         uint32_t attribs_layout = 0b100011;
         mesh_load_data->vertex_stride = 32;
         mesh_load_data->vertices_data_size = mesh_load_data->num_vertices * mesh_load_data->vertex_stride;
-        vertices_data = sp_alloc(allocator, mesh_load_data->vertices_data_size);
+        uint8_t* vertices_data = sp_alloc(scratch, mesh_load_data->vertices_data_size);
         merge_vertex_streams_to_buffer(mesh_load_data, attribs_layout, vertices_data);
         p_final_vertices = vertices_data;
     }
@@ -558,25 +1554,57 @@ sp_mesh_handle_t load_mesh_to_gpu(IRenderDevice* pDevice, rendering_context_t* p
     sp_vb_handle_t vb_handle = buffers_manager_allocate_vb(pDevice, p_final_vertices, mesh_load_data->vertices_data_size);
     sp_ib_handle_t ib_handle = buffers_manager_allocate_ib(pDevice, mesh_load_data->indices, mesh_load_data->indices_data_size);
 
-    if (vertices_data)
+    // copied bit for bit from the interleaved vertices, the pre-pass and the colour pass have to compute the
+    // same depth for the EQUAL test
+    sp_vb_handle_t position_vb_handle = SP_INVALID_HANDLE;
+    if (mesh_load_data->num_vertices)
     {
-        sp_free(allocator, vertices_data, mesh_load_data->vertices_data_size);
+        const uint32_t position_size = 3 * sizeof(float);
+        uint8_t* positions = sp_alloc(scratch, (uint64_t)mesh_load_data->num_vertices * position_size);
+        for (uint32_t i = 0; i < mesh_load_data->num_vertices; ++i)
+            memcpy(positions + (uint64_t)i * position_size, p_final_vertices + (uint64_t)i * mesh_load_data->vertex_stride, position_size);
+        position_vb_handle = buffers_manager_allocate_vb(pDevice, positions, mesh_load_data->num_vertices * position_size);
     }
 
-    p_mesh->ib_handle = vb_handle;
-    p_mesh->vb_handle = ib_handle;
+    SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+
+    p_mesh->vb_handle = vb_handle;
+    p_mesh->ib_handle = ib_handle;
+    p_mesh->position_vb_handle = position_vb_handle;
     p_mesh->num_submeshes = mesh_load_data->num_submeshes;
     for (uint32_t i = 0; i < mesh_load_data->num_submeshes; ++i)
     {
         p_mesh->sub_meshes[i].indices_start = mesh_load_data->sub_meshes[i].indices_start;
         p_mesh->sub_meshes[i].indices_count = mesh_load_data->sub_meshes[i].indices_count;
-        p_mesh->sub_meshes[i].material_handle = material_manager_lookup_material(&g_rendering_context_o->materials_manager, mesh_load_data->sub_meshes[i].material_hash);// sp_hash_get_default(&p_rendering_context->materials_manager.material_name_lookup, mesh_load_data->sub_meshes[i].material_hash, 0);//mesh_load_data->sub_meshes[i].material_handle;
+        sp_mat_handle_t material_handle = material_manager_lookup_material(&p_rendering_context->materials_manager, mesh_load_data->sub_meshes[i].material_hash);
+        if (material_handle == SP_INVALID_HANDLE)
+        {
+            // model references a material that is not defined in the materials file
+            material_handle = p_rendering_context->materials_manager.fallback_material;
+        }
+        p_mesh->sub_meshes[i].material_handle = material_handle;
     }
     
     p_mesh->bounding_box_max = mesh_load_data->bounding_box_max;
     p_mesh->bounding_box_min = mesh_load_data->bounding_box_min;
     p_mesh->bounding_sphere_center = mesh_load_data->bounding_sphere_center;
     p_mesh->bounding_sphere_radius = mesh_load_data->bounding_sphere_radius;
+    if (mesh_load_data->flags)
+    {
+        // the merged vertex positions were converted to meters, the bounds have to match
+        CENTIMETERS_TO_METERS(p_mesh->bounding_box_max.x);
+        CENTIMETERS_TO_METERS(p_mesh->bounding_box_max.y);
+        CENTIMETERS_TO_METERS(p_mesh->bounding_box_max.z);
+        CENTIMETERS_TO_METERS(p_mesh->bounding_box_min.x);
+        CENTIMETERS_TO_METERS(p_mesh->bounding_box_min.y);
+        CENTIMETERS_TO_METERS(p_mesh->bounding_box_min.z);
+        CENTIMETERS_TO_METERS(p_mesh->bounding_sphere_center.x);
+        CENTIMETERS_TO_METERS(p_mesh->bounding_sphere_center.y);
+        CENTIMETERS_TO_METERS(p_mesh->bounding_sphere_center.z);
+        CENTIMETERS_TO_METERS(p_mesh->bounding_sphere_radius);
+    }
+
+    build_mesh_collision(&p_rendering_context->renderer, p_mesh, mesh_load_data);
 
     return mesh_handle;
 }
@@ -858,6 +1886,12 @@ static IPipelineState* create_pipeline_state(const char* pso_name, IRenderDevice
     PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthEnable = (state_flags & SP_MATERIAL_STATE_DEPTH_TEST_ENABLED) ? True : False;
     PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthWriteEnable = (state_flags & SP_MATERIAL_STATE_DEPTH_WRITE_ENABLED) ? True : False;
     PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthFunc = COMPARISON_FUNC_GREATER;
+    if (state_flags & SP_MATERIAL_STATE_DEPTH_EQUAL)
+    {
+        // the pre-pass wrote the closest depth, only the visible pixels are shaded
+        PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthWriteEnable = False;
+        PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthFunc = COMPARISON_FUNC_EQUAL;
+    }
 
     PSOCreateInfo.GraphicsPipeline.RasterizerDesc.FillMode = FILL_MODE_SOLID;
     PSOCreateInfo.GraphicsPipeline.RasterizerDesc.CullMode = CULL_MODE_NONE;// (state_flags & SP_MATERIAL_DOUBLE_SIDED) ? CULL_MODE_NONE : CULL_MODE_BACK;
@@ -927,6 +1961,17 @@ static IPipelineState* create_pipeline_state(const char* pso_name, IRenderDevice
         
     }
 
+    // a shader that fails to compile (e.g. while being edited for hot reload) leaves the caller's pso untouched
+    if (!pVS || !pPS)
+    {
+        if (pVS)
+            IObject_Release(pVS);
+        if (pPS)
+            IObject_Release(pPS);
+        IObject_Release(pShaderSourceFactory);
+        return NULL;
+    }
+
     // Define vertex shader input layout
     LayoutElement LayoutElems[] =
     {
@@ -954,6 +1999,14 @@ static IPipelineState* create_pipeline_state(const char* pso_name, IRenderDevice
         {.ShaderStages = SHADER_TYPE_VERTEX, .Name = "cbCameraAttribs", .Type = SHADER_RESOURCE_VARIABLE_TYPE_STATIC},
         {.ShaderStages = SHADER_TYPE_PIXEL, .Name = "cbCameraAttribs", .Type = SHADER_RESOURCE_VARIABLE_TYPE_STATIC},
         {.ShaderStages = SHADER_TYPE_PIXEL, .Name = "cbLightAttribs", .Type = SHADER_RESOURCE_VARIABLE_TYPE_STATIC},        
+        {.ShaderStages = SHADER_TYPE_PIXEL, .Name = "cbClusterAttribs", .Type = SHADER_RESOURCE_VARIABLE_TYPE_STATIC},
+        {.ShaderStages = SHADER_TYPE_PIXEL, .Name = "g_ClusterLights", .Type = SHADER_RESOURCE_VARIABLE_TYPE_STATIC},
+        {.ShaderStages = SHADER_TYPE_PIXEL, .Name = "g_LightClusters", .Type = SHADER_RESOURCE_VARIABLE_TYPE_STATIC},
+        {.ShaderStages = SHADER_TYPE_PIXEL, .Name = "g_LightIndices", .Type = SHADER_RESOURCE_VARIABLE_TYPE_STATIC},
+        {.ShaderStages = SHADER_TYPE_PIXEL, .Name = "cbShadowAttribs", .Type = SHADER_RESOURCE_VARIABLE_TYPE_STATIC},
+        {.ShaderStages = SHADER_TYPE_PIXEL, .Name = "g_ShadowMap", .Type = SHADER_RESOURCE_VARIABLE_TYPE_STATIC},
+        {.ShaderStages = SHADER_TYPE_PIXEL, .Name = "g_ShadowAtlas", .Type = SHADER_RESOURCE_VARIABLE_TYPE_STATIC},
+        {.ShaderStages = SHADER_TYPE_PIXEL, .Name = "g_ShadowAtlasViews", .Type = SHADER_RESOURCE_VARIABLE_TYPE_STATIC},
         {.ShaderStages = SHADER_TYPE_VERTEX, .Name = "cbTransforms", .Type = SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE},
         {.ShaderStages = SHADER_TYPE_PIXEL, .Name = "cbTransforms", .Type = SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE},        
         {.ShaderStages = SHADER_TYPE_PIXEL, .Name = "g_AlbedoTexture", .Type = SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE},
@@ -993,14 +2046,27 @@ static IPipelineState* create_pipeline_state(const char* pso_name, IRenderDevice
     sampler_description.ComparisonFunc = COMPARISON_FUNC_NEVER;
     sampler_description.MaxLOD = +3.402823466e+38F;
     
-    
+    // bilinear depth comparison for the shadow PCF taps
+    SamplerDesc shadow_sampler_description = { 0 };
+    shadow_sampler_description._DeviceObjectAttribs.Name = "Shadow comparison sampler";
+    shadow_sampler_description.MinFilter = FILTER_TYPE_COMPARISON_LINEAR;
+    shadow_sampler_description.MagFilter = FILTER_TYPE_COMPARISON_LINEAR;
+    shadow_sampler_description.MipFilter = FILTER_TYPE_COMPARISON_POINT;
+    shadow_sampler_description.AddressU = TEXTURE_ADDRESS_CLAMP;
+    shadow_sampler_description.AddressV = TEXTURE_ADDRESS_CLAMP;
+    shadow_sampler_description.AddressW = TEXTURE_ADDRESS_CLAMP;
+    shadow_sampler_description.ComparisonFunc = COMPARISON_FUNC_LESS;
+    shadow_sampler_description.MaxLOD = +3.402823466e+38F;
+
 
     // Define immutable sampler for g_Texture. Immutable samplers should be used whenever possible
     ImmutableSamplerDesc ImtblSamplers[] =
     {
         {.ShaderStages = SHADER_TYPE_PIXEL, .SamplerOrTextureName = "g_AlbedoTexture", .Desc = sampler_description},
         {.ShaderStages = SHADER_TYPE_PIXEL, .SamplerOrTextureName = "g_NormalsTexture", .Desc = sampler_description},
-        {.ShaderStages = SHADER_TYPE_PIXEL, .SamplerOrTextureName = "g_PhysicalDescriptorMap", .Desc = sampler_description}
+        {.ShaderStages = SHADER_TYPE_PIXEL, .SamplerOrTextureName = "g_PhysicalDescriptorMap", .Desc = sampler_description},
+        {.ShaderStages = SHADER_TYPE_PIXEL, .SamplerOrTextureName = "g_ShadowMap", .Desc = shadow_sampler_description},
+        {.ShaderStages = SHADER_TYPE_PIXEL, .SamplerOrTextureName = "g_ShadowAtlas", .Desc = shadow_sampler_description}
     };
 
     pPSODesc->ResourceLayout.ImmutableSamplers = ImtblSamplers;
@@ -1031,6 +2097,176 @@ static IPipelineState* create_pipeline_state(const char* pso_name, IRenderDevice
 }
 
 
+// depth only pipeline of the shadow casters. The vertex layout matches the default pbr pipeline, only the
+// positions are read
+static bool create_shadow_pso_srb(IRenderDevice* pDevice, IPipelineState** pp_pso, IShaderResourceBinding** pp_srb)
+{
+    GraphicsPipelineStateCreateInfo PSOCreateInfo;
+    memset(&PSOCreateInfo, 0, sizeof(PSOCreateInfo));
+
+    PipelineStateDesc* pPSODesc = &PSOCreateInfo._PipelineStateCreateInfo.PSODesc;
+    pPSODesc->_DeviceObjectAttribs.Name = "shadow_pso";
+    pPSODesc->PipelineType = PIPELINE_TYPE_GRAPHICS;
+    pPSODesc->ImmediateContextMask = 1;
+
+    PSOCreateInfo.GraphicsPipeline.NumRenderTargets = 0;
+    PSOCreateInfo.GraphicsPipeline.DSVFormat = TEX_FORMAT_D32_FLOAT;
+    PSOCreateInfo.GraphicsPipeline.PrimitiveTopology = PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    PSOCreateInfo.GraphicsPipeline.SmplDesc.Count = 1;
+    PSOCreateInfo.GraphicsPipeline.SampleMask = 0xFFFFFFFF;
+    PSOCreateInfo.GraphicsPipeline.NumViewports = 1;
+
+    // the shadow map uses a regular depth range, 0 is closest to the light
+    PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthEnable = True;
+    PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthWriteEnable = True;
+    PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthFunc = COMPARISON_FUNC_LESS;
+
+    // same culling as the default pbr pipeline, the slope bias keeps surfaces at grazing angles from shadowing themselves
+    PSOCreateInfo.GraphicsPipeline.RasterizerDesc.FillMode = FILL_MODE_SOLID;
+    PSOCreateInfo.GraphicsPipeline.RasterizerDesc.CullMode = CULL_MODE_NONE;
+    PSOCreateInfo.GraphicsPipeline.RasterizerDesc.DepthClipEnable = True;
+    PSOCreateInfo.GraphicsPipeline.RasterizerDesc.SlopeScaledDepthBias = 2.0f;
+
+    ShaderCreateInfo ShaderCI;
+    memset(&ShaderCI, 0, sizeof(ShaderCI));
+    ShaderCI.SourceLanguage = SHADER_SOURCE_LANGUAGE_HLSL;
+    ShaderCI.Desc.UseCombinedTextureSamplers = true;
+    ShaderCI.Desc.CombinedSamplerSuffix = "_sampler";
+
+    IEngineFactory* pEngineFactory = IRenderDevice_GetEngineFactory(pDevice);
+    IShaderSourceInputStreamFactory* pShaderSourceFactory = NULL;
+    IEngineFactory_CreateDefaultShaderSourceStreamFactory(pEngineFactory, NULL, &pShaderSourceFactory);
+    ShaderCI.pShaderSourceStreamFactory = pShaderSourceFactory;
+
+    IShader* pVS = NULL;
+    ShaderCI.Desc._DeviceObjectAttribs.Name = "shadow VS";
+    ShaderCI.Desc.ShaderType = SHADER_TYPE_VERTEX;
+    ShaderCI.EntryPoint = "main";
+    ShaderCI.FilePath = "shadow.vsh";
+    IRenderDevice_CreateShader(pDevice, &ShaderCI, &pVS, NULL);
+    IObject_Release(pShaderSourceFactory);
+    if (!pVS)
+        return false;
+
+    LayoutElement LayoutElems[] =
+    {
+        {.HLSLSemantic = "ATTRIB", .InputIndex = 0, .NumComponents = 3, .ValueType = VT_FLOAT32, .IsNormalized = False, .RelativeOffset = LAYOUT_ELEMENT_AUTO_OFFSET, .Stride = LAYOUT_ELEMENT_AUTO_STRIDE, .Frequency = INPUT_ELEMENT_FREQUENCY_PER_VERTEX, .InstanceDataStepRate = 1},
+        {.HLSLSemantic = "ATTRIB", .InputIndex = 1, .NumComponents = 3, .ValueType = VT_FLOAT32, .IsNormalized = False, .RelativeOffset = LAYOUT_ELEMENT_AUTO_OFFSET, .Stride = LAYOUT_ELEMENT_AUTO_STRIDE, .Frequency = INPUT_ELEMENT_FREQUENCY_PER_VERTEX, .InstanceDataStepRate = 1},
+        {.HLSLSemantic = "ATTRIB", .InputIndex = 2, .NumComponents = 2, .ValueType = VT_FLOAT32, .IsNormalized = False, .RelativeOffset = LAYOUT_ELEMENT_AUTO_OFFSET, .Stride = LAYOUT_ELEMENT_AUTO_STRIDE, .Frequency = INPUT_ELEMENT_FREQUENCY_PER_VERTEX, .InstanceDataStepRate = 1}
+    };
+    PSOCreateInfo.pVS = pVS;
+    PSOCreateInfo.pPS = NULL;
+    PSOCreateInfo.GraphicsPipeline.InputLayout.LayoutElements = LayoutElems;
+    PSOCreateInfo.GraphicsPipeline.InputLayout.NumElements = SP_ARRAY_COUNT(LayoutElems);
+
+    // both buffers are dynamic and mapped per draw and per cascade, so they can be static
+    pPSODesc->ResourceLayout.DefaultVariableType = SHADER_RESOURCE_VARIABLE_TYPE_STATIC;
+    ShaderResourceVariableDesc Vars[] =
+    {
+        {.ShaderStages = SHADER_TYPE_VERTEX, .Name = "cbTransforms", .Type = SHADER_RESOURCE_VARIABLE_TYPE_STATIC},
+        {.ShaderStages = SHADER_TYPE_VERTEX, .Name = "cbShadowCascade", .Type = SHADER_RESOURCE_VARIABLE_TYPE_STATIC},
+    };
+    pPSODesc->ResourceLayout.Variables = Vars;
+    pPSODesc->ResourceLayout.NumVariables = SP_ARRAY_COUNT(Vars);
+
+    IPipelineState* pPSO = NULL;
+    IRenderDevice_CreateGraphicsPipelineState(pDevice, &PSOCreateInfo, &pPSO);
+    IObject_Release(pVS);
+    if (!pPSO)
+        return false;
+
+    IShaderResourceVariable* pVar = IPipelineState_GetStaticVariableByName(pPSO, SHADER_TYPE_VERTEX, "cbTransforms");
+    if (pVar)
+        IShaderResourceVariable_Set(pVar, (IDeviceObject*)g_rendering_context_o->cb_drawcall, SET_SHADER_RESOURCE_FLAG_NONE);
+    pVar = IPipelineState_GetStaticVariableByName(pPSO, SHADER_TYPE_VERTEX, "cbShadowCascade");
+    if (pVar)
+        IShaderResourceVariable_Set(pVar, (IDeviceObject*)g_rendering_context_o->cb_shadow_cascade, SET_SHADER_RESOURCE_FLAG_NONE);
+
+    *pp_pso = pPSO;
+    *pp_srb = NULL;
+    IPipelineState_CreateShaderResourceBinding(pPSO, pp_srb, true);
+    return true;
+}
+
+// depth only pipeline of the pre-pass. Reads the position only vertex buffers and has the depth state and
+// rasterizer state of the default pbr pipeline, so both write the same depth
+static bool create_depth_prepass_pso_srb(IRenderDevice* pDevice, IPipelineState** pp_pso, IShaderResourceBinding** pp_srb)
+{
+    GraphicsPipelineStateCreateInfo PSOCreateInfo;
+    memset(&PSOCreateInfo, 0, sizeof(PSOCreateInfo));
+
+    PipelineStateDesc* pPSODesc = &PSOCreateInfo._PipelineStateCreateInfo.PSODesc;
+    pPSODesc->_DeviceObjectAttribs.Name = "depth_prepass_pso";
+    pPSODesc->PipelineType = PIPELINE_TYPE_GRAPHICS;
+    pPSODesc->ImmediateContextMask = 1;
+
+    PSOCreateInfo.GraphicsPipeline.NumRenderTargets = 0;
+    PSOCreateInfo.GraphicsPipeline.DSVFormat = TEX_FORMAT_D32_FLOAT;
+    PSOCreateInfo.GraphicsPipeline.PrimitiveTopology = PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    PSOCreateInfo.GraphicsPipeline.SmplDesc.Count = 1;
+    PSOCreateInfo.GraphicsPipeline.SampleMask = 0xFFFFFFFF;
+    PSOCreateInfo.GraphicsPipeline.NumViewports = 1;
+
+    // reverse z like the colour pass
+    PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthEnable = True;
+    PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthWriteEnable = True;
+    PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthFunc = COMPARISON_FUNC_GREATER;
+
+    PSOCreateInfo.GraphicsPipeline.RasterizerDesc.FillMode = FILL_MODE_SOLID;
+    PSOCreateInfo.GraphicsPipeline.RasterizerDesc.CullMode = CULL_MODE_NONE;
+    PSOCreateInfo.GraphicsPipeline.RasterizerDesc.DepthClipEnable = True;
+
+    ShaderCreateInfo ShaderCI;
+    memset(&ShaderCI, 0, sizeof(ShaderCI));
+    ShaderCI.SourceLanguage = SHADER_SOURCE_LANGUAGE_HLSL;
+    ShaderCI.Desc.UseCombinedTextureSamplers = true;
+
+    IEngineFactory* pEngineFactory = IRenderDevice_GetEngineFactory(pDevice);
+    IShaderSourceInputStreamFactory* pShaderSourceFactory = NULL;
+    IEngineFactory_CreateDefaultShaderSourceStreamFactory(pEngineFactory, NULL, &pShaderSourceFactory);
+    ShaderCI.pShaderSourceStreamFactory = pShaderSourceFactory;
+
+    IShader* pVS = NULL;
+    ShaderCI.Desc._DeviceObjectAttribs.Name = "depth prepass VS";
+    ShaderCI.Desc.ShaderType = SHADER_TYPE_VERTEX;
+    ShaderCI.EntryPoint = "main";
+    ShaderCI.FilePath = "depth_prepass.vsh";
+    IRenderDevice_CreateShader(pDevice, &ShaderCI, &pVS, NULL);
+    IObject_Release(pShaderSourceFactory);
+    if (!pVS)
+        return false;
+
+    LayoutElement LayoutElems[] =
+    {
+        {.HLSLSemantic = "ATTRIB", .InputIndex = 0, .NumComponents = 3, .ValueType = VT_FLOAT32, .IsNormalized = False, .RelativeOffset = LAYOUT_ELEMENT_AUTO_OFFSET, .Stride = LAYOUT_ELEMENT_AUTO_STRIDE, .Frequency = INPUT_ELEMENT_FREQUENCY_PER_VERTEX, .InstanceDataStepRate = 1},
+    };
+    PSOCreateInfo.pVS = pVS;
+    PSOCreateInfo.pPS = NULL;
+    PSOCreateInfo.GraphicsPipeline.InputLayout.LayoutElements = LayoutElems;
+    PSOCreateInfo.GraphicsPipeline.InputLayout.NumElements = SP_ARRAY_COUNT(LayoutElems);
+
+    // both buffers are dynamic and mapped per draw and per frame, so they can be static
+    pPSODesc->ResourceLayout.DefaultVariableType = SHADER_RESOURCE_VARIABLE_TYPE_STATIC;
+
+    IPipelineState* pPSO = NULL;
+    IRenderDevice_CreateGraphicsPipelineState(pDevice, &PSOCreateInfo, &pPSO);
+    IObject_Release(pVS);
+    if (!pPSO)
+        return false;
+
+    IShaderResourceVariable* pVar = IPipelineState_GetStaticVariableByName(pPSO, SHADER_TYPE_VERTEX, "cbTransforms");
+    if (pVar)
+        IShaderResourceVariable_Set(pVar, (IDeviceObject*)g_rendering_context_o->cb_drawcall, SET_SHADER_RESOURCE_FLAG_NONE);
+    pVar = IPipelineState_GetStaticVariableByName(pPSO, SHADER_TYPE_VERTEX, "cbCameraAttribs");
+    if (pVar)
+        IShaderResourceVariable_Set(pVar, (IDeviceObject*)g_rendering_context_o->cb_camera_attribs, SET_SHADER_RESOURCE_FLAG_NONE);
+
+    *pp_pso = pPSO;
+    *pp_srb = NULL;
+    IPipelineState_CreateShaderResourceBinding(pPSO, pp_srb, true);
+    return true;
+}
+
 inline void bind_shader_texture_variable(IShaderResourceBinding* p_srb, ITextureView* p_texture_SRV, const char* texture_var)
 {
     IShaderResourceVariable* pVar = IShaderResourceBinding_GetVariableByName(p_srb, SHADER_TYPE_PIXEL, texture_var);
@@ -1040,8 +2276,968 @@ inline void bind_shader_texture_variable(IShaderResourceBinding* p_srb, ITexture
     }
 }
 
+// draws one triangle over the viewport that writes depth only, with the far depth from the vertex shader or
+// the depth of the pixel shader
+static IPipelineState* create_shadow_viewport_pso(IRenderDevice* pDevice, const char* name, const char* ps_file_path)
+{
+    GraphicsPipelineStateCreateInfo PSOCreateInfo;
+    memset(&PSOCreateInfo, 0, sizeof(PSOCreateInfo));
+
+    PipelineStateDesc* pPSODesc = &PSOCreateInfo._PipelineStateCreateInfo.PSODesc;
+    pPSODesc->_DeviceObjectAttribs.Name = name;
+    pPSODesc->PipelineType = PIPELINE_TYPE_GRAPHICS;
+    pPSODesc->ImmediateContextMask = 1;
+    pPSODesc->ResourceLayout.DefaultVariableType = SHADER_RESOURCE_VARIABLE_TYPE_STATIC;
+    ShaderResourceVariableDesc Vars[] =
+    {
+        {.ShaderStages = SHADER_TYPE_PIXEL, .Name = "g_ShadowCache", .Type = SHADER_RESOURCE_VARIABLE_TYPE_MUTABLE},
+    };
+    pPSODesc->ResourceLayout.Variables = Vars;
+    pPSODesc->ResourceLayout.NumVariables = ps_file_path ? SP_ARRAY_COUNT(Vars) : 0;
+
+    PSOCreateInfo.GraphicsPipeline.NumRenderTargets = 0;
+    PSOCreateInfo.GraphicsPipeline.DSVFormat = TEX_FORMAT_D32_FLOAT;
+    PSOCreateInfo.GraphicsPipeline.PrimitiveTopology = PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    PSOCreateInfo.GraphicsPipeline.SmplDesc.Count = 1;
+    PSOCreateInfo.GraphicsPipeline.SampleMask = 0xFFFFFFFF;
+    PSOCreateInfo.GraphicsPipeline.NumViewports = 1;
+    PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthEnable = True;
+    PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthWriteEnable = True;
+    PSOCreateInfo.GraphicsPipeline.DepthStencilDesc.DepthFunc = COMPARISON_FUNC_ALWAYS;
+    PSOCreateInfo.GraphicsPipeline.RasterizerDesc.FillMode = FILL_MODE_SOLID;
+    PSOCreateInfo.GraphicsPipeline.RasterizerDesc.CullMode = CULL_MODE_NONE;
+    PSOCreateInfo.GraphicsPipeline.RasterizerDesc.DepthClipEnable = True;
+
+    ShaderCreateInfo ShaderCI;
+    memset(&ShaderCI, 0, sizeof(ShaderCI));
+    ShaderCI.SourceLanguage = SHADER_SOURCE_LANGUAGE_HLSL;
+    ShaderCI.Desc.UseCombinedTextureSamplers = true;
+
+    IEngineFactory* pEngineFactory = IRenderDevice_GetEngineFactory(pDevice);
+    IShaderSourceInputStreamFactory* pShaderSourceFactory = NULL;
+    IEngineFactory_CreateDefaultShaderSourceStreamFactory(pEngineFactory, NULL, &pShaderSourceFactory);
+    ShaderCI.pShaderSourceStreamFactory = pShaderSourceFactory;
+
+    IShader* pVS = NULL;
+    ShaderCI.Desc._DeviceObjectAttribs.Name = "shadow clear VS";
+    ShaderCI.Desc.ShaderType = SHADER_TYPE_VERTEX;
+    ShaderCI.EntryPoint = "main";
+    ShaderCI.FilePath = "shadow_clear.vsh";
+    IRenderDevice_CreateShader(pDevice, &ShaderCI, &pVS, NULL);
+
+    IShader* pPS = NULL;
+    if (pVS && ps_file_path)
+    {
+        ShaderCI.Desc._DeviceObjectAttribs.Name = "shadow viewport PS";
+        ShaderCI.Desc.ShaderType = SHADER_TYPE_PIXEL;
+        ShaderCI.EntryPoint = "main";
+        ShaderCI.FilePath = ps_file_path;
+        IRenderDevice_CreateShader(pDevice, &ShaderCI, &pPS, NULL);
+    }
+    IObject_Release(pShaderSourceFactory);
+    if (!pVS || (ps_file_path && !pPS))
+    {
+        if (pVS)
+            IObject_Release(pVS);
+        return NULL;
+    }
+
+    PSOCreateInfo.pVS = pVS;
+    PSOCreateInfo.pPS = pPS;
+
+    IPipelineState* pPSO = NULL;
+    IRenderDevice_CreateGraphicsPipelineState(pDevice, &PSOCreateInfo, &pPSO);
+    IObject_Release(pVS);
+    if (pPS)
+        IObject_Release(pPS);
+    return pPSO;
+}
+
+// writes the far depth over the viewport, clears a shadow atlas tile without touching the rest of the atlas
+static IPipelineState* create_shadow_clear_pso(IRenderDevice* pDevice)
+{
+    return create_shadow_viewport_pso(pDevice, "shadow_clear_pso", NULL);
+}
+
+// copies the static shadow cache into the viewport. Depth textures can't be copied by region, the pixel shader
+// writes the cached depth instead. srb i reads cascade i of the cache, the last one the atlas cache
+static bool create_shadow_copy_pso_srbs(IRenderDevice* pDevice, IPipelineState** pp_pso, IShaderResourceBinding** pp_srbs)
+{
+    IPipelineState* pPSO = create_shadow_viewport_pso(pDevice, "shadow_copy_pso", "shadow_copy.psh");
+    if (!pPSO)
+        return false;
+
+    for (uint32_t i = 0; i <= SHADOW_CASCADES_MAX; ++i)
+    {
+        pp_srbs[i] = NULL;
+        IPipelineState_CreateShaderResourceBinding(pPSO, &pp_srbs[i], true);
+        ITextureView* p_cache_srv = i < SHADOW_CASCADES_MAX ? g_rendering_context_o->shadow_cache_srvs[i] : g_rendering_context_o->shadow_atlas_cache_srv;
+        bind_shader_texture_variable(pp_srbs[i], p_cache_srv, "g_ShadowCache");
+    }
+    *pp_pso = pPSO;
+    return true;
+}
+
+
+
+
+////
+// shadows
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static StateTransitionDesc state_transition(IDeviceObject* p_resource, RESOURCE_STATE new_state)
+{
+    StateTransitionDesc barrier;
+    memset(&barrier, 0, sizeof(barrier));
+    barrier.pResource = p_resource;
+    barrier.MipLevelsCount = REMAINING_MIP_LEVELS;
+    barrier.ArraySliceCount = REMAINING_ARRAY_SLICES;
+    barrier.OldState = RESOURCE_STATE_UNKNOWN;
+    barrier.NewState = new_state;
+    barrier.TransitionType = STATE_TRANSITION_TYPE_IMMEDIATE;
+    barrier.Flags = STATE_TRANSITION_FLAG_UPDATE_STATE;
+    return barrier;
+}
+
+static bool sphere_in_frustum(const sp_vec4_t planes[6], sp_vec4_t sphere)
+{
+    for (uint32_t i = 0; i < 6; ++i)
+    {
+        if (planes[i].x * sphere.x + planes[i].y * sphere.y + planes[i].z * sphere.z + planes[i].w < -sphere.w)
+            return false;
+    }
+    return true;
+}
+
+static bool aabb_in_frustum(const sp_vec4_t planes[6], const sp_aabb_t* aabb)
+{
+    for (uint32_t i = 0; i < 6; ++i)
+    {
+        // the corner furthest along the plane normal
+        const sp_vec3_t p = {
+            planes[i].x >= 0.0f ? aabb->max.x : aabb->min.x,
+            planes[i].y >= 0.0f ? aabb->max.y : aabb->min.y,
+            planes[i].z >= 0.0f ? aabb->max.z : aabb->min.z,
+        };
+        if (planes[i].x * p.x + planes[i].y * p.y + planes[i].z * p.z + planes[i].w < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+static bool is_render_object_dynamic(sapphire_renderer_t* renderer, sp_render_handle_t render_handle)
+{
+    const uint32_t index = sp_handle_table_dense_index(&renderer->render_object_table, render_handle);
+    return *sp_pool_get(&renderer->dynamic_slots, uint32_t, index) != UINT32_MAX;
+}
+
+// static render objects in the frustum, into shadow_static_casters_arr
+static const sp_render_handle_t* cull_static_casters(sapphire_renderer_t* renderer, const sp_vec4_t planes[6])
+{
+    if (renderer->shadow_static_casters_arr)
+        sp_array_header(renderer->shadow_static_casters_arr)->size = 0;
+    sp_bvh_query_frustum(&renderer->bvh, planes, &renderer->shadow_static_casters_arr, renderer->allocator);
+    sp_render_handle_t* casters = renderer->shadow_static_casters_arr;
+    uint32_t num_static = 0;
+    for (uint32_t i = 0; i < sp_array_size(casters); ++i)
+    {
+        if (!is_render_object_dynamic(renderer, casters[i]))
+            casters[num_static++] = casters[i];
+    }
+    if (casters)
+        sp_array_header(casters)->size = num_static;
+    return casters;
+}
+
+// every render object in the frustum, for cascades drawn without their static cache
+static void cull_all_casters(sapphire_renderer_t* renderer, const sp_vec4_t planes[6], sp_render_handle_t** casters_arr)
+{
+    if (*casters_arr)
+        sp_array_header(*casters_arr)->size = 0;
+    sp_bvh_query_frustum(&renderer->bvh, planes, casters_arr, renderer->allocator);
+}
+
+// dynamic render objects in the frustum. There are few of them, their leaf boxes are tested one by one
+static void cull_dynamic_casters(sapphire_renderer_t* renderer, const sp_vec4_t planes[6], sp_render_handle_t** casters_arr)
+{
+    if (*casters_arr)
+        sp_array_header(*casters_arr)->size = 0;
+    for (uint32_t i = 0; i < sp_array_size(renderer->dynamic_arr); ++i)
+    {
+        const uint32_t index = sp_handle_table_dense_index(&renderer->render_object_table, renderer->dynamic_arr[i]);
+        const uint32_t leaf = *sp_pool_get(&renderer->bvh_leaves, uint32_t, index);
+        if (aabb_in_frustum(planes, &renderer->bvh.nodes_arr[leaf].aabb))
+            sp_array_push(*casters_arr, renderer->dynamic_arr[i], renderer->allocator);
+    }
+}
+
+// a static shadow cache with the view projection is up to date when no static render object changed in its frustum
+static bool is_shadow_cache_valid(const sapphire_renderer_t* renderer, const sp_vec4_t planes[6])
+{
+    if (renderer->shadow_invalidate_all)
+        return false;
+    for (uint32_t i = 0; i < sp_array_size(renderer->shadow_invalidations_arr); ++i)
+    {
+        if (aabb_in_frustum(planes, &renderer->shadow_invalidations_arr[i]))
+            return false;
+    }
+    return true;
+}
+
+// restores the static shadows of the bound depth target from the cache, the viewport selects the texels
+static void draw_shadow_cache(IDeviceContext* pContext, IShaderResourceBinding* p_copy_srb, RESOURCE_STATE_TRANSITION_MODE transition_mode)
+{
+    IDeviceContext_SetPipelineState(pContext, g_rendering_context_o->p_shadow_copy_pso);
+    IDeviceContext_CommitShaderResources(pContext, p_copy_srb, transition_mode);
+    DrawAttribs copy_attrs;
+    memset(&copy_attrs, 0, sizeof(copy_attrs));
+    copy_attrs.NumVertices = 3;
+    copy_attrs.NumInstances = 1;
+    copy_attrs.Flags = DRAW_FLAG_VERIFY_ALL;
+    IDeviceContext_Draw(pContext, &copy_attrs);
+}
+
+// draws shadow casters into the bound depth target with the shadow pso, returns the number of draws.
+// Deferred contexts can't transition resources, their states are verified only and the rendering thread
+// transitions the resources before recording
+static uint32_t draw_shadow_casters(IDeviceContext* pContext, const sp_mat4x4_t* view_projection, const sp_render_handle_t* casters, RESOURCE_STATE_TRANSITION_MODE transition_mode)
+{
+    sapphire_renderer_t* renderer = &g_rendering_context_o->renderer;
+    sapphire_buffers_manager_t* buffers_manager = &g_rendering_context_o->buffers_manager;
+
+    cb_shadow_cascade_t* p_cascade_data = NULL;
+    IDeviceContext_MapBuffer(pContext, g_rendering_context_o->cb_shadow_cascade, MAP_WRITE, MAP_FLAG_DISCARD, &p_cascade_data);
+    p_cascade_data->view_projection = *view_projection;
+    IDeviceContext_UnmapBuffer(pContext, g_rendering_context_o->cb_shadow_cascade, MAP_WRITE);
+
+    IDeviceContext_SetPipelineState(pContext, g_rendering_context_o->p_shadow_pso);
+    IDeviceContext_CommitShaderResources(pContext, g_rendering_context_o->p_shadow_srb, transition_mode);
+
+    uint32_t num_draws = 0;
+    const uint32_t num_casters = (uint32_t)sp_array_size(casters);
+    for (uint32_t caster_idx = 0; caster_idx < num_casters; ++caster_idx)
+    {
+        uint32_t i = sp_handle_table_dense_index(&renderer->render_object_table, casters[caster_idx]);
+        sapphire_mesh_t* mesh = renderer_get_mesh(renderer, *sp_pool_get(&renderer->mesh_handles, sp_mesh_handle_t, i));
+
+        const Uint64 offset = 0;
+        IBuffer* pBuffs[1];
+        pBuffs[0] = buffers_manager_get_vb(buffers_manager, mesh->vb_handle);
+        IDeviceContext_SetVertexBuffers(pContext, 0, 1, pBuffs, &offset, transition_mode, SET_VERTEX_BUFFERS_FLAG_RESET);
+        IDeviceContext_SetIndexBuffer(pContext, buffers_manager_get_ib(buffers_manager, mesh->ib_handle), 0, transition_mode);
+
+        cb_drawcall_t* p_cb_data = NULL;
+        IDeviceContext_MapBuffer(pContext, g_rendering_context_o->cb_drawcall, MAP_WRITE, MAP_FLAG_DISCARD, &p_cb_data);
+        p_cb_data->identity = *sp_pool_get(&renderer->identities, uint64_t, i);
+        p_cb_data->transform = *sp_pool_get(&renderer->world_matrices, sp_mat4x4_t, i);
+        IDeviceContext_UnmapBuffer(pContext, g_rendering_context_o->cb_drawcall, MAP_WRITE);
+
+        // casters don't need their materials, every sub mesh is drawn with the shadow pso
+        for (uint32_t sub_mesh_idx = 0; sub_mesh_idx < mesh->num_submeshes; ++sub_mesh_idx)
+        {
+            DrawIndexedAttribs draw_attrs;
+            memset(&draw_attrs, 0, sizeof(draw_attrs));
+            draw_attrs.IndexType = VT_UINT32;
+            draw_attrs.NumIndices = mesh->sub_meshes[sub_mesh_idx].indices_count;
+            draw_attrs.FirstIndexLocation = mesh->sub_meshes[sub_mesh_idx].indices_start;
+            draw_attrs.NumInstances = 1;
+            draw_attrs.Flags = DRAW_FLAG_VERIFY_ALL;
+            IDeviceContext_DrawIndexed(pContext, &draw_attrs);
+            ++num_draws;
+        }
+    }
+    return num_draws;
+}
+
+// decides where the static casters of a cascade come from this frame, returns true when it's the cache.
+// Cascades follow the camera. While it moves their projections change every frame and the cache would be
+// re-rendered and copied every frame for nothing, so the cascade draws its static casters itself, on its
+// deferred context with the dynamic ones. Once a projection held for a frame the cache is re-rendered here on the
+// immediate context, at most refreshes_left of them per frame, and restored from until the projection or a static
+// caster in it changes
+static bool update_shadow_cascade_cache(IDeviceContext* pContext, uint32_t cascade, uint32_t* refreshes_left)
+{
+    sapphire_renderer_t* renderer = &g_rendering_context_o->renderer;
+    const shadow_cascade_t* shadow_cascade = &renderer->shadow_cascades[cascade];
+    renderer_shadow_cascade_stats_t* stats = &renderer->shadow_stats[cascade];
+    const bool stable = memcmp(&renderer->shadow_last_view_projections[cascade], &shadow_cascade->view_projection, sizeof(sp_mat4x4_t)) == 0;
+    renderer->shadow_last_view_projections[cascade] = shadow_cascade->view_projection;
+    stats->static_cached = renderer->shadow_cache_valid[cascade] &&
+        memcmp(&renderer->shadow_cache_view_projections[cascade], &shadow_cascade->view_projection, sizeof(sp_mat4x4_t)) == 0 &&
+        is_shadow_cache_valid(renderer, shadow_cascade->frustum_planes);
+    stats->num_casters = 0;
+    stats->num_draws = 0;
+    if (stats->static_cached)
+        return true;
+
+    // static changes aren't tracked for a cache that isn't used, it can't become valid again by itself
+    renderer->shadow_cache_valid[cascade] = false;
+    if (!stable || !*refreshes_left)
+        return false;
+    --*refreshes_left;
+
+    const sp_render_handle_t* static_casters = cull_static_casters(renderer, shadow_cascade->frustum_planes);
+    ITextureView* pDSV = g_rendering_context_o->shadow_cache_dsvs[cascade];
+    IDeviceContext_SetRenderTargets(pContext, 0, NULL, pDSV, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+    IDeviceContext_ClearDepthStencil(pContext, pDSV, CLEAR_DEPTH_FLAG, 1.0f, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+    stats->num_draws = draw_shadow_casters(pContext, &shadow_cascade->view_projection, static_casters, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+    stats->num_casters = (uint32_t)sp_array_size(static_casters);
+
+    renderer->shadow_cache_view_projections[cascade] = shadow_cascade->view_projection;
+    renderer->shadow_cache_valid[cascade] = true;
+    stats->static_cached = true;
+    return true;
+}
+
+// restores the static casters of a cascade from its cache and draws the dynamic ones over them, or draws all
+// casters when the cascade doesn't use its cache this frame
+static void record_shadow_cascade(IDeviceContext* pContext, uint32_t cascade, RESOURCE_STATE_TRANSITION_MODE transition_mode)
+{
+    const double start = now_seconds();
+    sapphire_renderer_t* renderer = &g_rendering_context_o->renderer;
+    ITextureView* pDSV = g_rendering_context_o->shadow_map_dsvs[cascade];
+
+    IDeviceContext_SetRenderTargets(pContext, 0, NULL, pDSV, transition_mode);
+    if (renderer->shadow_stats[cascade].static_cached)
+        draw_shadow_cache(pContext, g_rendering_context_o->p_shadow_copy_srbs[cascade], transition_mode);
+    else
+        IDeviceContext_ClearDepthStencil(pContext, pDSV, CLEAR_DEPTH_FLAG, 1.0f, 0, transition_mode);
+    const uint32_t num_draws = draw_shadow_casters(pContext, &renderer->shadow_cascades[cascade].view_projection, renderer->shadow_casters_arr[cascade], transition_mode);
 
+    renderer_shadow_cascade_stats_t* stats = &renderer->shadow_stats[cascade];
+    stats->num_casters += (uint32_t)sp_array_size(renderer->shadow_casters_arr[cascade]);
+    stats->num_draws += num_draws;
+    stats->record_ms = (float)((now_seconds() - start) * 1000.0);
+}
+
+static void record_deferred_shadow_cascade(uint32_t cascade, ICommandList** pp_command_list)
+{
+    IDeviceContext* pDeferred = g_rendering_context_o->p_deferred_contexts[cascade];
+    IDeviceContext_Begin(pDeferred, 0);
+    record_shadow_cascade(pDeferred, cascade, RESOURCE_STATE_TRANSITION_MODE_VERIFY);
+    IDeviceContext_FinishCommandList(pDeferred, pp_command_list);
+}
+
+static void shadow_worker_thread(void* user_data)
+{
+    shadow_worker_t* worker = user_data;
+    for (;;)
+    {
+        sp_semaphore_wait(&worker->work);
+        if (worker->quit)
+            break;
+        record_deferred_shadow_cascade(worker->cascade, &worker->p_command_list);
+        sp_semaphore_post(&g_rendering_context_o->shadow_workers_done, 1);
+    }
+}
+
+void renderer_set_deferred_contexts(rendering_context_t* p_rendering_context, IDeviceContext** pp_contexts, uint32_t num_contexts)
+{
+    const uint32_t num_deferred_contexts = num_contexts < SHADOW_CASCADES_MAX ? num_contexts : SHADOW_CASCADES_MAX;
+    if (!num_deferred_contexts || p_rendering_context->num_deferred_contexts)
+        return;
+
+    for (uint32_t i = 0; i < num_deferred_contexts; ++i)
+    {
+        p_rendering_context->p_deferred_contexts[i] = pp_contexts[i];
+        IObject_AddRef(pp_contexts[i]);
+    }
+    p_rendering_context->num_deferred_contexts = num_deferred_contexts;
+
+    sp_semaphore_init(&p_rendering_context->shadow_workers_done, 0);
+    const uint32_t num_workers = num_deferred_contexts - 1;
+    if (!num_workers)
+        return;
+    p_rendering_context->shadow_workers = sp_alloc(sp_allocator_api->system_allocator, num_workers * sizeof(shadow_worker_t));
+    memset(p_rendering_context->shadow_workers, 0, num_workers * sizeof(shadow_worker_t));
+    for (uint32_t i = 0; i < num_workers; ++i)
+    {
+        shadow_worker_t* worker = &p_rendering_context->shadow_workers[i];
+        worker->cascade = i + 1;
+        sp_semaphore_init(&worker->work, 0);
+        sp_thread_create(&worker->thread, shadow_worker_thread, worker);
+    }
+}
+
+// gpu time of a cascade, the query of this frame slot was issued RENDERING_SHADOW_QUERY_FRAMES frames ago
+static void begin_shadow_query(IDeviceContext* pContext, uint32_t frame, uint32_t cascade)
+{
+    IQuery* p_query = g_rendering_context_o->shadow_queries[frame][cascade];
+    if (!p_query)
+        return;
+    if (g_rendering_context_o->shadow_queries_pending[frame][cascade])
+    {
+        QueryDataDuration data;
+        memset(&data, 0, sizeof(data));
+        if (IQuery_GetData(p_query, &data, sizeof(data), True) && data.Frequency)
+            g_rendering_context_o->renderer.shadow_stats[cascade].gpu_ms = (float)((double)data.Duration * 1000.0 / (double)data.Frequency);
+    }
+    IDeviceContext_BeginQuery(pContext, p_query);
+}
 
+static void end_shadow_query(IDeviceContext* pContext, uint32_t frame, uint32_t cascade)
+{
+    IQuery* p_query = g_rendering_context_o->shadow_queries[frame][cascade];
+    if (!p_query)
+        return;
+    IDeviceContext_EndQuery(pContext, p_query);
+    g_rendering_context_o->shadow_queries_pending[frame][cascade] = true;
+}
+
+// renders the shadow cascades of the directional light and updates the shadow constants of the pbr shader.
+// Cascades with a deferred context are recorded in parallel, the rest on the immediate context
+static void render_shadow_cascades(IDeviceContext* pContext, const viewer_t* viewer, sp_vec3_t light_direction)
+{
+    sapphire_renderer_t* renderer = &g_rendering_context_o->renderer;
+    sapphire_buffers_manager_t* buffers_manager = &g_rendering_context_o->buffers_manager;
+    const shadow_cascades_config_t* config = &renderer->shadow_config;
+    const uint32_t num_cascades = config->num_cascades;
+
+    sp_aabb_t scene_bounds = { .min = { 1.0f, 1.0f, 1.0f }, .max = { -1.0f, -1.0f, -1.0f } };
+    if (renderer->bvh.root != SP_BVH_NULL)
+        scene_bounds = renderer->bvh.nodes_arr[renderer->bvh.root].aabb;
+    shadow_cascades_update(renderer->shadow_cascades, config, &viewer->camera.view[SP_CAMERA_TRANSFORM_DEFAULT], &viewer->camera.projection[SP_CAMERA_TRANSFORM_DEFAULT],
+        viewer->camera.near_plane, viewer->camera.far_plane, light_direction, &scene_bounds);
+
+    cb_shadow_attribs_t* p_cb_data = NULL;
+    IDeviceContext_MapBuffer(pContext, g_rendering_context_o->cb_shadow_attribs, MAP_WRITE, MAP_FLAG_DISCARD, &p_cb_data);
+    memset(p_cb_data, 0, sizeof(cb_shadow_attribs_t));
+    float* splits = &p_cb_data->splits.x;
+    float* depth_biases = &p_cb_data->depth_biases.x;
+    for (uint32_t i = 0; i < num_cascades; ++i)
+    {
+        p_cb_data->view_projections[i] = renderer->shadow_cascades[i].view_projection;
+        splits[i] = renderer->shadow_cascades[i].split_far;
+        depth_biases[i] = renderer->shadow_cascades[i].depth_bias;
+    }
+    p_cb_data->map_attribs = (sp_vec4_t){ (float)config->map_size, 1.0f / (float)config->map_size, (float)num_cascades, 0.0f };
+    IDeviceContext_UnmapBuffer(pContext, g_rendering_context_o->cb_shadow_attribs, MAP_WRITE);
+
+    // static caches first, then the casters of every cascade from the light's view - the dynamic ones over a cache,
+    // all of them without
+    uint32_t cache_refreshes_left = RENDERING_SHADOW_CACHE_REFRESHES_PER_FRAME;
+    for (uint32_t i = 0; i < num_cascades; ++i)
+    {
+        const double start = now_seconds();
+        if (update_shadow_cascade_cache(pContext, i, &cache_refreshes_left))
+            cull_dynamic_casters(renderer, renderer->shadow_cascades[i].frustum_planes, &renderer->shadow_casters_arr[i]);
+        else
+            cull_all_casters(renderer, renderer->shadow_cascades[i].frustum_planes, &renderer->shadow_casters_arr[i]);
+        renderer->shadow_stats[i].cull_ms = (float)((now_seconds() - start) * 1000.0);
+        renderer->shadow_stats[i].deferred = i < g_rendering_context_o->num_deferred_contexts;
+    }
+    StateTransitionDesc cache_barrier = state_transition((IDeviceObject*)g_rendering_context_o->shadow_cache, RESOURCE_STATE_SHADER_RESOURCE);
+    IDeviceContext_TransitionResourceStates(pContext, 1, &cache_barrier);
+
+    const uint32_t query_frame = (uint32_t)(g_rendering_context_o->frame_fence_value % RENDERING_SHADOW_QUERY_FRAMES);
+    const uint32_t num_parallel = num_cascades < g_rendering_context_o->num_deferred_contexts ? num_cascades : g_rendering_context_o->num_deferred_contexts;
+    if (num_parallel)
+    {
+        // deferred contexts only verify states, move everything they use into place first
+        SP_INIT_SCRATCH_ALLOCATOR(scratch);
+        StateTransitionDesc* barriers_arr = NULL;
+        sp_array_push(barriers_arr, state_transition((IDeviceObject*)g_rendering_context_o->shadow_map, RESOURCE_STATE_DEPTH_WRITE), scratch);
+        IDeviceContext_TransitionResourceStates(pContext, (Uint32)sp_array_size(barriers_arr), barriers_arr);
+        for (uint32_t cascade = 0; cascade < num_parallel; ++cascade)
+        {
+            sp_array_header(barriers_arr)->size = 0;
+            const sp_render_handle_t* casters = renderer->shadow_casters_arr[cascade];
+            for (uint32_t caster_idx = 0; caster_idx < sp_array_size(casters); ++caster_idx)
+            {
+                uint32_t i = sp_handle_table_dense_index(&renderer->render_object_table, casters[caster_idx]);
+                sapphire_mesh_t* mesh = renderer_get_mesh(renderer, *sp_pool_get(&renderer->mesh_handles, sp_mesh_handle_t, i));
+                IBuffer* vb = buffers_manager_get_vb(buffers_manager, mesh->vb_handle);
+                IBuffer* ib = buffers_manager_get_ib(buffers_manager, mesh->ib_handle);
+                if (IBuffer_GetState(vb) != RESOURCE_STATE_VERTEX_BUFFER)
+                    sp_array_push(barriers_arr, state_transition((IDeviceObject*)vb, RESOURCE_STATE_VERTEX_BUFFER), scratch);
+                if (IBuffer_GetState(ib) != RESOURCE_STATE_INDEX_BUFFER)
+                    sp_array_push(barriers_arr, state_transition((IDeviceObject*)ib, RESOURCE_STATE_INDEX_BUFFER), scratch);
+            }
+            // per cascade, so a buffer shared by cascades is transitioned once
+            if (sp_array_size(barriers_arr))
+                IDeviceContext_TransitionResourceStates(pContext, (Uint32)sp_array_size(barriers_arr), barriers_arr);
+        }
+        SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+
+        ICommandList* command_lists[SHADOW_CASCADES_MAX];
+        for (uint32_t cascade = 1; cascade < num_parallel; ++cascade)
+            sp_semaphore_post(&g_rendering_context_o->shadow_workers[cascade - 1].work, 1);
+        record_deferred_shadow_cascade(0, &command_lists[0]);
+        for (uint32_t cascade = 1; cascade < num_parallel; ++cascade)
+            sp_semaphore_wait(&g_rendering_context_o->shadow_workers_done);
+        for (uint32_t cascade = 1; cascade < num_parallel; ++cascade)
+            command_lists[cascade] = g_rendering_context_o->shadow_workers[cascade - 1].p_command_list;
+
+        // one list at a time, so every cascade gets its own gpu timing
+        for (uint32_t cascade = 0; cascade < num_parallel; ++cascade)
+        {
+            begin_shadow_query(pContext, query_frame, cascade);
+            IDeviceContext_ExecuteCommandLists(pContext, 1, &command_lists[cascade]);
+            end_shadow_query(pContext, query_frame, cascade);
+            IObject_Release(command_lists[cascade]);
+        }
+        for (uint32_t cascade = 0; cascade < num_parallel; ++cascade)
+            IDeviceContext_FinishFrame(g_rendering_context_o->p_deferred_contexts[cascade]);
+    }
+
+    for (uint32_t cascade = num_parallel; cascade < num_cascades; ++cascade)
+    {
+        begin_shadow_query(pContext, query_frame, cascade);
+        record_shadow_cascade(pContext, cascade, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+        end_shadow_query(pContext, query_frame, cascade);
+    }
+
+    StateTransitionDesc barrier = state_transition((IDeviceObject*)g_rendering_context_o->shadow_map, RESOURCE_STATE_SHADER_RESOURCE);
+    IDeviceContext_TransitionResourceStates(pContext, 1, &barrier);
+}
+
+////
+// shadow atlas
+
+typedef struct shadow_light_order_t
+{
+    float importance;
+    uint32_t light;
+} shadow_light_order_t;
+
+// most important first
+static int compare_shadow_light_importance(const void* a, const void* b)
+{
+    const float ia = ((const shadow_light_order_t*)a)->importance;
+    const float ib = ((const shadow_light_order_t*)b)->importance;
+    return (ia < ib) - (ia > ib);
+}
+
+typedef struct shadow_atlas_job_t
+{
+    float priority;
+    uint32_t light;
+    uint32_t view;
+} shadow_atlas_job_t;
+
+static int compare_shadow_atlas_job(const void* a, const void* b)
+{
+    const float pa = ((const shadow_atlas_job_t*)a)->priority;
+    const float pb = ((const shadow_atlas_job_t*)b)->priority;
+    return (pa < pb) - (pa > pb);
+}
+
+// shadow views of a light for its current parameters, returns the number of views
+static uint32_t light_shadow_views(const sp_light_t* light, uint32_t tile_size, sp_mat4x4_t* view_projections, float* depth_bias)
+{
+    const float near_plane = fminf(RENDERING_SHADOW_ATLAS_NEAR, light->range * 0.1f);
+    // the views are a few texels wider than they have to be, the filter taps at the tile border stay in the view
+    const float margin = 1.0f + 4.0f / (float)tile_size;
+    if (light->type == SP_LIGHT_TYPE_SPOT)
+    {
+        const float tan_half_fov = tanf(fminf(light->spot_outer_angle, SP_PI * 0.45f)) * margin;
+        const sp_vec3_t up = fabsf(light->direction.y) > 0.99f ? (sp_vec3_t){ 1.0f, 0.0f, 0.0f } : (sp_vec3_t){ 0.0f, 1.0f, 0.0f };
+        view_projections[0] = shadow_atlas_perspective_view(light->position, light->direction, up, tan_half_fov, near_plane, light->range);
+        *depth_bias = shadow_atlas_depth_bias(tile_size, tan_half_fov, near_plane, light->range);
+        return 1;
+    }
+
+    // +x, -x, +y, -y, +z, -z, the face order of GetPointShadowFace in ShadowAtlas.fxh
+    static const sp_vec3_t forwards[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+    static const sp_vec3_t ups[6] = { { 0, 1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 }, { 0, 1, 0 }, { 0, 1, 0 } };
+    for (uint32_t i = 0; i < 6; ++i)
+        view_projections[i] = shadow_atlas_perspective_view(light->position, forwards[i], ups[i], margin, near_plane, light->range);
+    *depth_bias = shadow_atlas_depth_bias(tile_size, margin, near_plane, light->range);
+    return 6;
+}
+
+// part of the screen height the light bounds cover, up to 1
+static float light_screen_importance(sp_vec4_t sphere, sp_vec3_t camera_position, float tan_half_fov)
+{
+    const sp_vec3_t d = { sphere.x - camera_position.x, sphere.y - camera_position.y, sphere.z - camera_position.z };
+    const float distance = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z);
+    if (distance <= sphere.w)
+        return 1.0f;
+    return fminf(sphere.w / (distance * tan_half_fov), 1.0f);
+}
+
+// power of two tile size for the screen coverage of a light. The six cube faces of a point light each see
+// a part of what a spot light sees, they get half the size
+static uint32_t light_shadow_tile_size(float importance, sp_light_type type)
+{
+    const float texels = importance * (float)(type == SP_LIGHT_TYPE_SPOT ? RENDERING_SHADOW_ATLAS_MAX_TILE : RENDERING_SHADOW_ATLAS_MAX_TILE / 2);
+    uint32_t size = RENDERING_SHADOW_ATLAS_MIN_TILE;
+    while (size < RENDERING_SHADOW_ATLAS_MAX_TILE && (float)size < texels)
+        size *= 2;
+    return size;
+}
+
+// assigns atlas tiles to the shadow casting lights in the view, re-renders the views that need it within the
+// budget and uploads the views the shader samples. Lights out of view keep their tiles, cached, until a light
+// in view needs the space
+static void render_shadow_atlas(IDeviceContext* pContext, const viewer_t* viewer)
+{
+    const double start = now_seconds();
+    sapphire_renderer_t* renderer = &g_rendering_context_o->renderer;
+    shadow_atlas_t* atlas = &renderer->shadow_atlas;
+    renderer_shadow_atlas_stats_t* stats = &renderer->shadow_atlas_stats;
+    memset(stats, 0, sizeof(renderer_shadow_atlas_stats_t));
+    uint32_t num_lights = renderer->light_table.num_alive;
+    if (num_lights > RENDERING_MAX_LIGHTS)
+        num_lights = RENDERING_MAX_LIGHTS;
+
+    sp_vec4_t frustum_planes[6];
+    sp_frustum_planes_from_matrix(frustum_planes, &viewer->view_projection);
+    const float tan_half_fov = 1.0f / viewer->camera.projection[SP_CAMERA_TRANSFORM_DEFAULT].yy;
+
+    SP_INIT_SCRATCH_ALLOCATOR(scratch);
+    shadow_light_order_t* order = sp_alloc(scratch, sizeof(shadow_light_order_t) * (num_lights + 1));
+    uint32_t num_shadow_lights = 0;
+    for (uint32_t i = 0; i < num_lights; ++i)
+    {
+        const sp_light_t* light = sp_pool_get(&renderer->lights, sp_light_t, i);
+        sp_light_shadow_t* shadow = sp_pool_get(&renderer->light_shadows, sp_light_shadow_t, i);
+        shadow->gpu_view = UINT32_MAX;
+        if (!light->cast_shadows)
+            continue;
+        const sp_vec4_t sphere = light_bounding_sphere(light);
+        shadow->importance = sphere_in_frustum(frustum_planes, sphere) ? light_screen_importance(sphere, viewer->camera_transform.position, tan_half_fov) : -1.0f;
+        order[num_shadow_lights++] = (shadow_light_order_t){ .importance = shadow->importance, .light = i };
+        if (shadow->importance >= 0.0f)
+            ++stats->num_lights;
+    }
+    qsort(order, num_shadow_lights, sizeof(shadow_light_order_t), compare_shadow_light_importance);
+
+    // lights in view past the light limit give up their tiles, and so do the ones whose tile size is off by
+    // more than a factor of two - the slack keeps lights at the size boundary from reallocating every frame
+    for (uint32_t k = 0; k < num_shadow_lights && order[k].importance >= 0.0f; ++k)
+    {
+        const sp_light_t* light = sp_pool_get(&renderer->lights, sp_light_t, order[k].light);
+        sp_light_shadow_t* shadow = sp_pool_get(&renderer->light_shadows, sp_light_shadow_t, order[k].light);
+        const uint32_t tile_size = k < RENDERING_MAX_SHADOW_LIGHTS ? light_shadow_tile_size(order[k].importance, light->type) : 0;
+        if (shadow->tile_size && (tile_size == 0 || shadow->tile_size > tile_size * 2 || shadow->tile_size * 2 < tile_size))
+            free_light_shadow_tiles(atlas, shadow);
+    }
+
+    // then the lights in view without tiles get them, most important first. When the atlas is full the lights
+    // out of view are evicted, least important first, before the tile size is halved
+    uint32_t num_evictable = num_shadow_lights;
+    for (uint32_t k = 0; k < num_shadow_lights && k < RENDERING_MAX_SHADOW_LIGHTS && order[k].importance >= 0.0f; ++k)
+    {
+        const sp_light_t* light = sp_pool_get(&renderer->lights, sp_light_t, order[k].light);
+        sp_light_shadow_t* shadow = sp_pool_get(&renderer->light_shadows, sp_light_shadow_t, order[k].light);
+        if (shadow->tile_size)
+            continue;
+        const uint32_t num_views = light->type == SP_LIGHT_TYPE_SPOT ? 1 : SHADOW_ATLAS_MAX_LIGHT_VIEWS;
+        uint32_t tile_size = light_shadow_tile_size(order[k].importance, light->type);
+        while (!alloc_light_shadow_tiles(atlas, shadow, num_views, tile_size))
+        {
+            while (num_evictable > k + 1 && order[num_evictable - 1].importance < 0.0f && !sp_pool_get(&renderer->light_shadows, sp_light_shadow_t, order[num_evictable - 1].light)->tile_size)
+                --num_evictable;
+            if (num_evictable > k + 1 && order[num_evictable - 1].importance < 0.0f)
+            {
+                free_light_shadow_tiles(atlas, sp_pool_get(&renderer->light_shadows, sp_light_shadow_t, order[num_evictable - 1].light));
+                --num_evictable;
+                continue;
+            }
+            if (tile_size <= RENDERING_SHADOW_ATLAS_MIN_TILE)
+                break;
+            tile_size /= 2;
+        }
+        if (!shadow->tile_size)
+            ++stats->num_dropped_lights;
+    }
+    stats->num_dropped_lights += stats->num_lights > RENDERING_MAX_SHADOW_LIGHTS ? stats->num_lights - RENDERING_MAX_SHADOW_LIGHTS : 0;
+
+    // views that see a changed render object are re-rendered. Views of lights out of view too, so they are
+    // right when the lights come back
+    const sp_aabb_t* invalidations = renderer->shadow_invalidations_arr;
+    const uint32_t num_invalidations = (uint32_t)sp_array_size(invalidations);
+    sp_mat4x4_t* view_projections = sp_alloc(scratch, sizeof(sp_mat4x4_t) * SHADOW_ATLAS_MAX_LIGHT_VIEWS * (num_shadow_lights + 1));
+    float* depth_biases = sp_alloc(scratch, sizeof(float) * (num_shadow_lights + 1));
+    shadow_atlas_job_t* jobs_arr = NULL;
+    for (uint32_t k = 0; k < num_shadow_lights; ++k)
+    {
+        const sp_light_t* light = sp_pool_get(&renderer->lights, sp_light_t, order[k].light);
+        sp_light_shadow_t* shadow = sp_pool_get(&renderer->light_shadows, sp_light_shadow_t, order[k].light);
+        if (!shadow->tile_size)
+            continue;
+        sp_mat4x4_t* light_view_projections = view_projections + k * SHADOW_ATLAS_MAX_LIGHT_VIEWS;
+        light_shadow_views(light, shadow->tile_size, light_view_projections, &depth_biases[k]);
+
+        if (renderer->shadow_invalidate_all)
+        {
+            shadow->dirty_mask = (uint8_t)((1u << shadow->num_views) - 1);
+        }
+        else if (num_invalidations)
+        {
+            const sp_vec4_t sphere = light_bounding_sphere(light);
+            for (uint32_t view = 0; view < shadow->num_views; ++view)
+            {
+                if (shadow->dirty_mask & (1u << view))
+                    continue;
+                sp_vec4_t view_planes[6];
+                sp_frustum_planes_from_matrix(view_planes, &light_view_projections[view]);
+                for (uint32_t i = 0; i < num_invalidations; ++i)
+                {
+                    const sp_aabb_t* box = &invalidations[i];
+                    const sp_vec3_t closest = {
+                        fmaxf(box->min.x, fminf(sphere.x, box->max.x)),
+                        fmaxf(box->min.y, fminf(sphere.y, box->max.y)),
+                        fmaxf(box->min.z, fminf(sphere.z, box->max.z)),
+                    };
+                    const sp_vec3_t d = { closest.x - sphere.x, closest.y - sphere.y, closest.z - sphere.z };
+                    if (d.x * d.x + d.y * d.y + d.z * d.z <= sphere.w * sphere.w && aabb_in_frustum(view_planes, box))
+                    {
+                        shadow->dirty_mask |= (uint8_t)(1u << view);
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (order[k].importance < 0.0f)
+            continue;
+        // views never rendered come first, they keep the light unshadowed until they are
+        for (uint32_t view = 0; view < shadow->num_views; ++view)
+        {
+            const uint8_t bit = (uint8_t)(1u << view);
+            if (!(shadow->valid_mask & bit))
+                sp_array_push(jobs_arr, ((shadow_atlas_job_t){ .priority = 2.0f + order[k].importance, .light = k, .view = view }), scratch);
+            else if (shadow->dirty_mask & bit)
+                sp_array_push(jobs_arr, ((shadow_atlas_job_t){ .priority = order[k].importance, .light = k, .view = view }), scratch);
+            else
+                ++stats->num_cached;
+        }
+    }
+    stats->update_ms = (float)((now_seconds() - start) * 1000.0);
+
+    const double record_start = now_seconds();
+    const uint32_t num_jobs = (uint32_t)sp_array_size(jobs_arr);
+    const uint32_t num_rendered = num_jobs < renderer->shadow_atlas_budget ? num_jobs : renderer->shadow_atlas_budget;
+    qsort(jobs_arr, num_jobs, sizeof(shadow_atlas_job_t), compare_shadow_atlas_job);
+    // views rendered this frame, per light
+    uint8_t* rendered_masks = sp_alloc(scratch, num_shadow_lights + 1);
+    memset(rendered_masks, 0, num_shadow_lights + 1);
+    if (num_rendered)
+    {
+        // static casters only, into the cache
+        ITextureView* pDSV = g_rendering_context_o->shadow_atlas_cache_dsv;
+        IDeviceContext_SetRenderTargets(pContext, 0, NULL, pDSV, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+        for (uint32_t j = 0; j < num_rendered; ++j)
+        {
+            const shadow_atlas_job_t* job = &jobs_arr[j];
+            sp_light_shadow_t* shadow = sp_pool_get(&renderer->light_shadows, sp_light_shadow_t, order[job->light].light);
+            sp_light_shadow_view_t* view = &shadow->views[job->view];
+            const sp_mat4x4_t* view_projection = &view_projections[job->light * SHADOW_ATLAS_MAX_LIGHT_VIEWS + job->view];
+
+            const shadow_atlas_tile_t tile = shadow_atlas_get_tile(atlas, view->tile);
+            Viewport viewport = { .TopLeftX = (float)tile.x, .TopLeftY = (float)tile.y, .Width = (float)tile.size, .Height = (float)tile.size, .MinDepth = 0.0f, .MaxDepth = 1.0f };
+            IDeviceContext_SetViewports(pContext, 1, &viewport, RENDERING_SHADOW_ATLAS_SIZE, RENDERING_SHADOW_ATLAS_SIZE);
+
+            // depth clears take the whole texture, the tile is cleared by drawing the far depth over it
+            IDeviceContext_SetPipelineState(pContext, g_rendering_context_o->p_shadow_clear_pso);
+            DrawAttribs clear_attrs;
+            memset(&clear_attrs, 0, sizeof(clear_attrs));
+            clear_attrs.NumVertices = 3;
+            clear_attrs.NumInstances = 1;
+            clear_attrs.Flags = DRAW_FLAG_VERIFY_ALL;
+            IDeviceContext_Draw(pContext, &clear_attrs);
+
+            sp_vec4_t view_planes[6];
+            sp_frustum_planes_from_matrix(view_planes, view_projection);
+            draw_shadow_casters(pContext, view_projection, cull_static_casters(renderer, view_planes), RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+
+            view->view_projection = *view_projection;
+            view->depth_bias = depth_biases[job->light];
+            shadow->valid_mask |= (uint8_t)(1u << job->view);
+            shadow->dirty_mask &= (uint8_t)~(1u << job->view);
+            rendered_masks[job->light] |= (uint8_t)(1u << job->view);
+        }
+    }
+    stats->num_rendered = num_rendered;
+    StateTransitionDesc cache_barrier = state_transition((IDeviceObject*)g_rendering_context_o->shadow_atlas_cache, RESOURCE_STATE_SHADER_RESOURCE);
+    IDeviceContext_TransitionResourceStates(pContext, 1, &cache_barrier);
+
+    // the atlas holds the cache with the dynamic casters drawn over it. A tile is restored from the cache when
+    // its cache was re-rendered, or when dynamic casters are in the view now or were last frame. The views
+    // keep the projection their cache was rendered with, stale ones included
+    bool atlas_bound = false;
+    for (uint32_t k = 0; k < num_shadow_lights && order[k].importance >= 0.0f; ++k)
+    {
+        sp_light_shadow_t* shadow = sp_pool_get(&renderer->light_shadows, sp_light_shadow_t, order[k].light);
+        for (uint32_t view = 0; view < shadow->num_views; ++view)
+        {
+            const uint8_t bit = (uint8_t)(1u << view);
+            if (!(shadow->valid_mask & bit))
+                continue;
+            const sp_light_shadow_view_t* light_view = &shadow->views[view];
+            sp_vec4_t view_planes[6];
+            sp_frustum_planes_from_matrix(view_planes, &light_view->view_projection);
+            cull_dynamic_casters(renderer, view_planes, &renderer->shadow_atlas_casters_arr);
+            const bool has_dynamic = sp_array_size(renderer->shadow_atlas_casters_arr) > 0;
+            if (!has_dynamic && !((rendered_masks[k] | shadow->dynamic_mask) & bit))
+                continue;
+
+            if (!atlas_bound)
+            {
+                IDeviceContext_SetRenderTargets(pContext, 0, NULL, g_rendering_context_o->shadow_atlas_dsv, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+                atlas_bound = true;
+            }
+            const shadow_atlas_tile_t tile = shadow_atlas_get_tile(atlas, light_view->tile);
+            Viewport viewport = { .TopLeftX = (float)tile.x, .TopLeftY = (float)tile.y, .Width = (float)tile.size, .Height = (float)tile.size, .MinDepth = 0.0f, .MaxDepth = 1.0f };
+            IDeviceContext_SetViewports(pContext, 1, &viewport, RENDERING_SHADOW_ATLAS_SIZE, RENDERING_SHADOW_ATLAS_SIZE);
+            draw_shadow_cache(pContext, g_rendering_context_o->p_shadow_copy_srbs[SHADOW_CASCADES_MAX], RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+            if (has_dynamic)
+                stats->num_dynamic_draws += draw_shadow_casters(pContext, &light_view->view_projection, renderer->shadow_atlas_casters_arr, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+            shadow->dynamic_mask = has_dynamic ? (uint8_t)(shadow->dynamic_mask | bit) : (uint8_t)(shadow->dynamic_mask & ~bit);
+            ++stats->num_composed;
+        }
+    }
+    for (uint32_t j = num_rendered; j < num_jobs; ++j)
+    {
+        // views that were never rendered aren't shown at all, they aren't stale
+        const sp_light_shadow_t* shadow = sp_pool_get(&renderer->light_shadows, sp_light_shadow_t, order[jobs_arr[j].light].light);
+        if (shadow->valid_mask & (1u << jobs_arr[j].view))
+            ++stats->num_stale;
+    }
+
+    // lights in view with all their views rendered are shadowed
+    gpu_shadow_view_t* gpu_views = sp_alloc(scratch, sizeof(gpu_shadow_view_t) * RENDERING_SHADOW_ATLAS_MAX_VIEWS);
+    uint32_t num_gpu_views = 0;
+    const float inv_atlas_size = 1.0f / (float)RENDERING_SHADOW_ATLAS_SIZE;
+    for (uint32_t k = 0; k < num_shadow_lights && order[k].importance >= 0.0f; ++k)
+    {
+        sp_light_shadow_t* shadow = sp_pool_get(&renderer->light_shadows, sp_light_shadow_t, order[k].light);
+        if (!shadow->tile_size || shadow->valid_mask != (uint8_t)((1u << shadow->num_views) - 1) || num_gpu_views + shadow->num_views > RENDERING_SHADOW_ATLAS_MAX_VIEWS)
+            continue;
+        shadow->gpu_view = num_gpu_views;
+        for (uint32_t view = 0; view < shadow->num_views; ++view)
+        {
+            const shadow_atlas_tile_t tile = shadow_atlas_get_tile(atlas, shadow->views[view].tile);
+            gpu_views[num_gpu_views++] = (gpu_shadow_view_t){
+                .view_projection = shadow->views[view].view_projection,
+                .uv_rect = { (float)tile.x * inv_atlas_size, (float)tile.y * inv_atlas_size, (float)tile.size * inv_atlas_size, (float)tile.size * inv_atlas_size },
+                .depth_bias = shadow->views[view].depth_bias,
+                .texel_size = inv_atlas_size,
+            };
+        }
+    }
+    if (num_gpu_views)
+        IDeviceContext_UpdateBuffer(pContext, g_rendering_context_o->shadow_views_buffer, 0, sizeof(gpu_shadow_view_t) * num_gpu_views, gpu_views, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+    SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+
+    StateTransitionDesc barrier = state_transition((IDeviceObject*)g_rendering_context_o->shadow_atlas, RESOURCE_STATE_SHADER_RESOURCE);
+    IDeviceContext_TransitionResourceStates(pContext, 1, &barrier);
+    stats->usage = (float)((double)atlas->used_area / ((double)atlas->size * (double)atlas->size));
+    stats->record_ms = (float)((now_seconds() - record_start) * 1000.0);
+}
+
+typedef struct visible_sort_key_t
+{
+    float distance_sq;
+    sp_render_handle_t handle;
+} visible_sort_key_t;
+
+static int compare_visible_sort_keys(const void* a, const void* b)
+{
+    const float da = ((const visible_sort_key_t*)a)->distance_sq;
+    const float db = ((const visible_sort_key_t*)b)->distance_sq;
+    return (da > db) - (da < db);
+}
+
+// nearest objects first, they fill the depth buffer early and hide the pixels of the ones behind them
+static void sort_visible_front_to_back(sapphire_renderer_t* renderer, sp_vec3_t camera_position)
+{
+    const uint32_t num_visible = (uint32_t)sp_array_size(renderer->visible_arr);
+    if (num_visible < 2)
+        return;
+
+    SP_INIT_SCRATCH_ALLOCATOR(scratch);
+    visible_sort_key_t* keys = sp_alloc(scratch, sizeof(visible_sort_key_t) * num_visible);
+    for (uint32_t k = 0; k < num_visible; ++k)
+    {
+        const uint32_t i = sp_handle_table_dense_index(&renderer->render_object_table, renderer->visible_arr[k]);
+        const sp_aabb_t* aabb = &renderer->bvh.nodes_arr[*sp_pool_get(&renderer->bvh_leaves, uint32_t, i)].aabb;
+        const float dx = (aabb->min.x + aabb->max.x) * 0.5f - camera_position.x;
+        const float dy = (aabb->min.y + aabb->max.y) * 0.5f - camera_position.y;
+        const float dz = (aabb->min.z + aabb->max.z) * 0.5f - camera_position.z;
+        keys[k] = (visible_sort_key_t){ .distance_sq = dx * dx + dy * dy + dz * dz, .handle = renderer->visible_arr[k] };
+    }
+    qsort(keys, num_visible, sizeof(visible_sort_key_t), compare_visible_sort_keys);
+    for (uint32_t k = 0; k < num_visible; ++k)
+        renderer->visible_arr[k] = keys[k].handle;
+    SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+}
+
+static void set_drawcall_transform(IDeviceContext* pContext, sapphire_renderer_t* renderer, uint32_t i)
+{
+    // Map the buffer and write the world matrix and the identity the picking buffer reports
+    cb_drawcall_t* p_cb_data = NULL;
+    IDeviceContext_MapBuffer(pContext, g_rendering_context_o->cb_drawcall, MAP_WRITE, MAP_FLAG_DISCARD, &p_cb_data);
+    p_cb_data->identity = *sp_pool_get(&renderer->identities, uint64_t, i);
+    p_cb_data->transform = *sp_pool_get(&renderer->world_matrices, sp_mat4x4_t, i);
+    IDeviceContext_UnmapBuffer(pContext, g_rendering_context_o->cb_drawcall, MAP_WRITE);
+}
+
+static sp_material_t* get_sub_mesh_material(sapphire_materials_manager_t* materials_manager, const sapphire_sub_mesh_t* sub_mesh)
+{
+    if (!sp_handle_table_valid(&materials_manager->material_table, sub_mesh->material_handle))
+        return NULL;
+    return sp_pool_get(&materials_manager->materials, sp_material_t, sp_handle_table_dense_index(&materials_manager->material_table, sub_mesh->material_handle));
+}
+
+// depth of the opaque submeshes only, from the position only vertex buffers. Their colour pass then tests with
+// EQUAL and shades every pixel once. Returns the number of draws
+static uint32_t render_depth_prepass(IDeviceContext* pContext, ITextureView* pDSV)
+{
+    sapphire_renderer_t* renderer = &g_rendering_context_o->renderer;
+    sapphire_buffers_manager_t* buffers_manager = &g_rendering_context_o->buffers_manager;
+    sapphire_materials_manager_t* materials_manager = &g_rendering_context_o->materials_manager;
+
+    IDeviceContext_SetRenderTargets(pContext, 0, NULL, pDSV, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+    IDeviceContext_SetPipelineState(pContext, g_rendering_context_o->p_depth_prepass_pso);
+    IDeviceContext_CommitShaderResources(pContext, g_rendering_context_o->p_depth_prepass_srb, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+
+    uint32_t num_draws = 0;
+    const uint32_t num_visible = (uint32_t)sp_array_size(renderer->visible_arr);
+    for (uint32_t visible_idx = 0; visible_idx < num_visible; ++visible_idx)
+    {
+        uint32_t i = sp_handle_table_dense_index(&renderer->render_object_table, renderer->visible_arr[visible_idx]);
+        sapphire_mesh_t* mesh = renderer_get_mesh(renderer, *sp_pool_get(&renderer->mesh_handles, sp_mesh_handle_t, i));
+        bool bound = false;
+        for (uint32_t sub_mesh_idx = 0; sub_mesh_idx < mesh->num_submeshes; ++sub_mesh_idx)
+        {
+            sapphire_sub_mesh_t* sub_mesh = &mesh->sub_meshes[sub_mesh_idx];
+            sp_material_t* material = get_sub_mesh_material(materials_manager, sub_mesh);
+            if (!material || !material->p_prepass_pso)
+                continue;
+
+            if (!bound)
+            {
+                const Uint64 offset = 0;
+                IBuffer* pBuffs[1];
+                pBuffs[0] = buffers_manager_get_vb(buffers_manager, mesh->position_vb_handle);
+                IDeviceContext_SetVertexBuffers(pContext, 0, 1, pBuffs, &offset, RESOURCE_STATE_TRANSITION_MODE_TRANSITION, SET_VERTEX_BUFFERS_FLAG_RESET);
+                IDeviceContext_SetIndexBuffer(pContext, buffers_manager_get_ib(buffers_manager, mesh->ib_handle), 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+                set_drawcall_transform(pContext, renderer, i);
+                bound = true;
+            }
+
+            DrawIndexedAttribs draw_attrs;
+            memset(&draw_attrs, 0, sizeof(draw_attrs));
+            draw_attrs.IndexType = VT_UINT32;
+            draw_attrs.NumIndices = sub_mesh->indices_count;
+            draw_attrs.FirstIndexLocation = sub_mesh->indices_start;
+            draw_attrs.NumInstances = 1;
+            draw_attrs.Flags = DRAW_FLAG_VERIFY_ALL;
+            IDeviceContext_DrawIndexed(pContext, &draw_attrs);
+            ++num_draws;
+        }
+    }
+    return num_draws;
+}
 
 // Render a frame
 void renderer_do_rendering(IDeviceContext* pContext, viewer_t* viewer)
@@ -1049,13 +3245,9 @@ void renderer_do_rendering(IDeviceContext* pContext, viewer_t* viewer)
     ITextureView* pRTV = g_rendering_context_o->p_color_rtv;
     ITextureView* pDSV = g_rendering_context_o->p_depth_rtv;
 
-    // set texture render target 
-    
-    IDeviceContext_SetRenderTargets(pContext, 1, &pRTV, pDSV, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
-    // Clear the back buffer
-    const float ClearColor[] = { 0.850f, 0.350f, 0.350f, 1.0f };
-    IDeviceContext_ClearRenderTarget(pContext, pRTV, ClearColor, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
-    IDeviceContext_ClearDepthStencil(pContext, pDSV, CLEAR_DEPTH_FLAG, 0.f, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+    // release buffers of unloaded meshes the gpu is no longer using
+    uint64_t completed_fence_value = IFence_GetCompletedValue(g_rendering_context_o->p_frame_fence);
+    buffers_manager_collect_garbage(&g_rendering_context_o->buffers_manager, completed_fence_value);
 
     {
         cb_camera_attribs_t cb_camera = {
@@ -1076,14 +3268,14 @@ void renderer_do_rendering(IDeviceContext* pContext, viewer_t* viewer)
         IDeviceContext_UnmapBuffer(pContext, g_rendering_context_o->cb_camera_attribs, MAP_WRITE);
     }
 
+    const sp_vec4_t light_direction = sp_vec4_normalize((sp_vec4_t){ 0.5f, -0.6f, 0.2f, 0 });
     {
         cb_light_attribs_t cb_light = {
             .f4AmbientLight = {1,1,1,1},            
-            .f4Direction = {0.5f, -0.6f, 0.2f, 0},
+            .f4Direction = light_direction,
             .f4Intensity = {3,3,3,3}
         };
 
-        cb_light.f4Direction = sp_vec4_normalize(cb_light.f4Direction);
         // Map the buffer and write current camera data
         cb_light_attribs_t* p_cb_data = NULL;
         IDeviceContext_MapBuffer(pContext, g_rendering_context_o->cb_lights_attribs, MAP_WRITE, MAP_FLAG_DISCARD, &p_cb_data);
@@ -1092,46 +3284,82 @@ void renderer_do_rendering(IDeviceContext* pContext, viewer_t* viewer)
     }
 
     sapphire_renderer_t* renderer = &g_rendering_context_o->renderer;
-    sapphire_buffers_manager_t* buffers_manager = &g_rendering_context_o->buffers_manager;
-    sp_material_t* material_array = g_rendering_context_o->materials_manager.materials_arr;
-    // render all objects
-    for (uint32_t i = 0; i < renderer->num_render_objects; ++i)
-    {
-        sapphire_mesh_t* mesh = &renderer->meshes[renderer->mesh_handles[i]];
+    // the atlas decides which lights are shadowed before the lights are uploaded
+    render_shadow_atlas(pContext, viewer);
+    update_light_clusters(pContext, viewer);
+    render_shadow_cascades(pContext, viewer, (sp_vec3_t){ light_direction.x, light_direction.y, light_direction.z });
+    // both shadow passes checked their caches against the static changes
+    if (renderer->shadow_invalidations_arr)
+        sp_array_header(renderer->shadow_invalidations_arr)->size = 0;
+    renderer->shadow_invalidate_all = false;
 
-        // Bind vertex and index buffers
-        const Uint64 offset = 0;
-        IBuffer* pBuffs[1];
-        pBuffs[0] = buffers_manager->vertex_buffers[mesh->vb_handle];
-        IDeviceContext_SetVertexBuffers(pContext, 0, 1, pBuffs, &offset, RESOURCE_STATE_TRANSITION_MODE_TRANSITION, SET_VERTEX_BUFFERS_FLAG_RESET);
-        IDeviceContext_SetIndexBuffer(pContext, buffers_manager->index_buffers[mesh->ib_handle], 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+    // set texture render target 
+    
+    IDeviceContext_SetRenderTargets(pContext, 1, &pRTV, pDSV, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+    // Clear the back buffer
+    const float ClearColor[] = { 0.850f, 0.350f, 0.350f, 1.0f };
+    IDeviceContext_ClearRenderTarget(pContext, pRTV, ClearColor, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+    IDeviceContext_ClearDepthStencil(pContext, pDSV, CLEAR_DEPTH_FLAG, 0.f, 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
 
-        
+    sapphire_buffers_manager_t* buffers_manager = &g_rendering_context_o->buffers_manager;
+    sapphire_materials_manager_t* materials_manager = &g_rendering_context_o->materials_manager;
+    sapphire_textures_manager_t* textures_manager = &g_rendering_context_o->textures_manager;
+    // render the objects in the view frustum
+    sp_vec4_t frustum_planes[6];
+    sp_frustum_planes_from_matrix(frustum_planes, &viewer->view_projection);
+    if (renderer->visible_arr)
+        sp_array_header(renderer->visible_arr)->size = 0;
+    sp_bvh_query_frustum(&renderer->bvh, frustum_planes, &renderer->visible_arr, renderer->allocator);
+    sort_visible_front_to_back(renderer, (sp_vec3_t){ viewer->camera_transform.position.x, viewer->camera_transform.position.y, viewer->camera_transform.position.z });
+
+    const bool depth_prepass = renderer->depth_prepass && g_rendering_context_o->p_depth_prepass_pso;
+    if (depth_prepass)
+    {
+        render_depth_prepass(pContext, pDSV);
+        IDeviceContext_SetRenderTargets(pContext, 1, &pRTV, pDSV, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+    }
 
-        // set transform for mesh
-        {
-            // Map the buffer and write current world matrix
-            cb_drawcall_t* p_cb_data = NULL;
-            IDeviceContext_MapBuffer(pContext, g_rendering_context_o->cb_drawcall, MAP_WRITE, MAP_FLAG_DISCARD, &p_cb_data);
-            // TODO - handle identitity 
-            p_cb_data->identity = 0x1;
-            p_cb_data->transform = renderer->world_matrices[i];
-            IDeviceContext_UnmapBuffer(pContext, g_rendering_context_o->cb_drawcall, MAP_WRITE);
-        }
+    // opaque submeshes in the first pass, front to back. Submeshes left out of the pre-pass (transparent, alpha
+    // tested) in the second, once the opaque depth is complete
+    const uint32_t num_visible = (uint32_t)sp_array_size(renderer->visible_arr);
+    for (uint32_t pass = 0; pass < 2; ++pass)
+    for (uint32_t visible_idx = 0; visible_idx < num_visible; ++visible_idx)
+    {
+        uint32_t i = sp_handle_table_dense_index(&renderer->render_object_table, renderer->visible_arr[visible_idx]);
+        sapphire_mesh_t* mesh = renderer_get_mesh(renderer, *sp_pool_get(&renderer->mesh_handles, sp_mesh_handle_t, i));
+        bool bound = false;
 
         for (uint32_t sub_mesh_idx = 0; sub_mesh_idx < mesh->num_submeshes; ++sub_mesh_idx)
         {
             sapphire_sub_mesh_t* sub_mesh = &mesh->sub_meshes[sub_mesh_idx];
-            sp_material_t* material = &material_array[sub_mesh->material_handle];
-            IDeviceContext_SetPipelineState(pContext, material->p_pso);
+            sp_material_t* material = get_sub_mesh_material(materials_manager, sub_mesh);
+            if (!material || (material->p_prepass_pso == NULL) != (pass == 1))
+                continue;
+
+            if (!bound)
+            {
+                // Bind vertex and index buffers
+                const Uint64 offset = 0;
+                IBuffer* pBuffs[1];
+                pBuffs[0] = buffers_manager_get_vb(buffers_manager, mesh->vb_handle);
+                IDeviceContext_SetVertexBuffers(pContext, 0, 1, pBuffs, &offset, RESOURCE_STATE_TRANSITION_MODE_TRANSITION, SET_VERTEX_BUFFERS_FLAG_RESET);
+                IDeviceContext_SetIndexBuffer(pContext, buffers_manager_get_ib(buffers_manager, mesh->ib_handle), 0, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+                // set transform for mesh
+                set_drawcall_transform(pContext, renderer, i);
+                bound = true;
+            }
+
+            // the pre-pass wrote the final depth of the opaque submeshes, they only shade the pixels that match it
+            IShaderResourceBinding* p_srb = depth_prepass && material->p_prepass_pso ? material->p_prepass_srb : material->p_srb;
+            IDeviceContext_SetPipelineState(pContext, depth_prepass && material->p_prepass_pso ? material->p_prepass_pso : material->p_pso);
             // bind textures to srb
             //// Set texture SRV in the SRB
-            bind_shader_texture_variable(material->p_srb, material->texture_views[0], "g_AlbedoTexture");
-            bind_shader_texture_variable(material->p_srb, material->texture_views[1], "g_NormalsTexture");
-            bind_shader_texture_variable(material->p_srb, material->texture_views[2], "g_PhysicalDescriptorMap");
+            bind_shader_texture_variable(p_srb, textures_manager_get_texture_view(textures_manager, material->texture_handles[0]), "g_AlbedoTexture");
+            bind_shader_texture_variable(p_srb, textures_manager_get_texture_view(textures_manager, material->texture_handles[1]), "g_NormalsTexture");
+            bind_shader_texture_variable(p_srb, textures_manager_get_texture_view(textures_manager, material->texture_handles[2]), "g_PhysicalDescriptorMap");
 
 
-            IDeviceContext_CommitShaderResources(pContext, material->p_srb, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
+            IDeviceContext_CommitShaderResources(pContext, p_srb, RESOURCE_STATE_TRANSITION_MODE_TRANSITION);
 
             DrawIndexedAttribs draw_attrs;
             memset(&draw_attrs, 0, sizeof(draw_attrs));
@@ -1175,12 +3403,16 @@ void renderer_do_rendering(IDeviceContext* pContext, viewer_t* viewer)
 
     IDeviceContext_Draw(pContext, &draw_attrs);
 
+    // mark the end of the frame, deferred releases queued during this frame wait for this value
+    ++g_rendering_context_o->frame_fence_value;
+    IDeviceContext_EnqueueSignal(pContext, g_rendering_context_o->p_frame_fence, g_rendering_context_o->frame_fence_value);
 }
 
 void init_textures_manager(sapphire_textures_manager_t* textures_manager, sp_allocator_i* allocator)
 {
     textures_manager->allocator = allocator;
     textures_manager->textures_arr = NULL;
+    sp_handle_table_init(&textures_manager->texture_table, allocator);
     memset(&textures_manager->texture_path_lookup, 0, sizeof(textures_manager->texture_path_lookup));
     textures_manager->texture_path_lookup.allocator = allocator;
     
@@ -1188,23 +3420,27 @@ void init_textures_manager(sapphire_textures_manager_t* textures_manager, sp_all
 
 void destroy_textures_manager(sapphire_textures_manager_t* textures_manager)
 {
-    uint32_t num_textures = (uint32_t)sp_array_size(textures_manager->textures_arr);
+    uint32_t num_textures = textures_manager->texture_table.num_alive;
     for (uint32_t i = 0; i < num_textures; ++i)
     {
         IObject_Release(textures_manager->textures_arr[i]);
     }
     sp_array_free(textures_manager->textures_arr, textures_manager->allocator);
+    sp_handle_table_destroy(&textures_manager->texture_table);
     sp_hash_free(&textures_manager->texture_path_lookup);
 }
 
-static ITextureView* textures_manager_load_texture(IRenderDevice* pDevice, sapphire_textures_manager_t* textures_manager, const char* texture_file_path)
+ITextureView* textures_manager_get_texture_view(sapphire_textures_manager_t* textures_manager, sp_texture_handle_t handle)
+{
+    if (!sp_handle_table_valid(&textures_manager->texture_table, handle))
+        return NULL;
+    return textures_manager->textures_arr[sp_handle_table_dense_index(&textures_manager->texture_table, handle)];
+}
+
+// creates an immutable texture from an image file and returns its srv with a reference held, NULL if the file failed to load.
+// only touches the device, safe to call from the asset watcher thread
+ITextureView* renderer_create_texture_view_from_file(IRenderDevice* pDevice, const char* texture_file_path)
 {
-    sp_strhash_t texture_key = sp_murmur_hash_string(texture_file_path);
-    if (sp_hash_has(&textures_manager->texture_path_lookup, texture_key))
-    {
-        uint32_t index = sp_hash_get(&textures_manager->texture_path_lookup, texture_key);
-        return textures_manager->textures_arr[index];
-    }
     TextureLoadInfo loadInfo;
     memset(&loadInfo, 0, sizeof(loadInfo));
     loadInfo.IsSRGB = true;
@@ -1214,6 +3450,8 @@ static ITextureView* textures_manager_load_texture(IRenderDevice* pDevice, sapph
 
     ITexture* pTex = NULL;
     Diligent_CreateTextureFromFile(texture_file_path, &loadInfo, pDevice, &pTex);
+    if (!pTex)
+        return NULL;
     // Get shader resource view from the texture
     ITextureView* pTextureSRV = ITexture_GetDefaultView(pTex, TEXTURE_VIEW_SHADER_RESOURCE);
 
@@ -1227,92 +3465,180 @@ static ITextureView* textures_manager_load_texture(IRenderDevice* pDevice, sapph
     //}
 
     IObject_Release((IObject*)pTex);
+    return pTextureSRV;
+}
+
+static sp_texture_handle_t textures_manager_load_texture(IRenderDevice* pDevice, sapphire_textures_manager_t* textures_manager, const char* texture_file_path)
+{
+    sp_strhash_t texture_key = sp_murmur_hash_string(texture_file_path);
+    if (sp_hash_has(&textures_manager->texture_path_lookup, texture_key))
+    {
+        return sp_hash_get(&textures_manager->texture_path_lookup, texture_key);
+    }
+    ITextureView* pTextureSRV = renderer_create_texture_view_from_file(pDevice, texture_file_path);
+    if (!pTextureSRV)
+        return SP_INVALID_HANDLE;
+
     // store texture view in array and add to lookup table
-    uint32_t index = (uint32_t)sp_array_size(textures_manager->textures_arr);
+    sp_texture_handle_t handle = sp_handle_table_alloc(&textures_manager->texture_table);
     sp_array_push(textures_manager->textures_arr, pTextureSRV, textures_manager->allocator);
-    sp_hash_add(&textures_manager->texture_path_lookup, texture_key, index);
-    return pTextureSRV;
+    sp_hash_add(&textures_manager->texture_path_lookup, texture_key, handle);
+    return handle;
 }
 
-sp_material_t load_material_gpu_resources(sapphire_materials_manager_t* manager ,sp_material_def_t* material_def)
+// swaps the view behind an already loaded texture, materials keep their handles and pick up the new view
+// on the next draw. The old view is released once the frames using it are done
+bool textures_manager_replace_texture(rendering_context_t* p_rendering_context, sp_strhash_t texture_path_hash, ITextureView* p_texture_view)
+{
+    sapphire_textures_manager_t* textures_manager = &p_rendering_context->textures_manager;
+    sp_texture_handle_t handle = sp_hash_get_default(&textures_manager->texture_path_lookup, texture_path_hash, SP_INVALID_HANDLE);
+    if (!sp_handle_table_valid(&textures_manager->texture_table, handle))
+        return false;
+
+    uint32_t index = sp_handle_table_dense_index(&textures_manager->texture_table, handle);
+    buffers_manager_defer_release(&p_rendering_context->buffers_manager, (IObject*)textures_manager->textures_arr[index], p_rendering_context->frame_fence_value + 1);
+    textures_manager->textures_arr[index] = p_texture_view;
+    return true;
+}
+
+// creates the pso for the material state flags and its srb, with the shared uniform buffers bound.
+// returns an empty result when the shaders fail to compile
+static sp_mat_gpu_resources_t create_material_pso_srb(uint64_t state_flags)
 {
     TEXTURE_FORMAT  color_buffer_format  = TEX_FORMAT_RGBA8_UNORM;
     TEXTURE_FORMAT  depth_buffer_format  = TEX_FORMAT_D32_FLOAT;
-        
-    uint64_t pso_hash = material_def->flags;
-    IPipelineState* p_pso = NULL;
+
+    sp_mat_gpu_resources_t gpu_res = { 0 };
+    IPipelineState* p_pso = create_pipeline_state("default_pbr_pso", g_rendering_context_o->p_device, color_buffer_format, depth_buffer_format, state_flags);
+    if (!p_pso)
+        return gpu_res;
+
     IShaderResourceBinding* p_srb = NULL;
-    if (sp_hash_has(&manager->pso_srb_lookup, pso_hash))
+
+    // bind buffers to static shader variables
+    IShaderResourceVariable* pVar = IPipelineState_GetStaticVariableByName(p_pso, SHADER_TYPE_VERTEX, "cbCameraAttribs");
+    if (pVar)
     {
-        sp_mat_gpu_resources_t gpu_res = sp_hash_get(&manager->pso_srb_lookup, pso_hash);
-        p_pso = gpu_res.p_pso;
-        p_srb = gpu_res.p_srb;
+        IShaderResourceVariable_Set(pVar, (IDeviceObject*)g_rendering_context_o->cb_camera_attribs, SET_SHADER_RESOURCE_FLAG_NONE);
     }
-    else
+    pVar = IPipelineState_GetStaticVariableByName(p_pso, SHADER_TYPE_PIXEL, "cbCameraAttribs");
+    if (pVar)
     {
-        p_pso = create_pipeline_state("default_pbr_pso", g_rendering_context_o->p_device, color_buffer_format, depth_buffer_format, material_def->flags);
-
-        // bind buffers to static shader variables
-        IShaderResourceVariable* pVar = IPipelineState_GetStaticVariableByName(p_pso, SHADER_TYPE_VERTEX, "cbCameraAttribs");
-        if (pVar)
-        {
-            IShaderResourceVariable_Set(pVar, (IDeviceObject*)g_rendering_context_o->cb_camera_attribs, SET_SHADER_RESOURCE_FLAG_NONE);
-        }
-        pVar = IPipelineState_GetStaticVariableByName(p_pso, SHADER_TYPE_PIXEL, "cbCameraAttribs");
-        if (pVar)
-        {
-            IShaderResourceVariable_Set(pVar, (IDeviceObject*)g_rendering_context_o->cb_camera_attribs, SET_SHADER_RESOURCE_FLAG_NONE);
-        }
-        pVar = IPipelineState_GetStaticVariableByName(p_pso, SHADER_TYPE_PIXEL, "cbLightAttribs");
+        IShaderResourceVariable_Set(pVar, (IDeviceObject*)g_rendering_context_o->cb_camera_attribs, SET_SHADER_RESOURCE_FLAG_NONE);
+    }
+    pVar = IPipelineState_GetStaticVariableByName(p_pso, SHADER_TYPE_PIXEL, "cbLightAttribs");
+    if (pVar)
+    {
+        IShaderResourceVariable_Set(pVar, (IDeviceObject*)g_rendering_context_o->cb_lights_attribs, SET_SHADER_RESOURCE_FLAG_NONE);
+    }
+    pVar = IPipelineState_GetStaticVariableByName(p_pso, SHADER_TYPE_PIXEL, "cbClusterAttribs");
+    if (pVar)
+    {
+        IShaderResourceVariable_Set(pVar, (IDeviceObject*)g_rendering_context_o->cb_cluster_attribs, SET_SHADER_RESOURCE_FLAG_NONE);
+    }
+    pVar = IPipelineState_GetStaticVariableByName(p_pso, SHADER_TYPE_PIXEL, "cbShadowAttribs");
+    if (pVar)
+    {
+        IShaderResourceVariable_Set(pVar, (IDeviceObject*)g_rendering_context_o->cb_shadow_attribs, SET_SHADER_RESOURCE_FLAG_NONE);
+    }
+    pVar = IPipelineState_GetStaticVariableByName(p_pso, SHADER_TYPE_PIXEL, "g_ShadowMap");
+    if (pVar)
+    {
+        IShaderResourceVariable_Set(pVar, (IDeviceObject*)g_rendering_context_o->shadow_map_srv, SET_SHADER_RESOURCE_FLAG_NONE);
+    }
+    pVar = IPipelineState_GetStaticVariableByName(p_pso, SHADER_TYPE_PIXEL, "g_ShadowAtlas");
+    if (pVar)
+    {
+        IShaderResourceVariable_Set(pVar, (IDeviceObject*)g_rendering_context_o->shadow_atlas_srv, SET_SHADER_RESOURCE_FLAG_NONE);
+    }
+    const struct { const char* name; IBuffer* buffer; } light_buffers[] = {
+        { "g_ClusterLights", g_rendering_context_o->lights_buffer },
+        { "g_LightClusters", g_rendering_context_o->light_clusters_buffer },
+        { "g_LightIndices", g_rendering_context_o->light_indices_buffer },
+        { "g_ShadowAtlasViews", g_rendering_context_o->shadow_views_buffer },
+    };
+    for (uint32_t i = 0; i < SP_ARRAY_COUNT(light_buffers); ++i)
+    {
+        pVar = IPipelineState_GetStaticVariableByName(p_pso, SHADER_TYPE_PIXEL, light_buffers[i].name);
         if (pVar)
         {
-            IShaderResourceVariable_Set(pVar, (IDeviceObject*)g_rendering_context_o->cb_lights_attribs, SET_SHADER_RESOURCE_FLAG_NONE);
+            IBufferView* buffer_view = IBuffer_GetDefaultView(light_buffers[i].buffer, BUFFER_VIEW_SHADER_RESOURCE);
+            IShaderResourceVariable_Set(pVar, (IDeviceObject*)buffer_view, SET_SHADER_RESOURCE_FLAG_NONE);
         }
+    }
 
 
-        pVar = IPipelineState_GetStaticVariableByName(p_pso, SHADER_TYPE_PIXEL, "PickingBuffer");
-        if (pVar)
-        {
-            IBufferView* buffer_view = IBuffer_GetDefaultView(g_rendering_context_o->picking_buffer, BUFFER_VIEW_UNORDERED_ACCESS);
-            IShaderResourceVariable_Set(pVar, (IDeviceObject*)buffer_view, SET_SHADER_RESOURCE_FLAG_NONE);
-        }
-        
-        IPipelineState_CreateShaderResourceBinding(p_pso, &p_srb, true);
+    pVar = IPipelineState_GetStaticVariableByName(p_pso, SHADER_TYPE_PIXEL, "PickingBuffer");
+    if (pVar)
+    {
+        IBufferView* buffer_view = IBuffer_GetDefaultView(g_rendering_context_o->picking_buffer, BUFFER_VIEW_UNORDERED_ACCESS);
+        IShaderResourceVariable_Set(pVar, (IDeviceObject*)buffer_view, SET_SHADER_RESOURCE_FLAG_NONE);
+    }
+    
+    IPipelineState_CreateShaderResourceBinding(p_pso, &p_srb, true);
 
-        IShaderResourceVariable* p_srb_var = IShaderResourceBinding_GetVariableByName(p_srb, SHADER_TYPE_VERTEX, "cbTransforms");
-        if (p_srb_var)
-        {
-            IShaderResourceVariable_Set(p_srb_var, (IDeviceObject*)g_rendering_context_o->cb_drawcall, SET_SHADER_RESOURCE_FLAG_NONE);
-        }
+    IShaderResourceVariable* p_srb_var = IShaderResourceBinding_GetVariableByName(p_srb, SHADER_TYPE_VERTEX, "cbTransforms");
+    if (p_srb_var)
+    {
+        IShaderResourceVariable_Set(p_srb_var, (IDeviceObject*)g_rendering_context_o->cb_drawcall, SET_SHADER_RESOURCE_FLAG_NONE);
+    }
 
-        p_srb_var = IShaderResourceBinding_GetVariableByName(p_srb, SHADER_TYPE_PIXEL, "cbTransforms");
-        if (p_srb_var)
-        {
-            IShaderResourceVariable_Set(p_srb_var, (IDeviceObject*)g_rendering_context_o->cb_drawcall, SET_SHADER_RESOURCE_FLAG_NONE);
-        }
+    p_srb_var = IShaderResourceBinding_GetVariableByName(p_srb, SHADER_TYPE_PIXEL, "cbTransforms");
+    if (p_srb_var)
+    {
+        IShaderResourceVariable_Set(p_srb_var, (IDeviceObject*)g_rendering_context_o->cb_drawcall, SET_SHADER_RESOURCE_FLAG_NONE);
+    }
+
+    gpu_res.p_pso = p_pso;
+    gpu_res.p_srb = p_srb;
+    return gpu_res;
+}
+
+static sp_mat_gpu_resources_t get_material_gpu_resources(sapphire_materials_manager_t* manager, uint64_t state_flags)
+{
+    if (sp_hash_has(&manager->pso_srb_lookup, state_flags))
+        return sp_hash_get(&manager->pso_srb_lookup, state_flags);
 
-        sp_mat_gpu_resources_t gpu_res = { .p_pso = p_pso, .p_srb = p_srb };
-        sp_hash_add(&manager->pso_srb_lookup, pso_hash, gpu_res);
+    sp_mat_gpu_resources_t gpu_res = create_material_pso_srb(state_flags);
+    if (gpu_res.p_pso)
+    {
+        sp_hash_add(&manager->pso_srb_lookup, state_flags, gpu_res);
     }
+    return gpu_res;
+}
+
+// opaque materials that write depth are drawn in the depth pre-pass. Transparent and alpha tested ones are not,
+// their depth differs from what the position only pre-pass would write
+static bool is_depth_prepass_material(uint64_t state_flags)
+{
+    const uint64_t depth_flags = SP_MATERIAL_STATE_DEPTH_TEST_ENABLED | SP_MATERIAL_STATE_DEPTH_WRITE_ENABLED;
+    return (state_flags & depth_flags) == depth_flags && !(state_flags & (SP_MATERIAL_BLEND_MODE_TRANSPARENT | SP_MATERIAL_ALPHA_TEST));
+}
 
-    // TODO - store all texture views in a manager
-    ITextureView* albedo_texture_view = textures_manager_load_texture(g_rendering_context_o->p_device, &g_rendering_context_o->textures_manager, material_def->albedo_map); // , "g_AlbedoTexture"
-    ITextureView* normal_texture_view = textures_manager_load_texture(g_rendering_context_o->p_device, &g_rendering_context_o->textures_manager, material_def->normal_map);// , "g_NormalsTexture");
-    ITextureView* arm_texture_view = textures_manager_load_texture(g_rendering_context_o->p_device, &g_rendering_context_o->textures_manager, material_def->arm_map);// , "g_PhysicalDescriptorMap");
+sp_material_t load_material_gpu_resources(sapphire_materials_manager_t* manager ,sp_material_def_t* material_def)
+{
+    sp_mat_gpu_resources_t gpu_res = get_material_gpu_resources(manager, material_def->flags);
+    IPipelineState* p_pso = gpu_res.p_pso;
+    IShaderResourceBinding* p_srb = gpu_res.p_srb;
+    sp_mat_gpu_resources_t prepass_gpu_res = { 0 };
+    if (is_depth_prepass_material(material_def->flags))
+        prepass_gpu_res = get_material_gpu_resources(manager, material_def->flags | SP_MATERIAL_STATE_DEPTH_EQUAL);
+
+    sp_texture_handle_t albedo_texture = textures_manager_load_texture(g_rendering_context_o->p_device, &g_rendering_context_o->textures_manager, material_def->albedo_map); // , "g_AlbedoTexture"
+    sp_texture_handle_t normal_texture = textures_manager_load_texture(g_rendering_context_o->p_device, &g_rendering_context_o->textures_manager, material_def->normal_map);// , "g_NormalsTexture");
+    sp_texture_handle_t arm_texture = textures_manager_load_texture(g_rendering_context_o->p_device, &g_rendering_context_o->textures_manager, material_def->arm_map);// , "g_PhysicalDescriptorMap");
 
     // TODO - store shader sampler variables name in material
-    sp_material_t mat = {.p_pso = p_pso, .p_srb = p_srb };
-    mat.texture_views[0] = albedo_texture_view;
-    mat.texture_views[1] = normal_texture_view;
-    mat.texture_views[2] = arm_texture_view;
+    sp_material_t mat = {.p_pso = p_pso, .p_srb = p_srb, .p_prepass_pso = prepass_gpu_res.p_pso, .p_prepass_srb = prepass_gpu_res.p_srb };
+    mat.texture_handles[0] = albedo_texture;
+    mat.texture_handles[1] = normal_texture;
+    mat.texture_handles[2] = arm_texture;
     return mat;
 }
 
-void material_manager_add_materials(sapphire_materials_manager_t* manager , sp_material_def_t* materials_def_arr)
+static void material_manager_add_materials_range(sapphire_materials_manager_t* manager, sp_material_def_t* materials_def_arr, uint32_t num_materials)
 {
-    uint32_t num_materials = (uint32_t)sp_array_size(materials_def_arr);
-
-    sp_array_ensure(manager->materials_arr, num_materials, manager->allocator);
+    sp_array_ensure(manager->material_defs_arr, num_materials, manager->allocator);
 
     for (uint32_t i = 0; i < num_materials; ++i)
     {
@@ -1320,48 +3646,165 @@ void material_manager_add_materials(sapphire_materials_manager_t* manager , sp_m
         if (sp_hash_has(&manager->material_name_lookup, material_def->name_hash) == false)
         {
             sp_material_t mat = load_material_gpu_resources(manager, material_def);
-            sp_array_push(manager->materials_arr, mat, manager->allocator);
-            //uint64_t hash_key = sp_murmur_hash_string("xadvance");
-            uint32_t size = (uint32_t)sp_array_size(manager->materials_arr);
-            sp_hash_add(&manager->material_name_lookup, material_def->name_hash, size - 1);
+            sp_mat_handle_t handle = sp_handle_table_alloc(&manager->material_table);
+            sp_pool_ensure(&manager->materials, manager->material_table.num_alive);
+            *sp_pool_get(&manager->materials, sp_material_t, manager->material_table.num_alive - 1) = mat;
+            sp_array_push(manager->material_defs_arr, *material_def, manager->allocator);
+            sp_hash_add(&manager->material_name_lookup, material_def->name_hash, handle);
+            if (manager->fallback_material == SP_INVALID_HANDLE)
+                manager->fallback_material = handle;
         }
         
     }
 }
 
+void material_manager_add_materials(sapphire_materials_manager_t* manager , sp_material_def_t* materials_def_arr)
+{
+    material_manager_add_materials_range(manager, materials_def_arr, (uint32_t)sp_array_size(materials_def_arr));
+}
+
 sp_mat_handle_t material_manager_lookup_material(sapphire_materials_manager_t* manager, sp_strhash_t mat_name_hash)
 {
-    sp_mat_handle_t mat_handle = sp_hash_get_default(&manager->material_name_lookup, mat_name_hash, 0);
+    sp_mat_handle_t mat_handle = sp_hash_get_default(&manager->material_name_lookup, mat_name_hash, SP_INVALID_HANDLE);
     return mat_handle;
 }
 
-void load_materials(const char* materials_file, sp_material_def_t** p_materials_arr, sp_allocator_i* mats_allocator)
+// diffs reloaded definitions against the ones the materials were created from. Changed materials are rebuilt
+// in place so their handles stay valid, new ones are added. Materials removed from the file are kept, meshes
+// may still reference them
+void material_manager_reload_materials(sapphire_materials_manager_t* manager, sp_material_def_t* materials_def_arr)
 {
-    SP_INIT_TEMP_ALLOCATOR_WITH_ADAPTER(ta, a);
+    uint32_t num_materials = (uint32_t)sp_array_size(materials_def_arr);
+    for (uint32_t i = 0; i < num_materials; ++i)
+    {
+        sp_material_def_t* material_def = &materials_def_arr[i];
+        sp_mat_handle_t handle = material_manager_lookup_material(manager, material_def->name_hash);
+        if (handle == SP_INVALID_HANDLE)
+        {
+            material_manager_add_materials_range(manager, material_def, 1);
+            continue;
+        }
 
-    
+        uint32_t index = sp_handle_table_dense_index(&manager->material_table, handle);
+        if (memcmp(&manager->material_defs_arr[index], material_def, sizeof(sp_material_def_t)) == 0)
+            continue;
+
+        // pso/srb are shared by state flags and textures are cached by path, only new ones get created
+        sp_material_t mat = load_material_gpu_resources(manager, material_def);
+        // a state combination that fails to build keeps the old material, the old definition stays so the next
+        // reload tries again
+        if (!mat.p_pso)
+            continue;
+        *sp_pool_get(&manager->materials, sp_material_t, index) = mat;
+        manager->material_defs_arr[index] = *material_def;
+    }
+}
+
+// recompiles every material pso after a shader source changed. A shader that fails to compile keeps the old pso
+void material_manager_reload_shaders(rendering_context_t* p_rendering_context)
+{
+    sapphire_materials_manager_t* manager = &p_rendering_context->materials_manager;
+    uint64_t fence_value = p_rendering_context->frame_fence_value + 1;
+    const uint32_t num_materials = manager->material_table.num_alive;
+
+    for (uint32_t i = 0; i < manager->pso_srb_lookup.num_buckets; ++i)
+    {
+        if (!sp_hash_use_index(&manager->pso_srb_lookup, i))
+            continue;
+
+        sp_mat_gpu_resources_t* gpu_res = &manager->pso_srb_lookup.values[i];
+        sp_mat_gpu_resources_t new_gpu_res = create_material_pso_srb(manager->pso_srb_lookup.keys[i]);
+        if (!new_gpu_res.p_pso)
+            continue;
+
+        for (uint32_t mat_idx = 0; mat_idx < num_materials; ++mat_idx)
+        {
+            sp_material_t* material = sp_pool_get(&manager->materials, sp_material_t, mat_idx);
+            if (material->p_pso == gpu_res->p_pso)
+            {
+                material->p_pso = new_gpu_res.p_pso;
+                material->p_srb = new_gpu_res.p_srb;
+            }
+            if (material->p_prepass_pso == gpu_res->p_pso)
+            {
+                material->p_prepass_pso = new_gpu_res.p_pso;
+                material->p_prepass_srb = new_gpu_res.p_srb;
+            }
+        }
+
+        buffers_manager_defer_release(&p_rendering_context->buffers_manager, (IObject*)gpu_res->p_srb, fence_value);
+        buffers_manager_defer_release(&p_rendering_context->buffers_manager, (IObject*)gpu_res->p_pso, fence_value);
+        *gpu_res = new_gpu_res;
+    }
+
+    IPipelineState* p_shadow_pso = NULL;
+    IShaderResourceBinding* p_shadow_srb = NULL;
+    if (create_shadow_pso_srb(p_rendering_context->p_device, &p_shadow_pso, &p_shadow_srb))
+    {
+        buffers_manager_defer_release(&p_rendering_context->buffers_manager, (IObject*)p_rendering_context->p_shadow_srb, fence_value);
+        buffers_manager_defer_release(&p_rendering_context->buffers_manager, (IObject*)p_rendering_context->p_shadow_pso, fence_value);
+        p_rendering_context->p_shadow_pso = p_shadow_pso;
+        p_rendering_context->p_shadow_srb = p_shadow_srb;
+    }
+    IPipelineState* p_depth_prepass_pso = NULL;
+    IShaderResourceBinding* p_depth_prepass_srb = NULL;
+    if (create_depth_prepass_pso_srb(p_rendering_context->p_device, &p_depth_prepass_pso, &p_depth_prepass_srb))
+    {
+        buffers_manager_defer_release(&p_rendering_context->buffers_manager, (IObject*)p_rendering_context->p_depth_prepass_srb, fence_value);
+        buffers_manager_defer_release(&p_rendering_context->buffers_manager, (IObject*)p_rendering_context->p_depth_prepass_pso, fence_value);
+        p_rendering_context->p_depth_prepass_pso = p_depth_prepass_pso;
+        p_rendering_context->p_depth_prepass_srb = p_depth_prepass_srb;
+    }
+    IPipelineState* p_shadow_clear_pso = create_shadow_clear_pso(p_rendering_context->p_device);
+    if (p_shadow_clear_pso)
+    {
+        buffers_manager_defer_release(&p_rendering_context->buffers_manager, (IObject*)p_rendering_context->p_shadow_clear_pso, fence_value);
+        p_rendering_context->p_shadow_clear_pso = p_shadow_clear_pso;
+    }
+    IPipelineState* p_shadow_copy_pso = NULL;
+    IShaderResourceBinding* p_shadow_copy_srbs[SHADOW_CASCADES_MAX + 1];
+    if (create_shadow_copy_pso_srbs(p_rendering_context->p_device, &p_shadow_copy_pso, p_shadow_copy_srbs))
+    {
+        for (uint32_t i = 0; i < SHADOW_CASCADES_MAX + 1; ++i)
+        {
+            buffers_manager_defer_release(&p_rendering_context->buffers_manager, (IObject*)p_rendering_context->p_shadow_copy_srbs[i], fence_value);
+            p_rendering_context->p_shadow_copy_srbs[i] = p_shadow_copy_srbs[i];
+        }
+        buffers_manager_defer_release(&p_rendering_context->buffers_manager, (IObject*)p_rendering_context->p_shadow_copy_pso, fence_value);
+        p_rendering_context->p_shadow_copy_pso = p_shadow_copy_pso;
+    }
+}
+
+bool load_materials(const char* materials_file, sp_material_def_t** p_materials_arr, sp_allocator_i* mats_allocator)
+{
+    SP_INIT_TEMP_ALLOCATOR_WITH_ADAPTER(ta, a);
 
     const char* text = read_file(materials_file, ta);
+    if (!text)
+    {
+        SP_SHUTDOWN_TEMP_ALLOCATOR(ta);
+        return false;
+    }
 
     // read json file, including all extentions
     char error[256];
     const uint32_t parse_flags = SP_JSON_PARSE_EXT_ALLOW_UNQUOTED_KEYS | SP_JSON_PARSE_EXT_ALLOW_COMMENTS | SP_JSON_PARSE_EXT_IMPLICIT_ROOT_OBJECT | SP_JSON_PARSE_EXT_OPTIONAL_COMMAS | SP_JSON_PARSE_EXT_EQUALS_FOR_COLON;
     sp_config_i* materials_config = sp_config_api->create(a);
-    bool res = sp_json_api->parse(text, materials_config, parse_flags, error);
+    bool res = sp_json_simd_api->parse(text, materials_config, parse_flags, error);
     if (!res)
     {
-        return;
+        // a half saved file while hot reloading, keep the current materials
+        SP_SHUTDOWN_TEMP_ALLOCATOR(ta);
+        return false;
     }
 
     sp_config_item_t root = materials_config->root(materials_config->inst);
-    sp_strhash_t s_materials_hash = sp_murmur_hash_string("materials");
-    sp_strhash_t s_name_hash = sp_murmur_hash_string("name");
-    sp_strhash_t s_albedo_map_hash = sp_murmur_hash_string("albedo_map");
-    sp_strhash_t s_arm_map_hash = sp_murmur_hash_string("arm_map");
-    sp_strhash_t s_normal_map_hash = sp_murmur_hash_string("normal_map");
-    sp_strhash_t s_double_sided_hash = sp_murmur_hash_string("double_sided");
-
-    sp_config_item_t materials = materials_config->object_get(materials_config->inst, root, s_materials_hash);
+
+    // objects with many members are looked up through a hash index, small ones keep using object_get
+    config_object_index_t index;
+    config_object_index_build(&index, materials_config, root, a);
+    sp_config_item_t materials = config_object_index_get(&index, SP_KEY_MATERIALS);
+    config_object_index_free(&index);
     sp_config_item_t* materials_items_array = NULL;
     uint32_t num_materials = materials_config->to_array(materials_config->inst, materials, &materials_items_array);
 
@@ -1372,12 +3815,15 @@ void load_materials(const char* materials_file, sp_material_def_t** p_materials_
     {
         sp_config_item_t material_item = materials_items_array[i];
         sp_material_def_t* material_o = &materials_arr[i];
-        material_o->flags = 0;
-        get_attribute_as_string(materials_config, material_item, s_name_hash, material_o->name);
-        get_attribute_as_string(materials_config, material_item, s_albedo_map_hash, material_o->albedo_map);
-        get_attribute_as_string(materials_config, material_item, s_arm_map_hash, material_o->arm_map);
-        get_attribute_as_string(materials_config, material_item, s_normal_map_hash, material_o->normal_map);
-        bool is_double_sided = get_attribute_as_bool(materials_config, material_item, s_double_sided_hash);
+        // zeroed so definitions can be compared with memcmp on reload
+        memset(material_o, 0, sizeof(sp_material_def_t));
+        config_object_index_build(&index, materials_config, material_item, a);
+        get_indexed_attribute_as_string(&index, SP_KEY_NAME, material_o->name);
+        get_indexed_attribute_as_string(&index, SP_KEY_ALBEDO_MAP, material_o->albedo_map);
+        get_indexed_attribute_as_string(&index, SP_KEY_ARM_MAP, material_o->arm_map);
+        get_indexed_attribute_as_string(&index, SP_KEY_NORMAL_MAP, material_o->normal_map);
+        bool is_double_sided = get_indexed_attribute_as_bool(&index, SP_KEY_DOUBLE_SIDED);
+        config_object_index_free(&index);
         if (is_double_sided)
         {
             material_o->flags |= SP_MATERIAL_DOUBLE_SIDED;
@@ -1395,6 +3841,7 @@ void load_materials(const char* materials_file, sp_material_def_t** p_materials_
     *p_materials_arr = materials_arr;
 
     SP_SHUTDOWN_TEMP_ALLOCATOR(ta);
+    return true;
 }
 
 void init_materials_manager(sapphire_materials_manager_t* materials_manager, sp_allocator_i* allocator)
@@ -1403,7 +3850,8 @@ void init_materials_manager(sapphire_materials_manager_t* materials_manager, sp_
     materials_manager->allocator = allocator;
     materials_manager->material_name_lookup.allocator = allocator;
     materials_manager->pso_srb_lookup.allocator = allocator;
-    
+    sp_handle_table_init(&materials_manager->material_table, allocator);
+    sp_pool_init(&materials_manager->materials, sizeof(sp_material_t), MATERIALS_PAGE_SHIFT, allocator);
 }
 
 void destroy_materials_manager(sapphire_materials_manager_t* materials_manager)
@@ -1419,33 +3867,108 @@ void destroy_materials_manager(sapphire_materials_manager_t* materials_manager)
     }
              
         //         continue;
-    sp_array_free(materials_manager->materials_arr, materials_manager->allocator);
+    sp_pool_destroy(&materials_manager->materials);
+    sp_array_free(materials_manager->material_defs_arr, materials_manager->allocator);
+    sp_handle_table_destroy(&materials_manager->material_table);
     sp_hash_free(&materials_manager->material_name_lookup);
     sp_hash_free(&materials_manager->pso_srb_lookup);
 }
 
-void init_buffers_manager(sapphire_buffers_manager_t* buffers_manager)
+void init_buffers_manager(sapphire_buffers_manager_t* buffers_manager, sp_allocator_i* allocator)
 {
     memset(buffers_manager, 0, sizeof(sapphire_buffers_manager_t));
+    buffers_manager->allocator = allocator;
+    sp_handle_table_init(&buffers_manager->vb_table, allocator);
+    sp_handle_table_init(&buffers_manager->ib_table, allocator);
+    sp_pool_init(&buffers_manager->vertex_buffers, sizeof(IBuffer*), BUFFERS_PAGE_SHIFT, allocator);
+    sp_pool_init(&buffers_manager->index_buffers, sizeof(IBuffer*), BUFFERS_PAGE_SHIFT, allocator);
 }
 
 void destroy_buffers_manager(sapphire_buffers_manager_t* buffers_manager)
 {
-    for (uint32_t i = 0; i < buffers_manager->num_vertex_buffers; ++i)
+    for (uint32_t i = 0; i < buffers_manager->vb_table.num_alive; ++i)
+    {
+        IObject_Release(*sp_pool_get(&buffers_manager->vertex_buffers, IBuffer*, i));
+    }
+
+    for (uint32_t i = 0; i < buffers_manager->ib_table.num_alive; ++i)
     {
-        IObject_Release(buffers_manager->vertex_buffers[i]);
+        IObject_Release(*sp_pool_get(&buffers_manager->index_buffers, IBuffer*, i));
     }
+    sp_handle_table_destroy(&buffers_manager->vb_table);
+    sp_handle_table_destroy(&buffers_manager->ib_table);
+    sp_pool_destroy(&buffers_manager->vertex_buffers);
+    sp_pool_destroy(&buffers_manager->index_buffers);
+
+    // the device is idle at shutdown, release everything still waiting on the fence
+    buffers_manager_collect_garbage(buffers_manager, UINT64_MAX);
+    sp_array_free(buffers_manager->deferred_release_arr, buffers_manager->allocator);
+}
 
-    for (uint32_t i = 0; i < buffers_manager->num_index_buffers; ++i)
+void init_renderer(sapphire_renderer_t* p_renderer, sp_allocator_i* allocator)
+{
+    p_renderer->allocator = allocator;
+    sp_handle_table_init(&p_renderer->mesh_table, allocator);
+    sp_handle_table_init(&p_renderer->render_object_table, allocator);
+    sp_pool_init(&p_renderer->meshes, sizeof(sapphire_mesh_t), RENDERING_MESHES_PAGE_SHIFT, allocator);
+    sp_pool_init(&p_renderer->world_matrices, sizeof(sp_mat4x4_t), RENDERING_OBJECTS_PAGE_SHIFT, allocator);
+    sp_pool_init(&p_renderer->mesh_handles, sizeof(sp_mesh_handle_t), RENDERING_OBJECTS_PAGE_SHIFT, allocator);
+    sp_pool_init(&p_renderer->bvh_leaves, sizeof(uint32_t), RENDERING_OBJECTS_PAGE_SHIFT, allocator);
+    sp_pool_init(&p_renderer->identities, sizeof(uint64_t), RENDERING_OBJECTS_PAGE_SHIFT, allocator);
+    sp_pool_init(&p_renderer->dynamic_slots, sizeof(uint32_t), RENDERING_OBJECTS_PAGE_SHIFT, allocator);
+    p_renderer->dynamic_arr = NULL;
+    sp_bvh_init(&p_renderer->bvh, RENDERING_BVH_MARGIN, allocator);
+    p_renderer->visible_arr = NULL;
+    sp_handle_table_init(&p_renderer->light_table, allocator);
+    sp_pool_init(&p_renderer->lights, sizeof(sp_light_t), RENDERING_LIGHTS_PAGE_SHIFT, allocator);
+    light_clusters_init(&p_renderer->light_clusters, RENDERING_MAX_LIGHT_INDICES, RENDERING_LIGHT_BINNING_THREADS, allocator);
+    p_renderer->shadow_config = (shadow_cascades_config_t){
+        .num_cascades = SHADOW_CASCADES_MAX,
+        .map_size = RENDERING_SHADOW_MAP_SIZE,
+        .split_lambda = 0.75f,
+        .max_distance = 60.0f,
+    };
+    for (uint32_t i = 0; i < SHADOW_CASCADES_MAX; ++i)
     {
-        IObject_Release(buffers_manager->index_buffers[i]);
+        p_renderer->shadow_casters_arr[i] = NULL;
+        p_renderer->shadow_cache_valid[i] = false;
+        memset(&p_renderer->shadow_last_view_projections[i], 0, sizeof(sp_mat4x4_t));
     }
+    p_renderer->shadow_static_casters_arr = NULL;
+    sp_pool_init(&p_renderer->light_shadows, sizeof(sp_light_shadow_t), RENDERING_LIGHTS_PAGE_SHIFT, allocator);
+    shadow_atlas_init(&p_renderer->shadow_atlas, RENDERING_SHADOW_ATLAS_SIZE, RENDERING_SHADOW_ATLAS_MIN_TILE, allocator);
+    p_renderer->shadow_atlas_budget = RENDERING_SHADOW_ATLAS_VIEWS_PER_FRAME;
+    p_renderer->shadow_invalidations_arr = NULL;
+    p_renderer->shadow_invalidate_all = false;
+    p_renderer->shadow_atlas_casters_arr = NULL;
+    p_renderer->depth_prepass = true;
 }
 
-void init_renderer(sapphire_renderer_t* p_renderer)
+void destroy_renderer(sapphire_renderer_t* p_renderer)
 {
-    p_renderer->num_meshes = 0;
-    p_renderer->num_render_objects = 0;
+    for (uint32_t i = 0; i < p_renderer->mesh_table.num_alive; ++i)
+        release_mesh_collision(p_renderer, sp_pool_get(&p_renderer->meshes, sapphire_mesh_t, i));
+    sp_handle_table_destroy(&p_renderer->mesh_table);
+    sp_handle_table_destroy(&p_renderer->render_object_table);
+    sp_pool_destroy(&p_renderer->meshes);
+    sp_pool_destroy(&p_renderer->world_matrices);
+    sp_pool_destroy(&p_renderer->mesh_handles);
+    sp_pool_destroy(&p_renderer->bvh_leaves);
+    sp_pool_destroy(&p_renderer->identities);
+    sp_pool_destroy(&p_renderer->dynamic_slots);
+    sp_array_free(p_renderer->dynamic_arr, p_renderer->allocator);
+    sp_bvh_destroy(&p_renderer->bvh);
+    sp_array_free(p_renderer->visible_arr, p_renderer->allocator);
+    sp_handle_table_destroy(&p_renderer->light_table);
+    sp_pool_destroy(&p_renderer->lights);
+    light_clusters_destroy(&p_renderer->light_clusters);
+    for (uint32_t i = 0; i < SHADOW_CASCADES_MAX; ++i)
+        sp_array_free(p_renderer->shadow_casters_arr[i], p_renderer->allocator);
+    sp_pool_destroy(&p_renderer->light_shadows);
+    shadow_atlas_destroy(&p_renderer->shadow_atlas);
+    sp_array_free(p_renderer->shadow_invalidations_arr, p_renderer->allocator);
+    sp_array_free(p_renderer->shadow_atlas_casters_arr, p_renderer->allocator);
+    sp_array_free(p_renderer->shadow_static_casters_arr, p_renderer->allocator);
 }
 
 
@@ -1453,68 +3976,247 @@ void init_renderer(sapphire_renderer_t* p_renderer)
 
 
 
-void scene_load_resources(const char* root_path_str, scene_def_t* p_scene_def, IRenderDevice* p_device)
+// loads the mesh of an entity definition, the caller owns the returned reference
+sp_mesh_handle_t scene_load_entity_mesh(const char* root_path_str, const entity_def_t* p_entity_def, IRenderDevice* p_device)
 {
     SP_INIT_TEMP_ALLOCATOR_WITH_ADAPTER(ta, a);
+    sp_mesh_handle_t mesh_handle = SP_INVALID_HANDLE;
 
-    sp_allocator_i* allocator = sp_allocator_api->system_allocator;
+    sapphire_mesh_gpu_load_t mesh_load_data;
+    char mesh_file[1024];
+    uint8_t* stream = NULL;
+    uint64_t size;
+
+    bool loaded = true;
+    if (p_entity_def->flags == 0)
+    {
+        sp_sprintf_api->print(mesh_file, sizeof(mesh_file), "%s/%s", root_path_str, p_entity_def->model_file);
+        loaded = read_file_stream(mesh_file, ta, &stream, &size) && read_grimrock_model_from_stream(stream, size, &mesh_load_data);
+    }
+    else if (strcmp(p_entity_def->model_file, "cube") == 0)
+    {
+        create_cube_mesh_load_data(ta, p_entity_def->material_file, &mesh_load_data);
+    }
+    else if (strcmp(p_entity_def->model_file, "sphere") == 0)
+    {
+        create_sphere_mesh_load_data(ta, p_entity_def->material_file, 0, &mesh_load_data);
+    }
+    else
+    {
+        loaded = false;
+    }
+
+    if (loaded)
+    {
+        mesh_handle = load_mesh_to_gpu(p_device, g_rendering_context_o, &mesh_load_data);
+    }
 
-    // get mesh handle by entity hash
-    struct SP_HASH_T(sp_strhash_t, sp_mesh_handle_t) entity_to_mesh_handle = {.allocator = allocator};
+    SP_SHUTDOWN_TEMP_ALLOCATOR(ta);
+    return mesh_handle;
+}
 
-    uint32_t num_entities_defs = (uint32_t)sp_array_size(p_scene_def->entities_def_arr);
-    
+bool scene_read_entity_model(const char* root_path_str, const entity_def_t* p_entity_def, sapphire_mesh_gpu_load_t* p_mesh_load_data, uint8_t** p_stream, uint64_t* p_size, sp_allocator_i* allocator)
+{
+    *p_stream = NULL;
+    *p_size = 0;
+    if (p_entity_def->flags != 0)
+        return false;
+
+    char mesh_file[1024];
+    sp_sprintf_api->print(mesh_file, sizeof(mesh_file), "%s/%s", root_path_str, p_entity_def->model_file);
+    struct sp_os_file_io_api* io = sp_os_api->file_io;
+    sp_file_o f = io->open_input(mesh_file);
+    if (!f.valid)
+        return false;
+    const uint64_t size = sp_os_api->file_system->stat(mesh_file).size;
+    uint8_t* stream = sp_alloc(allocator, size);
+    const bool read = io->read(f, stream, size) == size;
+    io->close(f);
+
+    if (!read || !read_grimrock_model_from_stream(stream, size, p_mesh_load_data))
+    {
+        sp_free(allocator, stream, size);
+        return false;
+    }
+    *p_stream = stream;
+    *p_size = size;
+    return true;
+}
+
+sp_mesh_handle_t scene_create_entity_mesh(const entity_def_t* p_entity_def, sapphire_mesh_gpu_load_t* p_mesh_load_data, IRenderDevice* p_device)
+{
+    if (p_mesh_load_data)
+        return load_mesh_to_gpu(p_device, g_rendering_context_o, p_mesh_load_data);
+    // a model file that couldn't be read
+    if (p_entity_def->flags == 0)
+        return SP_INVALID_HANDLE;
+    // predefined shapes are generated, there is no file to read
+    return scene_load_entity_mesh("", p_entity_def, p_device);
+}
+
+// creates a render object for every instance of the scene definition
+static void scene_add_render_objects(sp_scene_resources_t* p_scene_resources)
+{
+    scene_def_t* p_scene_def = &p_scene_resources->scene_def;
+    uint32_t num_entity_instances = p_scene_def->num_instances;
+    sp_array_ensure(p_scene_resources->render_objects_arr, num_entity_instances, p_scene_resources->allocator);
+    for (uint32_t i = 0; i < num_entity_instances; ++i)
+    {
+        sp_strhash_t entity_hash = p_scene_def->instance_entity_hashes[i];
+        
+        sp_mesh_handle_t mesh_handle = sp_hash_get_default(&p_scene_resources->entity_to_mesh, entity_hash, SP_INVALID_HANDLE);
+        // world matrices are computed when the scene is parsed and stored in the compiled scene
+        sp_render_handle_t render_handle = renderer_add_render_object(g_rendering_context_o, mesh_handle, &p_scene_def->instance_world_matrices[i]);
+        if (render_handle != SP_INVALID_HANDLE)
+        {
+            // picking reports the instance, 0 is left for nothing picked
+            renderer_set_render_object_identity(g_rendering_context_o, render_handle, (uint64_t)i + 1);
+            sp_array_push(p_scene_resources->render_objects_arr, render_handle, p_scene_resources->allocator);
+            sp_transform_t local = {
+                .position = p_scene_def->instance_positions[i],
+                .rotation = p_scene_def->instance_rotations[i],
+                .scale = p_scene_def->instance_scales[i],
+            };
+            // the render object is already placed, a dirty node would report a move on the first update and
+            // turn every scene object dynamic
+            sp_transform_handle_t transform = transform_system_create_placed(&p_scene_resources->transforms, SP_INVALID_HANDLE, &local,
+                                                                             &p_scene_def->instance_world_matrices[i], render_handle);
+            sp_array_push(p_scene_resources->transforms_arr, transform, p_scene_resources->allocator);
+        }
+    }
+    // a loaded scene that nothing moved stays static, so the cached shadows are used
+    assert(p_scene_resources->transforms.first_dirty == TRANSFORM_NO_NODE);
+    // one SAH build gives a better tree than the incremental insertions
+    renderer_rebuild_bvh(g_rendering_context_o, RENDERING_BVH_BUILD_THREADS);
+}
+
+static void scene_remove_render_objects(sp_scene_resources_t* p_scene_resources)
+{
+    uint32_t num_render_objects = (uint32_t)sp_array_size(p_scene_resources->render_objects_arr);
+    for (uint32_t i = 0; i < num_render_objects; ++i)
+    {
+        renderer_remove_render_object(g_rendering_context_o, p_scene_resources->render_objects_arr[i]);
+    }
+    if (p_scene_resources->render_objects_arr)
+    {
+        sp_array_header(p_scene_resources->render_objects_arr)->size = 0;
+    }
+    transform_system_clear(&p_scene_resources->transforms);
+    if (p_scene_resources->transforms_arr)
+    {
+        sp_array_header(p_scene_resources->transforms_arr)->size = 0;
+    }
+}
+
+static void scene_release_entity_meshes(sp_scene_resources_t* p_scene_resources)
+{
+    for (uint32_t i = 0; i < p_scene_resources->entity_to_mesh.num_buckets; ++i)
+    {
+        if (sp_hash_use_index(&p_scene_resources->entity_to_mesh, i))
+        {
+            renderer_release_mesh(g_rendering_context_o, p_scene_resources->entity_to_mesh.values[i]);
+        }
+    }
+    sp_hash_free(&p_scene_resources->entity_to_mesh);
+}
+
+// takes ownership of the scene definition, it is kept to diff against on reload
+void scene_load_resources(const char* root_path_str, scene_def_t* p_scene_def, IRenderDevice* p_device, sp_scene_resources_t* p_scene_resources, sp_allocator_i* allocator)
+{
+    memset(p_scene_resources, 0, sizeof(sp_scene_resources_t));
+    p_scene_resources->allocator = allocator;
+    p_scene_resources->scene_def = *p_scene_def;
+    p_scene_resources->entity_to_mesh.allocator = allocator;
+    transform_system_init(&p_scene_resources->transforms, allocator);
+    memset(p_scene_def, 0, sizeof(scene_def_t));
+
+    entity_def_t* entities_def = p_scene_resources->scene_def.entities_def;
+    uint32_t num_entities_defs = p_scene_resources->scene_def.num_entities;
     for (uint32_t i = 0; i < num_entities_defs; ++i)
     {        
-        sapphire_mesh_gpu_load_t mesh_load_data;
-        char mesh_file[1024];
-        uint8_t* stream = NULL;
-        uint64_t size;
-
-        entity_def_t* p_entity_def = &p_scene_def->entities_def_arr[i];
-        //sp_strhash_t mesh_hash = sp_murmur_hash_string(p_entity_def->model_file);
-        //if (sp_hash_has(&mesh_file_to_handle, mesh_hash) == false)
-        if (p_entity_def->flags == 0)
+        sp_mesh_handle_t mesh_handle = scene_load_entity_mesh(root_path_str, &entities_def[i], p_device);
+        sp_hash_add(&p_scene_resources->entity_to_mesh, entities_def[i].entity_hash, mesh_handle);
+    }
+
+    scene_add_render_objects(p_scene_resources);
+}
+
+// diffs a reloaded scene definition against the loaded one. Only meshes of new or changed entities are loaded,
+// render objects are recreated from the new instances. Pass NULL for p_new_scene_def to keep the current
+// definition and reload the entities using changed_model_file (a model file changed on disk)
+void scene_reload_resources(const char* root_path_str, sp_scene_resources_t* p_scene_resources, scene_def_t* p_new_scene_def, IRenderDevice* p_device, const char* changed_model_file)
+{
+    sp_allocator_i* allocator = p_scene_resources->allocator;
+    scene_def_t* p_old_scene_def = &p_scene_resources->scene_def;
+    if (!p_new_scene_def)
+    {
+        p_new_scene_def = p_old_scene_def;
+    }
+
+    struct SP_HASH_T(sp_strhash_t, entity_def_t*) old_entities = {.allocator = allocator};
+    uint32_t num_old_entities = p_old_scene_def->num_entities;
+    for (uint32_t i = 0; i < num_old_entities; ++i)
+    {
+        sp_hash_add(&old_entities, p_old_scene_def->entities_def[i].entity_hash, &p_old_scene_def->entities_def[i]);
+    }
+
+    struct SP_HASH_T(sp_strhash_t, sp_mesh_handle_t) entity_to_mesh = {.allocator = allocator};
+    uint32_t num_new_entities = p_new_scene_def->num_entities;
+    for (uint32_t i = 0; i < num_new_entities; ++i)
+    {
+        entity_def_t* p_entity_def = &p_new_scene_def->entities_def[i];
+        entity_def_t* p_old_entity_def = sp_hash_get_default(&old_entities, p_entity_def->entity_hash, NULL);
+        bool model_changed = changed_model_file && strcmp(p_entity_def->model_file, changed_model_file) == 0;
+
+        sp_mesh_handle_t mesh_handle;
+        if (p_old_entity_def && !model_changed && memcmp(p_old_entity_def, p_entity_def, sizeof(entity_def_t)) == 0)
         {
-            sp_sprintf_api->print(mesh_file, sizeof(mesh_file), "%s/%s", root_path_str, p_entity_def->model_file);
-            read_file_stream(mesh_file, ta, &stream, &size);
-            read_grimrock_model_from_stream(stream, size, &mesh_load_data);            
+            // unchanged entity - share the loaded mesh
+            mesh_handle = sp_hash_get_default(&p_scene_resources->entity_to_mesh, p_entity_def->entity_hash, SP_INVALID_HANDLE);
+            renderer_add_mesh_ref(&g_rendering_context_o->renderer, mesh_handle);
         }
         else
         {
-            if (strcmp(p_entity_def->model_file, "cube") == 0)
-            {
-                create_cube_mesh_load_data(ta, p_entity_def->material_file, &mesh_load_data);
-            }
-            else if (strcmp(p_entity_def->model_file, "sphere") == 0)
-            {
-                create_sphere_mesh_load_data(ta, p_entity_def->material_file, 0, &mesh_load_data);
-            }
-                
+            mesh_handle = scene_load_entity_mesh(root_path_str, p_entity_def, p_device);
         }
-
-        sp_mesh_handle_t mesh_handle = load_mesh_to_gpu(p_device, g_rendering_context_o, &mesh_load_data);
-        sp_hash_add(&entity_to_mesh_handle, p_entity_def->entity_hash, mesh_handle);
-        
+        sp_hash_add(&entity_to_mesh, p_entity_def->entity_hash, mesh_handle);
     }
+    sp_hash_free(&old_entities);
 
-    uint32_t num_entity_instances = (uint32_t)sp_array_size(p_scene_def->instances_arr);
-    for (uint32_t i = 0; i < num_entity_instances; ++i)
+    // the new map holds its own references, so dropping the old render objects and references only frees
+    // meshes of changed or removed entities
+    scene_remove_render_objects(p_scene_resources);
+    scene_release_entity_meshes(p_scene_resources);
+    p_scene_resources->entity_to_mesh = entity_to_mesh;
+
+    if (p_new_scene_def != p_old_scene_def)
     {
-        sp_strhash_t entity_hash = p_scene_def->instances_arr[i].entity_hash;
-        
-        sp_mesh_handle_t mesh_handle = sp_hash_get(&entity_to_mesh_handle, entity_hash);
-        g_rendering_context_o->renderer.mesh_handles[i] = mesh_handle;
-        sp_transform_t* p_transform = &p_scene_def->instances_arr[i].transform;
-        sp_mat4x4_t inst_mat;
-        sp_mat4x4_from_translation_quaternion_scale(&inst_mat, p_transform->position, p_transform->rotation, p_transform->scale);
-        g_rendering_context_o->renderer.world_matrices[i] = inst_mat;
-        g_rendering_context_o->renderer.num_render_objects++;
+        scene_free(p_old_scene_def, allocator);
+        p_scene_resources->scene_def = *p_new_scene_def;
+        memset(p_new_scene_def, 0, sizeof(scene_def_t));
     }
 
-    
-    
-    sp_hash_free(&entity_to_mesh_handle);
+    scene_add_render_objects(p_scene_resources);
+}
 
-    SP_SHUTDOWN_TEMP_ALLOCATOR(ta);
+// removes the render objects and drops the mesh references created by scene_load_resources
+void scene_unload_resources(sp_scene_resources_t* p_scene_resources)
+{
+    scene_remove_render_objects(p_scene_resources);
+    scene_release_entity_meshes(p_scene_resources);
+    sp_array_free(p_scene_resources->render_objects_arr, p_scene_resources->allocator);
+    sp_array_free(p_scene_resources->transforms_arr, p_scene_resources->allocator);
+    transform_system_destroy(&p_scene_resources->transforms);
+    scene_free(&p_scene_resources->scene_def, p_scene_resources->allocator);
+}
+
+void scene_update_transforms(sp_scene_resources_t* p_scene_resources)
+{
+    transform_system_t* transforms = &p_scene_resources->transforms;
+    uint32_t num_changed = transform_system_update(transforms);
+    for (uint32_t i = 0; i < num_changed; ++i)
+    {
+        uint32_t node = transforms->changed_arr[i];
+        renderer_set_render_object_transform(g_rendering_context_o, transforms->user_data_arr[node], &transforms->worlds_arr[node]);
+    }
 }
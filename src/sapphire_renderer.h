@@ -1,12 +1,24 @@
 #pragma once
 
 #include "core/sapphire_types.h"
-
+#include "core/handle_table.h"
+#include "core/pool.h"
+#include "core/bvh.h"
+#include "core/thread.h"
+#include "scene.h"
+#include "transform_system.h"
+#include "light_clusters.h"
+#include "shadow_cascades.h"
+#include "shadow_atlas.h"
+
+// all handles are generational handles from an sp_handle_table_t, SP_INVALID_HANDLE (0) is never valid
 typedef uint32_t sp_vb_handle_t;
 typedef uint32_t sp_ib_handle_t;
 typedef uint32_t sp_mat_handle_t;
 typedef uint32_t sp_mesh_handle_t;
 typedef uint32_t sp_render_handle_t;
+typedef uint32_t sp_texture_handle_t;
+typedef uint32_t sp_light_handle_t;
 
 typedef struct IPipelineState IPipelineState;
 typedef struct IShaderResourceBinding IShaderResourceBinding;
@@ -15,6 +27,10 @@ typedef struct IRenderDevice IRenderDevice;
 typedef struct ISwapChain ISwapChain;
 typedef struct IBuffer IBuffer;
 typedef struct IDeviceContext IDeviceContext;
+typedef struct IFence IFence;
+typedef struct ITexture ITexture;
+typedef struct IQuery IQuery;
+typedef struct IObject IObject;
 
 typedef struct sp_allocator_i sp_allocator_i;
 
@@ -83,8 +99,13 @@ typedef struct sapphire_sub_mesh_t
 typedef struct sapphire_mesh_t
 {    
     uint32_t num_submeshes;    
+    // number of render objects (and loaders) holding this mesh, the mesh gpu buffers are released when it drops to 0
+    uint32_t ref_count;
+
     sp_vb_handle_t vb_handle;
     sp_ib_handle_t ib_handle;
+    // the positions of vb_handle alone (float3), for the depth pre-pass. SP_INVALID_HANDLE without vertices
+    sp_vb_handle_t position_vb_handle;
     
     sapphire_sub_mesh_t sub_meshes[MAX_SUB_MESHES];
 
@@ -93,23 +114,210 @@ typedef struct sapphire_mesh_t
     sp_vec3_t bounding_sphere_center;
     float bounding_sphere_radius;
 
+    // cpu copy of the geometry for picking, positions in meters
+    sp_vec3_t* positions_arr;
+    uint32_t* indices_arr;
+    // object space triangle boxes, leaf user data is the triangle index
+    sp_bvh_t triangles_bvh;
+
 } sapphire_mesh_t;
 
-#define MAX_RENDERING_MESHES 1024
-#define MAX_RENDERING_OBJECTS 0xFFFF
+// records per pool page, as a power of two
+#define RENDERING_MESHES_PAGE_SHIFT 6
+#define RENDERING_OBJECTS_PAGE_SHIFT 10
+// render object boxes are enlarged by this, in meters, so small moves don't touch the bvh
+#define RENDERING_BVH_MARGIN 0.1f
+#define RENDERING_BVH_BUILD_THREADS 4
+
+#define RENDERING_LIGHTS_PAGE_SHIFT 8
+// sizes of the gpu light buffers, lights past the limit are not drawn
+#define RENDERING_MAX_LIGHTS 8192
+#define RENDERING_MAX_LIGHT_INDICES (256 * 1024)
+#define RENDERING_LIGHT_BINNING_THREADS 4
+
+// directional light shadows - the cascades are slices of one texture array
+#define RENDERING_SHADOW_MAP_SIZE 2048
+// frames a gpu timing query is read back after, so reading it never waits for the gpu
+#define RENDERING_SHADOW_QUERY_FRAMES 3
+// cascade static caches re-rendered per frame on the immediate context, once the camera stopped
+#define RENDERING_SHADOW_CACHE_REFRESHES_PER_FRAME 1
+
+// point and spot light shadows - the views of the shadow casting lights are tiles of one depth atlas. Tiles are
+// sized by how much of the screen the light covers
+#define RENDERING_SHADOW_ATLAS_SIZE 4096
+#define RENDERING_SHADOW_ATLAS_MIN_TILE 64
+#define RENDERING_SHADOW_ATLAS_MAX_TILE 1024
+// shadow casting lights in the view that get tiles, the less important ones are drawn without shadows
+#define RENDERING_MAX_SHADOW_LIGHTS 64
+#define RENDERING_SHADOW_ATLAS_MAX_VIEWS (RENDERING_MAX_SHADOW_LIGHTS * SHADOW_ATLAS_MAX_LIGHT_VIEWS)
+// atlas views re-rendered per frame unless set with renderer_set_shadow_atlas_budget
+#define RENDERING_SHADOW_ATLAS_VIEWS_PER_FRAME 8
+#define RENDERING_SHADOW_ATLAS_NEAR 0.05f
+// boxes of changed static render objects kept per frame to invalidate the cached static shadows, past it every
+// cached shadow is invalidated
+#define RENDERING_SHADOW_MAX_INVALIDATIONS 1024
+
+typedef enum sp_light_type
+{
+    SP_LIGHT_TYPE_POINT,
+    SP_LIGHT_TYPE_SPOT,
+} sp_light_type;
+
+typedef struct sp_light_t
+{
+    sp_vec3_t position;
+    // distance where the light fades out, in meters
+    float range;
+    // linear color
+    sp_vec3_t color;
+    float intensity;
+    // spot lights only - cone axis and half angles of the cone in radians, the light fades out between them
+    sp_vec3_t direction;
+    float spot_inner_angle;
+    float spot_outer_angle;
+    sp_light_type type;
+    // rendered into the shadow atlas
+    bool cast_shadows;
+} sp_light_t;
+
+// atlas view of a shadow casting light
+typedef struct sp_light_shadow_view_t
+{
+    // SHADOW_ATLAS_NULL without a tile
+    uint32_t tile;
+    // world to shadow clip and depth bias the tile content was rendered with, kept while the view waits to be re-rendered
+    sp_mat4x4_t view_projection;
+    float depth_bias;
+} sp_light_shadow_view_t;
+
+// shadow state of a light, packed like the lights
+typedef struct sp_light_shadow_t
+{
+    sp_light_shadow_view_t views[SHADOW_ATLAS_MAX_LIGHT_VIEWS];
+    // 0 without tiles, all views have the same size
+    uint32_t tile_size;
+    uint32_t num_views;
+    // bit per view - static casters cached since the tile was allocated / the light or the static casters it
+    // sees changed since / dynamic casters drawn over the cache last frame
+    uint8_t valid_mask;
+    uint8_t dirty_mask;
+    uint8_t dynamic_mask;
+    // screen coverage this frame, negative when the light is out of view
+    float importance;
+    // first view of the light in the gpu shadow view buffer this frame, UINT32_MAX when it isn't shadowed
+    uint32_t gpu_view;
+} sp_light_shadow_t;
+
+// cost of one shadow cascade in the last frame, for budgeting the shadows
+typedef struct renderer_shadow_cascade_stats_t
+{
+    // casters drawn, the dynamic ones and the static ones when the cache was re-rendered or not used
+    uint32_t num_casters;
+    uint32_t num_draws;
+    // the static casters came from the cache
+    bool static_cached;
+    // cpu time of culling the casters, re-rendering the static cache included, and of recording their draws
+    float cull_ms;
+    float record_ms;
+    // gpu time of the cascade, from RENDERING_SHADOW_QUERY_FRAMES frames ago. 0 without duration queries. Re-rendering
+    // the static cache isn't included
+    float gpu_ms;
+    // recorded on a deferred context in parallel with the other cascades
+    bool deferred;
+} renderer_shadow_cascade_stats_t;
+
+// shadow atlas work of the last frame
+typedef struct renderer_shadow_atlas_stats_t
+{
+    // shadow casting lights in the view, and those of them without tiles
+    uint32_t num_lights;
+    uint32_t num_dropped_lights;
+    // static caches re-rendered, reused unchanged and changed but over the budget, shown with their old content
+    uint32_t num_rendered;
+    uint32_t num_cached;
+    uint32_t num_stale;
+    // views restored from the cache with the dynamic casters drawn over them, and those draws
+    uint32_t num_composed;
+    uint32_t num_dynamic_draws;
+    // allocated part of the atlas, 0..1
+    float usage;
+    float update_ms;
+    float record_ms;
+} renderer_shadow_atlas_stats_t;
 
 typedef struct sapphire_renderer_t
 {
-    sapphire_mesh_t meshes[MAX_RENDERING_MESHES];
-    uint32_t num_meshes;
-    // render objects
-    sp_mat4x4_t world_matrices[MAX_RENDERING_OBJECTS];
-    sp_mesh_handle_t mesh_handles[MAX_RENDERING_OBJECTS];
-    uint32_t num_render_objects;
-    
+    sp_allocator_i* allocator;
+    // meshes (sapphire_mesh_t), packed by the dense index of mesh_table
+    sp_handle_table_t mesh_table;
+    sp_pool_t meshes;
+    // render objects - SoA pools indexed by the dense index of render_object_table,
+    // render_object_table.num_alive is the number of render objects
+    sp_handle_table_t render_object_table;
+    // sp_mat4x4_t
+    sp_pool_t world_matrices;
+    // sp_mesh_handle_t
+    sp_pool_t mesh_handles;
+    // uint32_t - leaf of the render object in bvh
+    sp_pool_t bvh_leaves;
+    // uint64_t - id reported by picking, the render handle unless the owner sets one
+    sp_pool_t identities;
+    // uint32_t - slot in dynamic_arr, UINT32_MAX for static render objects
+    sp_pool_t dynamic_slots;
+    // render objects drawn into the shadow maps every frame, over the cached shadows of the static ones
+    sp_render_handle_t* dynamic_arr;
+
+    // world boxes of the render objects, leaf user data is the render handle
+    sp_bvh_t bvh;
+    // render handles that passed the frustum test this frame, front to back
+    sp_render_handle_t* visible_arr;
+    // opaque render objects are laid down depth only first, then shaded with a depth EQUAL test
+    bool depth_prepass;
+
+    // point and spot lights (sp_light_t), packed by the dense index of light_table
+    sp_handle_table_t light_table;
+    sp_pool_t lights;
+    // lights binned to the view frustum clusters every frame
+    light_clusters_t light_clusters;
+
+    // directional light shadows, the cascades of the current frame and the render handles casting into them
+    shadow_cascades_config_t shadow_config;
+    shadow_cascade_t shadow_cascades[SHADOW_CASCADES_MAX];
+    sp_render_handle_t* shadow_casters_arr[SHADOW_CASCADES_MAX];
+    renderer_shadow_cascade_stats_t shadow_stats[SHADOW_CASCADES_MAX];
+    // static casters of a cascade are cached while its projection doesn't change. The projection of the previous
+    // frame tells a moving camera, the cache isn't used then
+    sp_mat4x4_t shadow_cache_view_projections[SHADOW_CASCADES_MAX];
+    sp_mat4x4_t shadow_last_view_projections[SHADOW_CASCADES_MAX];
+    bool shadow_cache_valid[SHADOW_CASCADES_MAX];
+    sp_render_handle_t* shadow_static_casters_arr;
+
+    // point and spot light shadows (sp_light_shadow_t), packed by the dense index of light_table
+    sp_pool_t light_shadows;
+    shadow_atlas_t shadow_atlas;
+    // atlas views re-rendered per frame
+    uint32_t shadow_atlas_budget;
+    // boxes of the static render objects added, moved or removed since the last frame, the cached static shadows
+    // they touch are re-rendered
+    sp_aabb_t* shadow_invalidations_arr;
+    bool shadow_invalidate_all;
+    sp_render_handle_t* shadow_atlas_casters_arr;
+    renderer_shadow_atlas_stats_t shadow_atlas_stats;
 
 } sapphire_renderer_t;
 
+typedef struct renderer_pick_result_t
+{
+    sp_render_handle_t render_handle;
+    uint64_t identity;
+    // triangle of the render object mesh
+    uint32_t triangle;
+    float distance;
+    sp_vec3_t position;
+    // world space normal of the hit triangle, facing the ray
+    sp_vec3_t normal;
+} renderer_pick_result_t;
+
 
 
 
@@ -146,6 +354,9 @@ enum sp_material_flags {
 
     SP_MATERIAL_STATE_DEPTH_TEST_ENABLED = 0x400,
     SP_MATERIAL_STATE_DEPTH_WRITE_ENABLED = 0x800,
+    // set by the renderer, not by material files - colour pass over the depth pre-pass, the depth test is
+    // EQUAL and depth isn't written
+    SP_MATERIAL_STATE_DEPTH_EQUAL = 0x1000,
 };
 
 #define MAX_MATERIAL_TEXTURE_VIEWS 3
@@ -162,30 +373,52 @@ typedef struct sp_material_t
 {
     IPipelineState* p_pso;
     IShaderResourceBinding* p_srb;
-    ITextureView* texture_views[MAX_MATERIAL_TEXTURE_VIEWS];
+    // colour pipeline when the depth pre-pass is on, NULL for materials that aren't in the pre-pass
+    IPipelineState* p_prepass_pso;
+    IShaderResourceBinding* p_prepass_srb;
+    sp_texture_handle_t texture_handles[MAX_MATERIAL_TEXTURE_VIEWS];
 } sp_material_t;
 
+#define MATERIALS_PAGE_SHIFT 6
+
 typedef struct sapphire_materials_manager_t
 {
     sp_allocator_i* allocator;
-    // array of materials
-    sp_material_t* materials_arr;
-    // look up material index by name
-    struct SP_HASH_T(sp_strhash_t, uint32_t) material_name_lookup;
+    sp_handle_table_t material_table;
+    // materials (sp_material_t), packed by the dense index of material_table
+    sp_pool_t materials;
+    // definitions the materials were created from, same packing - diffed against on hot reload
+    sp_material_def_t* material_defs_arr;
+    // used for meshes that reference a material that was not loaded - the first material added
+    sp_mat_handle_t fallback_material;
+    // look up material handle by name
+    struct SP_HASH_T(sp_strhash_t, sp_mat_handle_t) material_name_lookup;
     // Pipeline state hash to pso lookup
     struct SP_HASH_T(uint64_t, sp_mat_gpu_resources_t) pso_srb_lookup;
 
 } sapphire_materials_manager_t;
 
-#define MAX_VERTEX_BUFFERS 1024
-#define MAX_INDEX_BUFFERS 1024
+#define BUFFERS_PAGE_SHIFT 8
+
+// gpu object that was released by the cpu but may still be referenced by frames in flight.
+// it is released once the frame fence reaches fence_value
+typedef struct sp_deferred_release_t
+{
+    IObject* p_object;
+    uint64_t fence_value;
+} sp_deferred_release_t;
 
 typedef struct sapphire_buffers_manager
 {
-    IBuffer* vertex_buffers[MAX_VERTEX_BUFFERS];
-    IBuffer* index_buffers[MAX_INDEX_BUFFERS];
-    uint32_t num_vertex_buffers;
-    uint32_t num_index_buffers;
+    sp_allocator_i* allocator;
+    // buffers are packed by the dense index of their handle table
+    sp_handle_table_t vb_table;
+    sp_handle_table_t ib_table;
+    // IBuffer*
+    sp_pool_t vertex_buffers;
+    sp_pool_t index_buffers;
+    // array of buffers waiting for the gpu to finish with them
+    sp_deferred_release_t* deferred_release_arr;
 } sapphire_buffers_manager_t;
 
 
@@ -196,8 +429,10 @@ typedef struct sapphire_buffers_manager
 typedef struct sapphire_textures_manager_t
 {
     sp_allocator_i* allocator;
+    sp_handle_table_t texture_table;
+    // texture views, packed by the dense index of texture_table
     ITextureView** textures_arr;
-    struct SP_HASH_T(sp_strhash_t, uint32_t) texture_path_lookup;
+    struct SP_HASH_T(sp_strhash_t, sp_texture_handle_t) texture_path_lookup;
 }sapphire_textures_manager_t;
 
 typedef struct rendering_context_t
@@ -209,6 +444,9 @@ typedef struct rendering_context_t
     ITextureView* p_depth_rtv;
     IPipelineState* p_rt_pso;
     IShaderResourceBinding* p_rt_srb;
+    // depth only pipeline of the pre-pass, reads the position only vertex buffers
+    IPipelineState* p_depth_prepass_pso;
+    IShaderResourceBinding* p_depth_prepass_srb;
     sapphire_renderer_t renderer;
     sapphire_materials_manager_t materials_manager;
     sapphire_textures_manager_t textures_manager;
@@ -217,18 +455,80 @@ typedef struct rendering_context_t
     IBuffer* cb_camera_attribs;
     IBuffer* cb_lights_attribs;
     IBuffer* cb_drawcall;
+    IBuffer* cb_cluster_attribs;
+
+    // clustered lighting - structured buffers of the lights, the light range of every cluster and the light
+    // index list the ranges point into
+    IBuffer* lights_buffer;
+    IBuffer* light_clusters_buffer;
+    IBuffer* light_indices_buffer;
+
+    // cascaded shadow map - one depth slice per cascade, rendered with the depth only shadow pso
+    ITexture* shadow_map;
+    ITextureView* shadow_map_srv;
+    ITextureView* shadow_map_dsvs[SHADOW_CASCADES_MAX];
+    IPipelineState* p_shadow_pso;
+    IShaderResourceBinding* p_shadow_srb;
+    IBuffer* cb_shadow_attribs;
+    IBuffer* cb_shadow_cascade;
+    // duration queries per cascade, a set per frame in flight. NULL when the device has no duration queries
+    IQuery* shadow_queries[RENDERING_SHADOW_QUERY_FRAMES][SHADOW_CASCADES_MAX];
+    bool shadow_queries_pending[RENDERING_SHADOW_QUERY_FRAMES][SHADOW_CASCADES_MAX];
+
+    // cascade i is recorded on deferred context i, by worker i - 1 (the rendering thread records cascade 0).
+    // Cascades without a deferred context are recorded on the immediate context
+    IDeviceContext* p_deferred_contexts[SHADOW_CASCADES_MAX];
+    uint32_t num_deferred_contexts;
+    struct shadow_worker_t* shadow_workers;
+    sp_semaphore_t shadow_workers_done;
+
+    // point and spot light shadow atlas, tiles are cleared by drawing the far depth over them
+    ITexture* shadow_atlas;
+    ITextureView* shadow_atlas_srv;
+    ITextureView* shadow_atlas_dsv;
+    IPipelineState* p_shadow_clear_pso;
+    IBuffer* shadow_views_buffer;
+
+    // static shadow caches with the layout of the shadow map and the atlas. Every frame the shadows are restored
+    // from them by the copy pso, which writes the cached depth, and only the dynamic casters are drawn.
+    // copy srb i reads cascade i, the last one the atlas cache
+    ITexture* shadow_cache;
+    ITextureView* shadow_cache_dsvs[SHADOW_CASCADES_MAX];
+    ITextureView* shadow_cache_srvs[SHADOW_CASCADES_MAX];
+    ITexture* shadow_atlas_cache;
+    ITextureView* shadow_atlas_cache_dsv;
+    ITextureView* shadow_atlas_cache_srv;
+    IPipelineState* p_shadow_copy_pso;
+    IShaderResourceBinding* p_shadow_copy_srbs[SHADOW_CASCADES_MAX + 1];
 
     // picking
     IBuffer* picking_buffer;
     IBuffer* picking_staging_buffer;
 
+    // signaled at the end of every frame with frame_fence_value, used to release gpu resources
+    // only after all frames referencing them are done
+    IFence* p_frame_fence;
+    uint64_t frame_fence_value;
+
 } rendering_context_t;
 
 
 
 typedef struct viewer_t viewer_t;
 
-typedef struct scene_def_t scene_def_t;
+// gpu resources of a loaded scene
+typedef struct sp_scene_resources_t
+{
+    sp_allocator_i* allocator;
+    // definition the resources were created from, diffed against on reload
+    scene_def_t scene_def;
+    // holds one mesh reference per entity definition
+    struct SP_HASH_T(sp_strhash_t, sp_mesh_handle_t) entity_to_mesh;
+    sp_render_handle_t* render_objects_arr;
+    // one root node per render object, same order as render_objects_arr. The node user data is the render handle
+    transform_system_t transforms;
+    sp_transform_handle_t* transforms_arr;
+} sp_scene_resources_t;
 
 rendering_context_t* rendering_context_create(IRenderDevice* p_device, ISwapChain* p_swap_chain);
 void rendering_context_destroy(rendering_context_t* p_rendering_context);
@@ -237,6 +537,70 @@ void renderer_do_rendering(IDeviceContext* pContext, viewer_t* viewer);
 void renderer_window_resize(IRenderDevice* pDevice, ISwapChain* pSwapChain, uint32_t width, uint32_t height);
 
 // TODO - remove from here
-void load_materials(const char* materials_file, sp_material_def_t** p_materials_arr, sp_allocator_i* mats_allocator);
-void scene_load_resources(const char* root_path_str, scene_def_t* p_scene_def, IRenderDevice* p_device);
-void material_manager_add_materials(sapphire_materials_manager_t* manager, sp_material_def_t* materials_def_arr);
\ No newline at end of file
+// returns false when the file is missing or fails to parse
+bool load_materials(const char* materials_file, sp_material_def_t** p_materials_arr, sp_allocator_i* mats_allocator);
+void scene_load_resources(const char* root_path_str, scene_def_t* p_scene_def, IRenderDevice* p_device, sp_scene_resources_t* p_scene_resources, sp_allocator_i* allocator);
+void scene_reload_resources(const char* root_path_str, sp_scene_resources_t* p_scene_resources, scene_def_t* p_new_scene_def, IRenderDevice* p_device, const char* changed_model_file);
+void scene_unload_resources(sp_scene_resources_t* p_scene_resources);
+// recomputes moved transforms and copies their world matrices to the render objects, call once per frame
+void scene_update_transforms(sp_scene_resources_t* p_scene_resources);
+// loads the mesh of an entity definition, the caller owns the returned reference. SP_INVALID_HANDLE if the model failed to load
+sp_mesh_handle_t scene_load_entity_mesh(const char* root_path_str, const entity_def_t* p_entity_def, IRenderDevice* p_device);
+// scene_load_entity_mesh split in two for loading on another thread. The read parses the model file of an entity
+// without touching the renderer, the load data points into *p_stream which is allocated on allocator. Returns false
+// for predefined shapes, they have no file
+bool scene_read_entity_model(const char* root_path_str, const entity_def_t* p_entity_def, sapphire_mesh_gpu_load_t* p_mesh_load_data, uint8_t** p_stream, uint64_t* p_size, sp_allocator_i* allocator);
+// main thread - uploads what scene_read_entity_model read, or generates the predefined shape when p_mesh_load_data
+// is NULL. The caller owns the returned reference
+sp_mesh_handle_t scene_create_entity_mesh(const entity_def_t* p_entity_def, sapphire_mesh_gpu_load_t* p_mesh_load_data, IRenderDevice* p_device);
+void material_manager_add_materials(sapphire_materials_manager_t* manager, sp_material_def_t* materials_def_arr);
+
+// hot reload - all called on the main thread, between frames
+void material_manager_reload_materials(sapphire_materials_manager_t* manager, sp_material_def_t* materials_def_arr);
+void material_manager_reload_shaders(rendering_context_t* p_rendering_context);
+bool textures_manager_replace_texture(rendering_context_t* p_rendering_context, sp_strhash_t texture_path_hash, ITextureView* p_texture_view);
+ITextureView* renderer_create_texture_view_from_file(IRenderDevice* pDevice, const char* texture_file_path);
+
+// render objects
+sp_render_handle_t renderer_add_render_object(rendering_context_t* p_rendering_context, sp_mesh_handle_t mesh_handle, const sp_mat4x4_t* world_matrix);
+void renderer_remove_render_object(rendering_context_t* p_rendering_context, sp_render_handle_t render_handle);
+bool renderer_is_render_object_valid(const sapphire_renderer_t* renderer, sp_render_handle_t render_handle);
+void renderer_set_render_object_transform(rendering_context_t* p_rendering_context, sp_render_handle_t render_handle, const sp_mat4x4_t* world_matrix);
+// rebuilds the render object bvh with a full SAH build, after adding many render objects
+void renderer_rebuild_bvh(rendering_context_t* p_rendering_context, uint32_t num_threads);
+void renderer_set_render_object_identity(rendering_context_t* p_rendering_context, sp_render_handle_t render_handle, uint64_t identity);
+// static render objects are cached in the shadow maps, changing one re-renders the cached shadows it is in.
+// Render objects are added static and become dynamic when they move
+void renderer_set_render_object_static(rendering_context_t* p_rendering_context, sp_render_handle_t render_handle, bool is_static);
+
+// lights are shaded by the clusters of the view frustum they touch, the directional light is separate
+sp_light_handle_t renderer_add_light(rendering_context_t* p_rendering_context, const sp_light_t* light);
+void renderer_remove_light(rendering_context_t* p_rendering_context, sp_light_handle_t light_handle);
+void renderer_set_light(rendering_context_t* p_rendering_context, sp_light_handle_t light_handle, const sp_light_t* light);
+
+// the number of cascades is clamped to SHADOW_CASCADES_MAX, the map size is RENDERING_SHADOW_MAP_SIZE
+void renderer_set_shadow_config(rendering_context_t* p_rendering_context, const shadow_cascades_config_t* config);
+// deferred contexts to record the shadow cascades on in parallel, up to SHADOW_CASCADES_MAX are used. Call once
+// after creating the rendering context, without any (OpenGL) the cascades are recorded on the immediate context
+void renderer_set_deferred_contexts(rendering_context_t* p_rendering_context, IDeviceContext** pp_contexts, uint32_t num_contexts);
+// atlas views re-rendered per frame. New views come first, views whose light or casters changed wait their turn
+// with their old content, unchanged views are never re-rendered
+void renderer_set_shadow_atlas_budget(rendering_context_t* p_rendering_context, uint32_t views_per_frame);
+// opaque materials that write depth are drawn into the depth buffer first, so the pbr shader runs once per
+// pixel. Pays off when the scene has a lot of overdraw, on by default
+void renderer_set_depth_prepass(rendering_context_t* p_rendering_context, bool enabled);
+
+// cpu picking - the render object bvh narrows the ray down to a few objects, their mesh triangle bvh is cast
+// against in object space. Synchronous, unlike the gpu picking buffer that is read back frames later
+bool renderer_pick_ray(rendering_context_t* p_rendering_context, sp_vec3_t origin, sp_vec3_t direction, float max_distance, renderer_pick_result_t* result);
+// screen position in pixels, origin at the top left
+bool renderer_pick_screen(rendering_context_t* p_rendering_context, const viewer_t* viewer, sp_vec2_t screen_position, sp_vec2_t screen_size, renderer_pick_result_t* result);
+
+// meshes are reference counted, the gpu buffers are released (after the gpu is done with them) when the last reference is dropped
+void renderer_add_mesh_ref(sapphire_renderer_t* renderer, sp_mesh_handle_t mesh_handle);
+void renderer_release_mesh(rendering_context_t* p_rendering_context, sp_mesh_handle_t mesh_handle);
+bool renderer_is_mesh_valid(const sapphire_renderer_t* renderer, sp_mesh_handle_t mesh_handle);
+
+// returns SP_INVALID_HANDLE when no material with that name was added
+sp_mat_handle_t material_manager_lookup_material(sapphire_materials_manager_t* manager, sp_strhash_t mat_name_hash);
+ITextureView* textures_manager_get_texture_view(sapphire_textures_manager_t* textures_manager, sp_texture_handle_t handle);
\ No newline at end of file
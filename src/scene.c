@@ -1,132 +1,389 @@
 #include "core/sapphire_types.h"
 #include "core/sapphire_math.h"
 #include "core/json.h"
-#include "core/config.h"
+#include "core/json_pull.h"
 #include "core/allocator.h"
-#include "core/temp_allocator.h"
 #include "core/os.h"
 #include "core/murmurhash64a.h"
 #include "core/array.h"
+#include "core/sprintf.h"
 #include "core/sapphire_math.h"
 #include "scene.h"
-#include "config_utils.h"
+#include "config_keys.h"
 
 #include <memory.h>
 
+#define SCENE_BIN_ALIGNMENT 16
 
+static uint64_t align_offset(uint64_t offset)
+{
+    return (offset + SCENE_BIN_ALIGNMENT - 1) & ~(uint64_t)(SCENE_BIN_ALIGNMENT - 1);
+}
 
-const char* read_file(const char* file, sp_temp_allocator_i* ta);
+// points the scene arrays into the data block, validating the header against the block size
+static bool scene_bind_data(scene_def_t* p_scene_def)
+{
+    if (p_scene_def->data_size < sizeof(scene_bin_header_t))
+        return false;
 
-void get_attribute_as_string(sp_config_i* config, sp_config_item_t item, sp_strhash_t hash, char* buffer);
-inline double get_attribute_as_number(sp_config_i* config, sp_config_item_t item, sp_strhash_t hash);
+    const scene_bin_header_t* header = p_scene_def->data;
+    if (header->magic != SCENE_BIN_MAGIC || header->version != SCENE_BIN_VERSION || header->size != p_scene_def->data_size)
+        return false;
 
-void get_attribute_as_vec3(sp_config_i* config, sp_config_item_t item, sp_strhash_t hash, sp_vec3_t* vec3)
-{
-    sp_config_item_t vec3_item = config->object_get(config->inst, item, hash);
-    sp_config_item_t* float_array = NULL;
-    uint32_t num_floats = config->to_array(config->inst, vec3_item, &float_array);
-    
-    if (num_floats == 3)
+    const uint64_t num_instances = header->num_instances;
+    if (header->entities_offset + header->num_entities * sizeof(entity_def_t) > header->size ||
+        header->instance_entity_hashes_offset + num_instances * sizeof(sp_strhash_t) > header->size ||
+        header->instance_positions_offset + num_instances * sizeof(sp_vec3_t) > header->size ||
+        header->instance_rotations_offset + num_instances * sizeof(sp_vec4_t) > header->size ||
+        header->instance_scales_offset + num_instances * sizeof(sp_vec3_t) > header->size ||
+        header->instance_world_matrices_offset + num_instances * sizeof(sp_mat4x4_t) > header->size)
     {
-        sp_config_item_t float_item;
-        float_item = float_array[0];
-        vec3->x = (float)config->to_number(config->inst, float_item);
-        float_item = float_array[1];
-        vec3->y = (float)config->to_number(config->inst, float_item);
-        float_item = float_array[2];
-        vec3->z = (float)config->to_number(config->inst, float_item);
+        return false;
     }
+
+    uint8_t* data = p_scene_def->data;
+    p_scene_def->num_entities = header->num_entities;
+    p_scene_def->num_instances = header->num_instances;
+    p_scene_def->entities_def = (entity_def_t*)(data + header->entities_offset);
+    p_scene_def->instance_entity_hashes = (sp_strhash_t*)(data + header->instance_entity_hashes_offset);
+    p_scene_def->instance_positions = (sp_vec3_t*)(data + header->instance_positions_offset);
+    p_scene_def->instance_rotations = (sp_vec4_t*)(data + header->instance_rotations_offset);
+    p_scene_def->instance_scales = (sp_vec3_t*)(data + header->instance_scales_offset);
+    p_scene_def->instance_world_matrices = (sp_mat4x4_t*)(data + header->instance_world_matrices_offset);
+    return true;
+}
+
+void scene_create(scene_def_t* p_scene_def, uint32_t num_entities, uint32_t num_instances, sp_allocator_i* allocator)
+{
+    scene_bin_header_t header = { .magic = SCENE_BIN_MAGIC, .version = SCENE_BIN_VERSION, .num_entities = num_entities, .num_instances = num_instances };
+    uint64_t offset = align_offset(sizeof(scene_bin_header_t));
+    header.entities_offset = offset;
+    offset = align_offset(offset + num_entities * sizeof(entity_def_t));
+    header.instance_entity_hashes_offset = offset;
+    offset = align_offset(offset + num_instances * sizeof(sp_strhash_t));
+    header.instance_positions_offset = offset;
+    offset = align_offset(offset + num_instances * sizeof(sp_vec3_t));
+    header.instance_rotations_offset = offset;
+    offset = align_offset(offset + num_instances * sizeof(sp_vec4_t));
+    header.instance_scales_offset = offset;
+    offset = align_offset(offset + num_instances * sizeof(sp_vec3_t));
+    header.instance_world_matrices_offset = offset;
+    offset = align_offset(offset + num_instances * sizeof(sp_mat4x4_t));
+    header.size = offset;
+
+    p_scene_def->data = sp_alloc(allocator, header.size);
+    p_scene_def->data_size = header.size;
+    memset(p_scene_def->data, 0, header.size);
+    memcpy(p_scene_def->data, &header, sizeof(header));
+    scene_bind_data(p_scene_def);
 }
 
 void scene_free(scene_def_t* p_scene_def, sp_allocator_i* allocator)
 {
-    sp_array_free(p_scene_def->entities_def_arr, allocator);
-    sp_array_free(p_scene_def->instances_arr, allocator);
+    if (p_scene_def->data)
+    {
+        sp_free(allocator, p_scene_def->data, p_scene_def->data_size);
+    }
+    memset(p_scene_def, 0, sizeof(scene_def_t));
 }
 
-void scene_load_file(const char* scene_file, scene_def_t* p_scene_def, sp_allocator_i* allocator)
+bool scene_load_compiled(const char* scenebin_file, scene_def_t* p_scene_def, sp_allocator_i* allocator)
 {
-    //SP_INIT_TEMP_ALLOCATOR(ta);
-    SP_INIT_TEMP_ALLOCATOR_WITH_ADAPTER(ta, a);
+    const sp_file_stat_t stat = sp_os_api->file_system->stat(scenebin_file);
+    if (!stat.exists || stat.size < sizeof(scene_bin_header_t))
+        return false;
 
-    const char* text = read_file(scene_file, ta);
+    struct sp_os_file_io_api* io = sp_os_api->file_io;
+    sp_file_o f = io->open_input(scenebin_file);
+    if (!f.valid)
+        return false;
 
-    char error[256];
-    const uint32_t parse_flags = SP_JSON_PARSE_EXT_ALLOW_UNQUOTED_KEYS | SP_JSON_PARSE_EXT_ALLOW_COMMENTS | SP_JSON_PARSE_EXT_IMPLICIT_ROOT_OBJECT | SP_JSON_PARSE_EXT_OPTIONAL_COMMAS | SP_JSON_PARSE_EXT_EQUALS_FOR_COLON;
-    sp_config_i* scene_config = sp_config_api->create(a);
-    bool res = sp_json_api->parse(text, scene_config, parse_flags, error);
-    if (!res)
+    memset(p_scene_def, 0, sizeof(scene_def_t));
+    p_scene_def->data = sp_alloc(allocator, stat.size);
+    p_scene_def->data_size = stat.size;
+    const int64_t read_size = io->read(f, p_scene_def->data, stat.size);
+    io->close(f);
+
+    if (read_size != (int64_t)stat.size || !scene_bind_data(p_scene_def))
+    {
+        scene_free(p_scene_def, allocator);
+        return false;
+    }
+    return true;
+}
+
+bool scene_compile(const scene_def_t* p_scene_def, const char* scenebin_file)
+{
+    if (!p_scene_def->data)
+        return false;
+
+    struct sp_os_file_io_api* io = sp_os_api->file_io;
+    sp_file_o f = io->open_output(scenebin_file);
+    if (!f.valid)
+        return false;
+    bool res = io->write(f, p_scene_def->data, p_scene_def->data_size);
+    io->close(f);
+    return res;
+}
+
+bool scene_load(const char* scene_file, scene_def_t* p_scene_def, sp_allocator_i* allocator)
+{
+    char scenebin_file[1024];
+    sp_sprintf_api->print(scenebin_file, sizeof(scenebin_file), "%sbin", scene_file);
+
+    const sp_file_stat_t text_stat = sp_os_api->file_system->stat(scene_file);
+    const sp_file_stat_t bin_stat = sp_os_api->file_system->stat(scenebin_file);
+    if (bin_stat.exists && (!text_stat.exists || bin_stat.last_modified_time >= text_stat.last_modified_time))
+    {
+        if (scene_load_compiled(scenebin_file, p_scene_def, allocator))
+            return true;
+    }
+
+    if (!scene_load_file(scene_file, p_scene_def, allocator))
+        return false;
+    scene_compile(p_scene_def, scenebin_file);
+    return true;
+}
+
+// parse state of a text scene, entities and instances are collected in arrays since their counts are only
+// known once the file was read
+typedef struct scene_parse_t
+{
+    sp_json_pull_t* pull;
+    sp_allocator_i* allocator;
+
+    entity_def_t* entities_arr;
+    sp_strhash_t* instance_entity_hashes_arr;
+    sp_vec3_t* instance_positions_arr;
+    // euler angles in degrees
+    sp_vec3_t* instance_rotations_arr;
+    sp_vec3_t* instance_scales_arr;
+
+} scene_parse_t;
+
+static uint32_t read_scene_chunk(void* stream, char* buffer, uint32_t size)
+{
+    const int64_t read_size = sp_os_api->file_io->read(*(sp_file_o*)stream, buffer, size);
+    return read_size > 0 ? (uint32_t)read_size : 0;
+}
+
+static bool next_token(scene_parse_t* parse, uint32_t type, sp_json_token_t* token)
+{
+    *token = sp_json_pull_api->next(parse->pull);
+    return token->type == type;
+}
+
+static bool parse_string(scene_parse_t* parse, char* buffer, uint32_t size)
+{
+    sp_json_token_t token;
+    if (!next_token(parse, SP_JSON_TOKEN_STRING, &token))
+        return false;
+    sp_sprintf_api->print(buffer, size, "%s", token.string);
+    return true;
+}
+
+// like the config version, the vector is left untouched unless the array has exactly 3 numbers
+static bool parse_vec3(scene_parse_t* parse, sp_vec3_t* vec3)
+{
+    sp_json_token_t token;
+    if (!next_token(parse, SP_JSON_TOKEN_ARRAY_BEGIN, &token))
+        return false;
+
+    float values[3];
+    uint32_t num_values = 0;
+    while (!next_token(parse, SP_JSON_TOKEN_ARRAY_END, &token))
     {
-        return;
+        if (token.type != SP_JSON_TOKEN_NUMBER)
+            return false;
+        if (num_values < 3)
+            values[num_values] = (float)token.number;
+        ++num_values;
     }
+    if (num_values == 3)
+        *vec3 = (sp_vec3_t){ values[0], values[1], values[2] };
+    return true;
+}
+
+static bool parse_entities(scene_parse_t* parse)
+{
+    sp_json_token_t token;
+    if (!next_token(parse, SP_JSON_TOKEN_ARRAY_BEGIN, &token))
+        return false;
 
-    sp_config_item_t root = scene_config->root(scene_config->inst);
-    sp_strhash_t s_name_hash = sp_murmur_hash_string("name");
-    sp_strhash_t s_model_hash = sp_murmur_hash_string("model");
-//    sp_strhash_t s_predefined_shape_hash = sp_murmur_hash_string("shape");
-    sp_strhash_t s_material_hash = sp_murmur_hash_string("material");
-    sp_strhash_t s_entities_hash = sp_murmur_hash_string("entities");
-    sp_strhash_t s_instances_hash = sp_murmur_hash_string("instances");
-    sp_strhash_t s_entity_hash = sp_murmur_hash_string("entity");
-    sp_strhash_t s_transform_hash = sp_murmur_hash_string("transform");
-    sp_strhash_t s_position_hash = sp_murmur_hash_string("position");
-    sp_strhash_t s_rotation_hash = sp_murmur_hash_string("rotation");
-    sp_strhash_t s_scale_hash = sp_murmur_hash_string("scale");
-    sp_strhash_t s_flags_hash = sp_murmur_hash_string("flags");
-    
-
-    
-    sp_config_item_t entities = scene_config->object_get(scene_config->inst, root, s_entities_hash);
-    sp_config_item_t* entities_array = NULL;
-    uint32_t num_entities = scene_config->to_array(scene_config->inst, entities, &entities_array);
-    
-    sp_array_ensure(p_scene_def->entities_def_arr, num_entities, allocator);    
     char entity_name_id[64];
-    
-    for (uint32_t i = 0; i < num_entities; ++i)
+    while (next_token(parse, SP_JSON_TOKEN_OBJECT_BEGIN, &token))
     {
-        sp_config_item_t entity_item = entities_array[i];
-        entity_def_t* p_entity_def = &p_scene_def->entities_def_arr[i];
-        p_entity_def->flags = 0;
-        get_attribute_as_string(scene_config, entity_item, s_name_hash, entity_name_id);
-        p_entity_def->entity_hash = sp_murmur_hash_string(entity_name_id);
-        get_attribute_as_string(scene_config, entity_item, s_model_hash, p_entity_def->model_file);
-        get_attribute_as_string(scene_config, entity_item, s_material_hash, p_entity_def->material_file);
-        p_entity_def->flags = (uint32_t)get_attribute_as_number(scene_config, entity_item, s_flags_hash);
-    
+        // zeroed, so entity definitions can be compared with memcmp on reload
+        entity_def_t entity_def;
+        memset(&entity_def, 0, sizeof(entity_def));
+        while (next_token(parse, SP_JSON_TOKEN_KEY, &token))
+        {
+            const sp_strhash_t key_hash = sp_murmur_hash_string(token.string);
+            bool res;
+            if (key_hash == SP_KEY_NAME)
+            {
+                res = parse_string(parse, entity_name_id, sizeof(entity_name_id));
+                entity_def.entity_hash = sp_murmur_hash_string(entity_name_id);
+            }
+            else if (key_hash == SP_KEY_MODEL)
+            {
+                res = parse_string(parse, entity_def.model_file, sizeof(entity_def.model_file));
+            }
+            else if (key_hash == SP_KEY_MATERIAL)
+            {
+                res = parse_string(parse, entity_def.material_file, sizeof(entity_def.material_file));
+            }
+            else if (key_hash == SP_KEY_FLAGS)
+            {
+                res = next_token(parse, SP_JSON_TOKEN_NUMBER, &token);
+                entity_def.flags = (uint32_t)token.number;
+            }
+            else
+            {
+                res = sp_json_pull_api->skip(parse->pull);
+            }
+            if (!res)
+                return false;
+        }
+        if (token.type != SP_JSON_TOKEN_OBJECT_END)
+            return false;
+        sp_array_push(parse->entities_arr, entity_def, parse->allocator);
     }
-    sp_array_header(p_scene_def->entities_def_arr)->size = num_entities;
+    return token.type == SP_JSON_TOKEN_ARRAY_END;
+}
 
-    sp_config_item_t instances = scene_config->object_get(scene_config->inst, root, s_instances_hash);
-    sp_config_item_t* instances_array = NULL;
-    uint32_t num_instances = scene_config->to_array(scene_config->inst, instances, &instances_array);
-    sp_array_ensure(p_scene_def->instances_arr, num_instances, allocator);
-    for (uint32_t i = 0; i < num_instances; ++i)
+static bool parse_transform(scene_parse_t* parse, sp_vec3_t* position, sp_vec3_t* rotation, sp_vec3_t* scale)
+{
+    sp_json_token_t token;
+    if (!next_token(parse, SP_JSON_TOKEN_OBJECT_BEGIN, &token))
+        return false;
+
+    while (next_token(parse, SP_JSON_TOKEN_KEY, &token))
     {
-        sp_config_item_t instance_item = instances_array[i];
-        entity_instance_t* p_instance = &p_scene_def->instances_arr[i];
-
-        get_attribute_as_string(scene_config, instance_item, s_entity_hash, entity_name_id);
-        p_instance->entity_hash = sp_murmur_hash_string(entity_name_id);
-        sp_config_item_t transform_item = scene_config->object_get(scene_config->inst, instance_item, s_transform_hash);
-        sp_vec3_t position;
-        sp_vec3_t rotation;
-        sp_vec3_t scale;
-        get_attribute_as_vec3(scene_config, transform_item, s_position_hash, &position);
-        get_attribute_as_vec3(scene_config, transform_item, s_rotation_hash, &rotation);
-        get_attribute_as_vec3(scene_config, transform_item, s_scale_hash, &scale);
-        p_instance->transform.position = position;
-        p_instance->transform.scale = scale;
-        // convert angles to radians, than convert euler angles to quaternion
-#define DEG_TO_RAD(a) ((a) * SP_PI / 180.0f)
-        rotation.x = DEG_TO_RAD(rotation.x);
-        rotation.y = DEG_TO_RAD(rotation.y);
-        rotation.z = DEG_TO_RAD(rotation.z);
-        p_instance->transform.rotation = sp_euler_to_quaternion(rotation);      
+        const sp_strhash_t key_hash = sp_murmur_hash_string(token.string);
+        bool res;
+        if (key_hash == SP_KEY_POSITION)
+            res = parse_vec3(parse, position);
+        else if (key_hash == SP_KEY_ROTATION)
+            res = parse_vec3(parse, rotation);
+        else if (key_hash == SP_KEY_SCALE)
+            res = parse_vec3(parse, scale);
+        else
+            res = sp_json_pull_api->skip(parse->pull);
+        if (!res)
+            return false;
     }
-    sp_array_header(p_scene_def->instances_arr)->size = num_instances;
-    
+    return token.type == SP_JSON_TOKEN_OBJECT_END;
+}
+
+static bool parse_instances(scene_parse_t* parse)
+{
+    sp_json_token_t token;
+    if (!next_token(parse, SP_JSON_TOKEN_ARRAY_BEGIN, &token))
+        return false;
+
+    char entity_name_id[64];
+    while (next_token(parse, SP_JSON_TOKEN_OBJECT_BEGIN, &token))
+    {
+        entity_name_id[0] = 0;
+        sp_vec3_t position = { 0 };
+        sp_vec3_t rotation = { 0 };
+        sp_vec3_t scale = { 0 };
+        while (next_token(parse, SP_JSON_TOKEN_KEY, &token))
+        {
+            const sp_strhash_t key_hash = sp_murmur_hash_string(token.string);
+            bool res;
+            if (key_hash == SP_KEY_ENTITY)
+                res = parse_string(parse, entity_name_id, sizeof(entity_name_id));
+            else if (key_hash == SP_KEY_TRANSFORM)
+                res = parse_transform(parse, &position, &rotation, &scale);
+            else
+                res = sp_json_pull_api->skip(parse->pull);
+            if (!res)
+                return false;
+        }
+        if (token.type != SP_JSON_TOKEN_OBJECT_END)
+            return false;
 
+        sp_array_push(parse->instance_entity_hashes_arr, sp_murmur_hash_string(entity_name_id), parse->allocator);
+        sp_array_push(parse->instance_positions_arr, position, parse->allocator);
+        sp_array_push(parse->instance_rotations_arr, rotation, parse->allocator);
+        sp_array_push(parse->instance_scales_arr, scale, parse->allocator);
+    }
+    return token.type == SP_JSON_TOKEN_ARRAY_END;
+}
+
+static bool parse_scene(scene_parse_t* parse)
+{
+    sp_json_token_t token;
+    if (!next_token(parse, SP_JSON_TOKEN_OBJECT_BEGIN, &token))
+        return false;
+
+    while (next_token(parse, SP_JSON_TOKEN_KEY, &token))
+    {
+        const sp_strhash_t key_hash = sp_murmur_hash_string(token.string);
+        bool res;
+        if (key_hash == SP_KEY_ENTITIES)
+            res = parse_entities(parse);
+        else if (key_hash == SP_KEY_INSTANCES)
+            res = parse_instances(parse);
+        else
+            res = sp_json_pull_api->skip(parse->pull);
+        if (!res)
+            return false;
+    }
+    return token.type == SP_JSON_TOKEN_OBJECT_END && next_token(parse, SP_JSON_TOKEN_END, &token);
+}
+
+// the text is streamed through the pull parser, so neither the file nor a config of it is ever held in
+// memory, only the parsed scene
+bool scene_load_file(const char* scene_file, scene_def_t* p_scene_def, sp_allocator_i* allocator)
+{
+    struct sp_os_file_io_api* io = sp_os_api->file_io;
+    sp_file_o f = io->open_input(scene_file);
+    if (!f.valid)
+        return false;
+
+    const uint32_t parse_flags = SP_JSON_PARSE_EXT_ALLOW_UNQUOTED_KEYS | SP_JSON_PARSE_EXT_ALLOW_COMMENTS | SP_JSON_PARSE_EXT_IMPLICIT_ROOT_OBJECT | SP_JSON_PARSE_EXT_OPTIONAL_COMMAS | SP_JSON_PARSE_EXT_EQUALS_FOR_COLON;
+    sp_json_pull_t* pull = sp_alloc(allocator, sizeof(sp_json_pull_t));
+    sp_json_pull_api->init(pull, read_scene_chunk, &f, parse_flags);
+
+    scene_parse_t parse = {
+        .pull = pull,
+        .allocator = allocator,
+    };
+    const bool res = parse_scene(&parse);
+    io->close(f);
+    sp_free(allocator, pull, sizeof(sp_json_pull_t));
+
+    if (res)
+    {
+        const uint32_t num_entities = (uint32_t)sp_array_size(parse.entities_arr);
+        const uint32_t num_instances = (uint32_t)sp_array_size(parse.instance_entity_hashes_arr);
+        scene_create(p_scene_def, num_entities, num_instances, allocator);
+        if (num_entities)
+            memcpy(p_scene_def->entities_def, parse.entities_arr, num_entities * sizeof(entity_def_t));
+
+        for (uint32_t i = 0; i < num_instances; ++i)
+        {
+            // convert angles to radians, than convert euler angles to quaternion
+#define DEG_TO_RAD(a) ((a) * SP_PI / 180.0f)
+            sp_vec3_t rotation = parse.instance_rotations_arr[i];
+            rotation.x = DEG_TO_RAD(rotation.x);
+            rotation.y = DEG_TO_RAD(rotation.y);
+            rotation.z = DEG_TO_RAD(rotation.z);
+            p_scene_def->instance_entity_hashes[i] = parse.instance_entity_hashes_arr[i];
+            p_scene_def->instance_positions[i] = parse.instance_positions_arr[i];
+            p_scene_def->instance_rotations[i] = sp_euler_to_quaternion(rotation);
+            p_scene_def->instance_scales[i] = parse.instance_scales_arr[i];
+            sp_mat4x4_from_translation_quaternion_scale(&p_scene_def->instance_world_matrices[i], p_scene_def->instance_positions[i], p_scene_def->instance_rotations[i], p_scene_def->instance_scales[i]);
+        }
+    }
 
-    SP_SHUTDOWN_TEMP_ALLOCATOR(ta);
+    sp_array_free(parse.entities_arr, allocator);
+    sp_array_free(parse.instance_entity_hashes_arr, allocator);
+    sp_array_free(parse.instance_positions_arr, allocator);
+    sp_array_free(parse.instance_rotations_arr, allocator);
+    sp_array_free(parse.instance_scales_arr, allocator);
+    return res;
 }
@@ -6,12 +6,6 @@
 #define FILE_MAX_PATH_LEN 64
 #endif
 
-typedef struct entity_instance_t
-{
-    sp_strhash_t entity_hash;
-    sp_transform_t transform;
-} entity_instance_t;
-
 typedef struct entity_def_t
 {
     sp_strhash_t entity_hash;
@@ -20,11 +14,56 @@ typedef struct entity_def_t
     uint32_t flags; // use predefined shape = 1
 } entity_def_t;
 
+// Compiled scene (.scenebin) layout. The whole scene lives in one block - header, entity table, instance
+// SoA arrays and precomputed world matrices - addressed by offsets from the start of the block. The block
+// is written to disk as is, so loading a compiled scene is a single read with no parsing.
+#define SCENE_BIN_MAGIC 0x43535053 // 'SPSC'
+#define SCENE_BIN_VERSION 1
+
+typedef struct scene_bin_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_entities;
+    uint32_t num_instances;
+    // total size of the block, including the header
+    uint64_t size;
+    uint64_t entities_offset;
+    uint64_t instance_entity_hashes_offset;
+    uint64_t instance_positions_offset;
+    uint64_t instance_rotations_offset;
+    uint64_t instance_scales_offset;
+    uint64_t instance_world_matrices_offset;
+} scene_bin_header_t;
+
 typedef struct scene_def_t
 {
-    entity_def_t*       entities_def_arr;
-    entity_instance_t*  instances_arr;
+    uint32_t num_entities;
+    uint32_t num_instances;
+    entity_def_t* entities_def;
+
+    // instances, SoA
+    sp_strhash_t* instance_entity_hashes;
+    sp_vec3_t* instance_positions;
+    // quaternions
+    sp_vec4_t* instance_rotations;
+    sp_vec3_t* instance_scales;
+    sp_mat4x4_t* instance_world_matrices;
+
+    // the block all of the above points into, starts with scene_bin_header_t
+    void* data;
+    uint64_t data_size;
 } scene_def_t;
 
-void scene_load_file(const char* scene_file, scene_def_t* p_scene_def, sp_allocator_i* allocator);
-void scene_free(scene_def_t* p_scene_def, sp_allocator_i* allocator);
\ No newline at end of file
+// allocates a zeroed scene block for the given counts, used to build scenes in code
+void scene_create(scene_def_t* p_scene_def, uint32_t num_entities, uint32_t num_instances, sp_allocator_i* allocator);
+// parses a text scene. Returns false when the file is missing or fails to parse
+bool scene_load_file(const char* scene_file, scene_def_t* p_scene_def, sp_allocator_i* allocator);
+// loads a scene written by scene_compile. Returns false if the file is missing or not a valid compiled scene
+bool scene_load_compiled(const char* scenebin_file, scene_def_t* p_scene_def, sp_allocator_i* allocator);
+// writes the compiled form of a loaded scene
+bool scene_compile(const scene_def_t* p_scene_def, const char* scenebin_file);
+// loads the compiled scene next to scene_file ("<scene_file>bin") if it is up to date, otherwise parses the
+// text scene and refreshes the compiled one
+bool scene_load(const char* scene_file, scene_def_t* p_scene_def, sp_allocator_i* allocator);
+void scene_free(scene_def_t* p_scene_def, sp_allocator_i* allocator);
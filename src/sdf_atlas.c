@@ -0,0 +1,374 @@
+#include "sdf_atlas.h"
+
+#include "text_layout.h"
+#include "core/allocator.h"
+#include "core/array.h"
+#include "core/frame_allocator.h"
+
+#include <math.h>
+#include <memory.h>
+#include <stdlib.h>
+
+// the copy of stb_truetype that comes with imgui. Its implementation in imgui is static, this file compiles its
+// own
+#define STB_TRUETYPE_IMPLEMENTATION
+#define STBTT_STATIC
+#include "imstb_truetype.h"
+
+#define SDF_INF 1e20f
+// texels between the cells, so linear filtering never reads a neighbouring glyph
+#define SDF_CELL_GAP 1
+// glyph index of the solid cell
+#define SDF_SOLID_CELL UINT32_MAX
+
+typedef struct sdf_cell_t
+{
+    uint32_t glyph;
+    // glyph bitmap in the source atlas
+    uint32_t src_x, src_y, src_w, src_h;
+    // cell in the sdf atlas
+    uint32_t x, y, w, h;
+    // field rendered from the outlines, w * h texels, and its top left relative to the glyph origin in atlas
+    // texels. NULL for cells baked from coverage
+    uint8_t* field;
+    int32_t field_x, field_y;
+} sdf_cell_t;
+
+// squared euclidean distance transform of n samples step apart (Felzenszwalb and Huttenlocher), in place. f is
+// 0 on the features and SDF_INF elsewhere, v and z are scratch of n and n + 1 entries
+static void edt_1d(float* f, uint32_t n, uint32_t step, float* d, uint32_t* v, float* z)
+{
+    uint32_t k = 0;
+    v[0] = 0;
+    z[0] = -SDF_INF;
+    z[1] = SDF_INF;
+    for (uint32_t q = 1; q < n; ++q)
+    {
+        const float fq = f[q * step] + (float)(q * q);
+        float s = (fq - (f[v[k] * step] + (float)(v[k] * v[k]))) / (2.0f * (float)(q - v[k]));
+        while (k > 0 && s <= z[k])
+        {
+            --k;
+            s = (fq - (f[v[k] * step] + (float)(v[k] * v[k]))) / (2.0f * (float)(q - v[k]));
+        }
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = SDF_INF;
+    }
+
+    k = 0;
+    for (uint32_t q = 0; q < n; ++q)
+    {
+        while (z[k + 1] < (float)q)
+            ++k;
+        const float dq = (float)q - (float)v[k];
+        d[q] = dq * dq + f[v[k] * step];
+    }
+    for (uint32_t q = 0; q < n; ++q)
+        f[q * step] = d[q];
+}
+
+static void edt_2d(float* grid, uint32_t width, uint32_t height, float* d, uint32_t* v, float* z)
+{
+    for (uint32_t x = 0; x < width; ++x)
+        edt_1d(grid + x, height, width, d, v, z);
+    for (uint32_t y = 0; y < height; ++y)
+        edt_1d(grid + (uint64_t)y * width, width, 1, d, v, z);
+}
+
+static uint32_t next_power_of_two(uint32_t value)
+{
+    uint32_t result = 1;
+    while (result < value)
+        result *= 2;
+    return result;
+}
+
+static int compare_cell_heights(const void* a, const void* b)
+{
+    const uint32_t ha = ((const sdf_cell_t*)a)->h;
+    const uint32_t hb = ((const sdf_cell_t*)b)->h;
+    return (ha < hb) - (ha > hb);
+}
+
+// shelves of cells, tallest first. Returns the used height
+static uint32_t pack_cells(sdf_cell_t* cells, uint32_t num_cells, uint32_t width)
+{
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t shelf_height = 0;
+    for (uint32_t i = 0; i < num_cells; ++i)
+    {
+        if (x + cells[i].w > width)
+        {
+            x = 0;
+            y += shelf_height + SDF_CELL_GAP;
+            shelf_height = 0;
+        }
+        cells[i].x = x;
+        cells[i].y = y;
+        x += cells[i].w + SDF_CELL_GAP;
+        shelf_height = cells[i].h > shelf_height ? cells[i].h : shelf_height;
+    }
+    return y + shelf_height;
+}
+
+// signed distance of every texel of a cell at the source resolution, box filtered down into the atlas
+static void bake_cell(sdf_atlas_t* atlas, const sdf_cell_t* cell, const uint8_t* coverage, uint32_t stride, uint32_t bytes_per_pixel, uint32_t channel, uint32_t spread, uint32_t downscale)
+{
+    SP_INIT_SCRATCH_ALLOCATOR(scratch);
+    const uint32_t local_w = cell->w * downscale;
+    const uint32_t local_h = cell->h * downscale;
+    const uint32_t num_texels = local_w * local_h;
+    const uint32_t max_n = local_w > local_h ? local_w : local_h;
+    float* outside = sp_alloc(scratch, sizeof(float) * num_texels);
+    float* inside = sp_alloc(scratch, sizeof(float) * num_texels);
+    uint8_t* is_inside = sp_alloc(scratch, num_texels);
+    float* d = sp_alloc(scratch, sizeof(float) * max_n);
+    uint32_t* v = sp_alloc(scratch, sizeof(uint32_t) * max_n);
+    float* z = sp_alloc(scratch, sizeof(float) * (max_n + 1));
+
+    // the glyph bitmap sits spread texels in, everything around it is outside
+    memset(is_inside, 0, num_texels);
+    for (uint32_t y = 0; y < cell->src_h; ++y)
+    {
+        const uint8_t* row = coverage + (uint64_t)(cell->src_y + y) * stride + (uint64_t)cell->src_x * bytes_per_pixel + channel;
+        for (uint32_t x = 0; x < cell->src_w; ++x)
+            is_inside[(y + spread) * local_w + x + spread] = row[x * bytes_per_pixel] >= 128;
+    }
+    for (uint32_t i = 0; i < num_texels; ++i)
+    {
+        outside[i] = is_inside[i] ? 0.0f : SDF_INF;
+        inside[i] = is_inside[i] ? SDF_INF : 0.0f;
+    }
+    // outside texels get the distance to the glyph, inside texels the distance to the background
+    edt_2d(outside, local_w, local_h, d, v, z);
+    edt_2d(inside, local_w, local_h, d, v, z);
+
+    const float inv_block = 1.0f / (float)(downscale * downscale);
+    const float encode = 1.0f / (2.0f * (float)spread);
+    for (uint32_t cy = 0; cy < cell->h; ++cy)
+    {
+        uint8_t* dst = atlas->texels + (uint64_t)(cell->y + cy) * atlas->width + cell->x;
+        for (uint32_t cx = 0; cx < cell->w; ++cx)
+        {
+            float sum = 0.0f;
+            for (uint32_t by = 0; by < downscale; ++by)
+            {
+                for (uint32_t bx = 0; bx < downscale; ++bx)
+                {
+                    const uint32_t i = (cy * downscale + by) * local_w + cx * downscale + bx;
+                    // the edge is half way between an inside and an outside texel
+                    sum += is_inside[i] ? sqrtf(inside[i]) - 0.5f : 0.5f - sqrtf(outside[i]);
+                }
+            }
+            const float value = 0.5f + sum * inv_block * encode;
+            dst[cx] = (uint8_t)(fminf(fmaxf(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+    }
+    SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+}
+
+// packs the cells, tallest first, into the narrowest power of two atlas that isn't taller than wide, allocates
+// its texels and fills the solid cell. Returns false when the cells don't fit in max_size
+static bool allocate_atlas(sdf_atlas_t* atlas, sdf_cell_t* cells, uint32_t num_cells, uint64_t area, uint32_t max_size, sp_allocator_i* allocator)
+{
+    qsort(cells, num_cells, sizeof(sdf_cell_t), compare_cell_heights);
+    uint32_t atlas_width = next_power_of_two((uint32_t)sqrt((double)area));
+    uint32_t used_height = pack_cells(cells, num_cells, atlas_width);
+    while (used_height > atlas_width && atlas_width < max_size)
+    {
+        atlas_width *= 2;
+        used_height = pack_cells(cells, num_cells, atlas_width);
+    }
+    const uint32_t atlas_height = next_power_of_two(used_height ? used_height : 1);
+    if (atlas_width > max_size || atlas_height > max_size)
+        return false;
+
+    atlas->width = atlas_width;
+    atlas->height = atlas_height;
+    atlas->texels = sp_alloc(allocator, (uint64_t)atlas_width * atlas_height);
+    // the background is as far outside as the field reaches
+    memset(atlas->texels, 0, (uint64_t)atlas_width * atlas_height);
+    for (uint32_t i = 0; i < num_cells; ++i)
+    {
+        const sdf_cell_t* cell = &cells[i];
+        if (cell->glyph != SDF_SOLID_CELL)
+            continue;
+        for (uint32_t y = 0; y < cell->h; ++y)
+            memset(atlas->texels + (uint64_t)(cell->y + y) * atlas_width + cell->x, 0xFF, cell->w);
+        atlas->solid_uv = (sp_vec2_t){ ((float)cell->x + 0.5f * (float)cell->w) / (float)atlas_width, ((float)cell->y + 0.5f * (float)cell->h) / (float)atlas_height };
+    }
+    return true;
+}
+
+// the solid cell is sampled at its centre, offsets up to the spread (shadows) stay inside it
+static sdf_cell_t solid_cell(uint32_t spread, uint32_t downscale)
+{
+    const uint32_t solid_size = 2 * ((spread + downscale - 1) / downscale) + 2;
+    return (sdf_cell_t){ .glyph = SDF_SOLID_CELL, .w = solid_size, .h = solid_size };
+}
+
+static uint64_t cell_area(const sdf_cell_t* cell)
+{
+    return (uint64_t)(cell->w + SDF_CELL_GAP) * (cell->h + SDF_CELL_GAP);
+}
+
+static void set_glyph_cell(const sdf_atlas_t* atlas, sp_font_glyph_t* glyph, const sdf_cell_t* cell, uint32_t downscale)
+{
+    glyph->u0 = (float)cell->x / (float)atlas->width;
+    glyph->v0 = (float)cell->y / (float)atlas->height;
+    glyph->u1 = (float)(cell->x + cell->w) / (float)atlas->width;
+    glyph->v1 = (float)(cell->y + cell->h) / (float)atlas->height;
+    glyph->width = (float)(cell->w * downscale);
+    glyph->height = (float)(cell->h * downscale);
+}
+
+bool sdf_atlas_build(sdf_atlas_t* atlas, sp_font_t* font, const uint8_t* coverage, uint32_t width, uint32_t height, uint32_t stride, uint32_t bytes_per_pixel, uint32_t channel, const sdf_atlas_desc_t* desc, sp_allocator_i* allocator)
+{
+    memset(atlas, 0, sizeof(sdf_atlas_t));
+    atlas->allocator = allocator;
+    const uint32_t spread = desc->spread;
+    const uint32_t downscale = desc->downscale ? desc->downscale : 1;
+
+    SP_INIT_SCRATCH_ALLOCATOR(scratch);
+    const uint32_t num_glyphs = (uint32_t)sp_array_size(font->glyphs_arr);
+    sdf_cell_t* cells = sp_alloc(scratch, sizeof(sdf_cell_t) * (num_glyphs + 1));
+    cells[0] = solid_cell(spread, downscale);
+    uint32_t num_cells = 1;
+    uint64_t area = cell_area(&cells[0]);
+    for (uint32_t i = 0; i < num_glyphs; ++i)
+    {
+        const sp_font_glyph_t* glyph = &font->glyphs_arr[i];
+        if (glyph->width <= 0.0f || glyph->height <= 0.0f)
+            continue;
+        sdf_cell_t* cell = &cells[num_cells++];
+        memset(cell, 0, sizeof(sdf_cell_t));
+        cell->glyph = i;
+        cell->src_x = (uint32_t)(glyph->u0 * (float)width + 0.5f);
+        cell->src_y = (uint32_t)(glyph->v0 * (float)height + 0.5f);
+        cell->src_w = (uint32_t)glyph->width;
+        cell->src_h = (uint32_t)glyph->height;
+        // glyphs reaching past the source atlas are clipped
+        cell->src_w = cell->src_x + cell->src_w > width ? width - cell->src_x : cell->src_w;
+        cell->src_h = cell->src_y + cell->src_h > height ? height - cell->src_y : cell->src_h;
+        cell->w = (cell->src_w + 2 * spread + downscale - 1) / downscale;
+        cell->h = (cell->src_h + 2 * spread + downscale - 1) / downscale;
+        area += cell_area(cell);
+    }
+    if (!allocate_atlas(atlas, cells, num_cells, area, desc->max_size, allocator))
+    {
+        SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+        return false;
+    }
+    atlas->spread = (float)spread / (float)downscale;
+
+    for (uint32_t i = 0; i < num_cells; ++i)
+    {
+        const sdf_cell_t* cell = &cells[i];
+        if (cell->glyph == SDF_SOLID_CELL)
+            continue;
+        bake_cell(atlas, cell, coverage, stride, bytes_per_pixel, channel, spread, downscale);
+
+        // the quad covers the padded cell, in source texels like the rest of the glyph metrics
+        sp_font_glyph_t* glyph = &font->glyphs_arr[cell->glyph];
+        set_glyph_cell(atlas, glyph, cell, downscale);
+        glyph->x_top -= (float)spread;
+        glyph->y_top -= (float)spread;
+    }
+    SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+    return true;
+}
+
+bool sdf_atlas_build_from_outlines(sdf_atlas_t* atlas, sp_font_t* font, const uint8_t* ttf, uint64_t ttf_size, const sdf_atlas_desc_t* desc, sp_allocator_i* allocator)
+{
+    memset(atlas, 0, sizeof(sdf_atlas_t));
+    atlas->allocator = allocator;
+    const uint32_t downscale = desc->downscale ? desc->downscale : 1;
+
+    stbtt_fontinfo info;
+    const int offset = stbtt_GetFontOffsetForIndex(ttf, 0);
+    if (offset < 0 || (uint64_t)offset >= ttf_size || !stbtt_InitFont(&info, ttf, offset))
+        return false;
+    int ascent, descent, line_gap;
+    stbtt_GetFontVMetrics(&info, &ascent, &descent, &line_gap);
+    const int font_line_height = ascent - descent + line_gap;
+    if (font_line_height <= 0 || font->line_height <= 0.0f)
+        return false;
+    // font texels per font unit, from the line height the bitmap was baked with. The field is rendered at the
+    // atlas resolution, downscale font texels per atlas texel
+    const float scale = font->line_height / (float)font_line_height;
+    const float atlas_scale = scale / (float)downscale;
+    const int padding = (int)((desc->spread + downscale - 1) / downscale);
+    atlas->spread = (float)desc->spread / (float)downscale;
+    // stb stores onedge + distance * pixel_dist_scale, so 0.5 + distance / (2 * spread) like the coverage bake
+    const float pixel_dist_scale = 127.5f / atlas->spread;
+    const float baseline = (float)ascent * scale;
+
+    SP_INIT_SCRATCH_ALLOCATOR(scratch);
+    const uint32_t num_glyphs = (uint32_t)sp_array_size(font->glyphs_arr);
+    sdf_cell_t* cells = sp_alloc(scratch, sizeof(sdf_cell_t) * (num_glyphs + 1));
+    cells[0] = solid_cell(desc->spread, downscale);
+    uint32_t num_cells = 1;
+    uint64_t area = cell_area(&cells[0]);
+    uint8_t* outlined = sp_alloc(scratch, num_glyphs ? num_glyphs : 1);
+    for (uint32_t i = 0; i < num_glyphs; ++i)
+    {
+        const sp_font_glyph_t* glyph = &font->glyphs_arr[i];
+        // code points missing from the typeface draw its missing glyph box, like the bitmap did
+        const int glyph_index = stbtt_FindGlyphIndex(&info, (int)glyph->code);
+        int w = 0, h = 0, x = 0, y = 0;
+        uint8_t* field = stbtt_GetGlyphSDF(&info, atlas_scale, glyph_index, padding, 128, pixel_dist_scale, &w, &h, &x, &y);
+        outlined[i] = field != NULL;
+        if (!field)
+            continue;
+        sdf_cell_t* cell = &cells[num_cells++];
+        memset(cell, 0, sizeof(sdf_cell_t));
+        cell->glyph = i;
+        cell->w = (uint32_t)w;
+        cell->h = (uint32_t)h;
+        cell->field = field;
+        cell->field_x = x;
+        cell->field_y = y;
+        area += cell_area(cell);
+    }
+
+    const bool fits = allocate_atlas(atlas, cells, num_cells, area, desc->max_size, allocator);
+    for (uint32_t i = 0; i < num_cells; ++i)
+    {
+        const sdf_cell_t* cell = &cells[i];
+        if (!cell->field)
+            continue;
+        if (fits)
+        {
+            for (uint32_t y = 0; y < cell->h; ++y)
+                memcpy(atlas->texels + (uint64_t)(cell->y + y) * atlas->width + cell->x, cell->field + (uint64_t)y * cell->w, cell->w);
+
+            // the glyph is placed from the outline box, relative to the top of the line like the bitmap metrics
+            sp_font_glyph_t* glyph = &font->glyphs_arr[cell->glyph];
+            set_glyph_cell(atlas, glyph, cell, downscale);
+            glyph->x_top = (float)(cell->field_x * (int32_t)downscale);
+            glyph->y_top = baseline + (float)(cell->field_y * (int32_t)downscale);
+        }
+        stbtt_FreeSDF(cell->field, NULL);
+    }
+    // glyphs without an outline, like spaces, only advance
+    for (uint32_t i = 0; fits && i < num_glyphs; ++i)
+    {
+        if (!outlined[i])
+        {
+            font->glyphs_arr[i].width = 0.0f;
+            font->glyphs_arr[i].height = 0.0f;
+        }
+    }
+    SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+    return fits;
+}
+
+void sdf_atlas_free(sdf_atlas_t* atlas)
+{
+    if (atlas->texels)
+        sp_free(atlas->allocator, atlas->texels, (uint64_t)atlas->width * atlas->height);
+    atlas->texels = NULL;
+}
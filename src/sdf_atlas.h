@@ -0,0 +1,57 @@
+#pragma once
+
+#include "core/sapphire_types.h"
+
+typedef struct sp_allocator_i sp_allocator_i;
+typedef struct sp_font_t sp_font_t;
+
+// Signed distance field font atlas, built at load time.
+//
+// The field is rendered from the outlines of the typeface the font was baked from when it is available
+// (sdf_atlas_build_from_outlines, stb_truetype's exact distance to the curves). Without it the field comes from
+// the bitmap atlas (sdf_atlas_build): every glyph bitmap is padded by spread source texels, turned into a signed
+// distance field at the source resolution and box filtered down by downscale. Either way every glyph gets its
+// own cell of the new atlas, the glyphs of the font are pointed at their cells and grow by the padding, which
+// gives outlines and shadows room around the glyph.
+//
+// A texel stores 0.5 + distance / (2 * spread), distance in source texels and positive inside the glyph, so
+// 0.5 is the edge and the field reaches spread texels to either side. One atlas scales down and moderately up
+// without the blur of a magnified bitmap. It is a single channel field: magnified well past the bake size,
+// corners round off, and fields from the bitmap also show the stair steps of its coverage.
+//
+// The atlas also holds a solid cell, fully inside at every texel, so untextured quads are drawn from the same
+// texture as the text.
+
+typedef struct sdf_atlas_desc_t
+{
+    // distance range in source texels
+    uint32_t spread;
+    // source texels per atlas texel, 1 keeps the source resolution
+    uint32_t downscale;
+    // largest atlas width and height
+    uint32_t max_size;
+} sdf_atlas_desc_t;
+
+typedef struct sdf_atlas_t
+{
+    sp_allocator_i* allocator;
+    // one byte per texel, rows of width bytes
+    uint8_t* texels;
+    uint32_t width;
+    uint32_t height;
+    // distance range in atlas texels
+    float spread;
+    // centre of the solid cell, the cell reaches spread texels around it
+    sp_vec2_t solid_uv;
+} sdf_atlas_t;
+
+// coverage is the source atlas with bytes_per_pixel bytes per texel and stride bytes per row, channel picks the
+// byte holding the coverage. The glyphs of font must address that atlas, they address the sdf atlas after the
+// call. Returns false when the glyphs don't fit in max_size, the font is left unchanged then
+bool sdf_atlas_build(sdf_atlas_t* atlas, sp_font_t* font, const uint8_t* coverage, uint32_t width, uint32_t height, uint32_t stride, uint32_t bytes_per_pixel, uint32_t channel, const sdf_atlas_desc_t* desc, sp_allocator_i* allocator);
+// ttf is a truetype or opentype file, the first font in it is used. Glyphs are matched by code point and scaled
+// so the line height of the typeface is the line height of font, their placement is taken from the outlines
+// while advances and kerning stay those of font. Returns false when the file can't be read or the glyphs don't
+// fit in max_size, the font is left unchanged then
+bool sdf_atlas_build_from_outlines(sdf_atlas_t* atlas, sp_font_t* font, const uint8_t* ttf, uint64_t ttf_size, const sdf_atlas_desc_t* desc, sp_allocator_i* allocator);
+void sdf_atlas_free(sdf_atlas_t* atlas);
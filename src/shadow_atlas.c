@@ -0,0 +1,182 @@
+#include "shadow_atlas.h"
+
+#include "core/allocator.h"
+
+#include <memory.h>
+#include <math.h>
+
+enum shadow_atlas_node_state
+{
+    SHADOW_ATLAS_NODE_FREE,
+    SHADOW_ATLAS_NODE_SPLIT,
+    SHADOW_ATLAS_NODE_USED,
+};
+
+// first node of a level, levels hold 1, 4, 16, ... nodes
+static uint32_t level_offset(uint32_t level)
+{
+    return ((1u << (2 * level)) - 1) / 3;
+}
+
+static uint32_t node_level(const shadow_atlas_t* atlas, uint32_t node)
+{
+    uint32_t level = 0;
+    while (level + 1 < atlas->num_levels && node >= level_offset(level + 1))
+        ++level;
+    return level;
+}
+
+// even bits of a morton code
+static uint32_t morton_compact(uint32_t code)
+{
+    code &= 0x55555555;
+    code = (code | (code >> 1)) & 0x33333333;
+    code = (code | (code >> 2)) & 0x0f0f0f0f;
+    code = (code | (code >> 4)) & 0x00ff00ff;
+    code = (code | (code >> 8)) & 0x0000ffff;
+    return code;
+}
+
+static uint32_t tile_size_of_level(const shadow_atlas_t* atlas, uint32_t level)
+{
+    return atlas->size >> level;
+}
+
+// a node is part of the tree when all its ancestors are split, the state of the others is stale
+static bool is_live(const shadow_atlas_t* atlas, uint32_t level, uint32_t index)
+{
+    return level == 0 || atlas->nodes[level_offset(level - 1) + (index >> 2)] == SHADOW_ATLAS_NODE_SPLIT;
+}
+
+void shadow_atlas_init(shadow_atlas_t* atlas, uint32_t size, uint32_t min_tile_size, sp_allocator_i* allocator)
+{
+    memset(atlas, 0, sizeof(shadow_atlas_t));
+    atlas->allocator = allocator;
+    atlas->size = size;
+    atlas->min_tile_size = min_tile_size;
+    atlas->num_levels = 1;
+    while (atlas->num_levels < SHADOW_ATLAS_MAX_LEVELS && (size >> atlas->num_levels) >= min_tile_size)
+        ++atlas->num_levels;
+    atlas->min_tile_size = size >> (atlas->num_levels - 1);
+    atlas->num_nodes = level_offset(atlas->num_levels);
+    atlas->nodes = sp_alloc(allocator, atlas->num_nodes);
+    shadow_atlas_clear(atlas);
+}
+
+void shadow_atlas_destroy(shadow_atlas_t* atlas)
+{
+    sp_free(atlas->allocator, atlas->nodes, atlas->num_nodes);
+    atlas->nodes = NULL;
+}
+
+void shadow_atlas_clear(shadow_atlas_t* atlas)
+{
+    memset(atlas->nodes, SHADOW_ATLAS_NODE_FREE, atlas->num_nodes);
+    atlas->used_area = 0;
+}
+
+uint32_t shadow_atlas_alloc(shadow_atlas_t* atlas, uint32_t tile_size)
+{
+    uint32_t level = 0;
+    while (level + 1 < atlas->num_levels && tile_size_of_level(atlas, level + 1) >= tile_size)
+        ++level;
+    if (tile_size_of_level(atlas, level) < tile_size)
+        return SHADOW_ATLAS_NULL;
+
+    // smallest free node that fits, so large free nodes stay whole for large tiles
+    for (int32_t l = (int32_t)level; l >= 0; --l)
+    {
+        const uint32_t offset = level_offset((uint32_t)l);
+        const uint32_t count = 1u << (2 * l);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (atlas->nodes[offset + i] != SHADOW_ATLAS_NODE_FREE || !is_live(atlas, (uint32_t)l, i))
+                continue;
+
+            // split down to the tile size, the tile takes the first child of every split
+            uint32_t index = i;
+            for (uint32_t split_level = (uint32_t)l; split_level < level; ++split_level)
+            {
+                atlas->nodes[level_offset(split_level) + index] = SHADOW_ATLAS_NODE_SPLIT;
+                index *= 4;
+                memset(atlas->nodes + level_offset(split_level + 1) + index, SHADOW_ATLAS_NODE_FREE, 4);
+            }
+            const uint32_t node = level_offset(level) + index;
+            atlas->nodes[node] = SHADOW_ATLAS_NODE_USED;
+            atlas->used_area += (uint64_t)tile_size_of_level(atlas, level) * tile_size_of_level(atlas, level);
+            return node;
+        }
+    }
+    return SHADOW_ATLAS_NULL;
+}
+
+void shadow_atlas_free(shadow_atlas_t* atlas, uint32_t tile)
+{
+    if (tile == SHADOW_ATLAS_NULL || atlas->nodes[tile] != SHADOW_ATLAS_NODE_USED)
+        return;
+    uint32_t level = node_level(atlas, tile);
+    uint32_t index = tile - level_offset(level);
+    atlas->used_area -= (uint64_t)tile_size_of_level(atlas, level) * tile_size_of_level(atlas, level);
+    atlas->nodes[tile] = SHADOW_ATLAS_NODE_FREE;
+
+    // merge free siblings back into their parent
+    while (level > 0)
+    {
+        const uint8_t* siblings = atlas->nodes + level_offset(level) + (index & ~3u);
+        if (siblings[0] != SHADOW_ATLAS_NODE_FREE || siblings[1] != SHADOW_ATLAS_NODE_FREE || siblings[2] != SHADOW_ATLAS_NODE_FREE || siblings[3] != SHADOW_ATLAS_NODE_FREE)
+            break;
+        --level;
+        index >>= 2;
+        atlas->nodes[level_offset(level) + index] = SHADOW_ATLAS_NODE_FREE;
+    }
+}
+
+shadow_atlas_tile_t shadow_atlas_get_tile(const shadow_atlas_t* atlas, uint32_t tile)
+{
+    const uint32_t level = node_level(atlas, tile);
+    const uint32_t index = tile - level_offset(level);
+    const uint32_t size = tile_size_of_level(atlas, level);
+    return (shadow_atlas_tile_t){ .x = morton_compact(index) * size, .y = morton_compact(index >> 1) * size, .size = size };
+}
+
+static float vec3_dot(sp_vec3_t a, sp_vec3_t b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static sp_vec3_t vec3_cross(sp_vec3_t a, sp_vec3_t b)
+{
+    return (sp_vec3_t){ a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+static sp_vec3_t vec3_normalize(sp_vec3_t v)
+{
+    const float length = sqrtf(vec3_dot(v, v));
+    const float inv_length = length > 0.0f ? 1.0f / length : 0.0f;
+    return (sp_vec3_t){ v.x * inv_length, v.y * inv_length, v.z * inv_length };
+}
+
+sp_mat4x4_t shadow_atlas_perspective_view(sp_vec3_t position, sp_vec3_t forward, sp_vec3_t up, float tan_half_fov, float near_plane, float far_plane)
+{
+    const sp_vec3_t f = vec3_normalize(forward);
+    const sp_vec3_t r = vec3_normalize(vec3_cross(up, f));
+    const sp_vec3_t u = vec3_cross(f, r);
+    const float scale = 1.0f / tan_half_fov;
+    // z' = z * a + b, w' = z
+    const float a = far_plane / (far_plane - near_plane);
+    const float b = -near_plane * a;
+    const float view_z = -vec3_dot(f, position);
+    return (sp_mat4x4_t){
+        .xx = r.x * scale, .xy = u.x * scale, .xz = f.x * a, .xw = f.x,
+        .yx = r.y * scale, .yy = u.y * scale, .yz = f.y * a, .yw = f.y,
+        .zx = r.z * scale, .zy = u.z * scale, .zz = f.z * a, .zw = f.z,
+        .wx = -vec3_dot(r, position) * scale, .wy = -vec3_dot(u, position) * scale, .wz = view_z * a + b, .ww = view_z,
+    };
+}
+
+float shadow_atlas_depth_bias(uint32_t tile_size, float tan_half_fov, float near_plane, float far_plane)
+{
+    // a texel at view depth d is 2 * d * tan_half_fov / tile_size wide and depth changes by n * f / ((f - n) * d^2)
+    // per unit of view depth, their product is the depth of a texel. 1.5 texels cover the filter footprint
+    return 1.5f * 2.0f * tan_half_fov / (float)tile_size * near_plane * far_plane / (far_plane - near_plane);
+}
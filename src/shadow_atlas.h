@@ -0,0 +1,61 @@
+#pragma once
+
+#include "core/sapphire_types.h"
+
+typedef struct sp_allocator_i sp_allocator_i;
+
+// Quadtree allocator of square shadow map tiles in one atlas texture.
+//
+// Tiles are power of two sized, from the atlas size down to min_tile_size. Every node of the tree is free,
+// split into four children or used by a tile. A tile is taken from the smallest free node that fits, which is
+// only split further when no free node of the tile size is left, and freeing the last used child of a node
+// merges it back into a free node.
+//
+// Node ids are stable while the tile is allocated.
+//
+// The views rendered into the tiles are square perspective projections, a spot light has one along its cone
+// and a point light one per cube face.
+
+#define SHADOW_ATLAS_NULL UINT32_MAX
+#define SHADOW_ATLAS_MAX_LEVELS 8
+// cube faces of a point light
+#define SHADOW_ATLAS_MAX_LIGHT_VIEWS 6
+
+typedef struct shadow_atlas_tile_t
+{
+    // in texels
+    uint32_t x;
+    uint32_t y;
+    uint32_t size;
+} shadow_atlas_tile_t;
+
+typedef struct shadow_atlas_t
+{
+    sp_allocator_i* allocator;
+    uint32_t size;
+    uint32_t min_tile_size;
+    // level 0 is the whole atlas, nodes of level l are min_tile_size << (num_levels - 1 - l) big
+    uint32_t num_levels;
+    // state of every node, the nodes of a level are stored together in morton order
+    uint8_t* nodes;
+    uint32_t num_nodes;
+    // texels of the allocated tiles
+    uint64_t used_area;
+} shadow_atlas_t;
+
+// size and min_tile_size are powers of two, at most SHADOW_ATLAS_MAX_LEVELS levels apart
+void shadow_atlas_init(shadow_atlas_t* atlas, uint32_t size, uint32_t min_tile_size, sp_allocator_i* allocator);
+void shadow_atlas_destroy(shadow_atlas_t* atlas);
+void shadow_atlas_clear(shadow_atlas_t* atlas);
+
+// tile_size is rounded up to a power of two and clamped to min_tile_size. Returns SHADOW_ATLAS_NULL when the
+// atlas has no room for the tile
+uint32_t shadow_atlas_alloc(shadow_atlas_t* atlas, uint32_t tile_size);
+void shadow_atlas_free(shadow_atlas_t* atlas, uint32_t tile);
+shadow_atlas_tile_t shadow_atlas_get_tile(const shadow_atlas_t* atlas, uint32_t tile);
+
+// world to shadow clip matrix (row vectors) of a square perspective view from position along forward. Depth is
+// in 0..1 between near_plane and far_plane
+sp_mat4x4_t shadow_atlas_perspective_view(sp_vec3_t position, sp_vec3_t forward, sp_vec3_t up, float tan_half_fov, float near_plane, float far_plane);
+// depth bias of about a texel of a view, at a view depth d it is bias / d
+float shadow_atlas_depth_bias(uint32_t tile_size, float tan_half_fov, float near_plane, float far_plane);
@@ -0,0 +1,135 @@
+#include "shadow_cascades.h"
+
+#include <math.h>
+
+static float vec3_dot(sp_vec3_t a, sp_vec3_t b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static sp_vec3_t vec3_cross(sp_vec3_t a, sp_vec3_t b)
+{
+    return (sp_vec3_t){ a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+static sp_vec3_t vec3_normalize(sp_vec3_t v)
+{
+    const float length = sqrtf(vec3_dot(v, v));
+    const float inv_length = length > 0.0f ? 1.0f / length : 0.0f;
+    return (sp_vec3_t){ v.x * inv_length, v.y * inv_length, v.z * inv_length };
+}
+
+void shadow_cascades_compute_splits(float near_plane, float far_plane, uint32_t num_cascades, float split_lambda, float* splits)
+{
+    splits[0] = near_plane;
+    for (uint32_t i = 1; i < num_cascades; ++i)
+    {
+        const float t = (float)i / (float)num_cascades;
+        const float log_split = near_plane * powf(far_plane / near_plane, t);
+        const float uniform_split = near_plane + (far_plane - near_plane) * t;
+        splits[i] = split_lambda * log_split + (1.0f - split_lambda) * uniform_split;
+    }
+    splits[num_cascades] = far_plane;
+}
+
+// light space axes, built from a fixed reference so they don't change while the light doesn't
+static void light_basis(sp_vec3_t light_direction, sp_vec3_t* right, sp_vec3_t* up, sp_vec3_t* forward)
+{
+    *forward = vec3_normalize(light_direction);
+    const sp_vec3_t reference = fabsf(forward->y) > 0.99f ? (sp_vec3_t){ 1.0f, 0.0f, 0.0f } : (sp_vec3_t){ 0.0f, 1.0f, 0.0f };
+    *right = vec3_normalize(vec3_cross(reference, *forward));
+    *up = vec3_cross(*forward, *right);
+}
+
+// smallest sphere around the frustum slice between the view depths n and f. tan_sq is tan(x)^2 + tan(y)^2 of
+// the half field of view angles, the squared distance of a slice corner from the axis per unit of depth.
+// Returns the distance of the center along the view axis
+static float slice_bounding_sphere(float n, float f, float tan_sq, float* radius)
+{
+    const float center = 0.5f * (n + f) * (1.0f + tan_sq);
+    if (center >= f)
+    {
+        *radius = f * sqrtf(tan_sq);
+        return f;
+    }
+    *radius = sqrtf((f - center) * (f - center) + f * f * tan_sq);
+    return center;
+}
+
+void shadow_cascades_update(shadow_cascade_t* cascades, const shadow_cascades_config_t* config, const sp_mat4x4_t* view, const sp_mat4x4_t* projection,
+    float near_plane, float far_plane, sp_vec3_t light_direction, const sp_aabb_t* scene_bounds)
+{
+    const uint32_t num_cascades = config->num_cascades < 1 ? 1 : (config->num_cascades > SHADOW_CASCADES_MAX ? SHADOW_CASCADES_MAX : config->num_cascades);
+    const float max_distance = config->max_distance > near_plane && config->max_distance < far_plane ? config->max_distance : far_plane;
+    float splits[SHADOW_CASCADES_MAX + 1];
+    shadow_cascades_compute_splits(near_plane, max_distance, num_cascades, config->split_lambda, splits);
+
+    // the view matrix is a rigid transform, its columns are the camera axes. clip.w is +-view z, depending
+    // on the handedness of the projection
+    const sp_mat4x4_t* v = view;
+    const float forward_sign = projection->zw < 0.0f ? -1.0f : 1.0f;
+    const sp_vec3_t camera_forward = { v->xz * forward_sign, v->yz * forward_sign, v->zz * forward_sign };
+    const sp_vec3_t camera_position = {
+        -(v->wx * v->xx + v->wy * v->xy + v->wz * v->xz),
+        -(v->wx * v->yx + v->wy * v->yy + v->wz * v->yz),
+        -(v->wx * v->zx + v->wy * v->zy + v->wz * v->zz),
+    };
+    const float tan_x = 1.0f / projection->xx;
+    const float tan_y = 1.0f / projection->yy;
+    const float tan_sq = tan_x * tan_x + tan_y * tan_y;
+
+    sp_vec3_t right, up, forward;
+    light_basis(light_direction, &right, &up, &forward);
+
+    // closest light space depth of the casters
+    float scene_min_z = INFINITY;
+    if (scene_bounds && scene_bounds->min.x <= scene_bounds->max.x)
+    {
+        for (uint32_t corner = 0; corner < 8; ++corner)
+        {
+            const sp_vec3_t p = {
+                corner & 1 ? scene_bounds->max.x : scene_bounds->min.x,
+                corner & 2 ? scene_bounds->max.y : scene_bounds->min.y,
+                corner & 4 ? scene_bounds->max.z : scene_bounds->min.z,
+            };
+            scene_min_z = fminf(scene_min_z, vec3_dot(p, forward));
+        }
+    }
+
+    for (uint32_t i = 0; i < num_cascades; ++i)
+    {
+        shadow_cascade_t* cascade = &cascades[i];
+        float radius;
+        const float center_distance = slice_bounding_sphere(splits[i], splits[i + 1], tan_sq, &radius);
+        // rounded up so float noise in the splits never changes the texel size
+        radius = ceilf(radius * 16.0f) / 16.0f;
+        const sp_vec3_t center = {
+            camera_position.x + camera_forward.x * center_distance,
+            camera_position.y + camera_forward.y * center_distance,
+            camera_position.z + camera_forward.z * center_distance,
+        };
+
+        // snapping the light space center to texels moves the projection in whole texels only
+        const float texel_size = 2.0f * radius / (float)config->map_size;
+        const float center_x = floorf(vec3_dot(center, right) / texel_size + 0.5f) * texel_size;
+        const float center_y = floorf(vec3_dot(center, up) / texel_size + 0.5f) * texel_size;
+        const float center_z = vec3_dot(center, forward);
+        const float max_z = center_z + radius;
+        const float min_z = fminf(center_z - radius, scene_min_z);
+        const float inv_depth_range = 1.0f / (max_z - min_z);
+
+        const float inv_radius = 1.0f / radius;
+        cascade->view_projection = (sp_mat4x4_t){
+            .xx = right.x * inv_radius, .xy = up.x * inv_radius, .xz = forward.x * inv_depth_range,
+            .yx = right.y * inv_radius, .yy = up.y * inv_radius, .yz = forward.y * inv_depth_range,
+            .zx = right.z * inv_radius, .zy = up.z * inv_radius, .zz = forward.z * inv_depth_range,
+            .wx = -center_x * inv_radius, .wy = -center_y * inv_radius, .wz = -min_z * inv_depth_range, .ww = 1.0f,
+        };
+        sp_frustum_planes_from_matrix(cascade->frustum_planes, &cascade->view_projection);
+        cascade->sphere = (sp_vec4_t){ center.x, center.y, center.z, radius };
+        cascade->split_near = splits[i];
+        cascade->split_far = splits[i + 1];
+        cascade->texel_size = texel_size;
+        cascade->depth_bias = texel_size * inv_depth_range;
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "core/sapphire_types.h"
+#include "core/bvh.h"
+
+// Cascaded shadow maps for the directional light.
+//
+// The view frustum up to max_distance is split into num_cascades depth ranges with the practical split
+// scheme, a blend of logarithmic and uniform splits weighted by split_lambda. Each range gets an orthographic
+// projection along the light direction that covers the bounding sphere of its frustum slice. The sphere only
+// depends on the split distances and the field of view, and its center is snapped to whole shadow map texels
+// in a light space that doesn't move with the camera, so the cascades don't shimmer when the camera rotates
+// or moves. The projections reach back towards the light up to the scene bounds, anything between the light
+// and the receivers casts into the map.
+
+#define SHADOW_CASCADES_MAX 4
+
+typedef struct shadow_cascades_config_t
+{
+    uint32_t num_cascades;
+    // width and height of a cascade in texels
+    uint32_t map_size;
+    // 0 - uniform splits, 1 - logarithmic splits
+    float split_lambda;
+    // view depth the last cascade ends at, clamped to the far plane
+    float max_distance;
+} shadow_cascades_config_t;
+
+typedef struct shadow_cascade_t
+{
+    // world to shadow clip space (row vectors), x and y in -1..1, depth in 0..1
+    sp_mat4x4_t view_projection;
+    // planes of view_projection for culling the casters
+    sp_vec4_t frustum_planes[6];
+    // xyz center, w radius of the covered part of the view frustum
+    sp_vec4_t sphere;
+    // view depth range of the cascade
+    float split_near;
+    float split_far;
+    // world size of a shadow map texel
+    float texel_size;
+    // a texel in shadow map depth, the constant depth bias of the cascade
+    float depth_bias;
+} shadow_cascade_t;
+
+// split distances of the practical split scheme, splits holds num_cascades + 1 view depths from near_plane to far_plane
+void shadow_cascades_compute_splits(float near_plane, float far_plane, uint32_t num_cascades, float split_lambda, float* splits);
+
+// computes config->num_cascades cascades for a camera. view and projection are the (row vector) camera
+// matrices, the projection is a perspective projection. light_direction is the direction the light travels
+// in, scene_bounds the box of all the shadow casters
+void shadow_cascades_update(shadow_cascade_t* cascades, const shadow_cascades_config_t* config, const sp_mat4x4_t* view, const sp_mat4x4_t* projection,
+    float near_plane, float far_plane, sp_vec3_t light_direction, const sp_aabb_t* scene_bounds);
@@ -3,6 +3,7 @@
 #include "imgui/cimguizmo.h"
 
 #include <memory.h>
+#include <string.h>
 #include "RenderDevice.h"
 #include "SwapChain.h"
 #include "DeviceContext.h"
@@ -19,6 +20,8 @@
 #include "core/config.h"
 #include "core/allocator.h"
 #include "core/temp_allocator.h"
+#include "core/frame_allocator.h"
+#include "core/memory_tracker.h"
 #include "core/os.h"
 #include "core/murmurhash64a.h"
 #include "core/array.h"
@@ -27,12 +30,20 @@
 #include "core/sprintf.h"
 #include "sapphire_renderer.h"
 #include "scene.h"
+#include "asset_watcher.h"
+#include "world_partition.h"
+#include "input_replay.h"
+#include "font_system.h"
 
 void sapphire_render(IDeviceContext* pContext);
-void sapphire_init(IRenderDevice* p_device, ISwapChain* p_swap_chain);
+void sapphire_init(IRenderDevice* p_device, ISwapChain* p_swap_chain, IDeviceContext** pp_deferred_contexts, uint32_t num_deferred_contexts);
 void sapphire_destroy();
 void sapphire_window_resize(IRenderDevice* pDevice, ISwapChain* pSwapChain, uint32_t width, uint32_t height);
 void sapphire_update(double curr_time, double elapsed_time);
+bool sapphire_input_record(const char* file, uint32_t num_keys, double step_dt);
+double sapphire_input_replay(const char* file, uint32_t num_keys);
+bool sapphire_input_fixed_step(input_snapshot_t* p_snapshot);
+const char* sapphire_assets_root();
 
 
 
@@ -61,6 +72,66 @@ typedef struct viewer_t
 
 static viewer_t g_viewer;
 static rendering_context_t* g_rendering_context_o;
+static sp_scene_resources_t g_scene_resources;
+static sp_asset_watcher_o* g_asset_watcher;
+// set when the assets folder holds a partitioned world, the flat scene is not loaded then
+static world_streamer_o* g_world_streamer;
+
+static const char* s_assets_root = "C:/Programming/Sapphire/assets";
+// relative to s_assets_root
+static const char* s_materials_file = "materials.mat";
+static const char* s_scene_file = "test.scene";
+static const char* s_world_file = "test.world";
+// side of the world cells built from s_scene_file, in meters
+static const float s_world_cell_size = 32.0f;
+static const world_streamer_config_t s_world_config = {
+    .load_radius = 64.0f,
+    .unload_radius = 96.0f,
+    .memory_budget = 256ull * 1024 * 1024,
+    .max_mesh_loads_per_frame = 4,
+    .max_render_objects_per_frame = 512,
+};
+
+// per frame data, one arena per frame in flight
+#define FRAME_ARENA_SIZE (4 * 1024 * 1024)
+// per thread temporary data, large enough for the interleaved vertices of a big model
+#define SCRATCH_ARENA_SIZE (16 * 1024 * 1024)
+static uint64_t g_frame_index;
+
+// memory tracking scopes
+static sp_allocator_i* g_scene_allocator;
+static sp_allocator_i* g_world_allocator;
+// the asset watcher and the assets it loads
+static sp_allocator_i* g_hot_reload_allocator;
+static sp_allocator_i* g_input_replay_allocator;
+
+// fixed step input recording and replay, at most one of them is active
+static input_replay_o* g_input_recorder;
+static input_replay_o* g_input_player;
+
+// last picked object, 0 when nothing is selected
+static renderer_pick_result_t g_selection;
+
+// game ui hud in the top right corner. Its text is refreshed a few times a second, the ui is left unchanged and
+// costs no layout in between
+#define HUD_LINES 4
+#define HUD_WIDTH 320.0f
+#define HUD_MARGIN 10.0f
+#define HUD_PADDING 6.0f
+#define HUD_SPACING 2.0f
+#define HUD_REFRESH_SECONDS 0.25
+typedef struct hud_t
+{
+    bool created;
+    ui_widget_handle_t panel;
+    ui_widget_handle_t lines[HUD_LINES];
+    // since the last refresh
+    double time;
+    uint32_t frames;
+    float fill_ms_sum;
+    float ui_update_ms_max;
+} hud_t;
+static hud_t g_hud;
 
 
 
@@ -87,13 +158,300 @@ inline bool get_attribute_as_bool(sp_config_i* config, sp_config_item_t item, sp
 
 void sapphire_destroy()
 {
+    // the recording is written out here
+    if (g_input_recorder)
+        input_replay_destroy(g_input_recorder);
+    if (g_input_player)
+        input_replay_destroy(g_input_player);
+    g_input_recorder = NULL;
+    g_input_player = NULL;
+
+    asset_watcher_destroy(g_asset_watcher);
+    if (g_world_streamer)
+        world_streamer_destroy(g_world_streamer);
+    else
+        scene_unload_resources(&g_scene_resources);
     rendering_context_destroy(g_rendering_context_o);
-    
+    sp_frame_allocator_api->shutdown();
+
+    sp_memory_tracker_api->destroy_allocator(g_scene_allocator);
+    sp_memory_tracker_api->destroy_allocator(g_world_allocator);
+    sp_memory_tracker_api->destroy_allocator(g_hot_reload_allocator);
+    sp_memory_tracker_api->destroy_allocator(g_input_replay_allocator);
+    sp_memory_tracker_api->shutdown("memory_report.json");
 }
 
-void sapphire_update(double curr_time, double elapsed_time)
+// records the input of every fixed step to file, written when the engine shuts down
+bool sapphire_input_record(const char* file, uint32_t num_keys, double step_dt)
+{
+    g_input_recorder = input_recorder_create(file, num_keys, step_dt, g_input_replay_allocator);
+    return g_input_recorder != NULL;
+}
+
+// replaces the input of the fixed steps with a recording. Returns the step length the recording was made with, 0
+// if it can't be played
+double sapphire_input_replay(const char* file, uint32_t num_keys)
+{
+    g_input_player = input_player_create(file, num_keys, g_input_replay_allocator);
+    return g_input_player ? input_player_step_dt(g_input_player) : 0.0;
+}
+
+// input of the next fixed step: live input is recorded as is, a replay overwrites it. Returns false on the step
+// the replay ran out, live input is used from then on
+bool sapphire_input_fixed_step(input_snapshot_t* p_snapshot)
+{
+    if (g_input_player)
+    {
+        if (input_player_next_step(g_input_player, p_snapshot))
+            return true;
+        input_replay_destroy(g_input_player);
+        g_input_player = NULL;
+        return false;
+    }
+    if (g_input_recorder)
+        input_recorder_record_step(g_input_recorder, p_snapshot);
+    return true;
+}
+
+// splits the flat scene into the cells of world_path
+static bool build_world(const char* scene_path, const char* world_path)
+{
+    scene_def_t world_scene_def;
+    if (!scene_load(scene_path, &world_scene_def, g_world_allocator))
+        return false;
+    const bool res = world_partition_build(&world_scene_def, s_world_cell_size, world_path, g_world_allocator);
+    scene_free(&world_scene_def, g_world_allocator);
+    return res;
+}
+
+// folder the scene, materials and fonts are loaded from
+const char* sapphire_assets_root()
+{
+    return s_assets_root;
+}
+
+// selects the render object under a screen position, in pixels of a screen of size width x height. Returns the
+// identity of the selected object, 0 when nothing was hit
+uint64_t sapphire_select(float x, float y, float width, float height)
+{
+    const sp_vec2_t position = { x, y };
+    const sp_vec2_t size = { width, height };
+    if (!renderer_pick_screen(g_rendering_context_o, &g_viewer, position, size, &g_selection))
+        memset(&g_selection, 0, sizeof(g_selection));
+    return g_selection.identity;
+}
+
+// asset hot reload - runs on the watcher thread. Text files are parsed here, gpu resources are created and
+// everything that touches the renderer managers is left to the main thread
+static void hot_reload_load_asset(sp_asset_change_t* change, const char* full_path, void* user_data)
+{
+    sp_allocator_i* allocator = g_hot_reload_allocator;
+    switch (change->type)
+    {
+    case SP_ASSET_TYPE_MATERIALS:
+    {
+        sp_material_def_t* mat_defs_array = NULL;
+        if (load_materials(full_path, &mat_defs_array, allocator))
+            change->data = mat_defs_array;
+        else
+            sp_array_free(mat_defs_array, allocator);
+        break;
+    }
+    case SP_ASSET_TYPE_SCENE:
+    {
+        // the scene resources take over the reloaded scene data, so it is allocated on their allocator
+        scene_def_t* p_scene_def = sp_alloc(allocator, sizeof(scene_def_t));
+        memset(p_scene_def, 0, sizeof(scene_def_t));
+        if (scene_load_file(full_path, p_scene_def, g_scene_allocator))
+        {
+            // keep the compiled scene in sync with the edited text
+            char scenebin_file[SP_ASSET_PATH_LEN * 2];
+            sp_sprintf_api->print(scenebin_file, sizeof(scenebin_file), "%sbin", full_path);
+            scene_compile(p_scene_def, scenebin_file);
+            change->data = p_scene_def;
+        }
+        else
+        {
+            scene_free(p_scene_def, g_scene_allocator);
+            sp_free(allocator, p_scene_def, sizeof(scene_def_t));
+        }
+        break;
+    }
+    default:
+        // shaders are compiled, textures created and models uploaded on the main thread. Not every backend can
+        // create gpu resources from another thread
+        break;
+    }
+}
+
+// frees what hot_reload_load_asset loaded for a change that was never applied
+static void hot_reload_free_asset(sp_asset_change_t* change, void* user_data)
+{
+    sp_allocator_i* allocator = g_hot_reload_allocator;
+    switch (change->type)
+    {
+    case SP_ASSET_TYPE_MATERIALS:
+    {
+        sp_material_def_t* mat_defs_array = change->data;
+        sp_array_free(mat_defs_array, allocator);
+        break;
+    }
+    case SP_ASSET_TYPE_SCENE:
+        scene_free(change->data, g_scene_allocator);
+        sp_free(allocator, change->data, sizeof(scene_def_t));
+        break;
+    default:
+        break;
+    }
+    change->data = NULL;
+}
+
+// swaps in the assets loaded by the watcher thread, between frames
+static void hot_reload_apply_changes()
 {
+    sp_allocator_i* allocator = g_hot_reload_allocator;
+    IRenderDevice* p_device = g_rendering_context_o->p_device;
 
+    sp_asset_change_t changes[16];
+    uint32_t num_changes;
+    while ((num_changes = asset_watcher_poll(g_asset_watcher, changes, SP_ARRAY_COUNT(changes))) > 0)
+    {
+        for (uint32_t i = 0; i < num_changes; ++i)
+        {
+            sp_asset_change_t* change = &changes[i];
+            switch (change->type)
+            {
+            case SP_ASSET_TYPE_MATERIALS:
+            {
+                sp_material_def_t* mat_defs_array = change->data;
+                if (mat_defs_array && strcmp(change->path, s_materials_file) == 0)
+                    material_manager_reload_materials(&g_rendering_context_o->materials_manager, mat_defs_array);
+                sp_array_free(mat_defs_array, allocator);
+                break;
+            }
+            case SP_ASSET_TYPE_SCENE:
+            {
+                scene_def_t* p_scene_def = change->data;
+                if (!p_scene_def)
+                    break;
+                if (strcmp(change->path, s_scene_file) == 0)
+                {
+                    if (g_world_streamer)
+                    {
+                        // the cells are rebuilt from the edited scene and stream in again, the loader thread is
+                        // stopped before its cell files are rewritten
+                        char world_path[1024];
+                        sp_sprintf_api->print(world_path, sizeof(world_path), "%s/%s", s_assets_root, s_world_file);
+                        world_streamer_destroy(g_world_streamer);
+                        world_partition_build(p_scene_def, s_world_cell_size, world_path, g_world_allocator);
+                        g_world_streamer = world_streamer_create(world_path, s_assets_root, &s_world_config, g_rendering_context_o, p_device, g_world_allocator);
+                        // the world couldn't be written, the flat scene takes over the definition
+                        if (!g_world_streamer)
+                            scene_load_resources(s_assets_root, p_scene_def, p_device, &g_scene_resources, g_scene_allocator);
+                    }
+                    else
+                    {
+                        scene_reload_resources(s_assets_root, &g_scene_resources, p_scene_def, p_device, NULL);
+                    }
+                }
+                scene_free(p_scene_def, g_scene_allocator);
+                sp_free(allocator, p_scene_def, sizeof(scene_def_t));
+                break;
+            }
+            case SP_ASSET_TYPE_SHADER:
+                material_manager_reload_shaders(g_rendering_context_o);
+                break;
+            case SP_ASSET_TYPE_TEXTURE:
+            {
+                char texture_path[1024];
+                sp_sprintf_api->print(texture_path, sizeof(texture_path), "%s/%s", s_assets_root, change->path);
+                ITextureView* p_texture_view = renderer_create_texture_view_from_file(p_device, texture_path);
+                // textures that were never loaded are not used by anything. The replaced one is released once
+                // the frames in flight are done with it
+                if (p_texture_view && !textures_manager_replace_texture(g_rendering_context_o, change->path_hash, p_texture_view))
+                    IObject_Release(p_texture_view);
+                break;
+            }
+            case SP_ASSET_TYPE_MODEL:
+                if (g_world_streamer)
+                    world_streamer_reload_model(g_world_streamer, change->path);
+                else
+                    scene_reload_resources(s_assets_root, &g_scene_resources, NULL, p_device, change->path);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+static void hud_create(ui_context_t* ui)
+{
+    const float line_height = ui->font->line_height;
+    const float height = 2.0f * HUD_PADDING + HUD_LINES * line_height + (HUD_LINES - 1) * HUD_SPACING;
+    const ui_placement_t panel_placement = {
+        .anchor_min = { 1.0f, 0.0f },
+        .anchor_max = { 1.0f, 0.0f },
+        .offset_min = { -HUD_WIDTH - HUD_MARGIN, HUD_MARGIN },
+        .offset_max = { -HUD_MARGIN, HUD_MARGIN + height },
+    };
+    g_hud.panel = ui_create_panel(ui, SP_INVALID_HANDLE, &panel_placement, 0x000000A0);
+    ui_set_stack(ui, g_hud.panel, UI_STACK_VERTICAL, HUD_PADDING, HUD_SPACING);
+
+    const text_style_t style = { .scale = 1.0f, .spacing = 0.0f, .color = 0xFFFFFFFF, .align = TEXT_ALIGN_LEFT };
+    const ui_placement_t line_placement = { .anchor_min = { 0.0f, 0.0f }, .anchor_max = { 1.0f, 0.0f }, .offset_max = { 0.0f, line_height } };
+    for (uint32_t i = 0; i < HUD_LINES; ++i)
+        g_hud.lines[i] = ui_create_text(ui, g_hud.panel, &line_placement, "", &style);
+    g_hud.created = true;
+}
+
+// frame time, the cpu cost of the text and ui itself and the selection
+static void hud_update(double elapsed_time)
+{
+    ui_context_t* ui = font_get_ui();
+    if (!ui)
+        return;
+    if (!g_hud.created)
+        hud_create(ui);
+
+    // stats of the frame drawn last
+    const font_frame_stats_t font_stats = font_get_frame_stats();
+    g_hud.time += elapsed_time;
+    ++g_hud.frames;
+    g_hud.fill_ms_sum += font_stats.fill_ms;
+    g_hud.ui_update_ms_max = font_stats.ui_update_ms > g_hud.ui_update_ms_max ? font_stats.ui_update_ms : g_hud.ui_update_ms_max;
+    if (g_hud.time < HUD_REFRESH_SECONDS)
+        return;
+
+    char line[128];
+    const double frame_ms = g_hud.time * 1000.0 / g_hud.frames;
+    sp_sprintf_api->print(line, sizeof(line), "frame %.2f ms, %.0f fps", frame_ms, 1000.0 / frame_ms);
+    ui_set_text(ui, g_hud.lines[0], line);
+    sp_sprintf_api->print(line, sizeof(line), "text and ui cpu %.3f ms, ui update max %.3f ms", g_hud.fill_ms_sum / g_hud.frames, g_hud.ui_update_ms_max);
+    ui_set_text(ui, g_hud.lines[1], line);
+    sp_sprintf_api->print(line, sizeof(line), "%u ui quads, %u text quads", font_stats.num_ui_quads, font_stats.num_text_quads);
+    ui_set_text(ui, g_hud.lines[2], line);
+    if (g_selection.identity)
+        sp_sprintf_api->print(line, sizeof(line), "selected %llu at %.2f m", (unsigned long long)g_selection.identity, g_selection.distance);
+    else
+        sp_sprintf_api->print(line, sizeof(line), "selected none");
+    ui_set_text(ui, g_hud.lines[3], line);
+
+    g_hud.time = 0.0;
+    g_hud.frames = 0;
+    g_hud.fill_ms_sum = 0.0f;
+    g_hud.ui_update_ms_max = 0.0f;
+}
+
+void sapphire_update(double curr_time, double elapsed_time)
+{
+    sp_frame_allocator_api->begin_frame(g_frame_index++);
+    hot_reload_apply_changes();
+    if (g_world_streamer)
+        world_streamer_update(g_world_streamer, g_viewer.camera_transform.position);
+    else
+        scene_update_transforms(&g_scene_resources);
+    hud_update(elapsed_time);
 }
 
 
@@ -104,17 +462,23 @@ void sapphire_render(IDeviceContext* pContext)
 }
 
 
-void sapphire_init(IRenderDevice* p_device, ISwapChain* p_swap_chain)
+void sapphire_init(IRenderDevice* p_device, ISwapChain* p_swap_chain, IDeviceContext** pp_deferred_contexts, uint32_t num_deferred_contexts)
 {
     scene_def_t scene_def;
     memset(&scene_def, 0, sizeof(scene_def));
     sp_allocator_i* allocator = sp_allocator_api->system_allocator;
+    g_scene_allocator = sp_memory_tracker_api->create_allocator(allocator, "scene", SP_MEMORY_TRACKING_FLAGS);
+    g_world_allocator = sp_memory_tracker_api->create_allocator(allocator, "world streaming", SP_MEMORY_TRACKING_FLAGS);
+    g_hot_reload_allocator = sp_memory_tracker_api->create_allocator(allocator, "hot reload", SP_MEMORY_TRACKING_FLAGS);
+    g_input_replay_allocator = sp_memory_tracker_api->create_allocator(allocator, "input replay", SP_MEMORY_TRACKING_FLAGS);
 
-    
     SP_INIT_TEMP_ALLOCATOR_WITH_ADAPTER(ta, a);
 
-   
+    sp_frame_allocator_api->init(SP_FRAME_ALLOCATOR_MAX_FRAMES, FRAME_ARENA_SIZE, SCRATCH_ARENA_SIZE);
+    sp_frame_allocator_api->begin_frame(g_frame_index);
+
     g_rendering_context_o = rendering_context_create(p_device, p_swap_chain);
+    renderer_set_deferred_contexts(g_rendering_context_o, pp_deferred_contexts, num_deferred_contexts);
 
     g_viewer = (viewer_t){ .camera = {.near_plane = 0.1f, .far_plane = 100.f, .vertical_fov =  (SP_PI / 4.0f) } };
     viewer_t* viewer = &g_viewer;
@@ -133,17 +497,39 @@ void sapphire_init(IRenderDevice* p_device, ISwapChain* p_swap_chain)
 
 
     sp_material_def_t* mat_defs_array = NULL;
+    char file_path[1024];
     
     // load materials definitions from file    
-    load_materials("C:/Programming/Sapphire/assets/materials.mat" , &mat_defs_array, allocator);
+    sp_sprintf_api->print(file_path, sizeof(file_path), "%s/%s", s_assets_root, s_materials_file);
+    load_materials(file_path, &mat_defs_array, g_scene_allocator);
     // create GPU resources for materials
     material_manager_add_materials(&g_rendering_context_o->materials_manager, mat_defs_array);
 
-    sp_array_free(mat_defs_array, allocator);
+    sp_array_free(mat_defs_array, g_scene_allocator);
+
+    // the world is built from the flat scene when it is missing or older than the scene, the same way the compiled
+    // scene follows the text one
+    char scene_path[1024];
+    sp_sprintf_api->print(scene_path, sizeof(scene_path), "%s/%s", s_assets_root, s_scene_file);
+    sp_sprintf_api->print(file_path, sizeof(file_path), "%s/%s", s_assets_root, s_world_file);
+    const sp_file_stat_t scene_stat = sp_os_api->file_system->stat(scene_path);
+    const sp_file_stat_t world_stat = sp_os_api->file_system->stat(file_path);
+    const bool world_outdated = !world_stat.exists || world_stat.last_modified_time < scene_stat.last_modified_time;
+    if (scene_stat.exists && world_outdated)
+        build_world(scene_path, file_path);
+
+    g_world_streamer = world_streamer_create(file_path, s_assets_root, &s_world_config, g_rendering_context_o, p_device, g_world_allocator);
+    // a world written by an older version is rebuilt once
+    if (!g_world_streamer && scene_stat.exists && !world_outdated && build_world(scene_path, file_path))
+        g_world_streamer = world_streamer_create(file_path, s_assets_root, &s_world_config, g_rendering_context_o, p_device, g_world_allocator);
+    if (!g_world_streamer)
+    {
+        // the scene resources take over the scene definition
+        scene_load(scene_path, &scene_def, g_scene_allocator);
+        scene_load_resources(s_assets_root, &scene_def, p_device, &g_scene_resources, g_scene_allocator);
+    }
 
-    scene_load_file("C:/Programming/Sapphire/assets/test.scene", &scene_def, allocator);
-    scene_load_resources("C:/Programming/Sapphire/assets", &scene_def, p_device);
-    scene_free(&scene_def, allocator);
+    g_asset_watcher = asset_watcher_create(s_assets_root, hot_reload_load_asset, hot_reload_free_asset, NULL, g_hot_reload_allocator);
 
 #if 0
    
@@ -257,8 +643,62 @@ void sapphire_init(IRenderDevice* p_device, ISwapChain* p_swap_chain)
 
 
 
+static void memory_panel()
+{
+    sp_memory_scope_stats_t scopes[SP_MEMORY_TRACKER_MAX_SCOPES];
+    const uint32_t num_scopes = sp_memory_tracker_api->scopes(scopes, SP_ARRAY_COUNT(scopes));
+
+    im_Begin("Memory", NULL, 0);
+    im_Text("%-20s %12s %12s %10s %10s", "scope", "live (KB)", "peak (KB)", "live", "total");
+    im_Separator();
+    uint64_t total_live = 0;
+    for (uint32_t i = 0; i < num_scopes; ++i)
+    {
+        const sp_memory_scope_stats_t* stats = &scopes[i];
+        im_Text("%-20s %12.1f %12.1f %10llu %10llu", stats->name, stats->live_bytes / 1024.0, stats->peak_bytes / 1024.0,
+            (unsigned long long)stats->live_allocations, (unsigned long long)stats->total_allocations);
+        total_live += stats->live_bytes;
+    }
+    im_Separator();
+    im_Text("%-20s %12.1f", "total", total_live / 1024.0);
+
+    const sp_arena_stats_t frame_stats = sp_frame_allocator_api->frame_stats();
+    im_Text("frame arena: %.1f / %.1f KB, high water %.1f KB, overflow %u", frame_stats.used / 1024.0, frame_stats.capacity / 1024.0,
+        frame_stats.high_water / 1024.0, frame_stats.overflow_count);
+
+    ImVec2 size = { 0 };
+    if (im_Button("Dump JSON", size))
+        sp_memory_tracker_api->dump_json("memory_report.json");
+    im_End();
+}
+
+static void world_panel()
+{
+    im_Begin("World", NULL, 0);
+    if (g_world_streamer)
+    {
+        const world_streamer_stats_t stats = world_streamer_get_stats(g_world_streamer);
+        im_Text("cells: %u resident, %u adding, %u loading, %u failed, %u total", stats.num_resident, stats.num_loaded, stats.num_loading,
+            stats.num_failed, stats.num_cells);
+        im_Text("cell data: %.1f / %.1f MB", stats.memory_in_use / (1024.0 * 1024.0), stats.memory_budget / (1024.0 * 1024.0));
+    }
+    else
+    {
+        im_Text("no world, %s is loaded as a flat scene", s_scene_file);
+    }
+    im_Separator();
+    if (g_selection.identity)
+        im_Text("selected: %llu at %.2f m, triangle %u", (unsigned long long)g_selection.identity, g_selection.distance, g_selection.triangle);
+    else
+        im_Text("selected: none");
+    im_End();
+}
+
 void testcimgui()
 {
+    memory_panel();
+    world_panel();
+
 	//input_scheme_t is = {.scheme_id = "oferdklfjsd;fjs"};
 
     //sp_allocator_i* allocator = sp_allocator_api->system_allocator;
@@ -0,0 +1,583 @@
+#include "text_layout.h"
+
+#include "core/allocator.h"
+#include "core/array.h"
+#include "core/frame_allocator.h"
+#include "core/murmurhash64a.h"
+
+#include <memory.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEXT_LAYOUT_CACHE_NULL UINT32_MAX
+// longest link name that is told apart, longer ones are hashed truncated
+#define TEXT_LAYOUT_MAX_LINK_NAME 64
+
+typedef struct layout_quad_t
+{
+    uint32_t line;
+    sp_strhash_t link;
+} layout_quad_t;
+
+typedef struct layout_line_t
+{
+    uint32_t first_quad;
+    float width;
+} layout_line_t;
+
+void font_init(sp_font_t* font, sp_allocator_i* allocator)
+{
+    memset(font, 0, sizeof(sp_font_t));
+    for (uint32_t i = 0; i < FONT_ASCII_GLYPHS; ++i)
+        font->ascii_glyphs[i] = FONT_NO_GLYPH;
+    font->glyph_lookup.allocator = allocator;
+}
+
+void font_destroy(sp_font_t* font, sp_allocator_i* allocator)
+{
+    sp_array_free(font->glyphs_arr, allocator);
+    sp_array_free(font->kernings_arr, allocator);
+    sp_hash_free(&font->glyph_lookup);
+}
+
+void font_add_glyph(sp_font_t* font, const sp_font_glyph_t* glyph, sp_allocator_i* allocator)
+{
+    const uint32_t glyph_index = (uint32_t)sp_array_size(font->glyphs_arr);
+    if (glyph->code < FONT_ASCII_GLYPHS)
+        font->ascii_glyphs[glyph->code] = glyph_index;
+    else
+        sp_hash_add(&font->glyph_lookup, glyph->code, glyph_index);
+    sp_array_push(font->glyphs_arr, *glyph, allocator);
+}
+
+void font_add_kerning(sp_font_t* font, uint32_t first, uint32_t second, float amount, sp_allocator_i* allocator)
+{
+    if (amount == 0.0f)
+        return;
+    sp_array_push(font->kernings_arr, ((sp_font_kerning_t){ .pair = ((uint64_t)first << 32) | second, .amount = amount }), allocator);
+}
+
+static int compare_kernings(const void* a, const void* b)
+{
+    const uint64_t pa = ((const sp_font_kerning_t*)a)->pair;
+    const uint64_t pb = ((const sp_font_kerning_t*)b)->pair;
+    return (pa > pb) - (pa < pb);
+}
+
+void font_finalize(sp_font_t* font)
+{
+    if (font->kernings_arr)
+        qsort(font->kernings_arr, sp_array_size(font->kernings_arr), sizeof(sp_font_kerning_t), compare_kernings);
+}
+
+const sp_font_glyph_t* font_find_glyph(const sp_font_t* font, uint32_t code)
+{
+    uint32_t index = FONT_NO_GLYPH;
+    if (code < FONT_ASCII_GLYPHS)
+        index = font->ascii_glyphs[code];
+    else
+        index = sp_hash_get_default(&font->glyph_lookup, code, FONT_NO_GLYPH);
+    return index == FONT_NO_GLYPH ? NULL : &font->glyphs_arr[index];
+}
+
+// code points the font has no glyph for show its replacement character, or '?'
+static const sp_font_glyph_t* find_glyph_or_fallback(const sp_font_t* font, uint32_t code)
+{
+    const sp_font_glyph_t* glyph = font_find_glyph(font, code);
+    if (!glyph)
+        glyph = font_find_glyph(font, FONT_REPLACEMENT_CHARACTER);
+    if (!glyph)
+        glyph = font_find_glyph(font, '?');
+    return glyph;
+}
+
+float font_get_kerning(const sp_font_t* font, uint32_t first, uint32_t second)
+{
+    const uint64_t pair = ((uint64_t)first << 32) | second;
+    const uint32_t num_kernings = (uint32_t)sp_array_size(font->kernings_arr);
+    uint32_t lo = 0;
+    uint32_t hi = num_kernings;
+    while (lo < hi)
+    {
+        const uint32_t mid = (lo + hi) / 2;
+        if (font->kernings_arr[mid].pair < pair)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < num_kernings && font->kernings_arr[lo].pair == pair ? font->kernings_arr[lo].amount : 0.0f;
+}
+
+uint32_t text_decode_utf8(const char** str)
+{
+    const uint8_t* s = (const uint8_t*)*str;
+    uint32_t code = s[0];
+    uint32_t length;
+    uint32_t min_code;
+    if (code < 0x80)
+    {
+        *str += 1;
+        return code;
+    }
+    else if ((code & 0xE0) == 0xC0)
+    {
+        length = 2;
+        code &= 0x1F;
+        min_code = 0x80;
+    }
+    else if ((code & 0xF0) == 0xE0)
+    {
+        length = 3;
+        code &= 0x0F;
+        min_code = 0x800;
+    }
+    else if ((code & 0xF8) == 0xF0)
+    {
+        length = 4;
+        code &= 0x07;
+        min_code = 0x10000;
+    }
+    else
+    {
+        *str += 1;
+        return FONT_REPLACEMENT_CHARACTER;
+    }
+
+    for (uint32_t i = 1; i < length; ++i)
+    {
+        if ((s[i] & 0xC0) != 0x80)
+        {
+            *str += 1;
+            return FONT_REPLACEMENT_CHARACTER;
+        }
+        code = (code << 6) | (s[i] & 0x3F);
+    }
+    if (code < min_code || code > 0x10FFFF || (code >= 0xD800 && code < 0xE000))
+    {
+        *str += 1;
+        return FONT_REPLACEMENT_CHARACTER;
+    }
+    *str += length;
+    return code;
+}
+
+uint32_t font_vertex_color(uint32_t rgba)
+{
+    return (rgba >> 24) | ((rgba >> 8) & 0xFF00) | ((rgba << 8) & 0xFF0000) | (rgba << 24);
+}
+
+static bool parse_hex_color(const char* s, uint32_t* color)
+{
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < 8; ++i)
+    {
+        const char c = s[i];
+        uint32_t digit;
+        if (c >= '0' && c <= '9')
+            digit = (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f')
+            digit = (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            digit = (uint32_t)(c - 'A' + 10);
+        else
+            return false;
+        value = (value << 4) | digit;
+    }
+    *color = value;
+    return true;
+}
+
+// consumes a markup tag at *p_str, which points at '['. Anything that isn't a known tag is text
+static bool parse_tag(const char** p_str, uint32_t* colors, uint32_t* num_colors, sp_strhash_t* link)
+{
+    const char* tag = *p_str + 1;
+    const char* end = strchr(tag, ']');
+    if (!end)
+        return false;
+    const uint32_t length = (uint32_t)(end - tag);
+
+    uint32_t color;
+    if (length == 10 && strncmp(tag, "c=", 2) == 0 && parse_hex_color(tag + 2, &color))
+    {
+        if (*num_colors < TEXT_LAYOUT_MAX_COLOR_SPANS)
+            colors[(*num_colors)++] = color;
+    }
+    else if (length == 2 && strncmp(tag, "/c", 2) == 0)
+    {
+        // the style colour is never popped
+        if (*num_colors > 1)
+            --*num_colors;
+    }
+    else if (length > 5 && strncmp(tag, "link=", 5) == 0)
+    {
+        char name[TEXT_LAYOUT_MAX_LINK_NAME];
+        const uint32_t name_length = length - 5 < TEXT_LAYOUT_MAX_LINK_NAME - 1 ? length - 5 : TEXT_LAYOUT_MAX_LINK_NAME - 1;
+        memcpy(name, tag + 5, name_length);
+        name[name_length] = 0;
+        *link = sp_murmur_hash_string(name);
+    }
+    else if (length == 5 && strncmp(tag, "/link", 5) == 0)
+    {
+        *link = 0;
+    }
+    else
+    {
+        return false;
+    }
+    *p_str = end + 1;
+    return true;
+}
+
+static void shift_quads(font_vertex_t* vertices, uint32_t first_quad, uint32_t end_quad, float dx, float dy)
+{
+    for (uint32_t v = first_quad * 4; v < end_quad * 4; ++v)
+    {
+        vertices[v].pos.x += dx;
+        vertices[v].pos.y += dy;
+    }
+}
+
+void text_layout(const sp_font_t* font, const char* str, float max_width, const text_style_t* style, text_layout_t* layout, sp_allocator_i* allocator)
+{
+    memset(layout, 0, sizeof(text_layout_t));
+    SP_INIT_SCRATCH_ALLOCATOR(scratch);
+    layout_quad_t* quads_arr = NULL;
+    layout_line_t* lines_arr = NULL;
+
+    const float scale = style->scale;
+    const float line_height = font->line_height * scale;
+    uint32_t colors[TEXT_LAYOUT_MAX_COLOR_SPANS] = { style->color };
+    uint32_t num_colors = 1;
+    sp_strhash_t link = 0;
+
+    float pen_x = 0.0f;
+    uint32_t line = 0;
+    uint32_t line_first_quad = 0;
+    uint32_t prev_code = 0;
+    // the last space of the line: the line width before it, and where the word after it starts
+    bool has_break = false;
+    bool after_space = false;
+    float break_width = 0.0f;
+    float word_start_x = 0.0f;
+    uint32_t word_first_quad = 0;
+
+    const char* s = str;
+    while (*s)
+    {
+        uint32_t code;
+        if (s[0] == '[' && s[1] == '[')
+        {
+            code = '[';
+            s += 2;
+        }
+        else if (s[0] == '[' && parse_tag(&s, colors, &num_colors, &link))
+        {
+            continue;
+        }
+        else
+        {
+            code = text_decode_utf8(&s);
+        }
+
+        if (code == '\n')
+        {
+            sp_array_push(lines_arr, ((layout_line_t){ .first_quad = line_first_quad, .width = after_space ? break_width : pen_x }), scratch);
+            ++line;
+            pen_x = 0.0f;
+            line_first_quad = (uint32_t)sp_array_size(quads_arr);
+            has_break = false;
+            after_space = false;
+            prev_code = 0;
+            continue;
+        }
+
+        const sp_font_glyph_t* glyph = find_glyph_or_fallback(font, code);
+        if (!glyph)
+            continue;
+        float kerning = prev_code ? font_get_kerning(font, prev_code, glyph->code) * scale : 0.0f;
+        prev_code = glyph->code;
+
+        if (code == ' ')
+        {
+            if (!after_space)
+                break_width = pen_x;
+            pen_x += kerning + glyph->x_advance * scale + style->spacing;
+            word_start_x = pen_x;
+            word_first_quad = (uint32_t)sp_array_size(quads_arr);
+            has_break = true;
+            after_space = true;
+            continue;
+        }
+        after_space = false;
+
+        // glyphs without a bitmap only advance
+        const bool visible = glyph->width > 0.0f && glyph->height > 0.0f;
+        const uint32_t num_quads = (uint32_t)sp_array_size(quads_arr);
+        if (max_width > 0.0f && visible && num_quads > line_first_quad && pen_x + kerning + (glyph->x_top + glyph->width) * scale > max_width)
+        {
+            if (has_break)
+            {
+                // the word moves to the next line
+                sp_array_push(lines_arr, ((layout_line_t){ .first_quad = line_first_quad, .width = break_width }), scratch);
+                shift_quads(layout->vertices_arr, word_first_quad, num_quads, -word_start_x, line_height);
+                for (uint32_t q = word_first_quad; q < num_quads; ++q)
+                    quads_arr[q].line = line + 1;
+                pen_x -= word_start_x;
+                line_first_quad = word_first_quad;
+            }
+            else
+            {
+                // a word longer than the line breaks before this glyph
+                sp_array_push(lines_arr, ((layout_line_t){ .first_quad = line_first_quad, .width = pen_x }), scratch);
+                pen_x = 0.0f;
+                kerning = 0.0f;
+                line_first_quad = num_quads;
+            }
+            ++line;
+            has_break = false;
+        }
+
+        pen_x += kerning;
+        if (visible)
+        {
+            const float x0 = pen_x + glyph->x_top * scale;
+            const float y0 = line * line_height + glyph->y_top * scale;
+            const float x1 = x0 + glyph->width * scale;
+            const float y1 = y0 + glyph->height * scale;
+            const uint32_t color = font_vertex_color(colors[num_colors - 1]);
+            sp_array_push(layout->vertices_arr, ((font_vertex_t){ .pos = { x0, y0 }, .uv = { glyph->u0, glyph->v0 }, .color = color }), allocator);
+            sp_array_push(layout->vertices_arr, ((font_vertex_t){ .pos = { x1, y0 }, .uv = { glyph->u1, glyph->v0 }, .color = color }), allocator);
+            sp_array_push(layout->vertices_arr, ((font_vertex_t){ .pos = { x0, y1 }, .uv = { glyph->u0, glyph->v1 }, .color = color }), allocator);
+            sp_array_push(layout->vertices_arr, ((font_vertex_t){ .pos = { x1, y1 }, .uv = { glyph->u1, glyph->v1 }, .color = color }), allocator);
+            sp_array_push(quads_arr, ((layout_quad_t){ .line = line, .link = link }), scratch);
+        }
+        pen_x += glyph->x_advance * scale + style->spacing;
+    }
+    sp_array_push(lines_arr, ((layout_line_t){ .first_quad = line_first_quad, .width = after_space ? break_width : pen_x }), scratch);
+
+    const uint32_t num_lines = (uint32_t)sp_array_size(lines_arr);
+    const uint32_t num_quads = (uint32_t)sp_array_size(quads_arr);
+    float widest = 0.0f;
+    for (uint32_t l = 0; l < num_lines; ++l)
+        widest = lines_arr[l].width > widest ? lines_arr[l].width : widest;
+
+    if (style->align != TEXT_ALIGN_LEFT)
+    {
+        const float box_width = max_width > 0.0f ? max_width : widest;
+        const float factor = style->align == TEXT_ALIGN_CENTER ? 0.5f : 1.0f;
+        for (uint32_t l = 0; l < num_lines; ++l)
+        {
+            const uint32_t end_quad = l + 1 < num_lines ? lines_arr[l + 1].first_quad : num_quads;
+            shift_quads(layout->vertices_arr, lines_arr[l].first_quad, end_quad, (box_width - lines_arr[l].width) * factor, 0.0f);
+        }
+    }
+
+    // consecutive quads of a link on the same line make one rect, the spaces between them included
+    for (uint32_t q = 0; q < num_quads; ++q)
+    {
+        const sp_strhash_t quad_link = quads_arr[q].link;
+        if (!quad_link)
+            continue;
+        const float x0 = layout->vertices_arr[q * 4].pos.x;
+        const float x1 = layout->vertices_arr[q * 4 + 1].pos.x;
+        if (q > 0 && quads_arr[q - 1].link == quad_link && quads_arr[q - 1].line == quads_arr[q].line)
+        {
+            text_link_rect_t* rect = &layout->links_arr[sp_array_size(layout->links_arr) - 1];
+            rect->x1 = x1 > rect->x1 ? x1 : rect->x1;
+            continue;
+        }
+        const float y0 = quads_arr[q].line * line_height;
+        sp_array_push(layout->links_arr, ((text_link_rect_t){ .link = quad_link, .x0 = x0, .y0 = y0, .x1 = x1, .y1 = y0 + line_height }), allocator);
+    }
+
+    layout->width = widest;
+    layout->height = num_lines * line_height;
+    layout->num_lines = num_lines;
+    SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+}
+
+void text_layout_free(text_layout_t* layout, sp_allocator_i* allocator)
+{
+    sp_array_free(layout->vertices_arr, allocator);
+    sp_array_free(layout->links_arr, allocator);
+    memset(layout, 0, sizeof(text_layout_t));
+}
+
+sp_strhash_t text_layout_hit_link(const text_layout_t* layout, float x, float y)
+{
+    const uint32_t num_links = (uint32_t)sp_array_size(layout->links_arr);
+    for (uint32_t i = 0; i < num_links; ++i)
+    {
+        const text_link_rect_t* rect = &layout->links_arr[i];
+        if (x >= rect->x0 && x < rect->x1 && y >= rect->y0 && y < rect->y1)
+            return rect->link;
+    }
+    return 0;
+}
+
+static uint64_t hash_combine(uint64_t hash, uint64_t value)
+{
+    return hash ^ (value + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2));
+}
+
+static uint64_t float_bits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static uint64_t layout_key(uint32_t font_id, const char* str, float max_width, const text_style_t* style)
+{
+    uint64_t key = sp_murmur_hash_string(str);
+    key = hash_combine(key, font_id);
+    key = hash_combine(key, float_bits(max_width));
+    key = hash_combine(key, float_bits(style->scale));
+    key = hash_combine(key, float_bits(style->spacing));
+    key = hash_combine(key, ((uint64_t)style->color << 32) | (uint32_t)style->align);
+    return key;
+}
+
+static bool entry_matches(const text_layout_cache_entry_t* entry, uint32_t font_id, const char* str, uint64_t str_size, float max_width, const text_style_t* style)
+{
+    // floats compare by bits like they are hashed
+    return entry->font_id == font_id && entry->str_size == str_size &&
+        float_bits(entry->max_width) == float_bits(max_width) &&
+        float_bits(entry->style.scale) == float_bits(style->scale) &&
+        float_bits(entry->style.spacing) == float_bits(style->spacing) &&
+        entry->style.color == style->color && entry->style.align == style->align &&
+        memcmp(entry->str, str, str_size) == 0;
+}
+
+static void free_entry(text_layout_cache_t* cache, text_layout_cache_entry_t* entry)
+{
+    text_layout_free(&entry->layout, cache->allocator);
+    sp_free(cache->allocator, entry->str, entry->str_size);
+    entry->str = NULL;
+}
+
+static void reset_cache_entries(text_layout_cache_t* cache)
+{
+    memset(cache->buckets, 0xFF, sizeof(uint32_t) * cache->num_buckets);
+    for (uint32_t i = 0; i < cache->max_entries; ++i)
+        cache->entries[i].next_in_bucket = i + 1 < cache->max_entries ? i + 1 : TEXT_LAYOUT_CACHE_NULL;
+    cache->free_head = 0;
+    cache->lru_head = TEXT_LAYOUT_CACHE_NULL;
+    cache->lru_tail = TEXT_LAYOUT_CACHE_NULL;
+    cache->num_entries = 0;
+    cache->num_vertices = 0;
+}
+
+void text_layout_cache_init(text_layout_cache_t* cache, uint32_t max_entries, uint32_t max_vertices, sp_allocator_i* allocator)
+{
+    memset(cache, 0, sizeof(text_layout_cache_t));
+    cache->allocator = allocator;
+    cache->max_entries = max_entries;
+    cache->max_vertices = max_vertices;
+    cache->num_buckets = 1;
+    while (cache->num_buckets < max_entries * 2)
+        cache->num_buckets *= 2;
+    cache->entries = sp_alloc(allocator, sizeof(text_layout_cache_entry_t) * max_entries);
+    memset(cache->entries, 0, sizeof(text_layout_cache_entry_t) * max_entries);
+    cache->buckets = sp_alloc(allocator, sizeof(uint32_t) * cache->num_buckets);
+    reset_cache_entries(cache);
+}
+
+void text_layout_cache_destroy(text_layout_cache_t* cache)
+{
+    text_layout_cache_clear(cache);
+    sp_free(cache->allocator, cache->entries, sizeof(text_layout_cache_entry_t) * cache->max_entries);
+    sp_free(cache->allocator, cache->buckets, sizeof(uint32_t) * cache->num_buckets);
+    cache->entries = NULL;
+    cache->buckets = NULL;
+}
+
+void text_layout_cache_clear(text_layout_cache_t* cache)
+{
+    for (uint32_t e = cache->lru_head; e != TEXT_LAYOUT_CACHE_NULL; e = cache->entries[e].next)
+        free_entry(cache, &cache->entries[e]);
+    reset_cache_entries(cache);
+}
+
+static void lru_unlink(text_layout_cache_t* cache, uint32_t e)
+{
+    text_layout_cache_entry_t* entry = &cache->entries[e];
+    if (entry->prev != TEXT_LAYOUT_CACHE_NULL)
+        cache->entries[entry->prev].next = entry->next;
+    else
+        cache->lru_head = entry->next;
+    if (entry->next != TEXT_LAYOUT_CACHE_NULL)
+        cache->entries[entry->next].prev = entry->prev;
+    else
+        cache->lru_tail = entry->prev;
+}
+
+static void lru_push_front(text_layout_cache_t* cache, uint32_t e)
+{
+    text_layout_cache_entry_t* entry = &cache->entries[e];
+    entry->prev = TEXT_LAYOUT_CACHE_NULL;
+    entry->next = cache->lru_head;
+    if (cache->lru_head != TEXT_LAYOUT_CACHE_NULL)
+        cache->entries[cache->lru_head].prev = e;
+    else
+        cache->lru_tail = e;
+    cache->lru_head = e;
+}
+
+static void evict_entry(text_layout_cache_t* cache, uint32_t e)
+{
+    text_layout_cache_entry_t* entry = &cache->entries[e];
+    uint32_t* link = &cache->buckets[entry->key & (cache->num_buckets - 1)];
+    while (*link != e)
+        link = &cache->entries[*link].next_in_bucket;
+    *link = entry->next_in_bucket;
+    lru_unlink(cache, e);
+
+    cache->num_vertices -= (uint32_t)sp_array_size(entry->layout.vertices_arr);
+    --cache->num_entries;
+    free_entry(cache, entry);
+    entry->next_in_bucket = cache->free_head;
+    cache->free_head = e;
+}
+
+const text_layout_t* text_layout_cache_get(text_layout_cache_t* cache, const sp_font_t* font, uint32_t font_id, const char* str, float max_width, const text_style_t* style)
+{
+    const uint64_t key = layout_key(font_id, str, max_width, style);
+    const uint64_t str_size = strlen(str) + 1;
+    const uint32_t bucket = (uint32_t)(key & (cache->num_buckets - 1));
+    for (uint32_t e = cache->buckets[bucket]; e != TEXT_LAYOUT_CACHE_NULL; e = cache->entries[e].next_in_bucket)
+    {
+        if (cache->entries[e].key != key || !entry_matches(&cache->entries[e], font_id, str, str_size, max_width, style))
+            continue;
+        ++cache->num_hits;
+        lru_unlink(cache, e);
+        lru_push_front(cache, e);
+        return &cache->entries[e].layout;
+    }
+
+    ++cache->num_misses;
+    text_layout_t layout;
+    text_layout(font, str, max_width, style, &layout, cache->allocator);
+    const uint32_t num_vertices = (uint32_t)sp_array_size(layout.vertices_arr);
+    // a layout bigger than the whole budget still gets in, alone
+    while (cache->lru_tail != TEXT_LAYOUT_CACHE_NULL && (cache->free_head == TEXT_LAYOUT_CACHE_NULL || cache->num_vertices + num_vertices > cache->max_vertices))
+        evict_entry(cache, cache->lru_tail);
+
+    const uint32_t e = cache->free_head;
+    text_layout_cache_entry_t* entry = &cache->entries[e];
+    cache->free_head = entry->next_in_bucket;
+    entry->key = key;
+    entry->str = sp_alloc(cache->allocator, str_size);
+    memcpy(entry->str, str, str_size);
+    entry->str_size = str_size;
+    entry->font_id = font_id;
+    entry->max_width = max_width;
+    entry->style = *style;
+    entry->layout = layout;
+    entry->next_in_bucket = cache->buckets[bucket];
+    cache->buckets[bucket] = e;
+    lru_push_front(cache, e);
+    cache->num_vertices += num_vertices;
+    ++cache->num_entries;
+    return &entry->layout;
+}
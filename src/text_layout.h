@@ -0,0 +1,165 @@
+#pragma once
+
+#include "core/sapphire_types.h"
+#include "core/hash.h"
+
+typedef struct sp_allocator_i sp_allocator_i;
+
+// Text layout of bitmap fonts.
+//
+// Strings are utf-8 with inline markup:
+//   [c=RRGGBBAA]...[/c]   colour span, spans nest up to TEXT_LAYOUT_MAX_COLOR_SPANS deep
+//   [link=name]...[/link] link span, its hit rects are reported per line with the hash of name
+//   [[                    a literal '['
+// Lines break at '\n' and, with a max width, at the last space before the line overflows. A word longer than
+// the line breaks between glyphs. Lines are aligned inside the max width, or the widest line without one.
+//
+// The layout is in pixels with its origin at the top left of the first line, y down. Laying out is the costly
+// part of drawing text, text_layout_cache_t keeps the layouts of recently drawn strings so unchanged text is
+// only copied.
+
+#define FONT_ASCII_GLYPHS 128
+#define FONT_NO_GLYPH UINT32_MAX
+#define FONT_REPLACEMENT_CHARACTER 0xFFFD
+#define TEXT_LAYOUT_MAX_COLOR_SPANS 8
+
+typedef struct font_vertex_t
+{
+    sp_vec2_t pos;
+    sp_vec2_t uv;
+    // r in the lowest byte
+    uint32_t color;
+} font_vertex_t;
+
+typedef struct font_glyph_t
+{
+    uint32_t code;
+    float u0, u1, v0, v1; // texture coordinates
+    float x_advance;
+    float x_top, y_top;
+    float width; //?
+    float height; //?
+} sp_font_glyph_t;
+
+typedef struct sp_font_kerning_t
+{
+    // first code point << 32 | second code point
+    uint64_t pair;
+    float amount;
+} sp_font_kerning_t;
+
+typedef struct sp_font_t
+{
+    sp_font_glyph_t* glyphs_arr;
+    // index in glyphs_arr of the ascii code points, FONT_NO_GLYPH when the font doesn't have them
+    uint32_t ascii_glyphs[FONT_ASCII_GLYPHS];
+    // code point to index in glyphs_arr of the code points from FONT_ASCII_GLYPHS on
+    struct SP_HASH_T(uint64_t, uint32_t) glyph_lookup;
+    // sorted by pair, binary searched
+    sp_font_kerning_t* kernings_arr;
+    float           ascender;
+    float           descender;
+    float           line_height;
+} sp_font_t;
+
+typedef enum text_align_t
+{
+    TEXT_ALIGN_LEFT,
+    TEXT_ALIGN_CENTER,
+    TEXT_ALIGN_RIGHT,
+} text_align_t;
+
+typedef struct text_style_t
+{
+    float scale;
+    // added to the advance of every glyph
+    float spacing;
+    // 0xRRGGBBAA, colour outside of colour spans
+    uint32_t color;
+    text_align_t align;
+} text_style_t;
+
+typedef struct text_link_rect_t
+{
+    sp_strhash_t link;
+    float x0, y0, x1, y1;
+} text_link_rect_t;
+
+typedef struct text_layout_t
+{
+    // 4 vertices per glyph quad: top left, top right, bottom left, bottom right
+    font_vertex_t* vertices_arr;
+    text_link_rect_t* links_arr;
+    // of the widest line
+    float width;
+    float height;
+    uint32_t num_lines;
+} text_layout_t;
+
+void font_init(sp_font_t* font, sp_allocator_i* allocator);
+void font_destroy(sp_font_t* font, sp_allocator_i* allocator);
+// glyphs and kernings are added in any order, font_finalize sorts the kernings
+void font_add_glyph(sp_font_t* font, const sp_font_glyph_t* glyph, sp_allocator_i* allocator);
+void font_add_kerning(sp_font_t* font, uint32_t first, uint32_t second, float amount, sp_allocator_i* allocator);
+void font_finalize(sp_font_t* font);
+
+const sp_font_glyph_t* font_find_glyph(const sp_font_t* font, uint32_t code);
+float font_get_kerning(const sp_font_t* font, uint32_t first, uint32_t second);
+
+// 0xRRGGBBAA to the byte order of font_vertex_t::color
+uint32_t font_vertex_color(uint32_t rgba);
+
+// next code point of a utf-8 string. A byte that doesn't start a valid sequence (overlong, surrogate, truncated
+// by the terminator) decodes to FONT_REPLACEMENT_CHARACTER and is skipped alone
+uint32_t text_decode_utf8(const char** str);
+
+// max_width 0 doesn't wrap. The layout arrays are allocated from allocator, text_layout_free releases them
+void text_layout(const sp_font_t* font, const char* str, float max_width, const text_style_t* style, text_layout_t* layout, sp_allocator_i* allocator);
+void text_layout_free(text_layout_t* layout, sp_allocator_i* allocator);
+// link under a point relative to the layout origin, 0 when there is none
+sp_strhash_t text_layout_hit_link(const text_layout_t* layout, float x, float y);
+
+// LRU cache of layouts keyed by string, font, max width and style. Layouts are evicted least recently used
+// first once the cache holds max_entries layouts or max_vertices vertices.
+typedef struct text_layout_cache_entry_t
+{
+    uint64_t key;
+    // what the key was hashed from, a hit compares it so colliding keys don't share a layout. str is an owned
+    // copy, str_size counts the terminator
+    char* str;
+    uint64_t str_size;
+    uint32_t font_id;
+    float max_width;
+    text_style_t style;
+    text_layout_t layout;
+    // LRU list, head is the most recently used
+    uint32_t prev;
+    uint32_t next;
+    // next entry of the same bucket
+    uint32_t next_in_bucket;
+} text_layout_cache_entry_t;
+
+typedef struct text_layout_cache_t
+{
+    sp_allocator_i* allocator;
+    text_layout_cache_entry_t* entries;
+    uint32_t max_entries;
+    uint32_t num_entries;
+    uint32_t max_vertices;
+    uint32_t num_vertices;
+    // power of two, first entry of each bucket
+    uint32_t* buckets;
+    uint32_t num_buckets;
+    uint32_t lru_head;
+    uint32_t lru_tail;
+    // unused entries, linked through next_in_bucket
+    uint32_t free_head;
+    uint32_t num_hits;
+    uint32_t num_misses;
+} text_layout_cache_t;
+
+void text_layout_cache_init(text_layout_cache_t* cache, uint32_t max_entries, uint32_t max_vertices, sp_allocator_i* allocator);
+void text_layout_cache_destroy(text_layout_cache_t* cache);
+void text_layout_cache_clear(text_layout_cache_t* cache);
+// font_id tells fonts apart in the key. The layout stays valid until the next call
+const text_layout_t* text_layout_cache_get(text_layout_cache_t* cache, const sp_font_t* font, uint32_t font_id, const char* str, float max_width, const text_style_t* style);
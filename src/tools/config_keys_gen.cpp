@@ -0,0 +1,82 @@
+// Generates config_keys.h from config_keys.inl: one SP_KEY_<ID> hash constant per config key, so loaders
+// don't hash key names at runtime.
+//
+// Runs as a build step and fails the build when two keys have the same hash, or when the constexpr hash of
+// SP_KEY() disagrees with sp_murmur_hash_string().
+//
+// usage: SapphireConfigKeysGen <output header>
+
+extern "C" {
+#include "../core/sapphire_types.h"
+#include "../core/murmurhash64a.h"
+}
+#include "../core/murmurhash64a.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+typedef struct config_key_t
+{
+    const char* id;
+    const char* key;
+    sp_strhash_t hash;
+    sp_strhash_t constexpr_hash;
+} config_key_t;
+
+static const config_key_t s_keys[] = {
+#define SP_CONFIG_KEY(ID, KEY) { #ID, KEY, 0, sp_murmur_hash_string_constexpr(KEY) },
+#include "../config_keys.inl"
+#undef SP_CONFIG_KEY
+};
+
+int main(int argc, char** argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <output header>\n", argv[0]);
+        return 1;
+    }
+
+    const uint32_t num_keys = (uint32_t)SP_ARRAY_COUNT(s_keys);
+    config_key_t keys[SP_ARRAY_COUNT(s_keys)];
+    memcpy(keys, s_keys, sizeof(keys));
+
+    bool valid = true;
+    for (uint32_t i = 0; i < num_keys; ++i)
+    {
+        keys[i].hash = sp_murmur_hash_string(keys[i].key);
+        if (keys[i].hash != keys[i].constexpr_hash)
+        {
+            fprintf(stderr, "config_keys: SP_KEY(\"%s\") differs from sp_murmur_hash_string()\n", keys[i].key);
+            valid = false;
+        }
+        for (uint32_t j = 0; j < i; ++j)
+        {
+            if (!strcmp(keys[i].id, keys[j].id))
+            {
+                fprintf(stderr, "config_keys: SP_KEY_%s is declared twice\n", keys[i].id);
+                valid = false;
+            }
+            else if (keys[i].hash == keys[j].hash)
+            {
+                fprintf(stderr, "config_keys: hash collision between \"%s\" and \"%s\"\n", keys[i].key, keys[j].key);
+                valid = false;
+            }
+        }
+    }
+    if (!valid)
+        return 1;
+
+    FILE* f = fopen(argv[1], "w");
+    if (!f)
+    {
+        fprintf(stderr, "config_keys: can't write %s\n", argv[1]);
+        return 1;
+    }
+    fprintf(f, "#pragma once\n\n");
+    fprintf(f, "// generated from config_keys.inl by SapphireConfigKeysGen, don't edit\n\n");
+    for (uint32_t i = 0; i < num_keys; ++i)
+        fprintf(f, "#define SP_KEY_%s 0x%016llxULL // \"%s\"\n", keys[i].id, (unsigned long long)keys[i].hash, keys[i].key);
+    const bool res = fclose(f) == 0;
+    return res ? 0 : 1;
+}
@@ -0,0 +1,327 @@
+#include "transform_system.h"
+
+#include "core/allocator.h"
+#include "core/array.h"
+#include "core/frame_allocator.h"
+#include "core/sapphire_math.h"
+
+#include <memory.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define TRANSFORM_SIMD_SSE 1
+#include <xmmintrin.h>
+#else
+#define TRANSFORM_SIMD_SSE 0
+#endif
+
+// res = lhs * rhs, res must not alias the inputs
+static void mat4x4_mul(sp_mat4x4_t* res, const sp_mat4x4_t* lhs, const sp_mat4x4_t* rhs)
+{
+#if TRANSFORM_SIMD_SSE
+    const float* a = &lhs->xx;
+    const float* b = &rhs->xx;
+    float* r = &res->xx;
+    const __m128 b0 = _mm_loadu_ps(b);
+    const __m128 b1 = _mm_loadu_ps(b + 4);
+    const __m128 b2 = _mm_loadu_ps(b + 8);
+    const __m128 b3 = _mm_loadu_ps(b + 12);
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        __m128 row = _mm_mul_ps(_mm_set1_ps(a[4 * i]), b0);
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[4 * i + 1]), b1));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[4 * i + 2]), b2));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[4 * i + 3]), b3));
+        _mm_storeu_ps(r + 4 * i, row);
+    }
+#else
+    sp_mat4x4_mul(res, lhs, rhs);
+#endif
+}
+
+static uint32_t num_nodes(const transform_system_t* system)
+{
+    return (uint32_t)sp_array_size(system->handles_arr);
+}
+
+static uint32_t node_index(const transform_system_t* system, sp_transform_handle_t handle)
+{
+    return system->slot_to_node_arr[sp_handle_index(handle)];
+}
+
+static void mark_dirty(transform_system_t* system, uint32_t node)
+{
+    system->dirty_arr[node] = 1;
+    if (system->first_dirty == TRANSFORM_NO_NODE || node < system->first_dirty)
+        system->first_dirty = node;
+}
+
+static void set_num_nodes(transform_system_t* system, uint32_t count)
+{
+    if (!system->handles_arr)
+        return;
+    sp_array_header(system->handles_arr)->size = count;
+    sp_array_header(system->parents_arr)->size = count;
+    sp_array_header(system->positions_arr)->size = count;
+    sp_array_header(system->rotations_arr)->size = count;
+    sp_array_header(system->scales_arr)->size = count;
+    sp_array_header(system->worlds_arr)->size = count;
+    sp_array_header(system->user_data_arr)->size = count;
+    sp_array_header(system->dirty_arr)->size = count;
+}
+
+// moves the element first + i of an array to first + remap[i], for i < count
+static void permute(void* arr, uint64_t element_size, uint32_t first, uint32_t count, const uint32_t* remap, sp_allocator_i* scratch)
+{
+    uint8_t* base = (uint8_t*)arr;
+    uint8_t* copy = sp_alloc(scratch, count * element_size);
+    memcpy(copy, base + first * element_size, count * element_size);
+    for (uint32_t i = 0; i < count; ++i)
+        memcpy(base + ((uint64_t)first + remap[i]) * element_size, copy + i * element_size, element_size);
+}
+
+#define PERMUTE(arr) permute((arr), sizeof(*(arr)), root, count, remap, scratch)
+
+// moves the subtree of root behind all other nodes. Both parts keep their relative order, so parents still
+// come before their children. Returns the new index of root
+static uint32_t move_subtree_to_end(transform_system_t* system, uint32_t root)
+{
+    const uint32_t n = num_nodes(system);
+    const uint32_t count = n - root;
+    SP_INIT_SCRATCH_ALLOCATOR(scratch);
+
+    // descendants come after root and their parent is in the subtree
+    uint8_t* in_subtree = sp_alloc(scratch, count);
+    uint32_t subtree_size = 0;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const uint32_t parent = system->parents_arr[root + i];
+        in_subtree[i] = i == 0 || (parent != TRANSFORM_NO_NODE && parent >= root && in_subtree[parent - root]);
+        subtree_size += in_subtree[i];
+    }
+
+    // remap[i] is the new index of node root + i
+    uint32_t* remap = sp_alloc(scratch, count * sizeof(uint32_t));
+    uint32_t next_outside = 0;
+    uint32_t next_inside = count - subtree_size;
+    for (uint32_t i = 0; i < count; ++i)
+        remap[i] = in_subtree[i] ? next_inside++ : next_outside++;
+
+    PERMUTE(system->handles_arr);
+    PERMUTE(system->parents_arr);
+    PERMUTE(system->positions_arr);
+    PERMUTE(system->rotations_arr);
+    PERMUTE(system->scales_arr);
+    PERMUTE(system->worlds_arr);
+    PERMUTE(system->user_data_arr);
+    PERMUTE(system->dirty_arr);
+
+    // nodes before root never have a parent at or after it
+    for (uint32_t i = root; i < n; ++i)
+    {
+        const uint32_t parent = system->parents_arr[i];
+        if (parent != TRANSFORM_NO_NODE && parent >= root)
+            system->parents_arr[i] = root + remap[parent - root];
+        system->slot_to_node_arr[sp_handle_index(system->handles_arr[i])] = i;
+    }
+
+    SP_SHUTDOWN_SCRATCH_ALLOCATOR(scratch);
+
+    // dirty nodes may have moved down to root
+    if (system->first_dirty != TRANSFORM_NO_NODE && system->first_dirty > root)
+        system->first_dirty = root;
+    if (system->changed_arr)
+        sp_array_header(system->changed_arr)->size = 0;
+    return n - subtree_size;
+}
+
+void transform_system_init(transform_system_t* system, sp_allocator_i* allocator)
+{
+    memset(system, 0, sizeof(transform_system_t));
+    system->allocator = allocator;
+    system->first_dirty = TRANSFORM_NO_NODE;
+    sp_handle_table_init(&system->table, allocator);
+}
+
+void transform_system_destroy(transform_system_t* system)
+{
+    sp_allocator_i* allocator = system->allocator;
+    sp_handle_table_destroy(&system->table);
+    sp_array_free(system->slot_to_node_arr, allocator);
+    sp_array_free(system->handles_arr, allocator);
+    sp_array_free(system->parents_arr, allocator);
+    sp_array_free(system->positions_arr, allocator);
+    sp_array_free(system->rotations_arr, allocator);
+    sp_array_free(system->scales_arr, allocator);
+    sp_array_free(system->worlds_arr, allocator);
+    sp_array_free(system->user_data_arr, allocator);
+    sp_array_free(system->dirty_arr, allocator);
+    sp_array_free(system->changed_arr, allocator);
+    system->first_dirty = TRANSFORM_NO_NODE;
+}
+
+void transform_system_clear(transform_system_t* system)
+{
+    // handles are released one by one so stale ones don't validate once their slot is reused
+    const uint32_t n = num_nodes(system);
+    for (uint32_t i = 0; i < n; ++i)
+        sp_handle_table_release(&system->table, system->handles_arr[i]);
+    set_num_nodes(system, 0);
+    if (system->changed_arr)
+        sp_array_header(system->changed_arr)->size = 0;
+    system->first_dirty = TRANSFORM_NO_NODE;
+}
+
+// world is the node's world matrix if the caller already knows it, NULL to compute it in the next update
+static sp_transform_handle_t create_node(transform_system_t* system, sp_transform_handle_t parent, const sp_transform_t* local, const sp_mat4x4_t* world, uint32_t user_data)
+{
+    uint32_t parent_node = TRANSFORM_NO_NODE;
+    if (parent != SP_INVALID_HANDLE)
+    {
+        if (!transform_system_valid(system, parent))
+            return SP_INVALID_HANDLE;
+        parent_node = node_index(system, parent);
+    }
+
+    sp_allocator_i* allocator = system->allocator;
+    sp_transform_handle_t handle = sp_handle_table_alloc(&system->table);
+    const uint32_t slot = sp_handle_index(handle);
+    const uint32_t node = num_nodes(system);
+    while (sp_array_size(system->slot_to_node_arr) <= slot)
+    {
+        uint32_t no_node = TRANSFORM_NO_NODE;
+        sp_array_push(system->slot_to_node_arr, no_node, allocator);
+    }
+    system->slot_to_node_arr[slot] = node;
+
+    // the parent already exists, so appending keeps parents before their children
+    sp_mat4x4_t initial_world = world ? *world : (sp_mat4x4_t){0};
+    uint8_t dirty = 0;
+    sp_array_push(system->handles_arr, handle, allocator);
+    sp_array_push(system->parents_arr, parent_node, allocator);
+    sp_array_push(system->positions_arr, local->position, allocator);
+    sp_array_push(system->rotations_arr, local->rotation, allocator);
+    sp_array_push(system->scales_arr, local->scale, allocator);
+    sp_array_push(system->worlds_arr, initial_world, allocator);
+    sp_array_push(system->user_data_arr, user_data, allocator);
+    sp_array_push(system->dirty_arr, dirty, allocator);
+    if (!world)
+        mark_dirty(system, node);
+    return handle;
+}
+
+sp_transform_handle_t transform_system_create(transform_system_t* system, sp_transform_handle_t parent, const sp_transform_t* local, uint32_t user_data)
+{
+    return create_node(system, parent, local, NULL, user_data);
+}
+
+sp_transform_handle_t transform_system_create_placed(transform_system_t* system, sp_transform_handle_t parent, const sp_transform_t* local, const sp_mat4x4_t* world, uint32_t user_data)
+{
+    return create_node(system, parent, local, world, user_data);
+}
+
+void transform_system_remove(transform_system_t* system, sp_transform_handle_t handle)
+{
+    if (!transform_system_valid(system, handle))
+        return;
+
+    const uint32_t first = move_subtree_to_end(system, node_index(system, handle));
+    const uint32_t n = num_nodes(system);
+    for (uint32_t i = first; i < n; ++i)
+        sp_handle_table_release(&system->table, system->handles_arr[i]);
+    set_num_nodes(system, first);
+}
+
+bool transform_system_valid(const transform_system_t* system, sp_transform_handle_t handle)
+{
+    return sp_handle_table_valid(&system->table, handle);
+}
+
+void transform_system_set_local(transform_system_t* system, sp_transform_handle_t handle, const sp_transform_t* local)
+{
+    if (!transform_system_valid(system, handle))
+        return;
+    const uint32_t node = node_index(system, handle);
+    system->positions_arr[node] = local->position;
+    system->rotations_arr[node] = local->rotation;
+    system->scales_arr[node] = local->scale;
+    mark_dirty(system, node);
+}
+
+sp_transform_t transform_system_get_local(const transform_system_t* system, sp_transform_handle_t handle)
+{
+    const uint32_t node = node_index(system, handle);
+    return (sp_transform_t){
+        .position = system->positions_arr[node],
+        .rotation = system->rotations_arr[node],
+        .scale = system->scales_arr[node],
+    };
+}
+
+bool transform_system_set_parent(transform_system_t* system, sp_transform_handle_t handle, sp_transform_handle_t parent)
+{
+    if (!transform_system_valid(system, handle) || (parent != SP_INVALID_HANDLE && !transform_system_valid(system, parent)))
+        return false;
+
+    uint32_t node = node_index(system, handle);
+    uint32_t parent_node = parent != SP_INVALID_HANDLE ? node_index(system, parent) : TRANSFORM_NO_NODE;
+    if (parent_node != TRANSFORM_NO_NODE && parent_node >= node)
+    {
+        // a parent after the node may be one of its descendants, ancestors always have lower indices
+        for (uint32_t p = parent_node; p != TRANSFORM_NO_NODE && p >= node; p = system->parents_arr[p])
+        {
+            if (p == node)
+                return false;
+        }
+        node = move_subtree_to_end(system, node);
+        parent_node = node_index(system, parent);
+    }
+
+    system->parents_arr[node] = parent_node;
+    mark_dirty(system, node);
+    return true;
+}
+
+const sp_mat4x4_t* transform_system_world(const transform_system_t* system, sp_transform_handle_t handle)
+{
+    return &system->worlds_arr[node_index(system, handle)];
+}
+
+uint32_t transform_system_update(transform_system_t* system)
+{
+    if (system->changed_arr)
+        sp_array_header(system->changed_arr)->size = 0;
+    if (system->first_dirty == TRANSFORM_NO_NODE)
+        return 0;
+
+    // parents come first, so a dirty parent is already marked and recomputed when its children are reached.
+    // Flags are cleared after the pass for that reason
+    const uint32_t n = num_nodes(system);
+    for (uint32_t i = system->first_dirty; i < n; ++i)
+    {
+        const uint32_t parent = system->parents_arr[i];
+        if (!system->dirty_arr[i])
+        {
+            if (parent == TRANSFORM_NO_NODE || !system->dirty_arr[parent])
+                continue;
+            system->dirty_arr[i] = 1;
+        }
+
+        if (parent == TRANSFORM_NO_NODE)
+        {
+            sp_mat4x4_from_translation_quaternion_scale(&system->worlds_arr[i], system->positions_arr[i], system->rotations_arr[i], system->scales_arr[i]);
+        }
+        else
+        {
+            sp_mat4x4_t local;
+            sp_mat4x4_from_translation_quaternion_scale(&local, system->positions_arr[i], system->rotations_arr[i], system->scales_arr[i]);
+            mat4x4_mul(&system->worlds_arr[i], &local, &system->worlds_arr[parent]);
+        }
+        sp_array_push(system->changed_arr, i, system->allocator);
+    }
+
+    const uint32_t num_changed = (uint32_t)sp_array_size(system->changed_arr);
+    for (uint32_t i = 0; i < num_changed; ++i)
+        system->dirty_arr[system->changed_arr[i]] = 0;
+    system->first_dirty = TRANSFORM_NO_NODE;
+    return num_changed;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "core/sapphire_types.h"
+#include "core/handle_table.h"
+
+// Transform hierarchy.
+//
+// Nodes are stored SoA and sorted so that a parent always comes before its children, which lets
+// transform_system_update() compute world matrices in a single linear pass: by the time a node is reached
+// its parent's world matrix is final. Setting a local transform only marks the node dirty, the update pass
+// starts at the first dirty node and only recomputes dirty nodes and their descendants.
+//
+// Creating a node appends it, which keeps the order since the parent already exists. Removing a node (with
+// its subtree) or attaching it to a parent that comes after it moves the subtree to the end, that is O(n)
+// and meant for edits, not for every frame.
+
+typedef uint32_t sp_transform_handle_t;
+
+// node index that refers to no node
+#define TRANSFORM_NO_NODE UINT32_MAX
+
+typedef struct transform_system_t
+{
+    sp_allocator_i* allocator;
+    // slot allocation and generations, the dense order of the handle table is not used
+    sp_handle_table_t table;
+    // slot -> node index
+    uint32_t* slot_to_node_arr;
+
+    // nodes, SoA sorted parents first
+    sp_transform_handle_t* handles_arr;
+    // node index of the parent, TRANSFORM_NO_NODE for roots
+    uint32_t* parents_arr;
+    sp_vec3_t* positions_arr;
+    // quaternions
+    sp_vec4_t* rotations_arr;
+    sp_vec3_t* scales_arr;
+    sp_mat4x4_t* worlds_arr;
+    // set by the owner of the node, e.g. the render object the world matrix is copied to
+    uint32_t* user_data_arr;
+    uint8_t* dirty_arr;
+
+    // lowest dirty node index, TRANSFORM_NO_NODE when nothing is dirty
+    uint32_t first_dirty;
+    // node indices whose world matrix changed in the last update, valid until the hierarchy changes
+    uint32_t* changed_arr;
+} transform_system_t;
+
+void transform_system_init(transform_system_t* system, sp_allocator_i* allocator);
+void transform_system_destroy(transform_system_t* system);
+// removes all nodes
+void transform_system_clear(transform_system_t* system);
+
+// parent is SP_INVALID_HANDLE for a root node
+sp_transform_handle_t transform_system_create(transform_system_t* system, sp_transform_handle_t parent, const sp_transform_t* local, uint32_t user_data);
+// creates a node whose world matrix is already known, e.g. an object placed from a loaded scene. The node isn't
+// dirty, so it shows up in changed_arr only once it is moved
+sp_transform_handle_t transform_system_create_placed(transform_system_t* system, sp_transform_handle_t parent, const sp_transform_t* local, const sp_mat4x4_t* world, uint32_t user_data);
+// removes the node and all its descendants
+void transform_system_remove(transform_system_t* system, sp_transform_handle_t handle);
+bool transform_system_valid(const transform_system_t* system, sp_transform_handle_t handle);
+
+void transform_system_set_local(transform_system_t* system, sp_transform_handle_t handle, const sp_transform_t* local);
+sp_transform_t transform_system_get_local(const transform_system_t* system, sp_transform_handle_t handle);
+// attaches the node to a new parent, SP_INVALID_HANDLE detaches it. Returns false if the parent is the node
+// or one of its descendants
+bool transform_system_set_parent(transform_system_t* system, sp_transform_handle_t handle, sp_transform_handle_t parent);
+
+// world matrix as of the last update
+const sp_mat4x4_t* transform_system_world(const transform_system_t* system, sp_transform_handle_t handle);
+
+// recomputes the world matrices of dirty nodes and their descendants, fills changed_arr and returns its size
+uint32_t transform_system_update(transform_system_t* system);
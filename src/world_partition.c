@@ -0,0 +1,733 @@
+#include "world_partition.h"
+
+#include "core/allocator.h"
+#include "core/array.h"
+#include "core/hash.h"
+#include "core/os.h"
+#include "core/sapphire_math.h"
+#include "core/sprintf.h"
+#include "core/thread.h"
+#include "scene.h"
+#include "sapphire_renderer.h"
+
+#include <math.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WORLD_PATH_LEN 1024
+
+// cells coordinates are biased so negative cells never produce the reserved hash keys
+static uint64_t cell_key(int32_t x, int32_t z)
+{
+    return ((uint64_t)((uint32_t)x + 0x80000000u) << 32) | ((uint32_t)z + 0x80000000u);
+}
+
+static void cell_file_path(char* buffer, uint32_t size, const char* world_file, int32_t x, int32_t z)
+{
+    sp_sprintf_api->print(buffer, size, "%s_%d_%d.scenebin", world_file, x, z);
+}
+
+typedef struct build_cell_t
+{
+    int32_t x;
+    int32_t z;
+    uint32_t* instances_arr;
+} build_cell_t;
+
+bool world_partition_build(const scene_def_t* p_scene_def, float cell_size, const char* world_file, sp_allocator_i* allocator)
+{
+    // bucket instances by cell
+    build_cell_t* cells_arr = NULL;
+    struct SP_HASH_T(uint64_t, uint32_t) cell_lookup = {.allocator = allocator};
+    for (uint32_t i = 0; i < p_scene_def->num_instances; ++i)
+    {
+        sp_vec3_t position = p_scene_def->instance_positions[i];
+        int32_t x = (int32_t)floorf(position.x / cell_size);
+        int32_t z = (int32_t)floorf(position.z / cell_size);
+        uint64_t key = cell_key(x, z);
+        if (!sp_hash_has(&cell_lookup, key))
+        {
+            build_cell_t cell = { .x = x, .z = z };
+            sp_hash_add(&cell_lookup, key, (uint32_t)sp_array_size(cells_arr));
+            sp_array_push(cells_arr, cell, allocator);
+        }
+        build_cell_t* cell = &cells_arr[sp_hash_get(&cell_lookup, key)];
+        sp_array_push(cell->instances_arr, i, allocator);
+    }
+    sp_hash_free(&cell_lookup);
+
+    struct SP_HASH_T(sp_strhash_t, uint32_t) entity_lookup = {.allocator = allocator};
+    for (uint32_t i = 0; i < p_scene_def->num_entities; ++i)
+    {
+        sp_hash_add(&entity_lookup, p_scene_def->entities_def[i].entity_hash, i);
+    }
+
+    const uint32_t num_cells = (uint32_t)sp_array_size(cells_arr);
+    world_cell_desc_t* cell_descs_arr = NULL;
+    uint32_t* instance_ids_arr = NULL;
+    uint32_t* cell_entities_arr = NULL;
+    struct SP_HASH_T(sp_strhash_t, uint32_t) cell_entity_lookup = {.allocator = allocator};
+    char cell_file[WORLD_PATH_LEN];
+    bool res = true;
+
+    for (uint32_t cell_idx = 0; cell_idx < num_cells; ++cell_idx)
+    {
+        build_cell_t* cell = &cells_arr[cell_idx];
+        const uint32_t num_instances = (uint32_t)sp_array_size(cell->instances_arr);
+
+        // entities used by the cell
+        if (cell_entities_arr)
+            sp_array_header(cell_entities_arr)->size = 0;
+        for (uint32_t i = 0; i < num_instances; ++i)
+        {
+            sp_strhash_t entity_hash = p_scene_def->instance_entity_hashes[cell->instances_arr[i]];
+            if (!sp_hash_has(&cell_entity_lookup, entity_hash) && sp_hash_has(&entity_lookup, entity_hash))
+            {
+                sp_hash_add(&cell_entity_lookup, entity_hash, 1);
+                sp_array_push(cell_entities_arr, sp_hash_get(&entity_lookup, entity_hash), allocator);
+            }
+        }
+        sp_hash_free(&cell_entity_lookup);
+        cell_entity_lookup.allocator = allocator;
+
+        const uint32_t num_entities = (uint32_t)sp_array_size(cell_entities_arr);
+        scene_def_t cell_def;
+        scene_create(&cell_def, num_entities, num_instances, allocator);
+        for (uint32_t i = 0; i < num_entities; ++i)
+        {
+            cell_def.entities_def[i] = p_scene_def->entities_def[cell_entities_arr[i]];
+        }
+        for (uint32_t i = 0; i < num_instances; ++i)
+        {
+            uint32_t src = cell->instances_arr[i];
+            cell_def.instance_entity_hashes[i] = p_scene_def->instance_entity_hashes[src];
+            cell_def.instance_positions[i] = p_scene_def->instance_positions[src];
+            cell_def.instance_rotations[i] = p_scene_def->instance_rotations[src];
+            cell_def.instance_scales[i] = p_scene_def->instance_scales[src];
+            cell_def.instance_world_matrices[i] = p_scene_def->instance_world_matrices[src];
+            sp_array_push(instance_ids_arr, src, allocator);
+        }
+
+        cell_file_path(cell_file, sizeof(cell_file), world_file, cell->x, cell->z);
+        res = scene_compile(&cell_def, cell_file) && res;
+
+        world_cell_desc_t desc = { .x = cell->x, .z = cell->z, .num_instances = num_instances, .num_entities = num_entities, .data_size = cell_def.data_size };
+        sp_array_push(cell_descs_arr, desc, allocator);
+
+        scene_free(&cell_def, allocator);
+        sp_array_free(cell->instances_arr, allocator);
+    }
+
+    world_header_t header = { .magic = WORLD_MAGIC, .version = WORLD_VERSION, .cell_size = cell_size, .num_cells = num_cells };
+    struct sp_os_file_io_api* io = sp_os_api->file_io;
+    sp_file_o f = io->open_output(world_file);
+    if (f.valid)
+    {
+        res = io->write(f, &header, sizeof(header)) && res;
+        res = io->write(f, cell_descs_arr, num_cells * sizeof(world_cell_desc_t)) && res;
+        res = io->write(f, instance_ids_arr, sp_array_size(instance_ids_arr) * sizeof(uint32_t)) && res;
+        io->close(f);
+    }
+    else
+    {
+        res = false;
+    }
+
+    sp_hash_free(&entity_lookup);
+    sp_array_free(cell_entities_arr, allocator);
+    sp_array_free(cell_descs_arr, allocator);
+    sp_array_free(instance_ids_arr, allocator);
+    sp_array_free(cells_arr, allocator);
+    return res;
+}
+
+enum world_cell_state
+{
+    WORLD_CELL_UNLOADED,
+    // waiting in the load queue
+    WORLD_CELL_QUEUED,
+    // being read by the loader thread
+    WORLD_CELL_LOADING,
+    // moved out of range while being read, the loader thread frees the data
+    WORLD_CELL_CANCELLED,
+    // data read, render objects not added yet
+    WORLD_CELL_LOADED,
+    // render objects being added or all added
+    WORLD_CELL_RESIDENT,
+    // the cell file failed to load, never retried
+    WORLD_CELL_FAILED,
+};
+
+// model file of an entity, read and parsed by the loader thread
+typedef struct world_cell_model_t
+{
+    // NULL for predefined shapes and files that failed to read
+    uint8_t* stream;
+    uint64_t stream_size;
+    sapphire_mesh_gpu_load_t load_data;
+} world_cell_model_t;
+
+typedef struct world_cell_t
+{
+    world_cell_desc_t desc;
+    // scene instance index of the first cell instance in world_streamer_o::instance_ids
+    uint32_t first_instance_id;
+    // guarded by the streamer lock until the cell is resident
+    uint32_t state;
+    float distance;
+    scene_def_t scene_def;
+    // one per entity, freed once the cell meshes are created
+    world_cell_model_t* models;
+    // a model changed on disk while the cell was being read, the loader drops what it read
+    bool reload;
+    // bytes of the models read for the cell, they stay counted once uploaded since the meshes hold as much
+    uint64_t models_size;
+
+    // main thread only
+    // one per entity of the cell, the cell holds a reference to each mesh
+    sp_mesh_handle_t* entity_meshes_arr;
+    sp_render_handle_t* render_objects_arr;
+    uint32_t num_added_instances;
+} world_cell_t;
+
+struct world_streamer_o
+{
+    sp_allocator_i* allocator;
+    char world_file[WORLD_PATH_LEN];
+    char root_path[WORLD_PATH_LEN];
+    world_streamer_config_t config;
+    rendering_context_t* p_rendering_context;
+    IRenderDevice* p_device;
+
+    float cell_size;
+    uint32_t num_cells;
+    world_cell_t* cells;
+    // scene instance index of every cell instance, cell after cell. Picking identities match the flat scene
+    uint32_t num_instance_ids;
+    uint32_t* instance_ids;
+
+    // last loaded mesh of each entity. Meshes are kept alive by the cells using them, so an entry may be stale -
+    // the generational handle no longer validates and the mesh is loaded again
+    struct SP_HASH_T(sp_strhash_t, sp_mesh_handle_t) entity_meshes;
+
+    // guarded by lock
+    sp_mutex_t lock;
+    uint32_t* load_queue_arr;
+    uint64_t memory_in_use;
+    bool quit;
+
+    sp_semaphore_t load_requests;
+    sp_thread_t loader_thread;
+};
+
+// bytes the cell counts against the memory budget
+static uint64_t cell_memory(const world_cell_t* cell)
+{
+    return cell->desc.data_size + cell->models_size;
+}
+
+static void free_cell_models(world_streamer_o* streamer, world_cell_t* cell)
+{
+    if (!cell->models)
+        return;
+    for (uint32_t i = 0; i < cell->scene_def.num_entities; ++i)
+    {
+        if (cell->models[i].stream)
+            sp_free(streamer->allocator, cell->models[i].stream, cell->models[i].stream_size);
+    }
+    sp_free(streamer->allocator, cell->models, cell->scene_def.num_entities * sizeof(world_cell_model_t));
+    cell->models = NULL;
+}
+
+// reads and parses the model files of the cell entities, the main thread only uploads them. A model shared with a
+// resident cell is read again here and dropped when the cell is added
+static world_cell_model_t* read_cell_models(world_streamer_o* streamer, const scene_def_t* scene_def)
+{
+    if (!scene_def->num_entities)
+        return NULL;
+    world_cell_model_t* models = sp_alloc(streamer->allocator, scene_def->num_entities * sizeof(world_cell_model_t));
+    memset(models, 0, scene_def->num_entities * sizeof(world_cell_model_t));
+    for (uint32_t i = 0; i < scene_def->num_entities; ++i)
+    {
+        world_cell_model_t* model = &models[i];
+        scene_read_entity_model(streamer->root_path, &scene_def->entities_def[i], &model->load_data, &model->stream, &model->stream_size, streamer->allocator);
+    }
+    return models;
+}
+
+static void loader_thread(void* user_data)
+{
+    world_streamer_o* streamer = user_data;
+    char cell_file[WORLD_PATH_LEN];
+
+    while (true)
+    {
+        sp_semaphore_wait(&streamer->load_requests);
+
+        sp_mutex_lock(&streamer->lock);
+        if (streamer->quit)
+        {
+            sp_mutex_unlock(&streamer->lock);
+            break;
+        }
+        // distances are refreshed every frame, take the nearest request
+        uint32_t num_requests = (uint32_t)sp_array_size(streamer->load_queue_arr);
+        if (!num_requests)
+        {
+            sp_mutex_unlock(&streamer->lock);
+            continue;
+        }
+        uint32_t nearest = 0;
+        for (uint32_t i = 1; i < num_requests; ++i)
+        {
+            if (streamer->cells[streamer->load_queue_arr[i]].distance < streamer->cells[streamer->load_queue_arr[nearest]].distance)
+                nearest = i;
+        }
+        world_cell_t* cell = &streamer->cells[streamer->load_queue_arr[nearest]];
+        streamer->load_queue_arr[nearest] = streamer->load_queue_arr[num_requests - 1];
+        sp_array_header(streamer->load_queue_arr)->size = num_requests - 1;
+        cell->state = WORLD_CELL_LOADING;
+        sp_mutex_unlock(&streamer->lock);
+
+        scene_def_t scene_def;
+        cell_file_path(cell_file, sizeof(cell_file), streamer->world_file, cell->desc.x, cell->desc.z);
+        bool loaded = scene_load_compiled(cell_file, &scene_def, streamer->allocator);
+        world_cell_model_t* models = loaded ? read_cell_models(streamer, &scene_def) : NULL;
+
+        sp_mutex_lock(&streamer->lock);
+        bool cancelled = cell->state == WORLD_CELL_CANCELLED || cell->reload;
+        cell->reload = false;
+        if (cancelled || !loaded)
+        {
+            cell->state = loaded ? WORLD_CELL_UNLOADED : WORLD_CELL_FAILED;
+            streamer->memory_in_use -= cell_memory(cell);
+            cell->models_size = 0;
+        }
+        else
+        {
+            cell->scene_def = scene_def;
+            cell->models = models;
+            cell->state = WORLD_CELL_LOADED;
+            // only known once read, a cell may take the memory in use past the budget until it is unloaded
+            for (uint32_t i = 0; models && i < scene_def.num_entities; ++i)
+                cell->models_size += models[i].stream_size;
+            streamer->memory_in_use += cell->models_size;
+        }
+        sp_mutex_unlock(&streamer->lock);
+
+        if (cancelled && loaded)
+        {
+            world_cell_t cancelled_cell = { .scene_def = scene_def, .models = models };
+            free_cell_models(streamer, &cancelled_cell);
+            scene_free(&scene_def, streamer->allocator);
+        }
+    }
+}
+
+world_streamer_o* world_streamer_create(const char* world_file, const char* root_path, const world_streamer_config_t* config, rendering_context_t* p_rendering_context, IRenderDevice* p_device, sp_allocator_i* allocator)
+{
+    struct sp_os_file_io_api* io = sp_os_api->file_io;
+    sp_file_o f = io->open_input(world_file);
+    if (!f.valid)
+        return NULL;
+
+    world_header_t header;
+    if (io->read(f, &header, sizeof(header)) != sizeof(header) || header.magic != WORLD_MAGIC || header.version != WORLD_VERSION)
+    {
+        io->close(f);
+        return NULL;
+    }
+
+    world_streamer_o* streamer = sp_alloc(allocator, sizeof(world_streamer_o));
+    memset(streamer, 0, sizeof(world_streamer_o));
+    streamer->allocator = allocator;
+    streamer->config = *config;
+    streamer->p_rendering_context = p_rendering_context;
+    streamer->p_device = p_device;
+    streamer->cell_size = header.cell_size;
+    streamer->num_cells = header.num_cells;
+    streamer->entity_meshes.allocator = allocator;
+    sp_sprintf_api->print(streamer->world_file, sizeof(streamer->world_file), "%s", world_file);
+    sp_sprintf_api->print(streamer->root_path, sizeof(streamer->root_path), "%s", root_path);
+
+    streamer->cells = sp_alloc(allocator, header.num_cells * sizeof(world_cell_t));
+    memset(streamer->cells, 0, header.num_cells * sizeof(world_cell_t));
+    for (uint32_t i = 0; i < header.num_cells; ++i)
+    {
+        io->read(f, &streamer->cells[i].desc, sizeof(world_cell_desc_t));
+        streamer->cells[i].first_instance_id = streamer->num_instance_ids;
+        streamer->num_instance_ids += streamer->cells[i].desc.num_instances;
+    }
+    streamer->instance_ids = sp_alloc(allocator, streamer->num_instance_ids * sizeof(uint32_t));
+    const uint64_t ids_size = streamer->num_instance_ids * sizeof(uint32_t);
+    const bool read_ids = (uint64_t)io->read(f, streamer->instance_ids, ids_size) == ids_size;
+    io->close(f);
+    if (!read_ids)
+    {
+        sp_free(allocator, streamer->instance_ids, ids_size);
+        sp_free(allocator, streamer->cells, header.num_cells * sizeof(world_cell_t));
+        sp_free(allocator, streamer, sizeof(world_streamer_o));
+        return NULL;
+    }
+
+    sp_mutex_init(&streamer->lock);
+    sp_semaphore_init(&streamer->load_requests, 0);
+    sp_thread_create(&streamer->loader_thread, loader_thread, streamer);
+    return streamer;
+}
+
+static void unload_resident_cell(world_streamer_o* streamer, world_cell_t* cell)
+{
+    uint32_t num_render_objects = (uint32_t)sp_array_size(cell->render_objects_arr);
+    for (uint32_t i = 0; i < num_render_objects; ++i)
+    {
+        renderer_remove_render_object(streamer->p_rendering_context, cell->render_objects_arr[i]);
+    }
+    uint32_t num_meshes = (uint32_t)sp_array_size(cell->entity_meshes_arr);
+    for (uint32_t i = 0; i < num_meshes; ++i)
+    {
+        renderer_release_mesh(streamer->p_rendering_context, cell->entity_meshes_arr[i]);
+    }
+    sp_array_free(cell->render_objects_arr, streamer->allocator);
+    sp_array_free(cell->entity_meshes_arr, streamer->allocator);
+    cell->num_added_instances = 0;
+    free_cell_models(streamer, cell);
+    scene_free(&cell->scene_def, streamer->allocator);
+}
+
+void world_streamer_destroy(world_streamer_o* streamer)
+{
+    if (!streamer)
+        return;
+
+    sp_mutex_lock(&streamer->lock);
+    streamer->quit = true;
+    sp_mutex_unlock(&streamer->lock);
+    sp_semaphore_post(&streamer->load_requests, 1);
+    sp_thread_join(&streamer->loader_thread);
+
+    for (uint32_t i = 0; i < streamer->num_cells; ++i)
+    {
+        world_cell_t* cell = &streamer->cells[i];
+        if (cell->state == WORLD_CELL_RESIDENT)
+            unload_resident_cell(streamer, cell);
+        else if (cell->state == WORLD_CELL_LOADED)
+        {
+            free_cell_models(streamer, cell);
+            scene_free(&cell->scene_def, streamer->allocator);
+        }
+    }
+
+    sp_semaphore_destroy(&streamer->load_requests);
+    sp_mutex_destroy(&streamer->lock);
+    sp_hash_free(&streamer->entity_meshes);
+    sp_array_free(streamer->load_queue_arr, streamer->allocator);
+    sp_free(streamer->allocator, streamer->instance_ids, streamer->num_instance_ids * sizeof(uint32_t));
+    sp_free(streamer->allocator, streamer->cells, streamer->num_cells * sizeof(world_cell_t));
+    sp_free(streamer->allocator, streamer, sizeof(world_streamer_o));
+}
+
+// distance on the xz plane from a point to the cell bounds
+static float cell_distance(const world_streamer_o* streamer, const world_cell_t* cell, sp_vec3_t position)
+{
+    const float half = streamer->cell_size * 0.5f;
+    const float center_x = ((float)cell->desc.x + 0.5f) * streamer->cell_size;
+    const float center_z = ((float)cell->desc.z + 0.5f) * streamer->cell_size;
+    const float dx = fmaxf(fabsf(position.x - center_x) - half, 0.0f);
+    const float dz = fmaxf(fabsf(position.z - center_z) - half, 0.0f);
+    return sqrtf(dx * dx + dz * dz);
+}
+
+typedef struct cell_by_distance_t
+{
+    float distance;
+    uint32_t cell_index;
+} cell_by_distance_t;
+
+static int compare_cell_distance(const void* a, const void* b)
+{
+    const float da = ((const cell_by_distance_t*)a)->distance;
+    const float db = ((const cell_by_distance_t*)b)->distance;
+    return (da > db) - (da < db);
+}
+
+static void remove_from_load_queue(world_streamer_o* streamer, uint32_t cell_index)
+{
+    uint32_t num_requests = (uint32_t)sp_array_size(streamer->load_queue_arr);
+    for (uint32_t i = 0; i < num_requests; ++i)
+    {
+        if (streamer->load_queue_arr[i] == cell_index)
+        {
+            streamer->load_queue_arr[i] = streamer->load_queue_arr[num_requests - 1];
+            sp_array_header(streamer->load_queue_arr)->size = num_requests - 1;
+            return;
+        }
+    }
+}
+
+// adds as much of the cell as the frame budgets allow, returns true once the whole cell was added
+static bool add_cell_to_renderer(world_streamer_o* streamer, world_cell_t* cell, uint32_t* mesh_loads_left, uint32_t* render_objects_left)
+{
+    const scene_def_t* scene_def = &cell->scene_def;
+
+    // meshes first, a mesh another cell already loaded is shared and doesn't count against the budget. The models
+    // were read on the loader thread, only the gpu upload happens here
+    while (sp_array_size(cell->entity_meshes_arr) < scene_def->num_entities)
+    {
+        const uint32_t entity_index = (uint32_t)sp_array_size(cell->entity_meshes_arr);
+        const entity_def_t* p_entity_def = &scene_def->entities_def[entity_index];
+        sp_mesh_handle_t mesh_handle = sp_hash_get_default(&streamer->entity_meshes, p_entity_def->entity_hash, SP_INVALID_HANDLE);
+        if (renderer_is_mesh_valid(&streamer->p_rendering_context->renderer, mesh_handle))
+        {
+            renderer_add_mesh_ref(&streamer->p_rendering_context->renderer, mesh_handle);
+        }
+        else
+        {
+            if (*mesh_loads_left == 0)
+                return false;
+            --*mesh_loads_left;
+            world_cell_model_t* model = &cell->models[entity_index];
+            mesh_handle = scene_create_entity_mesh(p_entity_def, model->stream ? &model->load_data : NULL, streamer->p_device);
+            sp_hash_add(&streamer->entity_meshes, p_entity_def->entity_hash, mesh_handle);
+        }
+        sp_array_push(cell->entity_meshes_arr, mesh_handle, streamer->allocator);
+    }
+    free_cell_models(streamer, cell);
+
+    while (cell->num_added_instances < scene_def->num_instances)
+    {
+        if (*render_objects_left == 0)
+            return false;
+        --*render_objects_left;
+
+        uint32_t i = cell->num_added_instances++;
+        sp_mesh_handle_t mesh_handle = sp_hash_get_default(&streamer->entity_meshes, scene_def->instance_entity_hashes[i], SP_INVALID_HANDLE);
+        sp_render_handle_t render_handle = renderer_add_render_object(streamer->p_rendering_context, mesh_handle, &scene_def->instance_world_matrices[i]);
+        if (render_handle != SP_INVALID_HANDLE)
+        {
+            // picking reports the scene instance, as for the flat scene. 0 is left for nothing picked
+            const uint64_t identity = (uint64_t)streamer->instance_ids[cell->first_instance_id + i] + 1;
+            renderer_set_render_object_identity(streamer->p_rendering_context, render_handle, identity);
+            sp_array_push(cell->render_objects_arr, render_handle, streamer->allocator);
+        }
+    }
+    return true;
+}
+
+void world_streamer_update(world_streamer_o* streamer, sp_vec3_t camera_position)
+{
+    sp_allocator_i* allocator = streamer->allocator;
+    const world_streamer_config_t* config = &streamer->config;
+
+    cell_by_distance_t* load_candidates_arr = NULL;
+    cell_by_distance_t* add_candidates_arr = NULL;
+    uint32_t* unload_arr = NULL;
+    uint32_t num_new_requests = 0;
+
+    sp_mutex_lock(&streamer->lock);
+    for (uint32_t i = 0; i < streamer->num_cells; ++i)
+    {
+        world_cell_t* cell = &streamer->cells[i];
+        const float distance = cell_distance(streamer, cell, camera_position);
+        const bool in_range = distance <= config->load_radius;
+        const bool out_of_range = distance > config->unload_radius;
+        cell->distance = distance;
+
+        switch (cell->state)
+        {
+        case WORLD_CELL_UNLOADED:
+            if (in_range)
+            {
+                cell_by_distance_t candidate = { .distance = distance, .cell_index = i };
+                sp_array_push(load_candidates_arr, candidate, allocator);
+            }
+            break;
+        case WORLD_CELL_QUEUED:
+            if (out_of_range)
+            {
+                remove_from_load_queue(streamer, i);
+                streamer->memory_in_use -= cell_memory(cell);
+                cell->models_size = 0;
+                cell->state = WORLD_CELL_UNLOADED;
+            }
+            break;
+        case WORLD_CELL_LOADING:
+            if (out_of_range)
+                cell->state = WORLD_CELL_CANCELLED;
+            break;
+        case WORLD_CELL_CANCELLED:
+            if (!out_of_range)
+                cell->state = WORLD_CELL_LOADING;
+            break;
+        case WORLD_CELL_LOADED:
+            if (out_of_range)
+            {
+                free_cell_models(streamer, cell);
+                scene_free(&cell->scene_def, allocator);
+                streamer->memory_in_use -= cell_memory(cell);
+                cell->models_size = 0;
+                cell->state = WORLD_CELL_UNLOADED;
+            }
+            else
+            {
+                cell->state = WORLD_CELL_RESIDENT;
+                cell_by_distance_t candidate = { .distance = distance, .cell_index = i };
+                sp_array_push(add_candidates_arr, candidate, allocator);
+            }
+            break;
+        case WORLD_CELL_RESIDENT:
+            if (out_of_range)
+            {
+                sp_array_push(unload_arr, i, allocator);
+            }
+            else if (cell->num_added_instances < cell->scene_def.num_instances || sp_array_size(cell->entity_meshes_arr) < cell->scene_def.num_entities)
+            {
+                cell_by_distance_t candidate = { .distance = distance, .cell_index = i };
+                sp_array_push(add_candidates_arr, candidate, allocator);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    // request the nearest cells first, as long as they fit in the memory budget
+    const uint32_t num_load_candidates = (uint32_t)sp_array_size(load_candidates_arr);
+    if (num_load_candidates)
+        qsort(load_candidates_arr, num_load_candidates, sizeof(cell_by_distance_t), compare_cell_distance);
+    for (uint32_t i = 0; i < num_load_candidates; ++i)
+    {
+        world_cell_t* cell = &streamer->cells[load_candidates_arr[i].cell_index];
+        if (streamer->memory_in_use + cell->desc.data_size > config->memory_budget)
+            break;
+        streamer->memory_in_use += cell->desc.data_size;
+        cell->state = WORLD_CELL_QUEUED;
+        sp_array_push(streamer->load_queue_arr, load_candidates_arr[i].cell_index, allocator);
+        ++num_new_requests;
+    }
+    sp_mutex_unlock(&streamer->lock);
+
+    if (num_new_requests)
+        sp_semaphore_post(&streamer->load_requests, num_new_requests);
+
+    // resident cells are only touched by the main thread
+    const uint32_t num_unloads = (uint32_t)sp_array_size(unload_arr);
+    for (uint32_t i = 0; i < num_unloads; ++i)
+    {
+        world_cell_t* cell = &streamer->cells[unload_arr[i]];
+        unload_resident_cell(streamer, cell);
+        sp_mutex_lock(&streamer->lock);
+        streamer->memory_in_use -= cell_memory(cell);
+        cell->models_size = 0;
+        cell->state = WORLD_CELL_UNLOADED;
+        sp_mutex_unlock(&streamer->lock);
+    }
+
+    // spread the gpu uploads over frames, nearest cells first
+    uint32_t mesh_loads_left = config->max_mesh_loads_per_frame;
+    uint32_t render_objects_left = config->max_render_objects_per_frame;
+    const uint32_t num_add_candidates = (uint32_t)sp_array_size(add_candidates_arr);
+    if (num_add_candidates)
+        qsort(add_candidates_arr, num_add_candidates, sizeof(cell_by_distance_t), compare_cell_distance);
+    for (uint32_t i = 0; i < num_add_candidates; ++i)
+    {
+        if (!add_cell_to_renderer(streamer, &streamer->cells[add_candidates_arr[i].cell_index], &mesh_loads_left, &render_objects_left))
+            break;
+    }
+
+    sp_array_free(load_candidates_arr, allocator);
+    sp_array_free(add_candidates_arr, allocator);
+    sp_array_free(unload_arr, allocator);
+}
+
+void world_streamer_reload_model(world_streamer_o* streamer, const char* model_file)
+{
+    uint32_t* unload_arr = NULL;
+    sp_mutex_lock(&streamer->lock);
+    for (uint32_t i = 0; i < streamer->num_cells; ++i)
+    {
+        world_cell_t* cell = &streamer->cells[i];
+        if (cell->state == WORLD_CELL_LOADING)
+        {
+            // the model may have been read before it changed
+            cell->reload = true;
+            continue;
+        }
+        if (cell->state != WORLD_CELL_LOADED && cell->state != WORLD_CELL_RESIDENT)
+            continue;
+        bool uses_model = false;
+        for (uint32_t e = 0; e < cell->scene_def.num_entities && !uses_model; ++e)
+            uses_model = strcmp(cell->scene_def.entities_def[e].model_file, model_file) == 0;
+        if (!uses_model)
+            continue;
+        if (cell->state == WORLD_CELL_LOADED)
+        {
+            free_cell_models(streamer, cell);
+            scene_free(&cell->scene_def, streamer->allocator);
+            streamer->memory_in_use -= cell_memory(cell);
+            cell->models_size = 0;
+            cell->state = WORLD_CELL_UNLOADED;
+        }
+        else
+        {
+            sp_array_push(unload_arr, i, streamer->allocator);
+        }
+    }
+    sp_mutex_unlock(&streamer->lock);
+
+    const uint32_t num_unloads = (uint32_t)sp_array_size(unload_arr);
+    for (uint32_t i = 0; i < num_unloads; ++i)
+    {
+        world_cell_t* cell = &streamer->cells[unload_arr[i]];
+        // the cached meshes of its entities are loaded again instead of being shared
+        for (uint32_t e = 0; e < cell->scene_def.num_entities; ++e)
+        {
+            const entity_def_t* p_entity_def = &cell->scene_def.entities_def[e];
+            if (strcmp(p_entity_def->model_file, model_file) == 0)
+                sp_hash_add(&streamer->entity_meshes, p_entity_def->entity_hash, SP_INVALID_HANDLE);
+        }
+        unload_resident_cell(streamer, cell);
+        sp_mutex_lock(&streamer->lock);
+        streamer->memory_in_use -= cell_memory(cell);
+        cell->models_size = 0;
+        cell->state = WORLD_CELL_UNLOADED;
+        sp_mutex_unlock(&streamer->lock);
+    }
+    sp_array_free(unload_arr, streamer->allocator);
+}
+
+world_streamer_stats_t world_streamer_get_stats(world_streamer_o* streamer)
+{
+    world_streamer_stats_t stats = { .num_cells = streamer->num_cells, .memory_budget = streamer->config.memory_budget };
+    sp_mutex_lock(&streamer->lock);
+    for (uint32_t i = 0; i < streamer->num_cells; ++i)
+    {
+        const world_cell_t* cell = &streamer->cells[i];
+        switch (cell->state)
+        {
+        case WORLD_CELL_QUEUED:
+        case WORLD_CELL_LOADING:
+        case WORLD_CELL_CANCELLED:
+            ++stats.num_loading;
+            break;
+        case WORLD_CELL_LOADED:
+            ++stats.num_loaded;
+            break;
+        case WORLD_CELL_RESIDENT:
+            if (cell->num_added_instances < cell->scene_def.num_instances || sp_array_size(cell->entity_meshes_arr) < cell->scene_def.num_entities)
+                ++stats.num_loaded;
+            else
+                ++stats.num_resident;
+            break;
+        case WORLD_CELL_FAILED:
+            ++stats.num_failed;
+            break;
+        default:
+            break;
+        }
+    }
+    stats.memory_in_use = streamer->memory_in_use;
+    sp_mutex_unlock(&streamer->lock);
+    return stats;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "core/sapphire_types.h"
+
+typedef struct sp_allocator_i sp_allocator_i;
+typedef struct scene_def_t scene_def_t;
+typedef struct rendering_context_t rendering_context_t;
+typedef struct IRenderDevice IRenderDevice;
+
+// World partition - a scene split into square cells on the xz plane, streamed in and out around the camera.
+//
+// On disk a world is an index file (.world) listing the cells and the scene instance index of each cell
+// instance, and one compiled scene (.scenebin) per cell holding the instances inside the cell and the entities
+// they use. At runtime cells are loaded on a
+// background thread, nearest first, within a memory budget, and their render objects are added to the
+// renderer over several frames within an upload budget.
+
+#define WORLD_MAGIC 0x44575053 // 'SPWD'
+#define WORLD_VERSION 2
+
+typedef struct world_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    float cell_size;
+    uint32_t num_cells;
+} world_header_t;
+
+// follows the header in the index file, one per non empty cell. The scene instance indices follow the cells, a
+// uint32_t per instance in cell order
+typedef struct world_cell_desc_t
+{
+    int32_t x;
+    int32_t z;
+    uint32_t num_instances;
+    uint32_t num_entities;
+    // size of the compiled cell scene, used for the memory budget
+    uint64_t data_size;
+} world_cell_desc_t;
+
+// splits a scene into cells of cell_size and writes "<world_file>" and "<world_file>_<x>_<z>.scenebin" cells
+bool world_partition_build(const scene_def_t* p_scene_def, float cell_size, const char* world_file, sp_allocator_i* allocator);
+
+typedef struct world_streamer_config_t
+{
+    // cells closer than load_radius are loaded, cells further than unload_radius are unloaded
+    float load_radius;
+    float unload_radius;
+    // max bytes of cell data resident or in flight, the compiled cells and the models read for them. A model
+    // shared by cells counts in each of them. Textures belong to the material manager and aren't counted
+    uint64_t memory_budget;
+    // max meshes created and render objects added per frame
+    uint32_t max_mesh_loads_per_frame;
+    uint32_t max_render_objects_per_frame;
+} world_streamer_config_t;
+
+typedef struct world_streamer_o world_streamer_o;
+
+// root_path is the folder meshes are loaded from. Returns NULL if the world index can't be read
+world_streamer_o* world_streamer_create(const char* world_file, const char* root_path, const world_streamer_config_t* config, rendering_context_t* p_rendering_context, IRenderDevice* p_device, sp_allocator_i* allocator);
+void world_streamer_destroy(world_streamer_o* streamer);
+
+// call once per frame on the main thread
+void world_streamer_update(world_streamer_o* streamer, sp_vec3_t camera_position);
+// a model file changed on disk, path relative to root_path. The cells using it are unloaded and stream back in
+// with the new model over the next updates. Main thread only
+void world_streamer_reload_model(world_streamer_o* streamer, const char* model_file);
+
+typedef struct world_streamer_stats_t
+{
+    uint32_t num_cells;
+    // queued or being read
+    uint32_t num_loading;
+    // read, render objects not all added yet
+    uint32_t num_loaded;
+    uint32_t num_resident;
+    uint32_t num_failed;
+    uint64_t memory_in_use;
+    uint64_t memory_budget;
+} world_streamer_stats_t;
+
+world_streamer_stats_t world_streamer_get_stats(world_streamer_o* streamer);